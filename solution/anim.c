@@ -0,0 +1,153 @@
+/* *********************************************************************
+ *
+ * Animations of the 8x8 display, expanded from the tables animgen
+ * generates out of animations.txt
+ *
+ * Program Name:        Anim
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <string.h>
+#include "anim.h"
+
+/* *********************************************************************
+ * NAME:             AnimStart
+ * CALLED BY:        Applications, AnimFrame, AnimExpand
+ * DESCRIPTION:      Places a cursor before the first frame
+ * INPUT PARAMETERS: Cursor : cursor to set up
+ *                   Anim : animation
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void AnimStart(AnimCursorType *Cursor, const AnimType *Anim)
+{
+	Cursor->Anim = Anim;
+	Cursor->Offset = 0;
+	Cursor->Frame = 0;
+	memset(Cursor->Rows,0,sizeof(Cursor->Rows));
+}
+
+/* *********************************************************************
+ * NAME:             AnimNext
+ * CALLED BY:        Applications, AnimFrame, AnimExpand
+ * DESCRIPTION:      Expands the next frame in Cursor->Rows
+ * INPUT PARAMETERS: Cursor : cursor of the animation
+ * RETURN VALUES:    int : status - Fail(-1, no frame left or bad
+ *                   table)/Pass(0)
+ ***********************************************************************/
+int AnimNext(AnimCursorType *Cursor)
+{
+	const unsigned char *Data = Cursor->Anim->Data;
+	unsigned int Size = Cursor->Anim->DataSize, Offset = Cursor->Offset;
+	unsigned char Mask, Column, Swap;
+	unsigned int LoopIndex;
+
+	if ((Cursor->Frame == Cursor->Anim->FrameCount) || (Offset >= Size))
+	{
+		return -1;
+	}
+	switch (Data[Offset++])
+	{
+	case ANIM_OP_DELTA:
+		Mask = (Offset < Size) ? Data[Offset++] : 0;
+		for (LoopIndex = 0; LoopIndex < ANIM_ROWS; LoopIndex++)
+		{
+			if (Mask & (1 << LoopIndex))
+			{
+				if (Offset == Size)
+				{
+					return -1;
+				}
+				Cursor->Rows[LoopIndex] = Data[Offset++];
+			}
+		}
+		break;
+
+	case ANIM_OP_SHIFT:
+		if (Offset == Size)
+		{
+			return -1;
+		}
+		Column = Data[Offset++];
+		for (LoopIndex = 0; LoopIndex < ANIM_ROWS; LoopIndex++)
+		{
+			Cursor->Rows[LoopIndex] = (unsigned char)(Cursor->Rows[LoopIndex] << 1) | ((Column >> LoopIndex) & 1);
+		}
+		break;
+
+	case ANIM_OP_ROTATE:
+		for (LoopIndex = 0; LoopIndex < ANIM_ROWS; LoopIndex++)
+		{
+			Cursor->Rows[LoopIndex] = (unsigned char)((Cursor->Rows[LoopIndex] >> 1) | (Cursor->Rows[LoopIndex] << 7));
+		}
+		break;
+
+	case ANIM_OP_MIRROR:
+		for (LoopIndex = 0; LoopIndex < (ANIM_ROWS / 2); LoopIndex++)
+		{
+			Swap = Cursor->Rows[LoopIndex];
+			Cursor->Rows[LoopIndex] = Cursor->Rows[ANIM_ROWS - 1 - LoopIndex];
+			Cursor->Rows[ANIM_ROWS - 1 - LoopIndex] = Swap;
+		}
+		break;
+
+	default:
+		return -1;
+	}
+	Cursor->Offset = Offset;
+	Cursor->Frame++;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             AnimFrame
+ * CALLED BY:        Applications showing one frame at a time
+ * DESCRIPTION:      Expands a frame on its own, the frames before it are
+ *                   expanded on the way, so short animations need no
+ *                   table of expanded frames
+ * INPUT PARAMETERS: Anim : animation
+ *                   Index : frame to expand
+ *                   Rows : filled with the frame
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int AnimFrame(const AnimType *Anim, unsigned int Index, unsigned char Rows[ANIM_ROWS])
+{
+	AnimCursorType Cursor;
+
+	AnimStart(&Cursor,Anim);
+	do
+	{
+		if (AnimNext(&Cursor) < 0)
+		{
+			return -1;
+		}
+	}while (Cursor.Frame <= Index);
+	memcpy(Rows,Cursor.Rows,ANIM_ROWS);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             AnimExpand
+ * CALLED BY:        Applications uploading the frames to a bank
+ * DESCRIPTION:      Expands the frames of an animation in a table
+ * INPUT PARAMETERS: Anim : animation
+ *                   Frames : table of Max frames
+ *                   Max : size of Frames
+ * RETURN VALUES:    unsigned int : frames expanded, less than
+ *                   FrameCount if Frames is too short or the table bad
+ ***********************************************************************/
+unsigned int AnimExpand(const AnimType *Anim, unsigned char (*Frames)[ANIM_ROWS], unsigned int Max)
+{
+	AnimCursorType Cursor;
+
+	AnimStart(&Cursor,Anim);
+	while ((Cursor.Frame < Max) && (0 == AnimNext(&Cursor)))
+	{
+		memcpy(Frames[Cursor.Frame - 1],Cursor.Rows,ANIM_ROWS);
+	}
+	return Cursor.Frame;
+}
@@ -0,0 +1,59 @@
+/* *********************************************************************
+ *
+ * Animations of the 8x8 display, expanded from the tables animgen
+ * generates out of animations.txt
+ *
+ * Program Name:        Anim
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef ANIM_H
+#define ANIM_H
+
+/*
+ * Row registers of a frame
+ */
+#define ANIM_ROWS 8
+
+/*
+ * The frames of an animation are kept as a stream of operations, each one
+ * turning the previous frame into the next. The frame before the first one
+ * is blank. animgen takes the shortest operation for every frame.
+ */
+typedef enum AnimOp_Tag {
+	ANIM_OP_DELTA, /* Mask of the rows that change, then their new values */
+	ANIM_OP_SHIFT, /* Rows shifted towards bit 7, then the column entering at bit 0 (bit n for row n) */
+	ANIM_OP_ROTATE, /* Rows rotated towards bit 0 by one */
+	ANIM_OP_MIRROR /* Rows in reverse order */
+}AnimOp_Type;
+
+/* Animation generated by animgen */
+typedef struct AnimTag
+{
+	const char *Name; /* Name in animations.txt */
+	const unsigned char *Data; /* Operations of the frames, see AnimOp_Type */
+	unsigned int DataSize; /* Bytes of Data */
+	unsigned int FrameCount; /* Frames, all different */
+	const unsigned short (*Sequence)[2]; /* {frame, time ms} steps ending with {0, 0}, NULL without */
+	unsigned int StepCount; /* Steps of Sequence with the end step */
+}AnimType;
+
+/* Position in the frames of an animation */
+typedef struct AnimCursorTag
+{
+	const AnimType *Anim; /* Animation being expanded */
+	unsigned int Offset; /* Next operation in Data */
+	unsigned int Frame; /* Frames expanded */
+	unsigned char Rows[ANIM_ROWS]; /* Last frame expanded */
+}AnimCursorType;
+
+void AnimStart(AnimCursorType *Cursor, const AnimType *Anim);
+int AnimNext(AnimCursorType *Cursor);
+int AnimFrame(const AnimType *Anim, unsigned int Index, unsigned char Rows[ANIM_ROWS]);
+unsigned int AnimExpand(const AnimType *Anim, unsigned char (*Frames)[ANIM_ROWS], unsigned int Max);
+
+#endif
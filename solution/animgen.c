@@ -0,0 +1,596 @@
+/* *********************************************************************
+ *
+ * Build tool turning the drawings of animations.txt into the compact
+ * frame tables of animations.c and animations.h
+ *
+ * Program Name:        AnimGen
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "anim.h"
+
+/*
+ * Limits of an input file
+ */
+#define ANIMGEN_MAX_LINE 256
+#define ANIMGEN_MAX_NAME 32
+#define ANIMGEN_MAX_ANIMATIONS 32
+#define ANIMGEN_MAX_FRAMES 4096
+/*
+ * Columns of a text, glyphs and the dark columns between them
+ */
+#define ANIMGEN_MAX_TEXT_COLUMNS 4096
+/*
+ * Dark columns of a space without glyph
+ */
+#define ANIMGEN_SPACE_COLUMNS 3
+
+/* Drawing of a character */
+typedef struct AnimGenGlyphTag
+{
+	unsigned int Width; /* Columns, 0 if the character has no glyph */
+	unsigned char Column[ANIM_ROWS]; /* Column n of the drawing, bit n for row n */
+}AnimGenGlyphType;
+
+/* Frame of an animation as it is defined */
+typedef struct AnimGenFrameTag
+{
+	char Name[ANIMGEN_MAX_NAME]; /* Empty for the frames of rotate and text */
+	unsigned char Rows[ANIM_ROWS]; /* Row registers */
+	unsigned int Index; /* Number of the frame once the duplicates are dropped */
+}AnimGenFrameType;
+
+/* Animation being generated */
+typedef struct AnimGenAnimationTag
+{
+	char Name[ANIMGEN_MAX_NAME]; /* Name in the file */
+	AnimGenFrameType Frame[ANIMGEN_MAX_FRAMES]; /* Frames in the order they are defined */
+	unsigned int Count; /* Frames in Frame */
+	unsigned int Unique; /* Different frames */
+	unsigned int PlayMs; /* Time of a step of the sequence, 0 without sequence */
+}AnimGenAnimationType;
+
+/* State of the generator */
+static AnimGenGlyphType Glyph[256];
+static AnimGenAnimationType *Animation[ANIMGEN_MAX_ANIMATIONS];
+static unsigned int AnimationCount = 0;
+static const char *InputPath;
+static unsigned int InputLine = 0;
+
+/* *********************************************************************
+ * NAME:             AnimGenFail
+ * CALLED BY:        Parser
+ * DESCRIPTION:      Reports an error at the current line and exits
+ * INPUT PARAMETERS: Message : what is wrong
+ * RETURN VALUES:    None, does not return
+ ***********************************************************************/
+static void AnimGenFail(const char *Message)
+{
+	fprintf(stderr,"%s:%u: %s\n",InputPath,InputLine,Message);
+	exit(1);
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenReadLine
+ * CALLED BY:        Parser
+ * DESCRIPTION:      Reads the next line, without its end of line
+ * INPUT PARAMETERS: File : input
+ *                   Line : filled with the line
+ * RETURN VALUES:    int : 0, -1 at the end of the file
+ ***********************************************************************/
+static int AnimGenReadLine(FILE *File, char Line[ANIMGEN_MAX_LINE])
+{
+	if (NULL == fgets(Line,ANIMGEN_MAX_LINE,File))
+	{
+		return -1;
+	}
+	InputLine++;
+	Line[strcspn(Line,"\r\n")] = 0;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenDrawing
+ * CALLED BY:        Parser, for glyph and frame
+ * DESCRIPTION:      Reads the eight lines of a drawing, '#' lit and '.'
+ *                   dark, all of the same width
+ * INPUT PARAMETERS: File : input
+ *                   Pixel : filled with the leds, Pixel[row][column]
+ *                   MaxWidth : widest drawing accepted
+ * RETURN VALUES:    unsigned int : width of the drawing
+ ***********************************************************************/
+static unsigned int AnimGenDrawing(FILE *File, unsigned char Pixel[ANIM_ROWS][ANIM_ROWS], unsigned int MaxWidth)
+{
+	char Line[ANIMGEN_MAX_LINE];
+	unsigned int Row, Column, Width = 0;
+
+	for (Row = 0; Row < ANIM_ROWS; Row++)
+	{
+		if (AnimGenReadLine(File,Line) < 0)
+		{
+			AnimGenFail("drawing cut short");
+		}
+		if (0 == Row)
+		{
+			Width = strlen(Line);
+		}
+		if ((0 == Width) || (Width > MaxWidth) || (strlen(Line) != Width) || (strspn(Line,"#.") != Width))
+		{
+			AnimGenFail("a drawing line is '#' and '.', as wide as the first one");
+		}
+		for (Column = 0; Column < Width; Column++)
+		{
+			Pixel[Row][Column] = ('#' == Line[Column]);
+		}
+	}
+	return Width;
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenAddFrame
+ * CALLED BY:        Parser
+ * DESCRIPTION:      Adds a frame to the animation being defined
+ * INPUT PARAMETERS: Anim : animation
+ *                   Name : name of the frame, "" for none
+ *                   Rows : row registers
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void AnimGenAddFrame(AnimGenAnimationType *Anim, const char *Name, const unsigned char Rows[ANIM_ROWS])
+{
+	unsigned int LoopIndex;
+
+	if (ANIMGEN_MAX_FRAMES == Anim->Count)
+	{
+		AnimGenFail("too many frames");
+	}
+	for (LoopIndex = 0; (Name[0]) && (LoopIndex < Anim->Count); LoopIndex++)
+	{
+		if (0 == strcmp(Anim->Frame[LoopIndex].Name,Name))
+		{
+			AnimGenFail("frame defined twice");
+		}
+	}
+	snprintf(Anim->Frame[Anim->Count].Name,ANIMGEN_MAX_NAME,"%s",Name);
+	memcpy(Anim->Frame[Anim->Count].Rows,Rows,ANIM_ROWS);
+	Anim->Count++;
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenFindFrame
+ * CALLED BY:        Parser, for mirror
+ * DESCRIPTION:      Looks a frame of the animation up by name
+ * INPUT PARAMETERS: Anim : animation
+ *                   Name : name of the frame
+ * RETURN VALUES:    AnimGenFrameType * : frame, the generator fails if
+ *                   there is none
+ ***********************************************************************/
+static AnimGenFrameType *AnimGenFindFrame(AnimGenAnimationType *Anim, const char *Name)
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < Anim->Count; LoopIndex++)
+	{
+		if (0 == strcmp(Anim->Frame[LoopIndex].Name,Name))
+		{
+			return &(Anim->Frame[LoopIndex]);
+		}
+	}
+	AnimGenFail("no frame of that name");
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenText
+ * CALLED BY:        Parser, for text
+ * DESCRIPTION:      Adds the frames of a string scrolled in and out of
+ *                   the display: frame k shows column k of the string at
+ *                   bit 0 and the seven columns before it at bits 1 to 7
+ * INPUT PARAMETERS: Anim : animation
+ *                   Text : string
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void AnimGenText(AnimGenAnimationType *Anim, const char *Text)
+{
+	static unsigned char Column[ANIMGEN_MAX_TEXT_COLUMNS];
+	unsigned char Rows[ANIM_ROWS];
+	unsigned int Width = 0, Frame, Bit, Row, LoopIndex;
+	const AnimGenGlyphType *Char;
+
+	for (; *Text; Text++)
+	{
+		Char = &Glyph[(unsigned char)*Text];
+		if ((0 == Char->Width) && (' ' != *Text))
+		{
+			AnimGenFail("no glyph for a character of the text");
+		}
+		if ((Width + ANIM_ROWS + 1) > ANIMGEN_MAX_TEXT_COLUMNS)
+		{
+			AnimGenFail("text too long");
+		}
+		/* A dark column between two glyphs */
+		if (Width)
+		{
+			Column[Width++] = 0;
+		}
+		for (LoopIndex = 0; LoopIndex < ((Char->Width) ? Char->Width : ANIMGEN_SPACE_COLUMNS); LoopIndex++)
+		{
+			Column[Width++] = (Char->Width) ? Char->Column[LoopIndex] : 0;
+		}
+	}
+	for (Frame = 0; Frame < (Width + ANIM_ROWS - 1); Frame++)
+	{
+		memset(Rows,0,sizeof(Rows));
+		for (Bit = 0; Bit < ANIM_ROWS; Bit++)
+		{
+			for (Row = 0; (Frame >= Bit) && ((Frame - Bit) < Width) && (Row < ANIM_ROWS); Row++)
+			{
+				Rows[Row] |= ((Column[Frame - Bit] >> Row) & 1) << Bit;
+			}
+		}
+		AnimGenAddFrame(Anim,"",Rows);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenParse
+ * CALLED BY:        main
+ * DESCRIPTION:      Reads the glyphs and the animations of the input
+ * INPUT PARAMETERS: File : input
+ * RETURN VALUES:    None, the generator fails on a bad input
+ ***********************************************************************/
+static void AnimGenParse(FILE *File)
+{
+	char Line[ANIMGEN_MAX_LINE], Keyword[ANIMGEN_MAX_NAME], Name[ANIMGEN_MAX_NAME], Other[ANIMGEN_MAX_NAME];
+	unsigned char Pixel[ANIM_ROWS][ANIM_ROWS], Rows[ANIM_ROWS];
+	AnimGenAnimationType *Anim = NULL;
+	AnimGenFrameType *Source;
+	unsigned int Width, Row, Column, Count, LoopIndex;
+	int Fields, Offset;
+
+	while (0 == AnimGenReadLine(File,Line))
+	{
+		Fields = sscanf(Line," %31s %n",Keyword,&Offset);
+		/* A comment is "# ...", a line of a drawing out of place is an error */
+		if ((Fields < 1) || (0 == strcmp(Keyword,"#")))
+		{
+			continue;
+		}
+		if (0 == strcmp(Keyword,"glyph"))
+		{
+			if ((Anim) || (1 != strlen(Line + Offset)))
+			{
+				AnimGenFail("glyph <character>, outside the animations");
+			}
+			Width = AnimGenDrawing(File,Pixel,ANIM_ROWS);
+			Glyph[(unsigned char)Line[Offset]].Width = Width;
+			for (Column = 0; Column < Width; Column++)
+			{
+				Glyph[(unsigned char)Line[Offset]].Column[Column] = 0;
+				for (Row = 0; Row < ANIM_ROWS; Row++)
+				{
+					Glyph[(unsigned char)Line[Offset]].Column[Column] |= Pixel[Row][Column] << Row;
+				}
+			}
+		}
+		else if (0 == strcmp(Keyword,"animation"))
+		{
+			if ((Anim) || (1 != sscanf(Line + Offset,"%31s",Name)) || (ANIMGEN_MAX_ANIMATIONS == AnimationCount))
+			{
+				AnimGenFail("animation <Name>, after the end of the previous one");
+			}
+			Anim = calloc(1,sizeof(*Anim));
+			if (NULL == Anim)
+			{
+				AnimGenFail("out of memory");
+			}
+			snprintf(Anim->Name,sizeof(Anim->Name),"%s",Name);
+			Animation[AnimationCount++] = Anim;
+		}
+		else if (NULL == Anim)
+		{
+			AnimGenFail("not in an animation");
+		}
+		else if (0 == strcmp(Keyword,"frame"))
+		{
+			if (1 != sscanf(Line + Offset,"%31s",Name))
+			{
+				AnimGenFail("frame <Name>");
+			}
+			if (ANIM_ROWS != AnimGenDrawing(File,Pixel,ANIM_ROWS))
+			{
+				AnimGenFail("a frame is eight columns wide");
+			}
+			for (Row = 0; Row < ANIM_ROWS; Row++)
+			{
+				for (Rows[Row] = 0, Column = 0; Column < ANIM_ROWS; Column++)
+				{
+					Rows[Row] |= Pixel[Row][Column] << (ANIM_ROWS - 1 - Column);
+				}
+			}
+			AnimGenAddFrame(Anim,Name,Rows);
+		}
+		else if (0 == strcmp(Keyword,"mirror"))
+		{
+			if (2 != sscanf(Line + Offset,"%31s %31s",Name,Other))
+			{
+				AnimGenFail("mirror <Name> <Frame>");
+			}
+			Source = AnimGenFindFrame(Anim,Other);
+			for (Row = 0; Row < ANIM_ROWS; Row++)
+			{
+				Rows[Row] = Source->Rows[ANIM_ROWS - 1 - Row];
+			}
+			AnimGenAddFrame(Anim,Name,Rows);
+		}
+		else if (0 == strcmp(Keyword,"rotate"))
+		{
+			if ((1 != sscanf(Line + Offset,"%u",&Count)) || (0 == Anim->Count))
+			{
+				AnimGenFail("rotate <count>, after a frame");
+			}
+			for (LoopIndex = 0; LoopIndex < Count; LoopIndex++)
+			{
+				for (Row = 0; Row < ANIM_ROWS; Row++)
+				{
+					Rows[Row] = Anim->Frame[Anim->Count - 1].Rows[Row];
+					Rows[Row] = (unsigned char)((Rows[Row] >> 1) | (Rows[Row] << 7));
+				}
+				AnimGenAddFrame(Anim,"",Rows);
+			}
+		}
+		else if (0 == strcmp(Keyword,"text"))
+		{
+			AnimGenText(Anim,Line + Offset);
+		}
+		else if (0 == strcmp(Keyword,"play"))
+		{
+			if ((1 != sscanf(Line + Offset,"%u",&(Anim->PlayMs))) || (0 == Anim->PlayMs) || (Anim->PlayMs > 0xFFFF))
+			{
+				AnimGenFail("play <ms>, 1 to 65535");
+			}
+		}
+		else if (0 == strcmp(Keyword,"end"))
+		{
+			if (0 == Anim->Count)
+			{
+				AnimGenFail("animation without frames");
+			}
+			Anim = NULL;
+		}
+		else
+		{
+			AnimGenFail("unknown keyword");
+		}
+	}
+	if (Anim)
+	{
+		AnimGenFail("animation without end");
+	}
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenEncode
+ * CALLED BY:        AnimGenWriteSource
+ * DESCRIPTION:      Picks the shortest operation turning Prev into Rows
+ * INPUT PARAMETERS: Prev : frame before, blank for the first one
+ *                   Rows : frame to encode
+ *                   Out : filled with the operation
+ * RETURN VALUES:    unsigned int : bytes of the operation
+ ***********************************************************************/
+static unsigned int AnimGenEncode(const unsigned char Prev[ANIM_ROWS], const unsigned char Rows[ANIM_ROWS],
+                                  unsigned char Out[ANIM_ROWS + 2])
+{
+	unsigned int Row, Size = 2;
+	int Rotate = 1, Mirror = 1, Shift = 1;
+	unsigned char Column = 0, Mask = 0;
+
+	for (Row = 0; Row < ANIM_ROWS; Row++)
+	{
+		Rotate &= (Rows[Row] == (unsigned char)((Prev[Row] >> 1) | (Prev[Row] << 7)));
+		Mirror &= (Rows[Row] == Prev[ANIM_ROWS - 1 - Row]);
+		Shift &= ((Rows[Row] & 0xFE) == (unsigned char)(Prev[Row] << 1));
+		Column |= (Rows[Row] & 1) << Row;
+	}
+	if (Rotate || Mirror)
+	{
+		Out[0] = (Rotate) ? ANIM_OP_ROTATE : ANIM_OP_MIRROR;
+		return 1;
+	}
+	if (Shift)
+	{
+		Out[0] = ANIM_OP_SHIFT;
+		Out[1] = Column;
+		return 2;
+	}
+	for (Row = 0; Row < ANIM_ROWS; Row++)
+	{
+		if (Rows[Row] != Prev[Row])
+		{
+			Mask |= 1 << Row;
+			Out[Size++] = Rows[Row];
+		}
+	}
+	Out[0] = ANIM_OP_DELTA;
+	Out[1] = Mask;
+	return Size;
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenMacro
+ * CALLED BY:        AnimGenWriteHeader
+ * DESCRIPTION:      Writes a CamelCase name as UPPER_CASE
+ * INPUT PARAMETERS: Out : output file
+ *                   Name : name
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void AnimGenMacro(FILE *Out, const char *Name)
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; Name[LoopIndex]; LoopIndex++)
+	{
+		if ((LoopIndex) && isupper((unsigned char)Name[LoopIndex]) && islower((unsigned char)Name[LoopIndex - 1]))
+		{
+			fputc('_',Out);
+		}
+		fputc(toupper((unsigned char)Name[LoopIndex]),Out);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenWriteSource
+ * CALLED BY:        main
+ * DESCRIPTION:      Drops the duplicate frames of every animation and
+ *                   writes the operations and sequences of animations.c
+ * INPUT PARAMETERS: Out : output file
+ *                   Header : name of the header to include
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void AnimGenWriteSource(FILE *Out, const char *Header)
+{
+	unsigned char Prev[ANIM_ROWS], Op[ANIM_ROWS + 2];
+	unsigned int Anim, Frame, Other, Size, Total, LoopIndex;
+	AnimGenAnimationType *A;
+
+	fprintf(Out,"/* Generated by animgen from %s, do not edit */\n#include \"%s\"\n",InputPath,Header);
+	for (Anim = 0; Anim < AnimationCount; Anim++)
+	{
+		A = Animation[Anim];
+		fprintf(Out,"\nstatic const unsigned char Anim%sData[] = {",A->Name);
+		memset(Prev,0,sizeof(Prev));
+		Total = 0;
+		A->Unique = 0;
+		for (Frame = 0; Frame < A->Count; Frame++)
+		{
+			for (Other = 0; (Other < Frame) && memcmp(A->Frame[Other].Rows,A->Frame[Frame].Rows,ANIM_ROWS); Other++);
+			if (Other < Frame)
+			{
+				A->Frame[Frame].Index = A->Frame[Other].Index;
+				continue;
+			}
+			A->Frame[Frame].Index = A->Unique++;
+			Size = AnimGenEncode(Prev,A->Frame[Frame].Rows,Op);
+			fprintf(Out,"\n\t");
+			for (LoopIndex = 0; LoopIndex < Size; LoopIndex++)
+			{
+				fprintf(Out,"0x%02x,%s",Op[LoopIndex],(LoopIndex + 1 < Size) ? " " : "");
+			}
+			memcpy(Prev,A->Frame[Frame].Rows,ANIM_ROWS);
+			Total += Size;
+		}
+		fprintf(Out,"\n};\n");
+		if (A->PlayMs)
+		{
+			fprintf(Out,"\nstatic const unsigned short Anim%sSequence[][2] = {",A->Name);
+			for (Frame = 0; Frame < A->Count; Frame++)
+			{
+				fprintf(Out,"%s{%u, %u},",(Frame % 6) ? " " : "\n\t",A->Frame[Frame].Index,A->PlayMs);
+			}
+			fprintf(Out,"\n\t{0, 0}\n};\n");
+		}
+		fprintf(Out,"\n/* %u frames, %u different, %u bytes instead of %u */\n",
+		        A->Count,A->Unique,Total,A->Unique * ANIM_ROWS);
+		fprintf(Out,"const AnimType Anim%s = {\n\t.Name = \"%s\",\n\t.Data = Anim%sData,\n"
+		        "\t.DataSize = sizeof(Anim%sData),\n\t.FrameCount = %u,\n",A->Name,A->Name,A->Name,A->Name,A->Unique);
+		if (A->PlayMs)
+		{
+			fprintf(Out,"\t.Sequence = Anim%sSequence,\n\t.StepCount = %u,\n",A->Name,A->Count + 1);
+		}
+		fprintf(Out,"};\n");
+	}
+}
+
+/* *********************************************************************
+ * NAME:             AnimGenWriteHeader
+ * CALLED BY:        main
+ * DESCRIPTION:      Writes animations.h: the animations, their sizes and
+ *                   the numbers of the named frames
+ * INPUT PARAMETERS: Out : output file
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void AnimGenWriteHeader(FILE *Out)
+{
+	unsigned int Anim, Frame;
+	AnimGenAnimationType *A;
+
+	fprintf(Out,"/* Generated by animgen from %s, do not edit */\n#ifndef ANIMATIONS_H\n#define ANIMATIONS_H\n\n"
+	        "#include \"anim.h\"\n",InputPath);
+	for (Anim = 0; Anim < AnimationCount; Anim++)
+	{
+		A = Animation[Anim];
+		fprintf(Out,"\nextern const AnimType Anim%s;\n#define ANIM_",A->Name);
+		AnimGenMacro(Out,A->Name);
+		fprintf(Out,"_FRAMES %u\n",A->Unique);
+		if (A->PlayMs)
+		{
+			fprintf(Out,"#define ANIM_");
+			AnimGenMacro(Out,A->Name);
+			fprintf(Out,"_STEPS %u\n",A->Count + 1);
+		}
+		for (Frame = 0; Frame < A->Count; Frame++)
+		{
+			if (A->Frame[Frame].Name[0])
+			{
+				fprintf(Out,"#define ANIM_");
+				AnimGenMacro(Out,A->Name);
+				fputc('_',Out);
+				AnimGenMacro(Out,A->Frame[Frame].Name);
+				fprintf(Out," %u\n",A->Frame[Frame].Index);
+			}
+		}
+	}
+	fprintf(Out,"\n#endif\n");
+}
+
+/* *********************************************************************
+ * NAME:             main
+ * CALLED BY:        make anim
+ * DESCRIPTION:      animgen <animations.txt> <animations.c> <animations.h>
+ * INPUT PARAMETERS: argc, argv : input and output files
+ * RETURN VALUES:    int : status - Fail(1)/Pass(0)
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	FILE *In, *Source, *Header;
+	const char *HeaderName;
+
+	if (4 != argc)
+	{
+		fprintf(stderr,"usage: %s <animations.txt> <animations.c> <animations.h>\n",argv[0]);
+		return 1;
+	}
+	InputPath = argv[1];
+	In = fopen(InputPath,"r");
+	if (NULL == In)
+	{
+		perror(InputPath);
+		return 1;
+	}
+	AnimGenParse(In);
+	fclose(In);
+	Source = fopen(argv[2],"w");
+	Header = fopen(argv[3],"w");
+	if ((NULL == Source) || (NULL == Header))
+	{
+		perror("output");
+		return 1;
+	}
+	HeaderName = strrchr(argv[3],'/');
+	AnimGenWriteSource(Source,(HeaderName) ? (HeaderName + 1) : argv[3]);
+	AnimGenWriteHeader(Header);
+	if (fclose(Source) || fclose(Header))
+	{
+		perror("output");
+		return 1;
+	}
+	return 0;
+}
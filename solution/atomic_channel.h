@@ -0,0 +1,156 @@
+/* *********************************************************************
+ *
+ * Lock free primitives shared by the user applications
+ *
+ * Program Name:        AtomicChannel
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc (C11 atomics, gcc 4.9 or later)
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef ATOMIC_CHANNEL_H
+#define ATOMIC_CHANNEL_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Latest distance published by the measurement thread. The sequence starts
+ * at 0 for the initial value and is incremented by every publish, so a
+ * reader that keeps the last sequence it saw can tell a new measurement
+ * from one it already used.
+ */
+typedef struct DistanceValueTag
+{
+	unsigned int DistanceMm; /* Measured distance */
+	unsigned long long TimestampNs; /* CLOCK_MONOTONIC time of the measurement */
+	unsigned int Sequence; /* Publishes so far */
+}DistanceValueType;
+
+/*
+ * Versioned cell holding a DistanceValueType. Version is odd while the
+ * writer updates the fields; a reader retries until it has seen the same
+ * even version before and after copying them. There must be a single
+ * writer, any number of readers. The writer never waits for the readers.
+ */
+typedef struct DistanceChannelTag
+{
+	atomic_uint Version; /* Odd while a publish is in progress */
+	atomic_uint DistanceMm; /* Fields of DistanceValueType */
+	atomic_ullong TimestampNs;
+	atomic_uint Sequence;
+}DistanceChannelType;
+
+/*
+ * Flag set once by the main thread to end the other threads
+ */
+typedef struct StopFlagTag
+{
+	atomic_int Stop; /* 0 while the threads should run */
+}StopFlagType;
+
+/* *********************************************************************
+ * NAME:             ChannelNowNs
+ * CALLED BY:        Producers and consumers of a channel
+ * DESCRIPTION:      Monotonic time in nano seconds, the time base of
+ *                   the channel timestamps
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned long long : current time
+ ***********************************************************************/
+static inline unsigned long long ChannelNowNs(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return ((unsigned long long)Now.tv_sec * 1000000000ULL) + Now.tv_nsec;
+}
+
+/* *********************************************************************
+ * NAME:             DistanceChannelInit
+ * CALLED BY:        main, before the threads are created
+ * DESCRIPTION:      Sets the initial value with sequence 0
+ * INPUT PARAMETERS: Channel : channel to initialise
+ *                   DistanceMm : value read until the first publish
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static inline void DistanceChannelInit(DistanceChannelType *Channel, unsigned int DistanceMm)
+{
+	atomic_init(&(Channel->Version),0);
+	atomic_init(&(Channel->DistanceMm),DistanceMm);
+	atomic_init(&(Channel->TimestampNs),ChannelNowNs());
+	atomic_init(&(Channel->Sequence),0);
+}
+
+/* *********************************************************************
+ * NAME:             DistanceChannelPublish
+ * CALLED BY:        The single writer of the channel
+ * DESCRIPTION:      Makes a new measurement visible to the readers
+ * INPUT PARAMETERS: Channel : channel to update
+ *                   DistanceMm : measured distance
+ *                   TimestampNs : time of the measurement
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static inline void DistanceChannelPublish(DistanceChannelType *Channel, unsigned int DistanceMm,
+                                          unsigned long long TimestampNs)
+{
+	unsigned int Version = atomic_load_explicit(&(Channel->Version),memory_order_relaxed);
+
+	atomic_store_explicit(&(Channel->Version),Version + 1,memory_order_relaxed);
+	/* The odd version must be visible before any field changes */
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&(Channel->DistanceMm),DistanceMm,memory_order_relaxed);
+	atomic_store_explicit(&(Channel->TimestampNs),TimestampNs,memory_order_relaxed);
+	atomic_store_explicit(&(Channel->Sequence),
+	                      atomic_load_explicit(&(Channel->Sequence),memory_order_relaxed) + 1,
+	                      memory_order_relaxed);
+	atomic_store_explicit(&(Channel->Version),Version + 2,memory_order_release);
+}
+
+/* *********************************************************************
+ * NAME:             DistanceChannelRead
+ * CALLED BY:        Readers of the channel
+ * DESCRIPTION:      Copies a consistent value, retrying only while a
+ *                   publish is in progress
+ * INPUT PARAMETERS: Channel : channel to read
+ *                   Value : filled with the latest value
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static inline void DistanceChannelRead(DistanceChannelType *Channel, DistanceValueType *Value)
+{
+	unsigned int Before, After;
+
+	do
+	{
+		Before = atomic_load_explicit(&(Channel->Version),memory_order_acquire);
+		Value->DistanceMm = atomic_load_explicit(&(Channel->DistanceMm),memory_order_relaxed);
+		Value->TimestampNs = atomic_load_explicit(&(Channel->TimestampNs),memory_order_relaxed);
+		Value->Sequence = atomic_load_explicit(&(Channel->Sequence),memory_order_relaxed);
+		/* The fields must be read before the version is checked again */
+		atomic_thread_fence(memory_order_acquire);
+		After = atomic_load_explicit(&(Channel->Version),memory_order_relaxed);
+	}while ((Before & 1) || (Before != After));
+}
+
+/* *********************************************************************
+ * NAME:             StopFlagInit / StopFlagSet / StopFlagIsSet
+ * CALLED BY:        main sets the flag, the threads poll it
+ * DESCRIPTION:      Stop request seen by every thread once set
+ ***********************************************************************/
+static inline void StopFlagInit(StopFlagType *Flag)
+{
+	atomic_init(&(Flag->Stop),0);
+}
+
+static inline void StopFlagSet(StopFlagType *Flag)
+{
+	atomic_store_explicit(&(Flag->Stop),1,memory_order_release);
+}
+
+static inline int StopFlagIsSet(StopFlagType *Flag)
+{
+	return atomic_load_explicit(&(Flag->Stop),memory_order_acquire);
+}
+
+#endif
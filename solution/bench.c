@@ -0,0 +1,671 @@
+/* *********************************************************************
+ *
+ * Benchmark of the display and distance pipelines of spi_led and pulse
+ *
+ * Program Name:        Bench
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include "spi_led.h"
+#include "pulse.h"
+#include "latency_hist.h"
+#include "bench.h"
+
+/*
+ * Defaults of a run: frames of the display benchmarks, run time and rate
+ * of the distance benchmarks. The obstacle distance is the one main3_2
+ * slows the car down at.
+ */
+#define BENCH_DEFAULT_FRAMES   500
+#define BENCH_DEFAULT_SECONDS   5
+#define BENCH_DEFAULT_RATE_HZ   PULSE_MAX_RATE_HZ
+#define BENCH_DEFAULT_THRESHOLD_MM   300
+/*
+ * Patterns the display benchmarks walk through. Every row of a pattern
+ * differs from the row of the next one, so the driver cannot skip rows
+ * that did not change.
+ */
+#define BENCH_PATTERNS   16
+/* Samples taken per read() */
+#define BENCH_READ_SAMPLES   16
+/* Longest wait for a device, well above a frame or an echo window */
+#define BENCH_POLL_TIMEOUT_MS   2000
+/* Results of a run, besides the histograms */
+#define BENCH_MAX_RESULTS   16
+
+/* Benchmarks, selected with tests= */
+typedef enum BenchTest_Tag {
+	BENCH_TEST_SPI = 1, /* Frame latency and frame rate of spi_led */
+	BENCH_TEST_PULSE = 2, /* Sample rate and trigger to read latency of pulse */
+	BENCH_TEST_REACTION = 4 /* Obstacle sample to slowed down frame on display */
+}BenchTest_Type;
+
+/* Figure of the report */
+typedef struct BenchResultTag
+{
+	const char *Name; /* Key in the report */
+	double Value; /* Value */
+}BenchResultType;
+
+/* Settings and report of a run */
+typedef struct BenchTag
+{
+	unsigned int Tests; /* BenchTest_Type bits */
+	unsigned int Frames; /* Frames of the display benchmarks */
+	unsigned int Seconds; /* Run time of each distance benchmark */
+	unsigned int RateHz; /* Rate of the continuous mode */
+	unsigned int ThresholdMm; /* Distance of an obstacle */
+	unsigned int Panels; /* Chained panels reported by spi_led */
+	BenchResultType Result[BENCH_MAX_RESULTS]; /* Figures measured */
+	unsigned int ResultCount; /* Figures so far */
+	LatencyHistType SpiFrame; /* PLAY of one frame to display free */
+	LatencyHistType PulseLatency; /* Trigger to sample read */
+	LatencyHistType Reaction; /* Trigger of the obstacle sample to slowed down frame shown */
+}BenchType;
+
+/* Settings and report of the run */
+static BenchType Bench;
+
+/* *********************************************************************
+ * NAME:             BenchNowNs
+ * CALLED BY:        Benchmarks
+ * DESCRIPTION:      Monotonic time in nano seconds, the time base of the
+ *                   sample timestamps
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned long long : current time
+ ***********************************************************************/
+static unsigned long long BenchNowNs(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return ((unsigned long long)Now.tv_sec * 1000000000ULL) + Now.tv_nsec;
+}
+
+/* *********************************************************************
+ * NAME:             Sys<file operation>
+ * CALLED BY:        Benchmark
+ * DESCRIPTION:      File operations on /dev/<name> of the loaded drivers,
+ *                   errors given as negative errno values
+ ***********************************************************************/
+static int SysParam(const char *Argument)
+{
+	return -EINVAL;
+}
+
+static int SysSetup(void)
+{
+	return 0;
+}
+
+static void SysTeardown(void)
+{
+}
+
+static int SysOpen(const char *Device, BenchFileType *File)
+{
+	char Path[64];
+
+	snprintf(Path,sizeof(Path),"/dev/%s",Device);
+	File->Sim = NULL;
+	File->Fd = open(Path,O_RDWR);
+	return (File->Fd < 0) ? -errno : 0;
+}
+
+static void SysClose(BenchFileType *File)
+{
+	close(File->Fd);
+	File->Fd = -1;
+}
+
+static ssize_t SysRead(BenchFileType *File, void *Buffer, size_t Size)
+{
+	ssize_t Ret;
+
+	Ret = read(File->Fd,Buffer,Size);
+	return (Ret < 0) ? -errno : Ret;
+}
+
+static long SysIoctl(BenchFileType *File, unsigned int Command, unsigned long Argument)
+{
+	return (ioctl(File->Fd,Command,Argument) < 0) ? -errno : 0;
+}
+
+static int SysPoll(BenchFileType *File, short Events, int TimeoutMs)
+{
+	struct pollfd Fd = {File->Fd, Events, 0};
+	int Ret;
+
+	Ret = poll(&Fd,1,TimeoutMs);
+	if (Ret < 0)
+	{
+		return -errno;
+	}
+	return (Fd.revents & Events) ? 1 : 0;
+}
+
+/* Drivers loaded with insmod */
+static const BenchIoType SysBenchIo = {
+	.Name = "dev",
+	.Param = SysParam,
+	.Setup = SysSetup,
+	.Teardown = SysTeardown,
+	.Open = SysOpen,
+	.Close = SysClose,
+	.Read = SysRead,
+	.Ioctl = SysIoctl,
+	.Poll = SysPoll,
+};
+
+/* Backend of the run */
+#ifdef BENCH_SIM
+static const BenchIoType *Io = &SimBenchIo;
+#else
+static const BenchIoType *Io = &SysBenchIo;
+#endif
+
+/* *********************************************************************
+ * NAME:             BenchResult
+ * CALLED BY:        Benchmarks
+ * DESCRIPTION:      Adds a figure to the report
+ * INPUT PARAMETERS: Name : key in the report
+ *                   Value : figure
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void BenchResult(const char *Name, double Value)
+{
+	if (Bench.ResultCount < BENCH_MAX_RESULTS)
+	{
+		Bench.Result[Bench.ResultCount].Name = Name;
+		Bench.Result[Bench.ResultCount].Value = Value;
+		Bench.ResultCount++;
+	}
+	fprintf(stderr,"%s: %.1f\n",Name,Value);
+}
+
+/* *********************************************************************
+ * NAME:             BenchPattern
+ * CALLED BY:        BenchCreateBank
+ * DESCRIPTION:      Pattern n of the benchmark bank, a bar that walks
+ *                   through the rows and columns so that every row differs
+ *                   from the one of pattern n + 1
+ * INPUT PARAMETERS: Number : pattern number
+ *                   Rows : eight digit registers to fill
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void BenchPattern(unsigned int Number, __u8 *Rows)
+{
+	unsigned int Row;
+
+	for (Row = 0; Row < 8; Row++)
+	{
+		Rows[Row] = (__u8)((Row == (Number % 8)) ? 0xFF : (1u << ((Number + Row) % 8)));
+	}
+}
+
+/* *********************************************************************
+ * NAME:             BenchCreateBank
+ * CALLED BY:        BenchSpi, BenchReaction
+ * DESCRIPTION:      Allocates and fills a bank of Steps steps of time 0,
+ *                   step i showing pattern 1 + i % BENCH_PATTERNS, so a
+ *                   PLAY of n steps sends n frames back to back
+ * INPUT PARAMETERS: Display : spi_led device
+ *                   Steps : sequence length
+ * RETURN VALUES:    int : bank handle, negative errno value on failure
+ ***********************************************************************/
+static int BenchCreateBank(BenchFileType *Display, unsigned int Steps)
+{
+	SpiLedBankReqType BankReq = {0};
+	SpiLedBankDataType BankData = {0};
+	__u8 (*Pattern)[8];
+	__u16 (*Sequence)[2];
+	unsigned int LoopIndex, PatternCount = 1 + BENCH_PATTERNS + Bench.Panels;
+	long Ret;
+
+	Pattern = calloc(PatternCount,sizeof(*Pattern));
+	Sequence = calloc(Steps,sizeof(*Sequence));
+	if ((NULL == Pattern) || (NULL == Sequence))
+	{
+		free(Pattern);
+		free(Sequence);
+		return -ENOMEM;
+	}
+	for (LoopIndex = 0; LoopIndex < PatternCount; LoopIndex++)
+	{
+		BenchPattern(LoopIndex,Pattern[LoopIndex]);
+	}
+	for (LoopIndex = 0; LoopIndex < Steps; LoopIndex++)
+	{
+		Sequence[LoopIndex][0] = 1 + (LoopIndex % BENCH_PATTERNS);
+		Sequence[LoopIndex][1] = 0;
+	}
+	BankReq.PatternCount = PatternCount;
+	BankReq.SequenceLength = Steps;
+	Ret = Io->Ioctl(Display,SPI_LED_IOC_BANK_ALLOC,(unsigned long)&BankReq);
+	if (0 == Ret)
+	{
+		BankData.Handle = BankReq.Handle;
+		BankData.Count = PatternCount;
+		BankData.Data = (unsigned long)Pattern;
+		Ret = Io->Ioctl(Display,SPI_LED_IOC_LOAD_PATTERNS,(unsigned long)&BankData);
+	}
+	if (0 == Ret)
+	{
+		BankData.Count = Steps;
+		BankData.Data = (unsigned long)Sequence;
+		Ret = Io->Ioctl(Display,SPI_LED_IOC_LOAD_SEQUENCE,(unsigned long)&BankData);
+	}
+	free(Pattern);
+	free(Sequence);
+	return (Ret) ? (int)Ret : (int)BankReq.Handle;
+}
+
+/* *********************************************************************
+ * NAME:             BenchPlay
+ * CALLED BY:        BenchSpi, BenchReaction
+ * DESCRIPTION:      Queues Count steps of a bank and waits until the
+ *                   display is free again
+ * INPUT PARAMETERS: Display : spi_led device
+ *                   Handle : bank
+ *                   First, Count : steps to be played
+ * RETURN VALUES:    int : 0, negative errno value on failure
+ ***********************************************************************/
+static int BenchPlay(BenchFileType *Display, unsigned int Handle, unsigned int First, unsigned int Count)
+{
+	SpiLedPlayType Play;
+	long Ret;
+
+	Play.Handle = Handle;
+	Play.First = First;
+	Play.Count = Count;
+	Ret = Io->Ioctl(Display,SPI_LED_IOC_PLAY,(unsigned long)&Play);
+	if (Ret)
+	{
+		return (int)Ret;
+	}
+	Ret = Io->Poll(Display,POLLIN,BENCH_POLL_TIMEOUT_MS + Count);
+	return (Ret > 0) ? 0 : ((Ret) ? (int)Ret : -ETIMEDOUT);
+}
+
+/* *********************************************************************
+ * NAME:             BenchSpi
+ * CALLED BY:        main
+ * DESCRIPTION:      Times Frames single frame PLAYs from the ioctl to the
+ *                   display being free, then one PLAY of Frames frames
+ *                   for the frame rate the bus allows
+ * INPUT PARAMETERS: Display : spi_led device
+ * RETURN VALUES:    int : 0, negative errno value on failure
+ ***********************************************************************/
+static int BenchSpi(BenchFileType *Display)
+{
+	unsigned long long Start, Took;
+	unsigned int LoopIndex;
+	int Handle, Ret = 0;
+
+	Handle = BenchCreateBank(Display,Bench.Frames);
+	if (Handle < 0)
+	{
+		return Handle;
+	}
+	for (LoopIndex = 0; (LoopIndex < Bench.Frames) && (0 == Ret); LoopIndex++)
+	{
+		Start = BenchNowNs();
+		Ret = BenchPlay(Display,Handle,LoopIndex,1);
+		LatencyHistRecord(&Bench.SpiFrame,BenchNowNs() - Start);
+	}
+	if (0 == Ret)
+	{
+		Start = BenchNowNs();
+		Ret = BenchPlay(Display,Handle,0,Bench.Frames);
+		Took = BenchNowNs() - Start;
+		BenchResult("spi_frames_per_sec",(Bench.Frames * 1e9) / Took);
+		BenchResult("spi_frame_mean_us",(Took / 1e3) / Bench.Frames);
+	}
+	Io->Ioctl(Display,SPI_LED_IOC_BANK_FREE,(unsigned long)Handle);
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             BenchSamples
+ * CALLED BY:        BenchPulse, BenchReaction
+ * DESCRIPTION:      Waits for samples of the continuous mode and reads
+ *                   all that are waiting
+ * INPUT PARAMETERS: Sensor : pulse device
+ *                   Sample : BENCH_READ_SAMPLES samples to fill
+ * RETURN VALUES:    int : samples read, 0 after BENCH_POLL_TIMEOUT_MS,
+ *                   negative errno value on failure
+ ***********************************************************************/
+static int BenchSamples(BenchFileType *Sensor, PulseSampleType *Sample)
+{
+	ssize_t Length;
+	int Ret;
+
+	Ret = Io->Poll(Sensor,POLLIN,BENCH_POLL_TIMEOUT_MS);
+	if (Ret <= 0)
+	{
+		return Ret;
+	}
+	Length = Io->Read(Sensor,Sample,BENCH_READ_SAMPLES * sizeof(PulseSampleType));
+	return (Length < 0) ? (int)Length : (int)(Length / sizeof(PulseSampleType));
+}
+
+/* *********************************************************************
+ * NAME:             BenchPulse
+ * CALLED BY:        main
+ * DESCRIPTION:      Runs the continuous mode for Seconds and times every
+ *                   sample from its trigger to its read()
+ * INPUT PARAMETERS: Sensor : pulse device
+ * RETURN VALUES:    int : 0, negative errno value on failure
+ ***********************************************************************/
+static int BenchPulse(BenchFileType *Sensor)
+{
+	PulseSampleType Sample[BENCH_READ_SAMPLES];
+	unsigned long long Start, End, Now, Samples = 0, Timeouts = 0, Lost = 0;
+	unsigned int Next = 0;
+	int Count, LoopIndex, Ret;
+
+	Ret = (int)Io->Ioctl(Sensor,PULSE_IOC_START,Bench.RateHz);
+	if (Ret)
+	{
+		return Ret;
+	}
+	Start = BenchNowNs();
+	End = Start + (Bench.Seconds * 1000000000ULL);
+	do
+	{
+		Count = BenchSamples(Sensor,Sample);
+		Now = BenchNowNs();
+		for (LoopIndex = 0; LoopIndex < Count; LoopIndex++)
+		{
+			LatencyHistRecord(&Bench.PulseLatency,Now - Sample[LoopIndex].TimestampNs);
+			Timeouts += (PULSE_SAMPLE_OK != Sample[LoopIndex].Status);
+			/* Gaps in the sequence are samples the fifo dropped */
+			if ((Samples) && (Sample[LoopIndex].Sequence != Next))
+			{
+				Lost += Sample[LoopIndex].Sequence - Next;
+			}
+			Next = Sample[LoopIndex].Sequence + 1;
+			Samples++;
+		}
+	}while ((Count > 0) && (Now < End));
+	Io->Ioctl(Sensor,PULSE_IOC_STOP,0);
+	if (Count <= 0)
+	{
+		return (Count) ? Count : -ETIMEDOUT;
+	}
+	BenchResult("pulse_samples_per_sec",(Samples * 1e9) / (Now - Start));
+	BenchResult("pulse_timeouts",(double)Timeouts);
+	BenchResult("pulse_lost",(double)Lost);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             BenchReaction
+ * CALLED BY:        main
+ * DESCRIPTION:      Runs the continuous mode for Seconds. The first sample
+ *                   closer than ThresholdMm after a clear one queues a
+ *                   frame, as main3_2 does to slow the car down, and the
+ *                   time from the trigger of that sample to the frame
+ *                   being shown is the reaction time
+ * INPUT PARAMETERS: Sensor : pulse device
+ *                   Display : spi_led device
+ * RETURN VALUES:    int : 0, negative errno value on failure
+ ***********************************************************************/
+static int BenchReaction(BenchFileType *Sensor, BenchFileType *Display)
+{
+	PulseSampleType Sample[BENCH_READ_SAMPLES];
+	unsigned long long End, Now = 0;
+	unsigned char Obstacle = 0;
+	int Count, LoopIndex, Handle, Ret;
+
+	Handle = BenchCreateBank(Display,1);
+	if (Handle < 0)
+	{
+		return Handle;
+	}
+	Ret = (int)Io->Ioctl(Sensor,PULSE_IOC_START,Bench.RateHz);
+	End = BenchNowNs() + (Bench.Seconds * 1000000000ULL);
+	while ((0 == Ret) && (Now < End))
+	{
+		Count = BenchSamples(Sensor,Sample);
+		Ret = (Count > 0) ? 0 : ((Count) ? Count : -ETIMEDOUT);
+		/* Only the newest sample counts, as the application only looks at the latest distance */
+		LoopIndex = Count - 1;
+		if ((0 == Ret) && (PULSE_SAMPLE_OK == Sample[LoopIndex].Status) &&
+		    (Sample[LoopIndex].DistanceMm < Bench.ThresholdMm))
+		{
+			if (0 == Obstacle)
+			{
+				Ret = BenchPlay(Display,Handle,0,1);
+				LatencyHistRecord(&Bench.Reaction,BenchNowNs() - Sample[LoopIndex].TimestampNs);
+			}
+			Obstacle = 1;
+		}
+		else
+		{
+			Obstacle = 0;
+		}
+		Now = BenchNowNs();
+	}
+	Io->Ioctl(Sensor,PULSE_IOC_STOP,0);
+	Io->Ioctl(Display,SPI_LED_IOC_BANK_FREE,(unsigned long)Handle);
+	BenchResult("reactions",(double)Bench.Reaction.Count);
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             BenchReport
+ * CALLED BY:        main
+ * DESCRIPTION:      Writes the settings, the figures and the histograms
+ *                   of the run as one JSON object
+ * INPUT PARAMETERS: Out : report file
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void BenchReport(FILE *Out)
+{
+	const LatencyHistType *Hist[] = {&Bench.SpiFrame, &Bench.PulseLatency, &Bench.Reaction};
+	unsigned int LoopIndex;
+	int First = 1;
+
+	fprintf(Out,"{\n  \"io\": \"%s\",\n  \"config\": {\"frames\": %u, \"seconds\": %u, \"rate_hz\": %u, "
+	        "\"threshold_mm\": %u, \"panels\": %u},\n  \"results\": {",
+	        Io->Name,Bench.Frames,Bench.Seconds,Bench.RateHz,Bench.ThresholdMm,Bench.Panels);
+	for (LoopIndex = 0; LoopIndex < Bench.ResultCount; LoopIndex++)
+	{
+		fprintf(Out,"%s\"%s\": %.3f",(LoopIndex) ? ", " : "",Bench.Result[LoopIndex].Name,Bench.Result[LoopIndex].Value);
+	}
+	fprintf(Out,"},\n  \"histograms\": [");
+	for (LoopIndex = 0; LoopIndex < (sizeof(Hist) / sizeof(Hist[0])); LoopIndex++)
+	{
+		if (Hist[LoopIndex]->Count)
+		{
+			fprintf(Out,"%s\n    ",(First) ? "" : ",");
+			LatencyHistJson(Hist[LoopIndex],Out);
+			First = 0;
+		}
+	}
+	fprintf(Out,"\n  ]\n}\n");
+}
+
+/* *********************************************************************
+ * NAME:             BenchTests
+ * CALLED BY:        main
+ * DESCRIPTION:      Parses the list of tests=
+ * INPUT PARAMETERS: Text : comma separated names of spi, pulse, reaction
+ * RETURN VALUES:    unsigned int : BenchTest_Type bits, 0 on a bad list
+ ***********************************************************************/
+static unsigned int BenchTests(const char *Text)
+{
+	static const struct
+	{
+		const char *Name;
+		BenchTest_Type Test;
+	}Names[] = {{"spi", BENCH_TEST_SPI}, {"pulse", BENCH_TEST_PULSE}, {"reaction", BENCH_TEST_REACTION}};
+	unsigned int Tests = 0, LoopIndex;
+	size_t Length;
+
+	while (*Text)
+	{
+		Length = strcspn(Text,",");
+		for (LoopIndex = 0; LoopIndex < (sizeof(Names) / sizeof(Names[0])); LoopIndex++)
+		{
+			if ((strlen(Names[LoopIndex].Name) == Length) && (0 == strncmp(Text,Names[LoopIndex].Name,Length)))
+			{
+				break;
+			}
+		}
+		if (LoopIndex == (sizeof(Names) / sizeof(Names[0])))
+		{
+			return 0;
+		}
+		Tests |= Names[LoopIndex].Test;
+		Text += Length + ((',' == Text[Length]) ? 1 : 0);
+	}
+	return Tests;
+}
+
+/* *********************************************************************
+ * NAME:             main
+ * CALLED BY:        user call this app on the terminal
+ * DESCRIPTION:      bench [tests=spi,pulse,reaction] [frames=n]
+ *                   [seconds=n] [rate=Hz] [threshold=mm] [json=file]
+ *                   [backend argument ...]. Runs the selected benchmarks
+ *                   on /dev/spi_led and /dev/pulse, or on the simulated
+ *                   drivers when built with BENCH_SIM, and writes the
+ *                   report as JSON to the standard output or to file.
+ *                   Progress goes to the standard error
+ * INPUT PARAMETERS: argc, argv : command line
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	BenchFileType Display, Sensor;
+	SpiLedInfoType Info;
+	FILE *Out = stdout;
+	int LoopIndex, Ret = 0;
+
+	Bench.Tests = BENCH_TEST_SPI | BENCH_TEST_PULSE | BENCH_TEST_REACTION;
+	Bench.Frames = BENCH_DEFAULT_FRAMES;
+	Bench.Seconds = BENCH_DEFAULT_SECONDS;
+	Bench.RateHz = BENCH_DEFAULT_RATE_HZ;
+	Bench.ThresholdMm = BENCH_DEFAULT_THRESHOLD_MM;
+	LatencyHistInit(&Bench.SpiFrame,"spi_frame_ns");
+	LatencyHistInit(&Bench.PulseLatency,"pulse_trigger_to_read_ns");
+	LatencyHistInit(&Bench.Reaction,"reaction_ns");
+	for (LoopIndex = 1; (LoopIndex < argc) && (0 == Ret); LoopIndex++)
+	{
+		if (0 == strncmp(argv[LoopIndex],"tests=",6))
+		{
+			Bench.Tests = BenchTests(argv[LoopIndex] + 6);
+			Ret = (0 == Bench.Tests);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"frames=",7))
+		{
+			Bench.Frames = (unsigned int)atoi(argv[LoopIndex] + 7);
+			Ret = ((0 == Bench.Frames) || (Bench.Frames > SPI_LED_BANK_MAX_STEPS));
+		}
+		else if (0 == strncmp(argv[LoopIndex],"seconds=",8))
+		{
+			Bench.Seconds = (unsigned int)atoi(argv[LoopIndex] + 8);
+			Ret = (0 == Bench.Seconds);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"rate=",5))
+		{
+			Bench.RateHz = (unsigned int)atoi(argv[LoopIndex] + 5);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"threshold=",10))
+		{
+			Bench.ThresholdMm = (unsigned int)atoi(argv[LoopIndex] + 10);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"json=",5))
+		{
+			Out = fopen(argv[LoopIndex] + 5,"w");
+			if (NULL == Out)
+			{
+				perror(argv[LoopIndex] + 5);
+				return 1;
+			}
+		}
+		else
+		{
+			Ret = Io->Param(argv[LoopIndex]);
+		}
+	}
+	if (Ret)
+	{
+		fprintf(stderr,"usage: %s [tests=spi,pulse,reaction] [frames=n] [seconds=n] [rate=Hz] [threshold=mm]"
+		        " [json=file]%s\n",argv[0],(&SysBenchIo == Io) ? "" : " [echo=mm,mm,...] [module parameter=value ...]");
+		return 1;
+	}
+
+	Ret = Io->Setup();
+	if (Ret)
+	{
+		fprintf(stderr,"%s setup failed: %s\n",Io->Name,strerror(-Ret));
+		return 1;
+	}
+	Display.Fd = Sensor.Fd = -1;
+	Display.Sim = Sensor.Sim = NULL;
+	if (Bench.Tests & (BENCH_TEST_SPI | BENCH_TEST_REACTION))
+	{
+		Ret = Io->Open("spi_led",&Display);
+		if (0 == Ret)
+		{
+			Ret = (int)Io->Ioctl(&Display,SPI_LED_IOC_GET_INFO,(unsigned long)&Info);
+			Bench.Panels = Info.PanelCount;
+		}
+	}
+	if ((0 == Ret) && (Bench.Tests & (BENCH_TEST_PULSE | BENCH_TEST_REACTION)))
+	{
+		Ret = Io->Open("pulse",&Sensor);
+	}
+	if ((0 == Ret) && (Bench.Tests & BENCH_TEST_SPI))
+	{
+		fprintf(stderr,"spi: %u frames on %u panels\n",Bench.Frames,Bench.Panels);
+		Ret = BenchSpi(&Display);
+	}
+	if ((0 == Ret) && (Bench.Tests & BENCH_TEST_PULSE))
+	{
+		fprintf(stderr,"pulse: %u s at %u Hz\n",Bench.Seconds,Bench.RateHz);
+		Ret = BenchPulse(&Sensor);
+	}
+	if ((0 == Ret) && (Bench.Tests & BENCH_TEST_REACTION))
+	{
+		fprintf(stderr,"reaction: %u s at %u Hz, obstacle below %u mm\n",Bench.Seconds,Bench.RateHz,Bench.ThresholdMm);
+		Ret = BenchReaction(&Sensor,&Display);
+	}
+	if (Ret)
+	{
+		fprintf(stderr,"benchmark failed: %s\n",strerror(-Ret));
+	}
+	if ((Display.Fd >= 0) || (Display.Sim))
+	{
+		Io->Close(&Display);
+	}
+	if ((Sensor.Fd >= 0) || (Sensor.Sim))
+	{
+		Io->Close(&Sensor);
+	}
+	Io->Teardown();
+	BenchReport(Out);
+	if (stdout != Out)
+	{
+		fclose(Out);
+	}
+	return (Ret) ? 1 : 0;
+}
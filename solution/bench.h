@@ -0,0 +1,52 @@
+/* *********************************************************************
+ *
+ * Device access of the display and distance benchmark
+ *
+ * Program Name:        Bench
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Open device of the benchmark */
+typedef struct BenchFileTag
+{
+	int Fd; /* File descriptor of /dev/<name>, -1 on the simulation */
+	void *Sim; /* Simulated device file */
+}BenchFileType;
+
+/*
+ * Backend the benchmark reaches the drivers through: the real devices, or
+ * the drivers linked into the program on the host simulation. Every call
+ * returns a negative errno value on failure.
+ */
+typedef struct BenchIoTag
+{
+	const char *Name; /* Name in the report */
+	/* Takes a name=value argument the benchmark does not know */
+	int (*Param)(const char *Argument);
+	/* Before the first Open, and after the last Close */
+	int (*Setup)(void);
+	void (*Teardown)(void);
+	int (*Open)(const char *Device, BenchFileType *File);
+	void (*Close)(BenchFileType *File);
+	ssize_t (*Read)(BenchFileType *File, void *Buffer, size_t Size);
+	long (*Ioctl)(BenchFileType *File, unsigned int Command, unsigned long Argument);
+	/* 1 once one of Events is ready, 0 after TimeoutMs */
+	int (*Poll)(BenchFileType *File, short Events, int TimeoutMs);
+}BenchIoType;
+
+#ifdef BENCH_SIM
+/* Drivers of the host simulation, sim/bench_sim.c */
+extern const BenchIoType SimBenchIo;
+#endif
+
+#endif
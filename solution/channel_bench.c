@@ -0,0 +1,216 @@
+/* *********************************************************************
+ *
+ * Stress benchmark of the distance channel against a mutex
+ *
+ * Program Name:        ChannelBench
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "atomic_channel.h"
+
+/*
+ * Default number of reader threads and run time of each variant
+ */
+#define BENCH_DEFAULT_READERS 3
+#define BENCH_DEFAULT_SECONDS 5
+#define BENCH_MAX_READERS 64
+/*
+ * Default time between two publishes, well above any sensor rate. 0 lets
+ * the writer publish flat out, the worst case for the readers of the
+ * channel who retry while a publish is in progress.
+ */
+#define BENCH_DEFAULT_PERIOD_US 1000
+
+/* Variants compared */
+typedef enum BenchMode_Tag {
+	BENCH_MUTEX,
+	BENCH_CHANNEL
+}BenchMode_Type;
+
+/* Result of one reader thread */
+typedef struct BenchReaderTag
+{
+	pthread_t Thread; /* Reader thread */
+	unsigned long long Reads; /* Values read */
+	unsigned long long WorstNs; /* Longest single read */
+	unsigned long long Torn; /* Values whose fields did not belong together */
+}BenchReaderType;
+
+/* Variant under test */
+static BenchMode_Type Mode;
+/* Ends the writer and the readers */
+static StopFlagType StopFlag;
+/* Lock free variant */
+static DistanceChannelType Channel;
+/* Mutex variant, same fields as the channel */
+static pthread_mutex_t DistanceMutex = PTHREAD_MUTEX_INITIALIZER;
+static DistanceValueType MutexValue;
+/* Values published by the writer */
+static unsigned long long Writes;
+/* Time between two publishes */
+static unsigned int WriterPeriodUs;
+
+/* *********************************************************************
+ * NAME:             BenchWriter
+ * CALLED BY:        Created by RunBench
+ * DESCRIPTION:      Publishes every WriterPeriodUs. The timestamp is always
+ *                   1000 times the distance, so a reader can detect a
+ *                   value mixed from two publishes
+ * INPUT PARAMETERS: Unused : not used
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void* BenchWriter(void *Unused)
+{
+	unsigned int DistanceMm = 0;
+
+	while (!StopFlagIsSet(&StopFlag))
+	{
+		DistanceMm = (DistanceMm + 1) % 4000;
+		if (BENCH_CHANNEL == Mode)
+		{
+			DistanceChannelPublish(&Channel,DistanceMm,(unsigned long long)DistanceMm * 1000);
+		}
+		else
+		{
+			pthread_mutex_lock(&DistanceMutex);
+			MutexValue.DistanceMm = DistanceMm;
+			MutexValue.TimestampNs = (unsigned long long)DistanceMm * 1000;
+			MutexValue.Sequence++;
+			pthread_mutex_unlock(&DistanceMutex);
+		}
+		Writes++;
+		if (WriterPeriodUs)
+		{
+			usleep(WriterPeriodUs);
+		}
+	}
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             BenchReader
+ * CALLED BY:        Created by RunBench
+ * DESCRIPTION:      Reads the latest value in a loop, timing every read
+ * INPUT PARAMETERS: ReaderLocal : BenchReaderType of this thread
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void* BenchReader(void *ReaderLocal)
+{
+	BenchReaderType *Reader = ReaderLocal;
+	DistanceValueType Value;
+	unsigned long long Start, Took;
+
+	while (!StopFlagIsSet(&StopFlag))
+	{
+		Start = ChannelNowNs();
+		if (BENCH_CHANNEL == Mode)
+		{
+			DistanceChannelRead(&Channel,&Value);
+		}
+		else
+		{
+			pthread_mutex_lock(&DistanceMutex);
+			Value = MutexValue;
+			pthread_mutex_unlock(&DistanceMutex);
+		}
+		Took = ChannelNowNs() - Start;
+		if (Took > Reader->WorstNs)
+		{
+			Reader->WorstNs = Took;
+		}
+		if (Value.TimestampNs != ((unsigned long long)Value.DistanceMm * 1000))
+		{
+			Reader->Torn++;
+		}
+		Reader->Reads++;
+	}
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             RunBench
+ * CALLED BY:        main
+ * DESCRIPTION:      Runs one writer and ReaderCount readers on a variant
+ *                   and prints the totals
+ * INPUT PARAMETERS: BenchMode : variant
+ *                   ReaderCount : reader threads
+ *                   Seconds : run time
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void RunBench(BenchMode_Type BenchMode, unsigned int ReaderCount, unsigned int Seconds)
+{
+	BenchReaderType Readers[BENCH_MAX_READERS];
+	pthread_t WriterThread;
+	unsigned long long Reads = 0, WorstNs = 0, Torn = 0;
+	unsigned int LoopIndex;
+
+	memset(Readers,0,sizeof(Readers));
+	Mode = BenchMode;
+	Writes = 0;
+	StopFlagInit(&StopFlag);
+	DistanceChannelInit(&Channel,0);
+	memset(&MutexValue,0,sizeof(MutexValue));
+
+	pthread_create(&WriterThread,NULL,&BenchWriter,NULL);
+	for (LoopIndex = 0; LoopIndex < ReaderCount; LoopIndex++)
+	{
+		pthread_create(&(Readers[LoopIndex].Thread),NULL,&BenchReader,&Readers[LoopIndex]);
+	}
+	sleep(Seconds);
+	StopFlagSet(&StopFlag);
+	pthread_join(WriterThread,NULL);
+	for (LoopIndex = 0; LoopIndex < ReaderCount; LoopIndex++)
+	{
+		pthread_join(Readers[LoopIndex].Thread,NULL);
+		Reads += Readers[LoopIndex].Reads;
+		Torn += Readers[LoopIndex].Torn;
+		if (Readers[LoopIndex].WorstNs > WorstNs)
+		{
+			WorstNs = Readers[LoopIndex].WorstNs;
+		}
+	}
+	printf("%-8s readers %u: %llu reads/s, %llu writes/s, worst read %llu ns, torn %llu\n",
+	       (BENCH_CHANNEL == BenchMode) ? "channel" : "mutex",ReaderCount,
+	       Reads / Seconds,Writes / Seconds,WorstNs,Torn);
+}
+
+/* *********************************************************************
+ * NAME:             main
+ * CALLED BY:        user call this app on the terminal
+ * DESCRIPTION:      channel_bench [readers [seconds [writer period us]]]
+ * INPUT PARAMETERS: argc, argv : command line
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	unsigned int ReaderCount = BENCH_DEFAULT_READERS;
+	unsigned int Seconds = BENCH_DEFAULT_SECONDS;
+
+	if (argc > 1)
+	{
+		ReaderCount = (unsigned int)atoi(argv[1]);
+	}
+	if (argc > 2)
+	{
+		Seconds = (unsigned int)atoi(argv[2]);
+	}
+	WriterPeriodUs = (argc > 3) ? (unsigned int)atoi(argv[3]) : BENCH_DEFAULT_PERIOD_US;
+	if ((0 == ReaderCount) || (ReaderCount > BENCH_MAX_READERS) || (0 == Seconds))
+	{
+		printf("usage: %s [readers (1-%d) [seconds [writer period us]]]\n",argv[0],BENCH_MAX_READERS);
+		return 1;
+	}
+	RunBench(BENCH_MUTEX,ReaderCount,Seconds);
+	RunBench(BENCH_CHANNEL,ReaderCount,Seconds);
+	return 0;
+}
@@ -0,0 +1,326 @@
+/* *********************************************************************
+ *
+ * Recorded distance traces, written by the applications and replayed
+ * into them
+ *
+ * Program Name:        DistanceTrace
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "distance_trace.h"
+
+/*
+ * Longest line of a trace file
+ */
+#define DISTANCE_TRACE_LINE 128
+/*
+ * Records the trace array starts with, doubled whenever it is full
+ */
+#define DISTANCE_TRACE_FIRST_RECORDS 1024
+
+/* *********************************************************************
+ * NAME:             DistanceTraceCreate
+ * CALLED BY:        Applications, when asked to record
+ * DESCRIPTION:      Creates a trace file and writes its header
+ * INPUT PARAMETERS: Path : file to create
+ * RETURN VALUES:    FILE * : open trace, NULL on failure
+ ***********************************************************************/
+FILE *DistanceTraceCreate(const char *Path)
+{
+	FILE *Trace;
+
+	Trace = fopen(Path,"w");
+	if (NULL == Trace)
+	{
+		perror("trace file creation failed ");
+		return NULL;
+	}
+	fprintf(Trace,"%s\n",DISTANCE_TRACE_HEADER);
+	return Trace;
+}
+
+/* *********************************************************************
+ * NAME:             DistanceTraceWrite
+ * CALLED BY:        Applications, for every measurement
+ * DESCRIPTION:      Adds a measurement to a trace. The file is buffered,
+ *                   fclose writes out the rest
+ * INPUT PARAMETERS: Trace : trace from DistanceTraceCreate
+ *                   Record : measurement
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int DistanceTraceWrite(FILE *Trace, const DistanceTraceRecordType *Record)
+{
+	return (fprintf(Trace,"%llu %u %u\n",Record->TimestampNs,Record->WidthNs,Record->Status) < 0) ? (-1) : (0);
+}
+
+/* *********************************************************************
+ * NAME:             DistanceTraceLoad
+ * CALLED BY:        Applications, before a replay
+ * DESCRIPTION:      Reads a whole trace file in memory, hours of samples
+ *                   are a few MB
+ * INPUT PARAMETERS: Path : trace file
+ *                   Trace : filled with the records
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int DistanceTraceLoad(const char *Path, DistanceTraceType *Trace)
+{
+	char Line[DISTANCE_TRACE_LINE];
+	DistanceTraceRecordType Record, *Grown;
+	unsigned int Size = 0, LineNumber = 1;
+	FILE *File;
+	int Ret = 0;
+
+	memset(Trace,0,sizeof(*Trace));
+	File = fopen(Path,"r");
+	if (NULL == File)
+	{
+		perror("trace file open failed ");
+		return -1;
+	}
+	if ((NULL == fgets(Line,sizeof(Line),File)) || (0 != strncmp(Line,DISTANCE_TRACE_HEADER,strlen(DISTANCE_TRACE_HEADER))))
+	{
+		printf("\n %s is not a distance trace",Path);
+		fclose(File);
+		return -1;
+	}
+	while ((0 == Ret) && (NULL != fgets(Line,sizeof(Line),File)))
+	{
+		LineNumber++;
+		if (('#' == Line[0]) || ('\n' == Line[0]))
+		{
+			continue;
+		}
+		if ((3 != sscanf(Line,"%llu %u %u",&Record.TimestampNs,&Record.WidthNs,&Record.Status)) ||
+		    (Record.Status > DISTANCE_TRACE_TIMEOUT) ||
+		    ((Trace->Count) && (Record.TimestampNs < Trace->Record[Trace->Count - 1].TimestampNs)))
+		{
+			printf("\n %s:%u: bad record",Path,LineNumber);
+			Ret = -1;
+			break;
+		}
+		if (Trace->Count == Size)
+		{
+			Size = (Size) ? (Size * 2) : DISTANCE_TRACE_FIRST_RECORDS;
+			Grown = realloc(Trace->Record,Size * sizeof(*Grown));
+			if (NULL == Grown)
+			{
+				printf("\n no memory for %u records",Size);
+				Ret = -1;
+				break;
+			}
+			Trace->Record = Grown;
+		}
+		Trace->Record[Trace->Count++] = Record;
+	}
+	fclose(File);
+	if ((0 == Ret) && (0 == Trace->Count))
+	{
+		printf("\n %s has no records",Path);
+		Ret = -1;
+	}
+	if (Ret)
+	{
+		DistanceTraceFree(Trace);
+	}
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             DistanceTraceFree
+ * CALLED BY:        Applications, after a replay
+ * DESCRIPTION:      Frees the records of a loaded trace
+ * INPUT PARAMETERS: Trace : trace from DistanceTraceLoad
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void DistanceTraceFree(DistanceTraceType *Trace)
+{
+	free(Trace->Record);
+	memset(Trace,0,sizeof(*Trace));
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockRealNs
+ * CALLED BY:        ReplayClock functions
+ * DESCRIPTION:      Monotonic time in nano seconds
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned long long : current time
+ ***********************************************************************/
+static unsigned long long ReplayClockRealNs(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return ((unsigned long long)Now.tv_sec * 1000000000ULL) + Now.tv_nsec;
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockInit
+ * CALLED BY:        main, before the threads taking part are created
+ * DESCRIPTION:      Starts the clock of a replay. Thread 0 is the caller
+ *                   and runs first, the others wait at time 0 in
+ *                   ReplayClockJoin until it sleeps.
+ * INPUT PARAMETERS: Clock : clock to start
+ *                   Speed : trace time per real time, 0 for the virtual
+ *                           clock
+ *                   Threads : threads taking part, REPLAY_MAX_THREADS
+ *                             at most
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void ReplayClockInit(ReplayClockType *Clock, double Speed, unsigned int Threads)
+{
+	memset(Clock->DueNs,0,sizeof(Clock->DueNs));
+	pthread_mutex_init(&(Clock->Lock),NULL);
+	pthread_cond_init(&(Clock->Turn),NULL);
+	Clock->Speed = Speed;
+	Clock->Threads = (Threads < REPLAY_MAX_THREADS) ? Threads : REPLAY_MAX_THREADS;
+	Clock->Running = 0;
+	Clock->NowNs = 0;
+	Clock->StartNs = ReplayClockRealNs();
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockNext
+ * CALLED BY:        ReplayClockSleepNs, ReplayClockLeave, with Lock held
+ * DESCRIPTION:      Hands the virtual clock over to the thread due first,
+ *                   the lowest id on a tie, and moves the time on to its
+ *                   wake up time
+ * INPUT PARAMETERS: Clock : virtual clock
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void ReplayClockNext(ReplayClockType *Clock)
+{
+	unsigned int LoopIndex, Next = Clock->Threads;
+
+	for (LoopIndex = 0; LoopIndex < Clock->Threads; LoopIndex++)
+	{
+		if ((~0ULL != Clock->DueNs[LoopIndex]) &&
+		    ((Clock->Threads == Next) || (Clock->DueNs[LoopIndex] < Clock->DueNs[Next])))
+		{
+			Next = LoopIndex;
+		}
+	}
+	/* Everybody has left */
+	if (Clock->Threads == Next)
+	{
+		return;
+	}
+	if (Clock->DueNs[Next] > Clock->NowNs)
+	{
+		Clock->NowNs = Clock->DueNs[Next];
+	}
+	Clock->Running = Next;
+	pthread_cond_broadcast(&(Clock->Turn));
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockJoin
+ * CALLED BY:        Threads taking part, first thing
+ * DESCRIPTION:      Waits for the first turn of the thread on the
+ *                   virtual clock, returns at once in real time
+ * INPUT PARAMETERS: Clock : clock of the replay
+ *                   Thread : id of the caller
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void ReplayClockJoin(ReplayClockType *Clock, unsigned int Thread)
+{
+	if (0 != Clock->Speed)
+	{
+		return;
+	}
+	pthread_mutex_lock(&(Clock->Lock));
+	while (Clock->Running != Thread)
+	{
+		pthread_cond_wait(&(Clock->Turn),&(Clock->Lock));
+	}
+	pthread_mutex_unlock(&(Clock->Lock));
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockNowNs
+ * CALLED BY:        Threads taking part
+ * DESCRIPTION:      Trace time since the start of the replay
+ * INPUT PARAMETERS: Clock : clock of the replay
+ * RETURN VALUES:    unsigned long long : current time
+ ***********************************************************************/
+unsigned long long ReplayClockNowNs(ReplayClockType *Clock)
+{
+	unsigned long long Now;
+
+	if (0 != Clock->Speed)
+	{
+		return (unsigned long long)((double)(ReplayClockRealNs() - Clock->StartNs) * Clock->Speed);
+	}
+	pthread_mutex_lock(&(Clock->Lock));
+	Now = Clock->NowNs;
+	pthread_mutex_unlock(&(Clock->Lock));
+	return Now;
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockSleepNs
+ * CALLED BY:        Threads taking part, in place of usleep
+ * DESCRIPTION:      Sleeps for a trace time. On the virtual clock the
+ *                   other threads run meanwhile, one at a time, and the
+ *                   call returns once the time has come and the threads
+ *                   due before have gone back to sleep.
+ * INPUT PARAMETERS: Clock : clock of the replay
+ *                   Thread : id of the caller
+ *                   Ns : trace time to sleep
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void ReplayClockSleepNs(ReplayClockType *Clock, unsigned int Thread, unsigned long long Ns)
+{
+	struct timespec Sleep;
+	unsigned long long RealNs;
+
+	if (0 != Clock->Speed)
+	{
+		RealNs = (unsigned long long)((double)Ns / Clock->Speed);
+		Sleep.tv_sec = RealNs / 1000000000ULL;
+		Sleep.tv_nsec = RealNs % 1000000000ULL;
+		nanosleep(&Sleep,NULL);
+		return;
+	}
+	pthread_mutex_lock(&(Clock->Lock));
+	Clock->DueNs[Thread] = Clock->NowNs + Ns;
+	ReplayClockNext(Clock);
+	while (Clock->Running != Thread)
+	{
+		pthread_cond_wait(&(Clock->Turn),&(Clock->Lock));
+	}
+	pthread_mutex_unlock(&(Clock->Lock));
+}
+
+/* *********************************************************************
+ * NAME:             ReplayClockLeave
+ * CALLED BY:        Threads taking part, before they end or block on
+ *                   anything but the clock
+ * DESCRIPTION:      Takes the thread out of the virtual clock and hands
+ *                   it over to the next one
+ * INPUT PARAMETERS: Clock : clock of the replay
+ *                   Thread : id of the caller
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void ReplayClockLeave(ReplayClockType *Clock, unsigned int Thread)
+{
+	if (0 != Clock->Speed)
+	{
+		return;
+	}
+	pthread_mutex_lock(&(Clock->Lock));
+	Clock->DueNs[Thread] = ~0ULL;
+	if (Clock->Running == Thread)
+	{
+		ReplayClockNext(Clock);
+	}
+	pthread_mutex_unlock(&(Clock->Lock));
+}
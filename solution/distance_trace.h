@@ -0,0 +1,84 @@
+/* *********************************************************************
+ *
+ * Recorded distance traces, written by the applications and replayed
+ * into them
+ *
+ * Program Name:        DistanceTrace
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef DISTANCE_TRACE_H
+#define DISTANCE_TRACE_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+/*
+ * A trace is a text file, one measurement per line after the header line:
+ *
+ *   # distance trace v1
+ *   <timestamp ns> <echo width ns> <status>
+ *
+ * The timestamps only have to grow, replay keeps the gaps between them.
+ * Lines starting with '#' are comments.
+ */
+#define DISTANCE_TRACE_HEADER "# distance trace v1"
+
+/* Status of a measurement, the values of PULSE_SAMPLE_* */
+#define DISTANCE_TRACE_OK        0 /* Echo measured */
+#define DISTANCE_TRACE_TIMEOUT   1 /* No echo */
+
+/* One measurement of a trace */
+typedef struct DistanceTraceRecordTag
+{
+	unsigned long long TimestampNs; /* Time of the trigger */
+	unsigned int WidthNs; /* Echo width, 0 on timeout */
+	unsigned int Status; /* DISTANCE_TRACE_* */
+}DistanceTraceRecordType;
+
+/* Trace loaded in memory */
+typedef struct DistanceTraceTag
+{
+	DistanceTraceRecordType *Record; /* Measurements, oldest first */
+	unsigned int Count; /* Records in Record */
+	unsigned int Next; /* Next record to be replayed */
+}DistanceTraceType;
+
+/*
+ * Time base of a replay. Speed 1 replays in real time, 10 ten times
+ * faster. Speed 0 runs on a virtual clock as fast as the program goes:
+ * the threads taking part run one at a time, and a thread that sleeps
+ * hands over to the one due first, so every run of a trace gives the
+ * same output.
+ */
+#define REPLAY_MAX_THREADS 4
+
+typedef struct ReplayClockTag
+{
+	double Speed; /* Trace time per real time, 0 for the virtual clock */
+	unsigned long long StartNs; /* Real time the replay started */
+	unsigned long long NowNs; /* Virtual clock, trace time since the start */
+	pthread_mutex_t Lock; /* Protects the virtual clock */
+	pthread_cond_t Turn; /* Signalled when Running changes */
+	unsigned int Threads; /* Threads taking part, ids 0 to Threads - 1 */
+	unsigned int Running; /* Thread allowed to run */
+	unsigned long long DueNs[REPLAY_MAX_THREADS]; /* Wake up time of every thread, ~0 once it has left */
+}ReplayClockType;
+
+/* Recording */
+FILE *DistanceTraceCreate(const char *Path);
+int DistanceTraceWrite(FILE *Trace, const DistanceTraceRecordType *Record);
+/* Replay */
+int DistanceTraceLoad(const char *Path, DistanceTraceType *Trace);
+void DistanceTraceFree(DistanceTraceType *Trace);
+void ReplayClockInit(ReplayClockType *Clock, double Speed, unsigned int Threads);
+void ReplayClockJoin(ReplayClockType *Clock, unsigned int Thread);
+unsigned long long ReplayClockNowNs(ReplayClockType *Clock);
+void ReplayClockSleepNs(ReplayClockType *Clock, unsigned int Thread, unsigned long long Ns);
+void ReplayClockLeave(ReplayClockType *Clock, unsigned int Thread);
+
+#endif
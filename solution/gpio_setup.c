@@ -0,0 +1,260 @@
+/* *********************************************************************
+ *
+ * Table driven sysfs gpio setup of the user applications
+ *
+ * Program Name:        GpioSetup
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "gpio_setup.h"
+
+/*
+ * Length of a sysfs gpio path
+ */
+#define GPIO_PATH_LENGTH 64
+/*
+ * udev changes the owner of the files of a newly exported pin after the
+ * export returns, an open failing meanwhile is retried this many times
+ */
+#define GPIO_OPEN_RETRIES 50
+#define GPIO_OPEN_RETRY_US 2000
+
+/* *********************************************************************
+ * NAME:             GpioNowUs
+ * CALLED BY:        GpioSetup
+ * DESCRIPTION:      Monotonic time in micro seconds
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned long long : current time
+ ***********************************************************************/
+static unsigned long long GpioNowUs(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return ((unsigned long long)Now.tv_sec * 1000000ULL) + (Now.tv_nsec / 1000);
+}
+
+/* *********************************************************************
+ * NAME:             GpioOpen
+ * CALLED BY:        GpioSetup
+ * DESCRIPTION:      Opens a file of an exported pin, retrying while the
+ *                   file is missing or not accessible yet
+ * INPUT PARAMETERS: Table : table being set up, counts the retries
+ *                   Gpio : pin number
+ *                   File : "direction", "value" or "edge"
+ *                   Flags : open flags
+ * RETURN VALUES:    int : file descriptor, -1 on failure
+ ***********************************************************************/
+static int GpioOpen(GpioTableType *Table, unsigned int Gpio, const char *File, int Flags)
+{
+	char Path[GPIO_PATH_LENGTH];
+	unsigned int Attempt;
+	int Fd = -1;
+
+	snprintf(Path,sizeof(Path),"/sys/class/gpio/gpio%u/%s",Gpio,File);
+	for (Attempt = 0; Attempt <= GPIO_OPEN_RETRIES; Attempt++)
+	{
+		Fd = open(Path,Flags);
+		if ((Fd >= 0) || ((ENOENT != errno) && (EACCES != errno)))
+		{
+			break;
+		}
+		Table->Retries++;
+		usleep(GPIO_OPEN_RETRY_US);
+	}
+	if (Fd < 0)
+	{
+		printf("\n %s open failed",Path);
+	}
+	return Fd;
+}
+
+/* *********************************************************************
+ * NAME:             GpioWriteString
+ * CALLED BY:        GpioSetup, GpioPinWrite, GpioPinEdge
+ * DESCRIPTION:      Writes a whole string to an open sysfs file
+ * INPUT PARAMETERS: Fd : file
+ *                   Value : string
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+static int GpioWriteString(int Fd, const char *Value)
+{
+	size_t Length = strlen(Value);
+
+	return (write(Fd,Value,Length) == (ssize_t)Length) ? (0) : (-1);
+}
+
+/* *********************************************************************
+ * NAME:             GpioSetup
+ * CALLED BY:        Applications, once at start
+ * DESCRIPTION:      Exports every pin of the table through a single
+ *                   export file, sets the directions and keeps the value
+ *                   and edge files open. An output gets its direction
+ *                   and level in one write ("low"/"high") so it never
+ *                   glitches. A pin exported already is taken as it is.
+ *                   On failure the pins set up so far are given back.
+ * INPUT PARAMETERS: Table : pins to set up
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int GpioSetup(GpioTableType *Table)
+{
+	char Number[12];
+	unsigned long long Start = GpioNowUs();
+	unsigned int LoopIndex;
+	GpioPinType *Pin;
+	int FdExport, FdDirection, Result;
+
+	Table->Retries = 0;
+	FdExport = open("/sys/class/gpio/export",O_WRONLY);
+	if (FdExport < 0)
+	{
+		printf("\n gpio export open failed");
+		return -1;
+	}
+	for (LoopIndex = 0; LoopIndex < Table->Count; LoopIndex++)
+	{
+		Pin = &(Table->Pin[LoopIndex]);
+		snprintf(Number,sizeof(Number),"%u",Pin->Gpio);
+		if (0 == GpioWriteString(FdExport,Number))
+		{
+			Pin->Exported = 1;
+		}
+		else if (EBUSY != errno)
+		{
+			printf("\n gpio%u export failed",Pin->Gpio);
+			close(FdExport);
+			GpioTeardown(Table);
+			return -1;
+		}
+	}
+	close(FdExport);
+
+	for (LoopIndex = 0; LoopIndex < Table->Count; LoopIndex++)
+	{
+		Pin = &(Table->Pin[LoopIndex]);
+		FdDirection = GpioOpen(Table,Pin->Gpio,"direction",O_WRONLY);
+		if (FdDirection < 0)
+		{
+			GpioTeardown(Table);
+			return -1;
+		}
+		if (GPIO_DIR_OUT == Pin->Direction)
+		{
+			Result = GpioWriteString(FdDirection,(Pin->InitialValue) ? "high" : "low");
+		}
+		else
+		{
+			Result = GpioWriteString(FdDirection,"in");
+		}
+		close(FdDirection);
+		if (Result < 0)
+		{
+			printf("\n gpio%u direction failed",Pin->Gpio);
+			GpioTeardown(Table);
+			return -1;
+		}
+		Pin->ValueFd = GpioOpen(Table,Pin->Gpio,"value",
+		                        (GPIO_DIR_OUT == Pin->Direction) ? O_WRONLY : (O_RDONLY | O_NONBLOCK));
+		if ((GPIO_DIR_IN == Pin->Direction) && (NULL != Pin->Edge))
+		{
+			Pin->EdgeFd = GpioOpen(Table,Pin->Gpio,"edge",O_WRONLY);
+			if ((Pin->EdgeFd < 0) || (GpioPinEdge(Pin,Pin->Edge) < 0))
+			{
+				GpioTeardown(Table);
+				return -1;
+			}
+		}
+		if (Pin->ValueFd < 0)
+		{
+			GpioTeardown(Table);
+			return -1;
+		}
+	}
+	Table->SetupUs = (unsigned long)(GpioNowUs() - Start);
+	printf("\n %s: %u gpios set up in %lu us, %u retries",Table->Name,Table->Count,Table->SetupUs,Table->Retries);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             GpioTeardown
+ * CALLED BY:        Applications at exit, GpioSetup on failure
+ * DESCRIPTION:      Closes the files of the table and unexports the
+ *                   pins GpioSetup exported
+ * INPUT PARAMETERS: Table : pins to give back
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void GpioTeardown(GpioTableType *Table)
+{
+	char Number[12];
+	unsigned int LoopIndex;
+	GpioPinType *Pin;
+	int FdUnexport;
+
+	FdUnexport = open("/sys/class/gpio/unexport",O_WRONLY);
+	if (FdUnexport < 0)
+	{
+		printf("\n gpio unexport open failed");
+	}
+	for (LoopIndex = 0; LoopIndex < Table->Count; LoopIndex++)
+	{
+		Pin = &(Table->Pin[LoopIndex]);
+		if (Pin->ValueFd >= 0)
+		{
+			close(Pin->ValueFd);
+			Pin->ValueFd = -1;
+		}
+		if (Pin->EdgeFd >= 0)
+		{
+			close(Pin->EdgeFd);
+			Pin->EdgeFd = -1;
+		}
+		if ((Pin->Exported) && (FdUnexport >= 0))
+		{
+			snprintf(Number,sizeof(Number),"%u",Pin->Gpio);
+			GpioWriteString(FdUnexport,Number);
+		}
+		Pin->Exported = 0;
+	}
+	if (FdUnexport >= 0)
+	{
+		close(FdUnexport);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             GpioPinWrite
+ * CALLED BY:        Applications
+ * DESCRIPTION:      Drives an output through its open value file
+ * INPUT PARAMETERS: Pin : output pin
+ *                   Value : 0 or 1
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int GpioPinWrite(const GpioPinType *Pin, int Value)
+{
+	return GpioWriteString(Pin->ValueFd,(Value) ? "1" : "0");
+}
+
+/* *********************************************************************
+ * NAME:             GpioPinEdge
+ * CALLED BY:        Applications, GpioSetup
+ * DESCRIPTION:      Changes the edge reported by poll() on the value
+ *                   file of an input
+ * INPUT PARAMETERS: Pin : input pin set up with an Edge
+ *                   Edge : "none", "rising", "falling" or "both"
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int GpioPinEdge(const GpioPinType *Pin, const char *Edge)
+{
+	return GpioWriteString(Pin->EdgeFd,Edge);
+}
@@ -0,0 +1,62 @@
+/* *********************************************************************
+ *
+ * Table driven sysfs gpio setup of the user applications
+ *
+ * Program Name:        GpioSetup
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef GPIO_SETUP_H
+#define GPIO_SETUP_H
+
+/* Direction of a pin */
+typedef enum GpioDirection_Tag {
+	GPIO_DIR_IN,
+	GPIO_DIR_OUT
+}GpioDirection_Type;
+
+/*
+ * One pin of a table. Gpio, Direction, InitialValue and Edge are given by
+ * the application, the files are opened by GpioSetup and stay open until
+ * GpioTeardown.
+ */
+typedef struct GpioPinTag
+{
+	unsigned int Gpio; /* sysfs gpio number */
+	GpioDirection_Type Direction; /* Direction set at setup */
+	int InitialValue; /* Level of an output, set together with the direction */
+	const char *Edge; /* Edge of an input, NULL if the edge file is not used */
+	int ValueFd; /* value file, -1 while not open */
+	int EdgeFd; /* edge file of an input with an Edge, -1 otherwise */
+	int Exported; /* Exported by GpioSetup, unexported by GpioTeardown */
+}GpioPinType;
+
+/* Pin table and the cost of its setup */
+typedef struct GpioTableTag
+{
+	const char *Name; /* Printed with the setup time */
+	GpioPinType *Pin; /* Pins */
+	unsigned int Count; /* Number of pins */
+	unsigned long SetupUs; /* Time GpioSetup took */
+	unsigned int Retries; /* Opens repeated while udev was still setting a pin up */
+}GpioTableType;
+
+/* Initialiser of a table from an array of pins */
+#define GPIO_TABLE(TableName, PinArray) \
+	{ .Name = (TableName), .Pin = (PinArray), .Count = sizeof(PinArray) / sizeof((PinArray)[0]) }
+
+/* Initialiser of a pin */
+#define GPIO_PIN(PinGpio, PinDirection, PinValue, PinEdge) \
+	{ .Gpio = (PinGpio), .Direction = (PinDirection), .InitialValue = (PinValue), .Edge = (PinEdge), \
+	  .ValueFd = -1, .EdgeFd = -1, .Exported = 0 }
+
+int GpioSetup(GpioTableType *Table);
+void GpioTeardown(GpioTableType *Table);
+int GpioPinWrite(const GpioPinType *Pin, int Value);
+int GpioPinEdge(const GpioPinType *Pin, const char *Edge);
+
+#endif
@@ -0,0 +1,168 @@
+/* *********************************************************************
+ *
+ * Log linear latency histogram of the benchmarks
+ *
+ * Program Name:        LatencyHist
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <string.h>
+#include "latency_hist.h"
+
+/* *********************************************************************
+ * NAME:             LatencyHistIndex
+ * CALLED BY:        LatencyHistRecord
+ * DESCRIPTION:      Bucket of a value: the value itself below
+ *                   2 * LATENCY_HIST_SUB_BUCKETS, above that the power of
+ *                   two and the LATENCY_HIST_SUB_BITS bits below the top one
+ * INPUT PARAMETERS: ValueNs : value to be counted
+ * RETURN VALUES:    unsigned int : bucket index
+ ***********************************************************************/
+static unsigned int LatencyHistIndex(unsigned long long ValueNs)
+{
+	unsigned int Shift;
+
+	if (ValueNs >= (1ULL << LATENCY_HIST_MAX_BITS))
+	{
+		ValueNs = (1ULL << LATENCY_HIST_MAX_BITS) - 1;
+	}
+	if (ValueNs < (2 * LATENCY_HIST_SUB_BUCKETS))
+	{
+		return (unsigned int)ValueNs;
+	}
+	Shift = (unsigned int)(63 - __builtin_clzll(ValueNs)) - LATENCY_HIST_SUB_BITS;
+	return (Shift * LATENCY_HIST_SUB_BUCKETS) + (unsigned int)(ValueNs >> Shift);
+}
+
+/* *********************************************************************
+ * NAME:             LatencyHistUpper
+ * CALLED BY:        LatencyHistPercentile, LatencyHistJson
+ * DESCRIPTION:      Largest value counted in a bucket
+ * INPUT PARAMETERS: Index : bucket index
+ * RETURN VALUES:    unsigned long long : upper end of the bucket
+ ***********************************************************************/
+static unsigned long long LatencyHistUpper(unsigned int Index)
+{
+	unsigned int Shift;
+
+	if (Index < (2 * LATENCY_HIST_SUB_BUCKETS))
+	{
+		return Index;
+	}
+	Shift = (Index / LATENCY_HIST_SUB_BUCKETS) - 1;
+	return ((unsigned long long)(Index - (Shift * LATENCY_HIST_SUB_BUCKETS) + 1) << Shift) - 1;
+}
+
+/* *********************************************************************
+ * NAME:             LatencyHistInit
+ * CALLED BY:        Benchmarks, before the first value
+ * DESCRIPTION:      Empties the histogram
+ * INPUT PARAMETERS: Hist : histogram
+ *                   Name : name in the report
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void LatencyHistInit(LatencyHistType *Hist, const char *Name)
+{
+	memset(Hist,0,sizeof(LatencyHistType));
+	Hist->Name = Name;
+	Hist->Min = ~0ULL;
+}
+
+/* *********************************************************************
+ * NAME:             LatencyHistRecord
+ * CALLED BY:        Benchmarks, for every measured latency
+ * DESCRIPTION:      Counts one value
+ * INPUT PARAMETERS: Hist : histogram
+ *                   ValueNs : latency in nano seconds
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void LatencyHistRecord(LatencyHistType *Hist, unsigned long long ValueNs)
+{
+	Hist->Bucket[LatencyHistIndex(ValueNs)]++;
+	Hist->Count++;
+	Hist->Sum += ValueNs;
+	if (ValueNs < Hist->Min)
+	{
+		Hist->Min = ValueNs;
+	}
+	if (ValueNs > Hist->Max)
+	{
+		Hist->Max = ValueNs;
+	}
+}
+
+/* *********************************************************************
+ * NAME:             LatencyHistPercentile
+ * CALLED BY:        Benchmarks, LatencyHistJson
+ * DESCRIPTION:      Walks the buckets up to the one holding the value of
+ *                   rank Percent
+ * INPUT PARAMETERS: Hist : histogram
+ *                   Percent : 0 to 100
+ * RETURN VALUES:    unsigned long long : upper end of that bucket, at most
+ *                   the largest value, 0 for an empty histogram
+ ***********************************************************************/
+unsigned long long LatencyHistPercentile(const LatencyHistType *Hist, double Percent)
+{
+	unsigned long long Rank, Seen = 0, Upper;
+	unsigned int Index;
+
+	if (0 == Hist->Count)
+	{
+		return 0;
+	}
+	/* Rank of the value, 1 for the smallest */
+	Rank = (unsigned long long)((Percent * Hist->Count) / 100.0 + 0.999999);
+	if (0 == Rank)
+	{
+		Rank = 1;
+	}
+	for (Index = 0; Index < LATENCY_HIST_BUCKETS; Index++)
+	{
+		Seen += Hist->Bucket[Index];
+		if (Seen >= Rank)
+		{
+			break;
+		}
+	}
+	Upper = LatencyHistUpper(Index);
+	if (Upper > Hist->Max)
+	{
+		Upper = Hist->Max;
+	}
+	return (Upper < Hist->Min) ? Hist->Min : Upper;
+}
+
+/* *********************************************************************
+ * NAME:             LatencyHistJson
+ * CALLED BY:        Benchmarks, for the report
+ * DESCRIPTION:      Writes the histogram as a JSON object on one line
+ * INPUT PARAMETERS: Hist : histogram
+ *                   Out : report file
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void LatencyHistJson(const LatencyHistType *Hist, FILE *Out)
+{
+	unsigned int Index;
+	int First = 1;
+
+	fprintf(Out,"{\"name\": \"%s\", \"unit\": \"ns\", \"count\": %llu, \"min\": %llu, \"mean\": %llu, "
+	        "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu, \"buckets\": [",
+	        Hist->Name,Hist->Count,(Hist->Count) ? Hist->Min : 0,(Hist->Count) ? Hist->Sum / Hist->Count : 0,
+	        LatencyHistPercentile(Hist,50.0),LatencyHistPercentile(Hist,90.0),
+	        LatencyHistPercentile(Hist,99.0),LatencyHistPercentile(Hist,99.9),Hist->Max);
+	for (Index = 0; Index < LATENCY_HIST_BUCKETS; Index++)
+	{
+		if (Hist->Bucket[Index])
+		{
+			fprintf(Out,"%s[%llu, %llu]",(First) ? "" : ", ",LatencyHistUpper(Index),Hist->Bucket[Index]);
+			First = 0;
+		}
+	}
+	fprintf(Out,"]}");
+}
@@ -0,0 +1,59 @@
+/* *********************************************************************
+ *
+ * Log linear latency histogram of the benchmarks
+ *
+ * Program Name:        LatencyHist
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdio.h>
+
+/*
+ * Values below 2 * LATENCY_HIST_SUB_BUCKETS have a bucket each, above that
+ * every power of two is split in LATENCY_HIST_SUB_BUCKETS buckets, so a
+ * value is known to 1/64 (1.6%) whatever its size, as an HDR histogram of
+ * two significant digits would. Values up to 2^40 ns (18 minutes) are
+ * counted, larger ones go to the last bucket.
+ */
+#define LATENCY_HIST_SUB_BITS   6
+#define LATENCY_HIST_SUB_BUCKETS   (1u << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS   40
+#define LATENCY_HIST_BUCKETS   ((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB_BUCKETS)
+
+/* Histogram of one measured latency, in nano seconds */
+typedef struct LatencyHistTag
+{
+	const char *Name; /* Name of the histogram in the report */
+	unsigned long long Count; /* Values recorded */
+	unsigned long long Min; /* Smallest value */
+	unsigned long long Max; /* Largest value */
+	unsigned long long Sum; /* For the mean */
+	unsigned long long Bucket[LATENCY_HIST_BUCKETS]; /* Values of each bucket */
+}LatencyHistType;
+
+/* Empties Hist, Name is kept and not copied */
+void LatencyHistInit(LatencyHistType *Hist, const char *Name);
+
+/* Counts one value */
+void LatencyHistRecord(LatencyHistType *Hist, unsigned long long ValueNs);
+
+/*
+ * Value below which Percent (0 to 100) of the recorded values are, given
+ * as the upper end of its bucket and never above Max. 0 if Hist is empty.
+ */
+unsigned long long LatencyHistPercentile(const LatencyHistType *Hist, double Percent);
+
+/*
+ * Writes Hist as a JSON object: name, unit, count, min, mean, p50, p90,
+ * p99, p999, max and the non empty buckets as [upper end, count] pairs
+ */
+void LatencyHistJson(const LatencyHistType *Hist, FILE *Out);
+
+#endif
@@ -20,8 +20,17 @@
 #include <poll.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <linux/types.h>
-#include <linux/spi/spidev.h>
+#ifndef NO_GPIO_CDEV
+#include <linux/gpio.h>
+#endif
+#include "atomic_channel.h"
+#include "gpio_setup.h"
+#include "spi_display.h"
+#include "distance_trace.h"
+#include "anim.h"
+#include "animations.h"
 
 //#define DEBUG
 
@@ -30,8 +39,11 @@
  */
 #define PROGRAM_RUN_TIME 30000000
 
+/*
+ * Speed of sound in mm/s, 343 m/s in air at 20 degree Celsius
+ */
+#define SPEED_OF_SOUND_MM_PER_SEC 343000ULL
 
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 /*
  * Minimum distance for which the dog starts running
  */
@@ -39,15 +51,11 @@
 /*
  * Global time out flag
  */
-unsigned char TimeoutFlag = 0;
-/*
- * Gloabl distance
- */
-unsigned int GlobalDistance = 300;
+StopFlagType TimeoutFlag;
 /*
- * Mutex to protect the global variable distance
+ * Gloabl distance, published by the measurement thread
  */
-pthread_mutex_t DistanceMutex = PTHREAD_MUTEX_INITIALIZER;
+DistanceChannelType DistanceChannel;
 /*
  * Enum to check whether the Dog should move to the right or left
  */
@@ -56,138 +64,523 @@ typedef enum DogDirection_Tag {
 	LEFT
 }DogDirection_Type;
 /*
- * Assembly level read Time stamp counter
+ * Sensor pins, sysfs numbers of IO2 and IO3 of the Galileo
+ */
+#define TRIGGER_GPIO 14
+#define ECHO_GPIO 15
+/*
+ * Longest wait for an echo edge
+ */
+#define ECHO_TIMEOUT_MS 1000
+/*
+ * gpio chip and line offsets of the sensor pins used by the character
+ * device backend, they can be changed on the command line
  */
-static __inline__ unsigned long long rdtsc(void)
+#define GPIO_CDEV_CHIP "/dev/gpiochip0"
+/*
+ * Threads on the clock of a replay
+ */
+#define REPLAY_THREAD_MAIN 0
+#define REPLAY_THREAD_MEASUREMENT 1
+#define REPLAY_THREAD_DISPLAY 2
+#define REPLAY_THREADS 3
+/*
+ * Run time of a replay after the last record of the trace, in trace time
+ */
+#define REPLAY_TAIL_US 2000000
+
+/*
+ * Record and replay, set up from the command line. Clock is NULL unless a
+ * trace is replayed, the threads then sleep and take the time through it.
+ */
+static FILE *TraceRecord = NULL; /* Measurements are recorded here, record=<file> */
+static FILE *FrameLog = NULL; /* Frames are written here instead of the display, frames=<file> */
+static double ReplaySpeed = 1; /* speed=<factor>, 0 for the virtual clock */
+static DistanceTraceType ReplayTrace; /* Trace of the replay backend */
+static ReplayClockType ReplayClock;
+static ReplayClockType *Clock = NULL;
+
+/* *********************************************************************
+ * NAME:             AppNowNs
+ * CALLED BY:        Measurement and display threads
+ * DESCRIPTION:      Time of the sensor and the display, the trace time
+ *                   of a replay
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned long long : current time
+ ***********************************************************************/
+unsigned long long AppNowNs(void)
 {
-    unsigned long long int x;
-    __asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
-    return x;
+	return (Clock) ? ReplayClockNowNs(Clock) : ChannelNowNs();
 }
+
 /* *********************************************************************
- * NAME:             DistanceMeasurementTask
- * CALLED BY:        Thread created by the main thread
- * DESCRIPTION:      Continously reads the distance from the sensor and 
- *                   updates the global vvariable
- * INPUT PARAMETERS: TimeoutFlagLocal : Pointer to the timeout flag
+ * NAME:             AppSleepUs
+ * CALLED BY:        Measurement and display threads, main
+ * DESCRIPTION:      usleep, on the clock of a replay if there is one
+ * INPUT PARAMETERS: Thread : REPLAY_THREAD_* of the caller
+ *                   Us : time to sleep
  * RETURN VALUES:    None
  ***********************************************************************/
-void* DistanceMeasurementTask(void *TimeoutFlagLocal)
+void AppSleepUs(unsigned int Thread, unsigned long long Us)
 {
-	int FdTrig,FdEch,FdEchV,res;
-	struct pollfd PollEch = {0};
-	unsigned long long StartTime, StopTime;
-	unsigned char ReadValue[2];
-	/* First change the direction of the Echo to 'in' */
-	FdEch = open("/sys/class/gpio/gpio15/direction", O_WRONLY);
-	if (FdEch < 0)
-	{
-		printf("\n gpio15 direction open failed");
-	}
-	write(FdEch,"in",2);
-	close(FdEch);
-
-	/* Open the edge and value files */
-	FdEch = open("/sys/class/gpio/gpio15/edge", O_WRONLY);
-	if (FdEch < 0)
+	if (Clock)
 	{
-		printf("\n gpio15 edge open failed");
+		ReplayClockSleepNs(Clock,Thread,Us * 1000ULL);
 	}
-	FdEchV = open("/sys/class/gpio/gpio15/value", O_RDONLY|O_NONBLOCK);
-	if (FdEchV < 0)
+	else
 	{
-		printf("\n gpio15 value open failed");
+		usleep((useconds_t)Us);
 	}
+}
+
+/*
+ * Trigger and echo access. The sysfs backend times the echo edges when
+ * poll() returns, the character device backend takes the timestamps the
+ * kernel puts in the line events when the edge interrupts come in.
+ */
+typedef struct EchoIoTag
+{
+	const char *Name; /* Printed at start */
+	int (*Setup)(void); /* Claims the trigger and echo pins */
+	int (*Measure)(unsigned long long *WidthNs); /* Triggers once and measures the echo, -1 without echo */
+	void (*Cleanup)(void); /* Gives the pins back */
+}EchoIoType;
+
+/*
+ * Pins of the sysfs backend. According to the HC-SR04 user guide, Init
+ * should set the Trigger to 0. The echo edge is switched between rising
+ * and falling for every measurement.
+ */
+static GpioPinType SysfsEchoPins[] = {
+	GPIO_PIN(TRIGGER_GPIO, GPIO_DIR_OUT, 0, NULL),
+	GPIO_PIN(ECHO_GPIO, GPIO_DIR_IN, 0, "rising"),
+};
+static GpioTableType SysfsEchoTable = GPIO_TABLE("sensor", SysfsEchoPins);
+#define SYSFS_TRIGGER (&SysfsEchoPins[0])
+#define SYSFS_ECHO (&SysfsEchoPins[1])
+
+/* *********************************************************************
+ * NAME:             SysfsEchoSetup
+ * CALLED BY:        main through SysfsEchoIo
+ * DESCRIPTION:      Exports the trigger as output at 0 and the echo as
+ *                   input, and keeps the files used for a measurement
+ *                   open
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int SysfsEchoSetup(void)
+{
+	unsigned char ReadValue[2];
 
-    /* Open the value file of gpio14 */
-	FdTrig = open("/sys/class/gpio/gpio14/value", O_WRONLY);
-	if (FdTrig < 0)
+	if (GpioSetup(&SysfsEchoTable) < 0)
 	{
-		printf("\n FdTrig : gpio14 vale open failed");
+		return -1;
 	}
+	pread(SYSFS_ECHO->ValueFd,&ReadValue,sizeof(ReadValue),0);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             SysfsEchoMeasure
+ * CALLED BY:        DistanceMeasurementTask through SysfsEchoIo
+ * DESCRIPTION:      Sends a trigger and times the echo edges when poll
+ *                   returns, the edge file is switched between the two
+ * INPUT PARAMETERS: WidthNs : set to the echo width
+ * RETURN VALUES:    int : status - Fail(-1, no echo)/Pass(0)
+ ***********************************************************************/
+int SysfsEchoMeasure(unsigned long long *WidthNs)
+{
+	struct pollfd PollEch = {0};
+	unsigned long long StartTime, StopTime;
+	unsigned char ReadValue[2];
+#ifdef DEBUG
+	int res;
+#endif
+
     /* Prepare poll fd structure */
-    PollEch.fd = FdEchV;
+    PollEch.fd = SYSFS_ECHO->ValueFd;
     PollEch.events = POLLPRI|POLLERR;
-    lseek(FdEchV, 0, SEEK_SET);
-	res = pread(FdEchV,&ReadValue,sizeof(ReadValue),0);
+	/* Change the edge trigger to rising edge */
+	GpioPinEdge(SYSFS_ECHO,"rising");
+	lseek(SYSFS_ECHO->ValueFd, 0, SEEK_SET);
+    /* Send the ON signal to Trigger port */
+	GpioPinWrite(SYSFS_TRIGGER,1);
+	/* Trigger pulse width atleast 10us */
+	usleep(12);
+	GpioPinWrite(SYSFS_TRIGGER,0);
+	/* Start polling for the rising edge now */
+	poll(&PollEch,1,ECHO_TIMEOUT_MS);
+	if (!(PollEch.revents & POLLPRI))
+	{
+		printf("\nError detecting rising edge");
+		return -1;
+	}
+	/* Start the timer */
+	StartTime = ChannelNowNs();
 #ifdef DEBUG
-	printf("\n Res = %i",res);
-    printf("\nRead out");
+	do
+	{
+
+		printf("\n Clearing the read1");
+		res = pread(SYSFS_ECHO->ValueFd,&ReadValue,sizeof(ReadValue),0);
+		printf("\n Res rising = %i",res);
+
+	}while(0 < res);
+#else
+	/* Only clears the edge, the value read is not needed */
+	(void)pread(SYSFS_ECHO->ValueFd,&ReadValue,sizeof(ReadValue),0);
 #endif
+    /* Now detect the falling edge */
+	GpioPinEdge(SYSFS_ECHO,"falling");
+    lseek(SYSFS_ECHO->ValueFd, 0, SEEK_SET);
+	/* Start polling for the falling edge now */
+	poll(&PollEch,1,ECHO_TIMEOUT_MS);
+	/* Stop the timer */
+	StopTime = ChannelNowNs();
+	/* clear the read buffer */
+#ifdef DEBUG
     do
     {
-		/* Change the edge trigger to rising edge */
-		write(FdEch,"rising",6);
-		lseek(FdEchV, 0, SEEK_SET);
-	    /* Send the ON signal to Trigger port */
-		write(FdTrig,"1",1);
-		/* Trigger pulse width atleast 10us */
-		usleep(12);
-		write(FdTrig,"0",1);
-		/* Start polling for the rising edge now */
-		poll(&PollEch,1,1000);
-        
-		if (PollEch.revents & POLLPRI)
-		{
-			/* Start the timer */
-			StartTime = rdtsc();
-#ifdef DEBUG
-			do
-			{
 
-				printf("\n Clearing the read1");
-#endif
-				res = pread(FdEchV,&ReadValue,sizeof(ReadValue),0);
-#ifdef DEBUG
-				printf("\n Res rising = %i",res);
+		printf("\n Clearing the read2");
+		res = pread(SYSFS_ECHO->ValueFd,&ReadValue,sizeof(ReadValue),0);
+		printf("\n Res = %i",res);
 
-			}while(0 < res);
+	}while(0 < res);
+#else
+	(void)pread(SYSFS_ECHO->ValueFd,&ReadValue,sizeof(ReadValue),0);
 #endif
-            /* Now detect the falling edge */
-			write(FdEch,"falling",7);
-		    lseek(FdEchV, 0, SEEK_SET);
-			/* Start polling for the falling edge now */
-			poll(&PollEch,1,1000);
-			/* Stop the timer */
-			StopTime = rdtsc();
-			/* clear the read buffer */
-#ifdef DEBUG
-            do
-            {
+    if (!(PollEch.revents & POLLPRI))
+    {
+	    printf("\nError detecting falling edge");
+		return -1;
+	}
+	*WidthNs = StopTime - StartTime;
+	return 0;
+}
 
-				printf("\n Clearing the read2");
-#endif
-				res = pread(FdEchV,&ReadValue,sizeof(ReadValue),0);
-#ifdef DEBUG
-				printf("\n Res = %i",res);
+/* *********************************************************************
+ * NAME:             SysfsEchoCleanup
+ * CALLED BY:        main through SysfsEchoIo
+ * DESCRIPTION:      Closes the files and unexports the sensor pins
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void SysfsEchoCleanup(void)
+{
+	GpioTeardown(&SysfsEchoTable);
+}
+
+#ifndef NO_GPIO_CDEV
+/* Lines of the character device backend */
+static const char *CdevChip = GPIO_CDEV_CHIP;
+static unsigned int CdevTriggerLine = TRIGGER_GPIO, CdevEchoLine = ECHO_GPIO;
+static int CdevTriggerFd = -1, CdevEventFd = -1;
 
-			}while(0 < res);
+/* *********************************************************************
+ * NAME:             CdevEchoSetup
+ * CALLED BY:        main through CdevEchoIo
+ * DESCRIPTION:      Requests the trigger as output at 0 and events on
+ *                   both edges of the echo from the gpio chip
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int CdevEchoSetup(void)
+{
+	struct gpiohandle_request TriggerReq;
+	struct gpioevent_request EchoReq;
+	int FdChip;
+
+	FdChip = open(CdevChip,O_RDONLY);
+	if (FdChip < 0)
+	{
+		return -1;
+	}
+	memset(&TriggerReq,0,sizeof(TriggerReq));
+	TriggerReq.lineoffsets[0] = CdevTriggerLine;
+	TriggerReq.lines = 1;
+	TriggerReq.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    /* According to the HC-SR04 user guide, Init should set the Trigger to 0 */
+	TriggerReq.default_values[0] = 0;
+	strcpy(TriggerReq.consumer_label,"hcsr04-trigger");
+	if (ioctl(FdChip,GPIO_GET_LINEHANDLE_IOCTL,&TriggerReq) < 0)
+	{
+		perror("trigger line request failed ");
+		close(FdChip);
+		return -1;
+	}
+	memset(&EchoReq,0,sizeof(EchoReq));
+	EchoReq.lineoffset = CdevEchoLine;
+	EchoReq.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	EchoReq.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	strcpy(EchoReq.consumer_label,"hcsr04-echo");
+	if (ioctl(FdChip,GPIO_GET_LINEEVENT_IOCTL,&EchoReq) < 0)
+	{
+		perror("echo line request failed ");
+		close(TriggerReq.fd);
+		close(FdChip);
+		return -1;
+	}
+	/* The lines stay requested through their own files */
+	close(FdChip);
+	CdevTriggerFd = TriggerReq.fd;
+	CdevEventFd = EchoReq.fd;
+	/* Old events are dropped before every trigger without waiting */
+	fcntl(CdevEventFd,F_SETFL,fcntl(CdevEventFd,F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             CdevEchoWait
+ * CALLED BY:        CdevEchoMeasure
+ * DESCRIPTION:      Waits for the next edge event of the echo line
+ * INPUT PARAMETERS: Event : filled with the event
+ * RETURN VALUES:    int : status - Fail(-1, timeout)/Pass(0)
+ ***********************************************************************/
+int CdevEchoWait(struct gpioevent_data *Event)
+{
+	struct pollfd PollEch = {0};
+
+	PollEch.fd = CdevEventFd;
+	PollEch.events = POLLIN;
+	while (read(CdevEventFd,Event,sizeof(*Event)) != sizeof(*Event))
+	{
+		if (poll(&PollEch,1,ECHO_TIMEOUT_MS) <= 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             CdevEchoMeasure
+ * CALLED BY:        DistanceMeasurementTask through CdevEchoIo
+ * DESCRIPTION:      Sends a trigger and takes the echo width from the
+ *                   kernel timestamps of its rising and falling edges,
+ *                   so the time the thread takes to wake up does not
+ *                   count
+ * INPUT PARAMETERS: WidthNs : set to the echo width
+ * RETURN VALUES:    int : status - Fail(-1, no echo)/Pass(0)
+ ***********************************************************************/
+int CdevEchoMeasure(unsigned long long *WidthNs)
+{
+	struct gpiohandle_data Level;
+	struct gpioevent_data Event;
+	unsigned long long StartTime = 0;
+
+	/* Drop edges left from an echo that came after its timeout */
+	while (read(CdevEventFd,&Event,sizeof(Event)) == sizeof(Event))
+	{
+	}
+    /* Send the ON signal to Trigger port */
+	memset(&Level,0,sizeof(Level));
+	Level.values[0] = 1;
+	ioctl(CdevTriggerFd,GPIOHANDLE_SET_LINE_VALUES_IOCTL,&Level);
+	/* Trigger pulse width atleast 10us */
+	usleep(12);
+	Level.values[0] = 0;
+	ioctl(CdevTriggerFd,GPIOHANDLE_SET_LINE_VALUES_IOCTL,&Level);
+	do
+	{
+		if (CdevEchoWait(&Event) < 0)
+		{
+			printf((0 == StartTime) ? "\nError detecting rising edge" : "\nError detecting falling edge");
+			return -1;
+		}
+		if (GPIOEVENT_EVENT_RISING_EDGE == Event.id)
+		{
+			StartTime = Event.timestamp;
+		}
+	}while ((0 == StartTime) || (GPIOEVENT_EVENT_FALLING_EDGE != Event.id));
+	*WidthNs = Event.timestamp - StartTime;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             CdevEchoCleanup
+ * CALLED BY:        main through CdevEchoIo
+ * DESCRIPTION:      Releases the lines
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void CdevEchoCleanup(void)
+{
+	close(CdevTriggerFd);
+	close(CdevEventFd);
+}
+
+/* Character device backend, linux 4.8 or later */
+static const EchoIoType CdevEchoIo = {
+	.Name = "gpio character device",
+	.Setup = CdevEchoSetup,
+	.Measure = CdevEchoMeasure,
+	.Cleanup = CdevEchoCleanup,
+};
 #endif
-			/* calculate the distance */
-		    if (PollEch.revents & POLLPRI)
-		    {
-				pthread_mutex_lock(&DistanceMutex);
-				GlobalDistance = (unsigned int)((StopTime - StartTime)*(7.5/20000));
-				pthread_mutex_unlock(&DistanceMutex);
-		    }
-		    else
-		    {
-			    printf("\nError detecting falling edge");
-			}
+
+/* *********************************************************************
+ * NAME:             ReplayEchoDueNs
+ * CALLED BY:        ReplayEchoMeasure, main
+ * DESCRIPTION:      Time of a record from the start of the replay
+ * INPUT PARAMETERS: Index : record of ReplayTrace
+ * RETURN VALUES:    unsigned long long : trace time of the record
+ ***********************************************************************/
+unsigned long long ReplayEchoDueNs(unsigned int Index)
+{
+	return ReplayTrace.Record[Index].TimestampNs - ReplayTrace.Record[0].TimestampNs;
+}
+
+/* *********************************************************************
+ * NAME:             ReplayEchoMeasure
+ * CALLED BY:        DistanceMeasurementTask through ReplayEchoIo
+ * DESCRIPTION:      Gives the echo of the trace at the current time of
+ *                   the replay: records that came due while the thread
+ *                   slept are skipped, as the sensor would not have been
+ *                   triggered for them, and a record still to come is
+ *                   waited for
+ * INPUT PARAMETERS: WidthNs : set to the echo width
+ * RETURN VALUES:    int : status - Fail(-1, no echo or end of the
+ *                   trace)/Pass(0)
+ ***********************************************************************/
+int ReplayEchoMeasure(unsigned long long *WidthNs)
+{
+	const DistanceTraceRecordType *Record;
+	unsigned long long NowNs = AppNowNs();
+
+	if (ReplayTrace.Next == ReplayTrace.Count)
+	{
+		return -1;
+	}
+	while (((ReplayTrace.Next + 1) < ReplayTrace.Count) && (ReplayEchoDueNs(ReplayTrace.Next + 1) <= NowNs))
+	{
+		ReplayTrace.Next++;
+	}
+	if (ReplayEchoDueNs(ReplayTrace.Next) > NowNs)
+	{
+		AppSleepUs(REPLAY_THREAD_MEASUREMENT,(ReplayEchoDueNs(ReplayTrace.Next) - NowNs) / 1000);
+	}
+	Record = &ReplayTrace.Record[ReplayTrace.Next++];
+	if (DISTANCE_TRACE_OK != Record->Status)
+	{
+		return -1;
+	}
+	*WidthNs = Record->WidthNs;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             ReplayEchoSetup / ReplayEchoCleanup
+ * CALLED BY:        main through ReplayEchoIo
+ * DESCRIPTION:      Nothing to claim, the trace is loaded by EchoIoSelect
+ *                   and freed here
+ ***********************************************************************/
+int ReplayEchoSetup(void)
+{
+	return 0;
+}
+
+void ReplayEchoCleanup(void)
+{
+	DistanceTraceFree(&ReplayTrace);
+}
+
+/* Recorded trace, no sensor needed */
+static const EchoIoType ReplayEchoIo = {
+	.Name = "replay",
+	.Setup = ReplayEchoSetup,
+	.Measure = ReplayEchoMeasure,
+	.Cleanup = ReplayEchoCleanup,
+};
+
+/* sysfs backend, works on every kernel */
+static const EchoIoType SysfsEchoIo = {
+	.Name = "sysfs",
+	.Setup = SysfsEchoSetup,
+	.Measure = SysfsEchoMeasure,
+	.Cleanup = SysfsEchoCleanup,
+};
+
+/* Backend used by the measurement thread */
+static const EchoIoType *EchoIo = &SysfsEchoIo;
+
+/* *********************************************************************
+ * NAME:             DistanceMeasurementTask
+ * CALLED BY:        Thread created by the main thread
+ * DESCRIPTION:      Continously reads the distance from the sensor and 
+ *                   updates the global vvariable
+ * INPUT PARAMETERS: TimeoutFlagLocal : Pointer to the timeout flag
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void* DistanceMeasurementTask(void *TimeoutFlagLocal)
+{
+	unsigned long long WidthNs;
+	DistanceTraceRecordType Record;
+
+	if (Clock)
+	{
+		ReplayClockJoin(Clock,REPLAY_THREAD_MEASUREMENT);
+	}
+    do
+    {
+		Record.TimestampNs = AppNowNs();
+		/* calculate the distance */
+		if (0 == EchoIo->Measure(&WidthNs))
+		{
+			/* Sound travels to the obstacle and back */
+			DistanceChannelPublish(&DistanceChannel,
+			                       (unsigned int)((WidthNs * SPEED_OF_SOUND_MM_PER_SEC) / 2000000000ULL),
+			                       AppNowNs());
+			Record.WidthNs = (unsigned int)WidthNs;
+			Record.Status = DISTANCE_TRACE_OK;
 		}
 		else
 		{
-			printf("\nError detecting rising edge");
+			Record.WidthNs = 0;
+			Record.Status = DISTANCE_TRACE_TIMEOUT;
 		}
-		usleep(100000);
+		if (TraceRecord)
+		{
+			DistanceTraceWrite(TraceRecord,&Record);
+		}
+		AppSleepUs(REPLAY_THREAD_MEASUREMENT,100000);
     }
-	while(0 == (*((unsigned char *)TimeoutFlagLocal)));
+	while(!StopFlagIsSet((StopFlagType *)TimeoutFlagLocal));
     /*Run till the timout flag is set by the main thread */
 	printf("\n Ending Distance measurement");
-	close(FdTrig);
-	close(FdEch);
+	if (Clock)
+	{
+		ReplayClockLeave(Clock,REPLAY_THREAD_MEASUREMENT);
+	}
 	return NULL;
 }
+
+/* *********************************************************************
+ * NAME:             DisplayShow
+ * CALLED BY:        DisplayTask
+ * DESCRIPTION:      Sends a frame to the display, or writes it to the
+ *                   frame log as "<time ns> <distance mm> <time of the
+ *                   measurement ns> <eight rows>". A new measurement
+ *                   reached the display when the third column changes.
+ * INPUT PARAMETERS: Display : open display
+ *                   Rows : row patterns, top row first
+ *                   DistanceMm : distance the frame was chosen with
+ *                   MeasuredNs : time of that distance, 0 before the
+ *                                first one
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int DisplayShow(SpiDisplayType *Display, const unsigned char Rows[SPI_DISPLAY_ROWS],
+                unsigned int DistanceMm, unsigned long long MeasuredNs)
+{
+	if (NULL == FrameLog)
+	{
+		return SpiDisplayFrame(Display,Rows);
+	}
+	fprintf(FrameLog,"%llu %u %llu %02x %02x %02x %02x %02x %02x %02x %02x\n",AppNowNs(),DistanceMm,MeasuredNs,
+	        Rows[0],Rows[1],Rows[2],Rows[3],Rows[4],Rows[5],Rows[6],Rows[7]);
+	Display->Frames++;
+	return 0;
+}
 /* *********************************************************************
  * NAME:             DisplayTask
  * CALLED BY:        Thread created by the main thread
@@ -198,66 +591,28 @@ void* DistanceMeasurementTask(void *TimeoutFlagLocal)
  ***********************************************************************/
 void* DisplayTask(void *TimeoutFlagLocal)
 {
-	int FdLed;
-    unsigned char LedMessage[2] ={0},ReceivedMsg[2] = {0,0};
-    unsigned char LoopIndex = 0;
-    struct spi_ioc_transfer spi_transfer_structure = {
-		.tx_buf = (unsigned long)LedMessage,
-		.rx_buf = (unsigned long)ReceivedMsg,
-		.len = ARRAY_SIZE(LedMessage),
-		.speed_hz = 500000,
-		.cs_change = 1,
-		.bits_per_word = 8,
-	};
+	SpiDisplayType Display;
     unsigned int LocalDistancePresent = 1500,LocalDistancePast = 0;
-    unsigned char DogStillRight[8] = {0x19, 0xFB, 0xEC, 0x08, 0x08, 0x0F, 0x09, 0x10};
-    unsigned char DogRunRight[8] = {0x18, 0xFF, 0xE9, 0x08, 0x0B, 0x0E, 0x08,0x04};
-    unsigned char DogStillLeft[8] = {0x10, 0x09, 0x0F, 0x08, 0x08, 0xEC, 0xFB, 0x19};
-    unsigned char DogRunLeft[8] = {0x04, 0x08, 0x0E, 0x0B, 0x08, 0xE9, 0xFF, 0x18};
+    DistanceValueType Distance;
+    unsigned int LastSequence = ~0U; /* The initial value counts as new */
+    unsigned long long MeasuredNs = 0; /* Time of LocalDistancePresent */
+    unsigned char DogFrame[ANIM_ROWS]; /* Expanded from the AnimDog table of animations.txt */
     DogDirection_Type DogDirection = RIGHT;
-    FdLed = open("/dev/spidev1.0",O_WRONLY);
-	if (FdLed < 0)
+
+	if (Clock)
 	{
-		printf("\n LED driver open failed");
+		ReplayClockJoin(Clock,REPLAY_THREAD_DISPLAY);
 	}
-
-    /* Test display */
-    LedMessage[0] = 0x0F;
-    LedMessage[1] = 0x01;
-    ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-    usleep(10000);
-    LedMessage[0] = 0x0F;
-    LedMessage[1] = 0x00;
-    ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-    usleep(10000);
-    /* Select No decode */
-    LedMessage[0] = 0x09;
-    LedMessage[1] = 0x00;
-    ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-    usleep(10000);
-    /* intensity level medium */
-    LedMessage[0] = 0x0A;
-    LedMessage[1] = 0x00;
-    ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-    usleep(10000);
-    /* scan all the data register for displaying */
-    LedMessage[0] = 0x0B;
-    LedMessage[1] = 0x07;
-    ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-    usleep(10000);
-    /* shutdown register - select normal operation */
-    LedMessage[0] = 0x0C;
-    LedMessage[1] = 0x01;
-    ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-    usleep(10000);
-    
-    /* clear the display */
-    for(LoopIndex = 1;LoopIndex < 9;LoopIndex++)
-    {
-       LedMessage[0] = LoopIndex;
-       LedMessage[1] = 0;
-       ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-       usleep(10000);
+    /* Set the display up and clear it, a frame log needs no display */
+	Display.Fd = -1;
+	Display.Frames = 0;
+	if ((NULL == FrameLog) && (SpiDisplayOpen(&Display,"/dev/spidev1.0") < 0))
+	{
+		if (Clock)
+		{
+			ReplayClockLeave(Clock,REPLAY_THREAD_DISPLAY);
+		}
+		return NULL;
 	}
 
     do
@@ -282,186 +637,239 @@ void* DisplayTask(void *TimeoutFlagLocal)
 			/* Person is neither moving front or backward, so maintain the present direction*/
 		}
 		/* Dog still */
-		for(LoopIndex = 1;LoopIndex < 9;LoopIndex++)
-		{
-		   LedMessage[0] = LoopIndex;
-		   LedMessage[1] = (RIGHT == DogDirection) ? (DogStillRight[LoopIndex - 1]) :(DogStillLeft[LoopIndex - 1]);
-		   ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
-		}
-		usleep((DISTANCE_SKIP_ZONE + (unsigned int)(LocalDistancePresent*0.4))*1000);
+		AnimFrame(&AnimDog,(RIGHT == DogDirection) ? (ANIM_DOG_STILL_RIGHT) : (ANIM_DOG_STILL_LEFT),DogFrame);
+		DisplayShow(&Display,DogFrame,LocalDistancePresent,MeasuredNs);
+		AppSleepUs(REPLAY_THREAD_DISPLAY,(DISTANCE_SKIP_ZONE + (unsigned int)(LocalDistancePresent*0.4))*1000);
 		/* Dog Run */
-		for(LoopIndex = 1;LoopIndex < 9;LoopIndex++)
+		AnimFrame(&AnimDog,(RIGHT == DogDirection) ? (ANIM_DOG_RUN_RIGHT) : (ANIM_DOG_RUN_LEFT),DogFrame);
+		DisplayShow(&Display,DogFrame,LocalDistancePresent,MeasuredNs);
+		AppSleepUs(REPLAY_THREAD_DISPLAY,(DISTANCE_SKIP_ZONE + (unsigned int)(LocalDistancePresent*0.4))*1000);
+	    LocalDistancePast = LocalDistancePresent;
+		/* Only a new measurement moves the dog, the measurement thread is never held up */
+		DistanceChannelRead(&DistanceChannel,&Distance);
+		if ((Distance.Sequence != LastSequence) && (Distance.DistanceMm < 1500))
 		{
-		   LedMessage[0] = LoopIndex;
-		   LedMessage[1] = (RIGHT == DogDirection) ? (DogRunRight[LoopIndex - 1]) :(DogRunLeft[LoopIndex - 1]);
-		   ioctl(FdLed,SPI_IOC_MESSAGE(1), &spi_transfer_structure);
+			LocalDistancePresent = Distance.DistanceMm;
+			MeasuredNs = Distance.TimestampNs;
 		}
-		usleep((DISTANCE_SKIP_ZONE + (unsigned int)(LocalDistancePresent*0.4))*1000);
-	    LocalDistancePast = LocalDistancePresent;
-		pthread_mutex_lock(&DistanceMutex);
-		LocalDistancePresent = (GlobalDistance < 1500) ? (GlobalDistance) : (LocalDistancePresent);
-		pthread_mutex_unlock(&DistanceMutex);
+		LastSequence = Distance.Sequence;
+#ifdef DEBUG
 		printf("\n Distance in display = %d mm",LocalDistancePresent);
-    }while(0 == (*((unsigned char *)TimeoutFlagLocal)));
-    close(FdLed);
+#endif
+    }while(!StopFlagIsSet((StopFlagType *)TimeoutFlagLocal));
+	printf("\n %lu frames displayed",Display.Frames);
+    SpiDisplayClose(&Display);
+	if (Clock)
+	{
+		ReplayClockLeave(Clock,REPLAY_THREAD_DISPLAY);
+	}
     return NULL;
 }
 
+/*
+ * Galileo muxes routing IO2, IO3 and the spi bus to the header, all low
+ */
+static GpioPinType MuxPins[] = {
+	GPIO_PIN(31, GPIO_DIR_OUT, 0, NULL),
+	GPIO_PIN(30, GPIO_DIR_OUT, 0, NULL),
+	GPIO_PIN(42, GPIO_DIR_OUT, 0, NULL),
+	GPIO_PIN(43, GPIO_DIR_OUT, 0, NULL),
+	GPIO_PIN(55, GPIO_DIR_OUT, 0, NULL),
+};
+static GpioTableType MuxTable = GPIO_TABLE("mux", MuxPins);
+
 /* *********************************************************************
- * NAME:             main
- * CALLED BY:        user call this app on the terminal
- * DESCRIPTION:      User test application to test distance measurement
- *                   sensor and 8x8 matrix display
- * INPUT PARAMETERS: None
- * RETURN VALUES:    int : status - Fail/Pass(0) 
+ * NAME:             EchoIoSelect
+ * CALLED BY:        main
+ * DESCRIPTION:      Sets up the backend asked for on the command line,
+ *                   "sysfs", "cdev [chip [trigger line [echo line]]]" or
+ *                   "replay <trace>". The character device is tried by
+ *                   default and sysfs is used when it cannot be set up.
+ * INPUT PARAMETERS: Count, Args : command line from the backend name on
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
  ***********************************************************************/
-int main()
+int EchoIoSelect(int Count, char *Args[])
 {
-	int FdE,Fd31,Fd30,Fd14,Fd15,Fd42,Fd43,Fd55;
-
-    pthread_t DistanceMeasurementThreadId, DisplayTaskId;
-
-	/* Enable mux gpio31 to activate gpio14(IO2)*/
-	FdE = open("/sys/class/gpio/export", O_WRONLY);
-	if (FdE < 0)
-	{
-		printf("\n gpio export open failed");
-	}
-	write(FdE,"31",2);
-	write(FdE,"30",2);
-	write(FdE,"14",2);
-    write(FdE,"15",2);
-    write(FdE,"42",2);
-    write(FdE,"43",2);
-    write(FdE,"55",2);
-
-    close(FdE);
-
-    /* Initialize all GPIOs */
-	Fd31 = open("/sys/class/gpio/gpio31/direction", O_WRONLY);
-	if (Fd31 < 0)
-	{
-		printf("\n gpio31 direction open failed");
-	}
-	Fd30 = open("/sys/class/gpio/gpio30/direction", O_WRONLY);
-	if (Fd30 < 0)
-	{
-		printf("\n gpio30 direction open failed");
-	}
-	Fd14 = open("/sys/class/gpio/gpio14/direction", O_WRONLY);
-	if (Fd14 < 0)
-	{
-		printf("\n gpio14 direction open failed");
-	}
-	Fd15 = open("/sys/class/gpio/gpio15/direction", O_WRONLY);
-	if (Fd15 < 0)
-	{
-		printf("\n gpio15 direction open failed");
-	}
-	Fd42 = open("/sys/class/gpio/gpio42/direction", O_WRONLY);
-	if (Fd42 < 0)
+	if ((Count > 0) && (0 == strcmp(Args[0],"replay")))
 	{
-		printf("\n gpio42 direction open failed");
+		if ((Count < 2) || (DistanceTraceLoad(Args[1],&ReplayTrace) < 0))
+		{
+			printf("\n replay needs a distance trace");
+			return -1;
+		}
+		EchoIo = &ReplayEchoIo;
+		printf("\n Replaying %u records of %s",ReplayTrace.Count,Args[1]);
+		return EchoIo->Setup();
 	}
-	Fd43 = open("/sys/class/gpio/gpio43/direction", O_WRONLY);
-	if (Fd43 < 0)
+	if ((Count < 1) || (0 != strcmp(Args[0],"sysfs")))
 	{
-		printf("\n gpio43 direction open failed");
+#ifndef NO_GPIO_CDEV
+		if (Count > 1)
+		{
+			CdevChip = Args[1];
+		}
+		if (Count > 2)
+		{
+			CdevTriggerLine = (unsigned int)atoi(Args[2]);
+		}
+		if (Count > 3)
+		{
+			CdevEchoLine = (unsigned int)atoi(Args[3]);
+		}
+		if (0 == CdevEchoIo.Setup())
+		{
+			EchoIo = &CdevEchoIo;
+			printf("\n Sensor on %s lines %u/%u",CdevChip,CdevTriggerLine,CdevEchoLine);
+			return 0;
+		}
+#endif
+		printf("\n gpio character device not available, using sysfs");
 	}
-	Fd55 = open("/sys/class/gpio/gpio55/direction", O_WRONLY);
-	if (Fd55 < 0)
+	EchoIo = &SysfsEchoIo;
+	return EchoIo->Setup();
+}
+
+/* *********************************************************************
+ * NAME:             AppOptions
+ * CALLED BY:        main
+ * DESCRIPTION:      Takes the name=value options in front of the
+ *                   backend: record=<file> records the measurements,
+ *                   frames=<file> logs the frames instead of showing
+ *                   them, speed=<factor> sets the speed of a replay
+ * INPUT PARAMETERS: argc, argv : command line
+ * RETURN VALUES:    int : index of the backend name, -1 on a bad option
+ ***********************************************************************/
+int AppOptions(int argc, char *argv[])
+{
+	int First;
+
+	for (First = 1; (First < argc) && (NULL != strchr(argv[First],'=')); First++)
 	{
-		printf("\n gpio15 direction open failed");
-	}
-	write(Fd31,"out",3);
-	write(Fd30,"out",3);
-	write(Fd14,"out",3);
-    write(Fd15,"out",3);
-    write(Fd42,"out",3);
-    write(Fd43,"out",3);
-    write(Fd55,"out",3);
-	/* After setting the direction, closr the direction file */
-	close(Fd31);
-	close(Fd30);
-	close(Fd14);
-	close(Fd15);
-	close(Fd42);
-	close(Fd43);
-	close(Fd55);
-	
-    /* Now open the value files */
-    Fd31 = open("/sys/class/gpio/gpio31/value", O_WRONLY);
-	if (Fd31 < 0)
-	{
-		printf("\n gpio31 value open failed");
+		if (0 == strncmp(argv[First],"record=",7))
+		{
+			TraceRecord = DistanceTraceCreate(argv[First] + 7);
+			if (NULL == TraceRecord)
+			{
+				return -1;
+			}
+		}
+		else if (0 == strncmp(argv[First],"frames=",7))
+		{
+			FrameLog = fopen(argv[First] + 7,"w");
+			if (NULL == FrameLog)
+			{
+				perror("frame log creation failed ");
+				return -1;
+			}
+		}
+		else if (0 == strncmp(argv[First],"speed=",6))
+		{
+			ReplaySpeed = atof(argv[First] + 6);
+			if (ReplaySpeed < 0)
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			printf("\n unknown option %s",argv[First]);
+			return -1;
+		}
 	}
-    Fd30 = open("/sys/class/gpio/gpio30/value", O_WRONLY);
-	if (Fd30 < 0)
+	return First;
+}
+
+/* *********************************************************************
+ * NAME:             AppCloseLogs
+ * CALLED BY:        main
+ * DESCRIPTION:      Writes out and closes the trace and the frame log
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void AppCloseLogs(void)
+{
+	if (TraceRecord)
 	{
-		printf("\n gpio30 value open failed");
+		fclose(TraceRecord);
 	}
-    Fd14 = open("/sys/class/gpio/gpio14/value", O_WRONLY);
-	if (Fd14 < 0)
+	if (FrameLog)
 	{
-		printf("\n gpio14 value open failed");
+		fclose(FrameLog);
 	}
-    Fd15 = open("/sys/class/gpio/gpio15/value", O_WRONLY);
-	if (Fd15 < 0)
+}
+
+/* *********************************************************************
+ * NAME:             main
+ * CALLED BY:        user call this app on the terminal
+ * DESCRIPTION:      User test application to test distance measurement
+ *                   sensor and 8x8 matrix display. A replay needs
+ *                   neither: it runs until the end of the trace, on the
+ *                   host as well.
+ * INPUT PARAMETERS: argc, argv : options, see AppOptions, then the
+ *                   sensor backend, see EchoIoSelect
+ * RETURN VALUES:    int : status - Fail/Pass(0) 
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+    pthread_t DistanceMeasurementThreadId, DisplayTaskId;
+	unsigned long long RunTimeUs = PROGRAM_RUN_TIME;
+	int First, Replay;
+
+	First = AppOptions(argc,argv);
+	if (First < 0)
 	{
-		printf("\n gpio15 value open failed");
+		printf("\n usage: %s [record=<file>] [frames=<file>] [speed=<factor>]"
+		       " [sysfs | cdev [chip [trigger line [echo line]]] | replay <trace>]\n",argv[0]);
+		AppCloseLogs();
+		return 1;
 	}
-	Fd42 = open("/sys/class/gpio/gpio42/value", O_WRONLY);
-	if (Fd42 < 0)
+	/* Enable mux gpio31 to activate gpio14(IO2) and the other muxes, a replay has no sensor */
+	Replay = (First < argc) && (0 == strcmp(argv[First],"replay"));
+	if ((!Replay) && (GpioSetup(&MuxTable) < 0))
 	{
-		printf("\n gpio42 value open failed");
+		printf("\n gpio muxes could not be set up\n");
+		AppCloseLogs();
+		return 1;
 	}
-	Fd43 = open("/sys/class/gpio/gpio43/value", O_WRONLY);
-	if (Fd43 < 0)
+    /* Trigger and echo pins */
+	if (EchoIoSelect(argc - First,argv + First) < 0)
 	{
-		printf("\n gpio43 value open failed");
+		printf("\n sensor pins could not be set up\n");
+		if (!Replay)
+		{
+			GpioTeardown(&MuxTable);
+		}
+		AppCloseLogs();
+		return 1;
 	}
-	Fd55 = open("/sys/class/gpio/gpio55/value", O_WRONLY);
-	if (Fd55 < 0)
+	if (Replay)
 	{
-		printf("\n gpio15 value open failed");
+		/* The run lasts as long as the trace */
+		ReplayClockInit(&ReplayClock,ReplaySpeed,REPLAY_THREADS);
+		Clock = &ReplayClock;
+		RunTimeUs = (ReplayEchoDueNs(ReplayTrace.Count - 1) / 1000) + REPLAY_TAIL_US;
 	}
-    write(Fd31,"0",1);
-    write(Fd30,"0",1);
-    /* According to the HC-SR04 user guide, Init should set the ECHO and Trigger to 0 */
-	write(Fd14,"0",1);
-    write(Fd15,"0",1); 
-    write(Fd42,"0",1); 
-    write(Fd43,"0",1); 
-    write(Fd55,"0",1); 
-    close(Fd31);
-    close(Fd30);
-    close(Fd14);
-    close(Fd15);
-    close(Fd42);
-    close(Fd43);
-    close(Fd55);
     /* Create Diaply and measurement threads to work on the Dog animation */
+    StopFlagInit(&TimeoutFlag);
+    DistanceChannelInit(&DistanceChannel,300);
     pthread_create(&DistanceMeasurementThreadId,NULL,&DistanceMeasurementTask,&TimeoutFlag);
     pthread_create(&DisplayTaskId,NULL,&DisplayTask,&TimeoutFlag);
-    usleep(PROGRAM_RUN_TIME);
+    AppSleepUs(REPLAY_THREAD_MAIN,RunTimeUs);
     /* Stop distance measurement and display */
-    TimeoutFlag = 1;
+    StopFlagSet(&TimeoutFlag);
+	if (Clock)
+	{
+		ReplayClockLeave(Clock,REPLAY_THREAD_MAIN);
+	}
 	printf("\nWaiting for Distance measurement to stop \n");
 	pthread_join(DistanceMeasurementThreadId, NULL);
 	pthread_join(DisplayTaskId, NULL);
+	EchoIo->Cleanup();
 
-	FdE = open("/sys/class/gpio/unexport", O_WRONLY);
-	if (FdE < 0)
+	if (!Replay)
 	{
-		printf("\n gpio unexport open failed");
+		GpioTeardown(&MuxTable);
 	}
-	write(FdE,"31",2);
-	write(FdE,"30",2);
-	write(FdE,"14",2);
-    write(FdE,"15",2);
-    write(FdE,"42",2);
-    write(FdE,"43",2);
-    write(FdE,"55",2);
-    close(FdE);
+	AppCloseLogs();
     return 0;
 }
@@ -17,7 +17,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <pthread.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "spi_led.h"
+#include "pulse.h"
+#include "atomic_channel.h"
+#include "distance_trace.h"
+#include "anim.h"
+#include "animations.h"
 
 //#define DEBUG
 
@@ -34,333 +43,831 @@
  */
 #define CAR_SLOWDOW_SPEED 2000
 /*
- * Time gap in us between two distance measurements
+ * Distance measurements per second
  */
-#define DISTANCE_MEASUTEMENT_TIME 100000
+#define DISTANCE_MEASUTEMENT_RATE 10
+/*
+ * Samples taken from the pulse driver with one read
+ */
+#define PULSE_READ_SAMPLES 8
 /* 
  * Total application Runtime
  */
 #define PROGRAM_RUN_TIME 90000000
 /*
- * Timeout flag set by the main thread
+ * Period of the timer that replaces epoll for a driver without poll support
  */
-unsigned char TimeoutFlag = 0;
-/* 
- * Distance measured by the Distance measurment thread is updated on here
+#define POLL_FALLBACK_PERIOD_MS 10
+/*
+ * Latencies kept for the percentiles, a frame is played at most every
+ * CAR_DEFAULT_SPEED ms so this covers the whole run
  */
-unsigned int GlobalDistance = 800;
+#define LATENCY_MAX_SAMPLES 4096
 /*
- * Mutex to protect the global variable distance
+ * Events handled per epoll_wait
  */
-pthread_mutex_t DistanceMutex = PTHREAD_MUTEX_INITIALIZER;
+#define EVENT_LOOP_EVENTS 8
+/*
+ * Run time of a replay after the last record of the trace, in trace time
+ */
+#define REPLAY_TAIL_MS 2000
+
+/* Source of an epoll event, kept in the event data */
+typedef enum EventSource_Tag {
+	EVENT_PULSE, /* Samples ready */
+	EVENT_PULSE_TICK, /* Fallback timer of the pulse driver */
+	EVENT_DISPLAY, /* Display free */
+	EVENT_DISPLAY_TICK, /* Fallback timer of the spi_led driver */
+	EVENT_RUN_END, /* PROGRAM_RUN_TIME over */
+	EVENT_REPLAY /* Next record of the replayed trace due */
+}EventSource_Type;
+
+/* What the display is showing */
+typedef enum AppPhase_Tag {
+	PHASE_ESP, /* Moving "ESP" */
+	PHASE_CAR, /* Car controlled by the distance */
+	PHASE_DONE /* Run time over */
+}AppPhase_Type;
+
+/* State of the event loop, everything runs in the main thread */
+typedef struct AppTag
+{
+	int EpollFd; /* Event loop */
+	int FdPulse; /* Distance sensor, non blocking */
+	int FdDisplay; /* Display, non blocking */
+	int PulseTickFd; /* Fallback timer of the pulse driver, -1 if epoll watches it */
+	int DisplayTickFd; /* Fallback timer of the display, -1 if epoll watches it */
+	int RunEndFd; /* One shot timer ending the car phase */
+	AppPhase_Type Phase; /* What the display is showing */
+	int CarHandle; /* Bank of the car */
+	unsigned int CarFrame; /* Next car frame, 0 to 7 */
+	unsigned char SlowdownFlag; /* Car is slowed down */
+	DistanceValueType Distance; /* Latest filtered distance */
+	unsigned int ShownSequence; /* Sequence of the distance the last frame was chosen with */
+	unsigned int LatencyUs[LATENCY_MAX_SAMPLES]; /* Measurement to display latencies */
+	unsigned int LatencyCount; /* Latencies recorded */
+	unsigned long Wakeups; /* epoll_wait returns */
+	FILE *TraceRecord; /* Samples are recorded here, record=<file> */
+	FILE *FrameLog; /* Frames played are logged here, frames=<file> */
+	DistanceTraceType Replay; /* Trace replayed through the pulse driver, replay=<file> */
+	double Speed; /* Trace time per real time of the replay, speed=<factor> */
+	unsigned long long ReplayStartNs; /* Time the replay started */
+	int ReplayFd; /* Timer of the next record, -1 without replay */
+}AppType;
+
+/* Application state */
+static AppType App;
 
 /* *********************************************************************
- * NAME:             WritePattern
+ * NAME:             CreateDisplayBank
  * CALLED BY:        Display Tasks
- * DESCRIPTION:      This function sends the ioctl command to the file with 
- *                   the display pattern
- * INPUT PARAMETERS: PatternNumber : ranging from 0-9
- *                   Pattern: pointer to eight byte array
- *                   fd:  function descriptor to which the ioctl command
- *                        is sent
- * RETURN VALUES:    int : status - Fail/Pass(0)
+ * DESCRIPTION:      Allocates a pattern bank in the spi_led driver and
+ *                   uploads the patterns and the sequence steps to it.
+ *                   The bank is freed by the driver when Fd is closed
+ *                   and the bank has been played
+ * INPUT PARAMETERS: Fd : spi_led file descriptor
+ *                   Pattern : PatternCount patterns of eight bytes
+ *                   PatternCount : number of patterns
+ *                   Sequence : StepCount steps of {pattern, time}
+ *                   StepCount : number of steps
+ * RETURN VALUES:    int : bank handle, -1 on failure
  ***********************************************************************/
-int WritePattern(unsigned char PatternNumber, const unsigned char *Pattern, int Fd)
+int CreateDisplayBank(int Fd, const unsigned char (*Pattern)[8], unsigned int PatternCount,
+                      const unsigned short (*Sequence)[2], unsigned int StepCount)
 {
-   int Res = 0;
-   Res = ioctl(Fd,(unsigned int)(Pattern),(unsigned long)PatternNumber);
-   if (Res < 0)
+   SpiLedBankReqType BankReq = {0};
+   SpiLedBankDataType BankData = {0};
+
+   BankReq.PatternCount = PatternCount;
+   BankReq.SequenceLength = StepCount;
+   if (ioctl(Fd,SPI_LED_IOC_BANK_ALLOC,&BankReq) < 0)
+   {
+	   perror("Bank allocation failed ");
+	   return -1;
+   }
+   BankData.Handle = BankReq.Handle;
+   BankData.First = 0;
+   BankData.Count = PatternCount;
+   BankData.Data = (unsigned long)Pattern;
+   if (ioctl(Fd,SPI_LED_IOC_LOAD_PATTERNS,&BankData) < 0)
+   {
+	   perror("Pattern upload failed ");
+	   return -1;
+   }
+   BankData.Count = StepCount;
+   BankData.Data = (unsigned long)Sequence;
+   if (ioctl(Fd,SPI_LED_IOC_LOAD_SEQUENCE,&BankData) < 0)
    {
-	   printf("IOCTL error in WritePattern ");
-       perror("Error is :");
+	   perror("Sequence upload failed ");
+	   return -1;
    }
-   return Res;
+   return (int)BankReq.Handle;
 }
+
+/* *********************************************************************
+ * NAME:             PlayDisplayBank
+ * CALLED BY:        Display Tasks
+ * DESCRIPTION:      Queues steps of a bank sequence for display
+ * INPUT PARAMETERS: Fd : spi_led file descriptor
+ *                   Handle : bank handle
+ *                   First : first step to play
+ *                   Count : number of steps
+ * RETURN VALUES:    int : status - Fail(<0, errno EBUSY if the display
+ *                   queue is full)/Pass(0)
+ ***********************************************************************/
+int PlayDisplayBank(int Fd, int Handle, unsigned int First, unsigned int Count)
+{
+   SpiLedPlayType Play;
+
+   Play.Handle = Handle;
+   Play.First = First;
+   Play.Count = Count;
+   return ioctl(Fd,SPI_LED_IOC_PLAY,&Play);
+}
+
 /* *********************************************************************
- * NAME:             DistanceMeasurementTask
- * CALLED BY:        Created by main() thread
- * DESCRIPTION:      Thread to trigger and gather measurement
- * INPUT PARAMETERS: TimeoutFlagLocal : To end the thread
+ * NAME:             TimerFdStart
+ * CALLED BY:        EventLoopWatch, DisplayEvent
+ * DESCRIPTION:      Creates a non blocking monotonic timerfd
+ * INPUT PARAMETERS: FirstMs : time to the first expiry
+ *                   PeriodMs : time between two expiries, 0 for one shot
+ * RETURN VALUES:    int : timer file descriptor, -1 on failure
+ ***********************************************************************/
+int TimerFdStart(unsigned int FirstMs, unsigned int PeriodMs)
+{
+	struct itimerspec Spec;
+	int Fd;
+
+	Fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+	if (Fd < 0)
+	{
+		perror("timerfd creation failed ");
+		return -1;
+	}
+	Spec.it_value.tv_sec = FirstMs / 1000;
+	Spec.it_value.tv_nsec = (FirstMs % 1000) * 1000000;
+	Spec.it_interval.tv_sec = PeriodMs / 1000;
+	Spec.it_interval.tv_nsec = (PeriodMs % 1000) * 1000000;
+	if (timerfd_settime(Fd,0,&Spec,NULL) < 0)
+	{
+		perror("timerfd start failed ");
+		close(Fd);
+		return -1;
+	}
+	return Fd;
+}
+
+/* *********************************************************************
+ * NAME:             TimerFdAck
+ * CALLED BY:        main
+ * DESCRIPTION:      Takes the expiries of a timer so that epoll stops
+ *                   reporting it
+ * INPUT PARAMETERS: Fd : timer file descriptor
  * RETURN VALUES:    None
  ***********************************************************************/
-void* DistanceMeasurementTask(void *TimeoutFlagLocal)
+void TimerFdAck(int Fd)
+{
+	unsigned long long Expiries;
+
+	if (read(Fd,&Expiries,sizeof(Expiries)) < 0)
+	{
+#ifdef DEBUG
+		printf("\n timerfd read: no expiry");
+#endif
+	}
+}
+
+/* *********************************************************************
+ * NAME:             EventLoopWatch
+ * CALLED BY:        main
+ * DESCRIPTION:      Adds a file to the event loop. A driver without
+ *                   poll support cannot be added (EPERM), it is looked
+ *                   at every TickMs instead, on a timerfd added with
+ *                   TickSource
+ * INPUT PARAMETERS: Fd : file to watch
+ *                   Events : EPOLLIN / EPOLLOUT
+ *                   Source : event reported for Fd
+ *                   TickSource : event reported for the fallback timer
+ *                   TickMs : period of the fallback timer
+ *                   TickFd : set to the fallback timer, -1 if none
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int EventLoopWatch(int Fd, unsigned int Events, EventSource_Type Source,
+                   EventSource_Type TickSource, unsigned int TickMs, int *TickFd)
 {
-	int FdPulse,Result;
-	unsigned int ReceivedValue = 0, LocalMaximum;
-	 /* Distance measurement */
-    FdPulse = open("/dev/pulse",O_RDWR);
-	if (FdPulse < 0)
+	struct epoll_event Event;
+
+	*TickFd = -1;
+	Event.events = Events;
+	Event.data.u32 = Source;
+	if (0 == epoll_ctl(App.EpollFd,EPOLL_CTL_ADD,Fd,&Event))
+	{
+		return 0;
+	}
+	if ((EPERM != errno) || (0 == TickMs))
 	{
-		printf("\n pulse driver file open failed");
+		perror("epoll add failed ");
+		return -1;
 	}
+	/* No poll in the driver, fall back to looking at it on a timer */
+	*TickFd = TimerFdStart(TickMs,TickMs);
+	if (*TickFd < 0)
+	{
+		return -1;
+	}
+	Event.events = EPOLLIN;
+	Event.data.u32 = TickSource;
+	if (epoll_ctl(App.EpollFd,EPOLL_CTL_ADD,*TickFd,&Event) < 0)
+	{
+		perror("epoll add failed ");
+		close(*TickFd);
+		*TickFd = -1;
+		return -1;
+	}
+	printf("\n driver without poll support, looked at every %u ms",TickMs);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             DistanceMeasurementEvent
+ * CALLED BY:        main, when samples are ready
+ * DESCRIPTION:      Takes the samples from the pulse driver and keeps
+ *                   the filtered distance
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void DistanceMeasurementEvent(void)
+{
+	int Result, LoopIndex;
+	PulseSampleType Samples[PULSE_READ_SAMPLES];
+	PulseFilteredType Filtered;
+	DistanceTraceRecordType Record;
+
+	/* Empty the fifo, epoll reports it again as long as a sample is left */
 	do
 	{
-		/* Trigger measurement */
-		Result  = write(FdPulse,&ReceivedValue,4);
-		if (Result < 0)
-		{
+		Result  = read(App.FdPulse,&Samples[0],sizeof(Samples));
 #ifdef DEBUG
-		  printf("\n WRITE call:  driver BUSY");
-#endif
-		}
-		else
+		if (Result > 0)
 		{
-#ifdef DEBUG
-			   printf("\n WRITE call: Measurement STARTED");
-#endif 
-               /* Give some time for the measument to happen */
-			   usleep(10000);
-#ifdef DEBUG
-			   printf("\n Reading Driver now");
-#endif
-               /* Try reading the measured value */
-			   do
-			   {
-				   /* Read the measured value */
-				   Result  = read(FdPulse,&ReceivedValue,sizeof(ReceivedValue));
-				   if (Result < 0)
-				   {
-#ifdef DEBUG
-					   printf("\n READ call: Measurement IN PROGRESS");
+			printf("\n Received pulse width : %d ns\n",Samples[(Result / sizeof(PulseSampleType)) - 1].WidthNs);
+		}
 #endif
-				       /* Measurement is not ready yet , give some more time */
-				       usleep(10000);
-				   }
-				   else
-				   {
+		for (LoopIndex = 0; (App.TraceRecord) && (LoopIndex < (int)(Result / (int)sizeof(PulseSampleType))); LoopIndex++)
+		{
+			Record.TimestampNs = Samples[LoopIndex].TimestampNs;
+			Record.WidthNs = Samples[LoopIndex].WidthNs;
+			Record.Status = Samples[LoopIndex].Status;
+			DistanceTraceWrite(App.TraceRecord,&Record);
+		}
+	}while (Result == (int)sizeof(Samples));
+	/* The driver filters the samples, a single spurious echo does not stop the car */
+	if ((ioctl(App.FdPulse,PULSE_IOC_GET_FILTERED,&Filtered) < 0) || (PULSE_FILTER_VALID != Filtered.Status))
+	{
+		return;
+	}
+	/* A rejected sample leaves the estimate and its timestamp as they were */
+	if (Filtered.TimestampNs == App.Distance.TimestampNs)
+	{
+		return;
+	}
 #ifdef DEBUG
-					   printf("\n READ call:  driver SUCCESS");
-					   printf("\n Received pulse width : %d us\n",ReceivedValue);
+	printf("\n Distance = %d mm, speed = %d mm/s\n",Filtered.DistanceMm,Filtered.VelocityMmPerSec);
 #endif
-					   printf("\n Distance = %d mm\n",(unsigned int)(ReceivedValue*0.150));
-					   /* Updat the measured value with distance in mm*/
-				       pthread_mutex_lock(&DistanceMutex);
-				       GlobalDistance = (unsigned int)(ReceivedValue*0.150);
-				       pthread_mutex_unlock(&DistanceMutex);
-				   }
-		       }while(Result < 0);
-		}
-		usleep(DISTANCE_MEASUTEMENT_TIME);
-	}while(0 == (*((unsigned char *)TimeoutFlagLocal)));
-	close(FdPulse);
-	return NULL;
+	App.Distance.DistanceMm = (Filtered.DistanceMm > 0) ? (unsigned int)Filtered.DistanceMm : 0;
+	App.Distance.TimestampNs = Filtered.TimestampNs;
+	App.Distance.Sequence++;
 }
 
 /* *********************************************************************
- * NAME:             ESPDisplayTask
- * CALLED BY:        Created by main() thread
- * DESCRIPTION:      Thread to display moving alphabets "ESP"
- * INPUT PARAMETERS: TimeoutFlagLocal : Not used
- * RETURN VALUES:    None
+ * NAME:             AppTraceNs
+ * CALLED BY:        DisplayEvent, ReplayEvent
+ * DESCRIPTION:      Converts a monotonic time to the time of the trace
+ *                   being replayed, 0 before the replay started. Without
+ *                   replay the time is kept.
+ * INPUT PARAMETERS: Ns : monotonic time
+ * RETURN VALUES:    unsigned long long : trace time
  ***********************************************************************/
-void* ESPDisplayTask(void *TimeoutFlagLocal)
+unsigned long long AppTraceNs(unsigned long long Ns)
 {
-	int FdDisplay;
-	unsigned char count = 0, LoopIndex, ReadBuff;
-	const unsigned char PatternESP[23][8] = {
-		{0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01},
-		{0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03},
-		{0x07, 0x07, 0x06, 0x07, 0x07, 0x06, 0x07, 0x07},
-		{0x0f, 0x0f, 0x0c, 0x0f, 0x0f, 0x0c, 0x0f, 0x0f},
-		{0x1f, 0x1f, 0x18, 0x1f, 0x1f, 0x18, 0x1f, 0x1f},
-		{0x3e, 0x3e, 0x30, 0x3e, 0x3e, 0x30, 0x3e, 0x3e},
-		{0x7d, 0x7d, 0x61, 0x7d, 0x7d, 0x60, 0x7d, 0x7d},
-		{0xfb, 0xfb, 0xc3, 0xfb, 0xfb, 0xc0, 0xfb, 0xfb},
-		{0xf7, 0xf7, 0x86, 0xf7, 0xf7, 0x81, 0xf7, 0xf7},
-		{0xef, 0xef, 0x0c, 0xef, 0xef, 0x03, 0xef, 0xef},
-		{0xde, 0xde, 0x18, 0xde, 0xde, 0x06, 0xde, 0xde},
-		{0xbd, 0xbd, 0x31, 0xbd, 0xbd, 0x0d, 0xbd, 0xbd},
-		{0x7b, 0x7b, 0x63, 0x7b, 0x7b, 0x1b, 0x7b, 0x7b},
-		{0xf7, 0xf7, 0xc6, 0xf6, 0xf7, 0x36, 0xf6, 0xf6},
-		{0xef, 0xef, 0x8c, 0xec, 0xef, 0x2c, 0xec, 0xec},
-		{0xdf, 0xdf, 0x19, 0xd9, 0xdf, 0xd8, 0xd8, 0xd8},
-		{0xbe, 0xbe, 0x32, 0xb2, 0xbe, 0xb0, 0xb0, 0xb0},
-		{0x7c, 0x7c, 0x64, 0x64, 0x7c, 0x60, 0x60, 0x60},
-		{0xf8, 0xf8, 0xc8, 0xc8, 0xf8, 0xc0, 0xc0, 0xc0},
-		{0xf0, 0xf0, 0x90, 0x90, 0xf0, 0x80, 0x80, 0x80},
-		{0xe0, 0xe0, 0x20, 0x20, 0xe0, 0x00, 0x00, 0x00},
-		{0xc0, 0xc0, 0x40, 0x40, 0xc0, 0x00, 0x00, 0x00},
-		{0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x00, 0x00}
-	};
-	unsigned short DisplaySequence[10][2]={
-		{0,500},{1,500},{2,500},
-		{3,500},{4,500},{5,500},
-		{6,500},{7,500},{8,500},
-		{9,400}/*Last one will be followed by a pattern change, hence less time*/
-		};
-    FdDisplay = open("/dev/spi_led",O_RDWR);
-	if (FdDisplay < 0)
+	if (App.ReplayFd < 0)
 	{
-		printf("\n spi_led driver file open failed");
+		return Ns;
 	}
-	/* write first 10 pattern */
-	for(LoopIndex = 0; LoopIndex < 10; LoopIndex++)
-	{
-    	WritePattern(LoopIndex,&(PatternESP[LoopIndex][0]),FdDisplay);
-    }
+	return (Ns > App.ReplayStartNs) ? (unsigned long long)((double)(Ns - App.ReplayStartNs) * App.Speed) : 0;
+}
 
-	/* Write the display sequence */ 
-	write(FdDisplay,&DisplaySequence,sizeof(DisplaySequence));
-	
-	/* poll if the display has become free to accept new pattern */
-	do
+/* *********************************************************************
+ * NAME:             ReplayDueNs
+ * CALLED BY:        ReplayEvent
+ * DESCRIPTION:      Time of a record from the start of the replay
+ * INPUT PARAMETERS: Index : record of the replayed trace
+ * RETURN VALUES:    unsigned long long : trace time of the record
+ ***********************************************************************/
+unsigned long long ReplayDueNs(unsigned int Index)
+{
+	return App.Replay.Record[Index].TimestampNs - App.Replay.Record[0].TimestampNs;
+}
+
+/* *********************************************************************
+ * NAME:             ReplayArm
+ * CALLED BY:        ReplayStart, ReplayEvent
+ * DESCRIPTION:      Sets the replay timer to a trace time
+ * INPUT PARAMETERS: DueNs : trace time of the next expiry
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int ReplayArm(unsigned long long DueNs)
+{
+	struct itimerspec Spec;
+	unsigned long long AtNs;
+
+	AtNs = App.ReplayStartNs + (unsigned long long)((double)DueNs / App.Speed);
+	memset(&Spec,0,sizeof(Spec));
+	Spec.it_value.tv_sec = AtNs / 1000000000ULL;
+	Spec.it_value.tv_nsec = AtNs % 1000000000ULL;
+	return timerfd_settime(App.ReplayFd,TFD_TIMER_ABSTIME,&Spec,NULL);
+}
+
+/* *********************************************************************
+ * NAME:             ReplayStart
+ * CALLED BY:        main
+ * DESCRIPTION:      Starts the timer that feeds the loaded trace to the
+ *                   pulse driver, the first record is due at once
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int ReplayStart(void)
+{
+	struct epoll_event Event;
+
+	App.ReplayFd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+	if (App.ReplayFd < 0)
 	{
-		usleep(10000);
-	}while (0 > read(FdDisplay,&ReadBuff,1));
-	/* By now it will be ready to accept new commands */
-	/* write next 10 pattern */
-	for(LoopIndex = 0; LoopIndex < 10; LoopIndex++)
+		perror("timerfd creation failed ");
+		return -1;
+	}
+	Event.events = EPOLLIN;
+	Event.data.u32 = EVENT_REPLAY;
+	App.ReplayStartNs = ChannelNowNs();
+	if ((epoll_ctl(App.EpollFd,EPOLL_CTL_ADD,App.ReplayFd,&Event) < 0) || (ReplayArm(0) < 0))
 	{
-    	WritePattern(LoopIndex,&(PatternESP[LoopIndex + 10][0]),FdDisplay);
-    }
+		perror("Replay cannot be started ");
+		return -1;
+	}
+	printf("\n Replaying %u records at %g times real time",App.Replay.Count,App.Speed);
+	return 0;
+}
 
-	/* Write the display sequence */ 
-	write(FdDisplay,&DisplaySequence,sizeof(DisplaySequence));
-	
-	/* poll if the display has become free to accept new pattern */
-	do
+/* *********************************************************************
+ * NAME:             ReplayEvent
+ * CALLED BY:        main, when the replay timer expires
+ * DESCRIPTION:      Gives the records that are due to the pulse driver,
+ *                   which treats them as samples of its sensor, then
+ *                   waits for the next one. The run ends REPLAY_TAIL_MS
+ *                   after the last record.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void ReplayEvent(void)
+{
+	const DistanceTraceRecordType *Record;
+	PulseSampleType Sample;
+	unsigned long long NowNs;
+
+	TimerFdAck(App.ReplayFd);
+	if (App.Replay.Next == App.Replay.Count)
 	{
-		usleep(10000);
-	}while (0 > read(FdDisplay,&ReadBuff,1));
-	/* By now it will be ready to accept new commands */
-	
-
-	/* write next 10 pattern */
-	for(LoopIndex = 0; LoopIndex < 3; LoopIndex++)
-	{
-    	WritePattern(LoopIndex,&(PatternESP[LoopIndex + 20][0]),FdDisplay);
-    }
-    /* Display only last 3 patterns */
-    DisplaySequence[3][0] = 0;
-    DisplaySequence[3][1] = 0;
-    
-	/* Write the display sequence */ 
-	write(FdDisplay,&DisplaySequence,sizeof(DisplaySequence));	
-	
-#ifdef DEBUG
-	printf("\n Display programmed %i \n",Result);
-#endif
-    close(FdDisplay);
-    return NULL;
+		App.Phase = PHASE_DONE;
+		return;
+	}
+	NowNs = AppTraceNs(ChannelNowNs());
+	while ((App.Replay.Next < App.Replay.Count) && (ReplayDueNs(App.Replay.Next) <= NowNs))
+	{
+		Record = &App.Replay.Record[App.Replay.Next++];
+		memset(&Sample,0,sizeof(Sample));
+		Sample.WidthNs = Record->WidthNs;
+		Sample.Status = Record->Status;
+		if (ioctl(App.FdPulse,PULSE_IOC_INJECT,&Sample) < 0)
+		{
+			perror("Sample cannot be replayed ");
+			App.Phase = PHASE_DONE;
+			return;
+		}
+	}
+	if (App.Replay.Next < App.Replay.Count)
+	{
+		ReplayArm(ReplayDueNs(App.Replay.Next));
+	}
+	else
+	{
+		ReplayArm(ReplayDueNs(App.Replay.Count - 1) + (REPLAY_TAIL_MS * 1000000ULL));
+	}
 }
 
 /* *********************************************************************
- * NAME:             CollisionAvoidanceTask
- * CALLED BY:        Created by main() thread
- * DESCRIPTION:      Thread to Display movement of Car. This car speed
- *                   is controlled the measured distance.
- * INPUT PARAMETERS: TimeoutFlagLocal : used for ending this task
+ * NAME:             ESPDisplayStart
+ * CALLED BY:        main
+ * DESCRIPTION:      Queues the moving alphabets "ESP". The display is
+ *                   free again once they have been shown.
+ * INPUT PARAMETERS: None
  * RETURN VALUES:    None
  ***********************************************************************/
-void* CollisionAvoidanceTask(void *TimeoutFlagLocal)
+void ESPDisplayStart(void)
 {
-	int FdDisplay;
-	unsigned char count = 0, LoopIndex,SlowdownFlag = 0,LocalLineNum = 0,ReadBuff;
-	/* Pattern that defines the CAR structure */
-	const unsigned char PatternESP[8][8] = {
-     	{0x00, 0x7c, 0x44, 0x47, 0x41, 0x7f, 0x22, 0x00},
-		{0x00, 0x3e, 0x22, 0xa3, 0xa0, 0xbf, 0x11, 0x00},
-		{0x00, 0x1f, 0x11, 0xd1, 0x50, 0xdf, 0x88, 0x00},
-		{0x00, 0x8f, 0x88, 0xe8, 0x28, 0xef, 0x44, 0x00},
-		{0x00, 0xc7, 0x44, 0x74, 0x14, 0xf7, 0x22, 0x00},
-		{0x00, 0xe3, 0x22, 0x3a, 0x0a, 0xfb, 0x11, 0x00},
-		{0x00, 0xf1, 0x11, 0x1d, 0x05, 0xfd, 0x88, 0x00},
-		{0x00, 0xf8, 0x88, 0x8e, 0x82, 0xfe, 0x44, 0x00}
-	};
-	/* Two speeds for the car */
-	unsigned short DisplaySequenceRun[10][2]={
+	unsigned char Pattern[ANIM_ESP_FRAMES][ANIM_ROWS];
+	int Handle = -1;
+
+	/* Every letter frame for 500ms, then clear the display, as animations.txt plays it.
+	   The distinct frames are expanded and the whole animation uploaded once */
+	if (ANIM_ESP_FRAMES == AnimExpand(&AnimEsp,Pattern,ANIM_ESP_FRAMES))
+	{
+		Handle = CreateDisplayBank(App.FdDisplay,(const unsigned char (*)[8])Pattern,ANIM_ESP_FRAMES,AnimEsp.Sequence,AnimEsp.StepCount);
+	}
+	if ((Handle < 0) || (PlayDisplayBank(App.FdDisplay,Handle,0,AnimEsp.StepCount) < 0))
+	{
+		printf("\n ESP could not be displayed");
+	}
+}
+
+/* *********************************************************************
+ * NAME:             CarDisplaySetup
+ * CALLED BY:        main
+ * DESCRIPTION:      Uploads the car frames at both speeds
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int CarDisplaySetup(void)
+{
+	/* Pattern that defines the CAR structure, expanded from animations.txt */
+	unsigned char Pattern[ANIM_CAR_FRAMES][ANIM_ROWS];
+	/* Two speeds for the car: steps 0-7 run, steps 9-16 slow down */
+	unsigned short DisplaySequence[18][2]={
 		{0,CAR_DEFAULT_SPEED},{1,CAR_DEFAULT_SPEED},{2,CAR_DEFAULT_SPEED},
 		{3,CAR_DEFAULT_SPEED},{4,CAR_DEFAULT_SPEED},{5,CAR_DEFAULT_SPEED},
 		{6,CAR_DEFAULT_SPEED},{7,CAR_DEFAULT_SPEED},{0,0},
-		{0,0}
-		};
-	unsigned short DisplaySequenceSlow[10][2]={
 		{0,CAR_SLOWDOW_SPEED},{1,CAR_SLOWDOW_SPEED},{2,CAR_SLOWDOW_SPEED},
 		{3,CAR_SLOWDOW_SPEED},{4,CAR_SLOWDOW_SPEED},{5,CAR_SLOWDOW_SPEED},
-		{6,CAR_SLOWDOW_SPEED},{7,CAR_SLOWDOW_SPEED},{0,0},
-		{0,0}
+		{6,CAR_SLOWDOW_SPEED},{7,CAR_SLOWDOW_SPEED},{0,0}
 		};
 
-    FdDisplay = open("/dev/spi_led",O_RDWR);
-	if (FdDisplay < 0)
+	unsigned int LoopIndex;
+
+	if (ANIM_CAR_FRAMES != AnimExpand(&AnimCar,Pattern,ANIM_CAR_FRAMES))
 	{
-		printf("\n spi_led driver file open failed");
+		return -1;
 	}
-	/* Check if the display is free to accept new pattern */
-	do
-    {
-#ifdef DEBUG
-		printf("Waiting for display to get free ");
-#endif
-	    usleep(1000);
-	}while (0 > read(FdDisplay,&ReadBuff,1));
-	
-    /* write the car pattern */
-	for (LoopIndex = 0; LoopIndex < 8; LoopIndex++)
+	/* A replay runs the car faster by its speed, time 0 ends a run */
+	for (LoopIndex = 0; (App.Replay.Count) && (LoopIndex < 18); LoopIndex++)
 	{
-        WritePattern(LoopIndex,&(PatternESP[LoopIndex][0]),FdDisplay);
+		if (DisplaySequence[LoopIndex][1])
+		{
+			DisplaySequence[LoopIndex][1] = (unsigned short)((DisplaySequence[LoopIndex][1] / App.Speed) + 1);
+		}
 	}
-	
-    /* Keep sending the sequence untill the timeout */
-	do
+    /* write the car pattern, it has its own bank so there is no need to wait for the display */
+	App.CarHandle = CreateDisplayBank(App.FdDisplay,(const unsigned char (*)[8])Pattern,ANIM_CAR_FRAMES,DisplaySequence,18);
+	return (App.CarHandle < 0) ? (-1) : (0);
+}
+
+/* *********************************************************************
+ * NAME:             DisplayEvent
+ * CALLED BY:        main, when the display is free
+ * DESCRIPTION:      Ends the ESP phase, then plays the car one frame at
+ *                   a time so that every frame is chosen with the latest
+ *                   distance, and records how long the distance took to
+ *                   reach the display. The frame log gets "<time ns>
+ *                   <distance mm> <time of the measurement ns> <car
+ *                   step>" for every frame, in trace time on a replay.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void DisplayEvent(void)
+{
+	unsigned char DisplayFree;
+	unsigned int First;
+	struct epoll_event Event;
+
+	/* Also confirms a wake up of the fallback timer, EAGAIN while busy */
+	if (read(App.FdDisplay,&DisplayFree,1) < 0)
+	{
+		return;
+	}
+	if ((PHASE_ESP == App.Phase) && (App.ReplayFd >= 0))
+	{
+		/* A replay shows no ESP, the car runs to the end of the trace */
+		App.Phase = PHASE_CAR;
+	}
+	else if (PHASE_ESP == App.Phase)
 	{
-	    /* poll if the display has become free to accept new sequnece */
-		do
+		/* ESP has ended, the car runs for PROGRAM_RUN_TIME from now */
+		App.Phase = PHASE_CAR;
+		App.RunEndFd = TimerFdStart(PROGRAM_RUN_TIME / 1000,0);
+		Event.events = EPOLLIN;
+		Event.data.u32 = EVENT_RUN_END;
+		if ((App.RunEndFd < 0) || (epoll_ctl(App.EpollFd,EPOLL_CTL_ADD,App.RunEndFd,&Event) < 0))
 		{
-#ifdef DEBUG
-			printf("Waiting for display to get free ");
-#endif
-			usleep(1000);
-		}while (0 > read(FdDisplay,&ReadBuff,1));
-		/* Read the distance and decide whether the car needs to be slowed down */
-		pthread_mutex_lock(&DistanceMutex);
-		SlowdownFlag = (GlobalDistance < MINIMUM_DISTANCE_TO_STOP) ? (1) : (0);
-		pthread_mutex_unlock(&DistanceMutex);
-		/* Check whether car needs to be slowed down */
-		if(1 == SlowdownFlag)
+			perror("Run time cannot be watched ");
+			App.Phase = PHASE_DONE;
+			return;
+		}
+	}
+	if (PHASE_CAR != App.Phase)
+	{
+		return;
+	}
+	/* A stale distance keeps the last decision */
+	if (App.Distance.Sequence != App.ShownSequence)
+	{
+		App.SlowdownFlag = (App.Distance.DistanceMm < MINIMUM_DISTANCE_TO_STOP) ? (1) : (0);
+	}
+	/* Slowed down car is on steps 9-16, full run on steps 0-7 */
+	First = ((1 == App.SlowdownFlag) ? 9 : 0) + App.CarFrame;
+	if (PlayDisplayBank(App.FdDisplay,App.CarHandle,First,1) < 0)
+	{
+		/* The display stays free, epoll would report it again at once */
+		perror("Car cannot be displayed ");
+		App.Phase = PHASE_DONE;
+		return;
+	}
+	App.CarFrame = (App.CarFrame + 1) % 8;
+	if (App.FrameLog)
+	{
+		fprintf(App.FrameLog,"%llu %u %llu %u\n",AppTraceNs(ChannelNowNs()),App.Distance.DistanceMm,
+		        AppTraceNs(App.Distance.TimestampNs),First);
+	}
+	/* The frame is on the display now, measure from the trigger of the sensor */
+	if (App.Distance.Sequence != App.ShownSequence)
+	{
+		if ((0 != App.Distance.TimestampNs) && (App.LatencyCount < LATENCY_MAX_SAMPLES))
 		{
-			/* Car needs to be slowed down , hence send the slow movement sequence */
-			write(FdDisplay,&DisplaySequenceSlow,sizeof(DisplaySequenceSlow));
+			App.LatencyUs[App.LatencyCount++] = (unsigned int)((ChannelNowNs() - App.Distance.TimestampNs) / 1000);
+		}
+		App.ShownSequence = App.Distance.Sequence;
+	}
+}
+
+/* *********************************************************************
+ * NAME:             LatencyCompare
+ * CALLED BY:        qsort in LatencyReport
+ * DESCRIPTION:      Orders two latencies
+ * INPUT PARAMETERS: A, B : latencies to compare
+ * RETURN VALUES:    int : <0, 0, >0
+ ***********************************************************************/
+int LatencyCompare(const void *A, const void *B)
+{
+	unsigned int LatencyA = *(const unsigned int *)A, LatencyB = *(const unsigned int *)B;
+
+	return (LatencyA > LatencyB) - (LatencyA < LatencyB);
+}
+
+/* *********************************************************************
+ * NAME:             LatencyReport
+ * CALLED BY:        main
+ * DESCRIPTION:      Prints the percentiles of the measurement to
+ *                   display latency
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void LatencyReport(void)
+{
+	unsigned int Last = App.LatencyCount - 1;
+
+	printf("\n %lu wake ups of the event loop\n",App.Wakeups);
+	if (0 == App.LatencyCount)
+	{
+		printf(" No distance has reached the display\n");
+		return;
+	}
+	qsort(App.LatencyUs,App.LatencyCount,sizeof(App.LatencyUs[0]),&LatencyCompare);
+	printf(" Distance to display latency over %u distances: p50 %u us, p90 %u us, p99 %u us, max %u us\n",
+	       App.LatencyCount,App.LatencyUs[(Last * 50) / 100],App.LatencyUs[(Last * 90) / 100],
+	       App.LatencyUs[(Last * 99) / 100],App.LatencyUs[Last]);
+}
+
+/* *********************************************************************
+ * NAME:             AppCleanup
+ * CALLED BY:        main
+ * DESCRIPTION:      Stops the measurement and closes every file and
+ *                   log
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void AppCleanup(void)
+{
+	if (App.FdPulse >= 0)
+	{
+		ioctl(App.FdPulse,PULSE_IOC_STOP);
+		close(App.FdPulse);
+	}
+	/* The driver frees the banks once they have been played */
+	if (App.FdDisplay >= 0)
+	{
+		close(App.FdDisplay);
+	}
+	if (App.PulseTickFd >= 0)
+	{
+		close(App.PulseTickFd);
+	}
+	if (App.DisplayTickFd >= 0)
+	{
+		close(App.DisplayTickFd);
+	}
+	if (App.RunEndFd >= 0)
+	{
+		close(App.RunEndFd);
+	}
+	if (App.ReplayFd >= 0)
+	{
+		close(App.ReplayFd);
+	}
+	if (App.TraceRecord)
+	{
+		fclose(App.TraceRecord);
+	}
+	if (App.FrameLog)
+	{
+		fclose(App.FrameLog);
+	}
+	DistanceTraceFree(&App.Replay);
+	if (App.EpollFd >= 0)
+	{
+		close(App.EpollFd);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             AppOptions
+ * CALLED BY:        main
+ * DESCRIPTION:      Takes the name=value options: record=<file> records
+ *                   the samples of the pulse driver, replay=<file> feeds
+ *                   a recorded trace to it instead of the sensor,
+ *                   speed=<factor> sets the speed of the replay and
+ *                   frames=<file> logs the frames played
+ * INPUT PARAMETERS: argc, argv : command line
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int AppOptions(int argc, char *argv[])
+{
+	int LoopIndex;
+
+	App.Speed = 1;
+	for (LoopIndex = 1; LoopIndex < argc; LoopIndex++)
+	{
+		if (0 == strncmp(argv[LoopIndex],"record=",7))
+		{
+			App.TraceRecord = DistanceTraceCreate(argv[LoopIndex] + 7);
+			if (NULL == App.TraceRecord)
+			{
+				return -1;
+			}
+		}
+		else if (0 == strncmp(argv[LoopIndex],"replay=",7))
+		{
+			if (DistanceTraceLoad(argv[LoopIndex] + 7,&App.Replay) < 0)
+			{
+				return -1;
+			}
+		}
+		else if (0 == strncmp(argv[LoopIndex],"frames=",7))
+		{
+			App.FrameLog = fopen(argv[LoopIndex] + 7,"w");
+			if (NULL == App.FrameLog)
+			{
+				perror("frame log creation failed ");
+				return -1;
+			}
+		}
+		else if (0 == strncmp(argv[LoopIndex],"speed=",6))
+		{
+			/* The drivers run in real time, there is no virtual clock here */
+			App.Speed = atof(argv[LoopIndex] + 6);
+			if (App.Speed <= 0)
+			{
+				return -1;
+			}
 		}
 		else
 		{
-			/* No obstacle with in the scan area, hence send full run sequence */
-			write(FdDisplay,&DisplaySequenceRun,sizeof(DisplaySequenceRun));
+			printf("\n unknown option %s",argv[LoopIndex]);
+			return -1;
 		}
-	}while(0 == (*((unsigned char *)TimeoutFlagLocal)));
-
-#ifdef DEBUG
-	printf("\n Display programmed %i \n",Result);
-#endif
-    return NULL;
+	}
+	return 0;
 }
 
 /* *********************************************************************
  * NAME:             main
  * CALLED BY:        user call this app on the terminal
  * DESCRIPTION:      User test application to test distance measurement
- *                   sensor and 8x8 matrix display
- * INPUT PARAMETERS: None
+ *                   sensor and 8x8 matrix display. A single thread
+ *                   sleeps in epoll_wait until a sample is ready, the
+ *                   display is free or the run time is over. A replay
+ *                   goes through the drivers in the same way and ends
+ *                   with the trace.
+ * INPUT PARAMETERS: argc, argv : options, see AppOptions
  * RETURN VALUES:    int : status - Fail/Pass(0) 
  ***********************************************************************/
-int main()
+int main(int argc, char *argv[])
 {
-    pthread_t DistanceMeasurementThreadId, CollisionAvoidanceTaskId, ESPDisplayTaskId, BoxDisplayTaskId;
-    
-    /* Testing sensor : Start distance measurement thread to see the distance meeasured on theconsole */
-    pthread_create(&DistanceMeasurementThreadId,NULL,&DistanceMeasurementTask,&TimeoutFlag);
-    /* Testing Display : start the display moving "ESP" */
-    pthread_create(&ESPDisplayTaskId,NULL,&ESPDisplayTask,&TimeoutFlag);
-    /* Wait for the ESP to end */
-	pthread_join(ESPDisplayTaskId, NULL);
-	/* Testing Distance controlled display : Start the car collision avoidance TASK */
-    pthread_create(&CollisionAvoidanceTaskId,NULL,&CollisionAvoidanceTask,&TimeoutFlag);
-    /* Total time for which this application should read */
-    usleep(PROGRAM_RUN_TIME);
-    /* Stop distance measurement and display*/
-    TimeoutFlag = 1;
-	printf("\nWaiting for Distance measurement and display thread to stop \n");
-	pthread_join(DistanceMeasurementThreadId, NULL);
-	pthread_join(CollisionAvoidanceTaskId, NULL);
+	struct epoll_event Events[EVENT_LOOP_EVENTS];
+	int Count, LoopIndex;
+
+	App.FdPulse = App.FdDisplay = App.PulseTickFd = App.DisplayTickFd = App.RunEndFd = App.ReplayFd = -1;
+	if (AppOptions(argc,argv) < 0)
+	{
+		printf("\n usage: %s [record=<file>] [replay=<trace>] [speed=<factor>] [frames=<file>]\n",argv[0]);
+		AppCleanup();
+		return 1;
+	}
+	App.Phase = PHASE_ESP;
+	/* No obstacle until the first distance is measured */
+	App.Distance.DistanceMm = 800;
+	App.EpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (App.EpollFd < 0)
+	{
+		perror("epoll creation failed ");
+		return 1;
+	}
+    /* Testing sensor : the driver triggers the sensor on its own at the measurement rate, unless a trace is replayed */
+    App.FdPulse = open("/dev/pulse",O_RDWR | O_NONBLOCK);
+	if ((App.FdPulse < 0) ||
+	    ((0 == App.Replay.Count) && (ioctl(App.FdPulse,PULSE_IOC_START,DISTANCE_MEASUTEMENT_RATE) < 0)))
+	{
+		printf("\n pulse continuous mode could not be started");
+		AppCleanup();
+		return 1;
+	}
+    App.FdDisplay = open("/dev/spi_led",O_RDWR | O_NONBLOCK);
+	if ((App.FdDisplay < 0) || (CarDisplaySetup() < 0))
+	{
+		printf("\n spi_led driver file open failed");
+		AppCleanup();
+		return 1;
+	}
+	/* Without poll support the pulse driver is read at the measurement rate */
+	if ((EventLoopWatch(App.FdPulse,EPOLLIN,EVENT_PULSE,EVENT_PULSE_TICK,
+	                    1000 / DISTANCE_MEASUTEMENT_RATE,&App.PulseTickFd) < 0) ||
+	    (EventLoopWatch(App.FdDisplay,EPOLLIN,EVENT_DISPLAY,EVENT_DISPLAY_TICK,
+	                    POLL_FALLBACK_PERIOD_MS,&App.DisplayTickFd) < 0))
+	{
+		AppCleanup();
+		return 1;
+	}
+    /* Testing Display : the display moving "ESP", then the car collision avoidance */
+	if (0 == App.Replay.Count)
+	{
+		ESPDisplayStart();
+	}
+	else if (ReplayStart() < 0)
+	{
+		AppCleanup();
+		return 1;
+	}
+	while (PHASE_DONE != App.Phase)
+	{
+		Count = epoll_wait(App.EpollFd,Events,EVENT_LOOP_EVENTS,-1);
+		if (Count < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			perror("epoll wait failed ");
+			break;
+		}
+		App.Wakeups++;
+		for (LoopIndex = 0; LoopIndex < Count; LoopIndex++)
+		{
+			switch (Events[LoopIndex].data.u32)
+			{
+				case EVENT_PULSE_TICK:
+					TimerFdAck(App.PulseTickFd);
+					DistanceMeasurementEvent();
+					break;
+				case EVENT_PULSE:
+					DistanceMeasurementEvent();
+					break;
+				case EVENT_DISPLAY_TICK:
+					TimerFdAck(App.DisplayTickFd);
+					DisplayEvent();
+					break;
+				case EVENT_DISPLAY:
+					DisplayEvent();
+					break;
+				case EVENT_REPLAY:
+					ReplayEvent();
+					break;
+				case EVENT_RUN_END:
+					/* Stop distance measurement and display */
+					TimerFdAck(App.RunEndFd);
+					App.Phase = PHASE_DONE;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	AppCleanup();
+	LatencyReport();
 	return 0;
 }
@@ -23,6 +23,7 @@
 #include <linux/device.h>
 #include <linux/init.h>
 #include <asm/msr.h>
+#include <asm/cpufeature.h>
 #include <linux/gpio.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
@@ -32,13 +33,29 @@
 #include <linux/irq.h>
 #include <linux/interrupt.h>
 #include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include "pulse.h"
+#define CREATE_TRACE_POINTS
+#include "pulse_trace.h"
 
 //#define DEBUG
 /*
- * Number of devices that are need to be created by the driver at the end of the
- * driver initialization using udev
+ * Most sensors the driver can handle. PulseCount of them are created at the
+ * end of the driver initialization using udev
  */
-#define NUMBER_OF_DEVICES   1
+#define NUMBER_OF_DEVICES   4
 
 /*
  * driver name
@@ -50,13 +67,50 @@
  */
 #define DEVICE_NAME_LENGTH   20
 /*
- * This is the clock frequency at which the CPU is running. This is used
- * for converting cpu ticks to micro seconds.
- * It has been defined with the clock frequency of the Intel Galileo
- * Quark processor. If you are running on other processor please change
- * accordingy
+ * Time the TSC is measured against the monotonic clock at load, when the
+ * TSC timing backend is selected
  */
-#define CPU_FREQ_MHZ 399.088
+#define PULSE_TSC_CALIBRATION_MS   100
+
+/*
+ * Width of the trigger pulse, the sensor needs at least 10us
+ */
+#define PULSE_TRIGGER_US   15
+
+/*
+ * Quiet time after an echo before the next sensor is triggered, so that
+ * late reflections of one sensor are not heard by the next one
+ */
+#define PULSE_GUARD_US   2000
+
+/*
+ * Delay between the end of the trigger and the rising echo of the
+ * simulated sensor, about what the HC-SR04 takes to send its burst
+ */
+#define PULSE_SIM_ECHO_DELAY_US   450
+
+/*
+ * Samples buffered by the continuous mode, must be a power of two. When
+ * the fifo is full the oldest sample is dropped.
+ */
+#define PULSE_FIFO_SAMPLES   64
+
+/*
+ * Echo edges the hard irq handler can queue for the irq thread, must be a
+ * power of two
+ */
+#define PULSE_EDGE_FIFO_EDGES   8
+
+/*
+ * Samples copied to user space per fifo access in read()
+ */
+#define PULSE_READ_BATCH   8
+
+/*
+ * Outliers dropped in a row before the filter takes them as a real change
+ * of distance and starts again
+ */
+#define PULSE_FILTER_MAX_REJECTS   3
 
 /* uint8 and unsigned char are used interchangeably in the program */
 typedef unsigned char uint8;
@@ -70,76 +124,1239 @@ typedef enum MesurementEdge_Tag {
 	FALLING
 }MesurementEdge_Type;
 
-/* Device structure */
+/* Echo edge taken by the hard irq handler */
+typedef struct PulseEdgeTag
+{
+	u64 Counter; /* Count of the timing backend at the edge */
+	int Level; /* Echo line after the edge, 1 for a rising edge */
+}PulseEdgeType;
+
+/*
+ * Timing backend used to timestamp the echo edges. Read returns a raw
+ * count and ToNs converts the difference of two counts to nano seconds.
+ */
+typedef struct PulseClockTag
+{
+	const char *Name; /* Shown in the statistics */
+	u64 (*Read)(void); /* Current count, callable from the irq handler */
+	u64 (*ToNs)(u64 Delta); /* Count difference to nano seconds */
+}PulseClockType;
+
+/* What the scheduler timer does when it fires next */
+typedef enum PulseTimerPhase_Tag {
+	PULSE_PHASE_TRIGGER, /* Raise the trigger of the next sensor that is due */
+	PULSE_PHASE_TRIGGER_END, /* Drop the trigger and open the echo window */
+	PULSE_PHASE_ECHO /* Echo window over without echo */
+}PulseTimerPhase_Type;
+
+/*
+ * Filter of the continuous mode. Every step costs the same whatever the
+ * number of samples: the median window is sorted by insertion and the
+ * tracker works on micro metres in 64 bit integers.
+ */
+typedef struct PulseFilterTag
+{
+	s32 Window[PULSE_FILTER_MEDIAN_SAMPLES]; /* Accepted distances, oldest replaced first */
+	s32 Sorted[PULSE_FILTER_MEDIAN_SAMPLES]; /* Same distances in ascending order */
+	unsigned int Count; /* Distances in the window */
+	unsigned int Head; /* Slot of Window replaced next */
+	s64 PositionUm; /* Estimated distance */
+	s64 VelocityUmPerSec; /* Estimated speed */
+	unsigned int Rejects; /* Outliers dropped in a row */
+	PulseFilteredType Output; /* Estimate given to user space */
+}PulseFilterType;
+
+/*
+ * Event counters of a sensor. They are bumped from the hard irq, the irq
+ * thread, the scheduler timer and the on demand thread, so every cpu counts
+ * in its own copy without a lock or an atomic operation, and the readers
+ * add the copies up.
+ */
+typedef enum PulseCounter_Tag {
+	PULSE_CNT_SAMPLES, /* Samples put in the fifo */
+	PULSE_CNT_TIMEOUTS, /* Triggers without echo */
+	PULSE_CNT_COLLISIONS, /* Echoes seen while the sensor was not triggered */
+	PULSE_CNT_FIFO_OVERRUNS, /* Samples dropped because the fifo was full */
+	PULSE_CNT_TRIGGERS_LATE, /* Triggers sent more than an echo window after they were due */
+	PULSE_CNT_EDGES_MISSED, /* Edges lost because EdgeFifo was full */
+	PULSE_CNT_EDGES_UNPAIRED, /* Rising edges without falling edge and the other way round */
+	PULSE_CNT_MEASUREMENT_TIMEOUTS, /* On demand measurements without echo */
+	PULSE_CNT_INJECTED, /* Recorded samples replayed with PULSE_IOC_INJECT */
+	PULSE_COUNTERS
+}PulseCounter_Type;
+
+/* Names of the counters in debugfs, in PulseCounter_Type order */
+static const char *const PulseCounterNames[PULSE_COUNTERS] = {
+	"samples", "timeouts", "collisions", "fifo_overruns", "triggers_late", "edges_missed",
+	"edges_unpaired", "measurement_timeouts", "injected"
+};
+
+/* Copy of the counters of all the sensors for one cpu */
+typedef struct PulseCountersTag
+{
+	unsigned long Count[NUMBER_OF_DEVICES][PULSE_COUNTERS]; /* Indexed by sensor and PulseCounter_Type */
+}PulseCountersType;
+
+#define PULSE_COUNT(Device, Counter) this_cpu_inc(PulseCounters->Count[(Device)->Index][Counter])
+
+/* Device structure, one per sensor */
 typedef struct PulseDevTag
 {
 	struct cdev cdev; /* cdev structure */
 	char name[DEVICE_NAME_LENGTH];   /* Driver Name */
+	unsigned int Index; /* Sensor number, minor number of the device */
+	int TriggerGpio; /* Trigger output of the sensor */
+	int EchoGpio; /* Echo input of the sensor */
+	int TriggerMuxGpio; /* Galileo mux enabling the trigger pin, -1 if none */
+	int EchoMuxGpio; /* Galileo mux enabling the echo pin, -1 if none */
+	int EchoIrq; /* Irq of the echo input */
+	struct task_struct *MeasurementTask; /* Thread of an on demand measurement */
 	MesurementOperation_Type MesurementOperation; /* To store the operation status */
 	struct completion MeasurementCompletion; /* For Completion event handling */
 	unsigned long long MeasurementStartTime; /* Start time of the pulse */
 	unsigned long long MeasurementEndTime; /* End time of the pulse */
 	MesurementEdge_Type MeasurementEdge; /* Measurement edge */
+	DECLARE_KFIFO(EdgeFifo, PulseEdgeType, PULSE_EDGE_FIFO_EDGES); /* Edges not handled by the irq thread yet */
+	bool Continuous; /* Continuous mode is running */
+	ktime_t SamplePeriod; /* Time between two triggers */
+	ktime_t NextTrigger; /* Time the sensor is due for its next trigger */
+	ktime_t TriggerTime; /* Time the last trigger was raised */
+	bool EchoPending; /* Trigger sent and its echo not measured yet */
+	u32 SampleSequence; /* Triggers sent since the continuous mode started */
+	spinlock_t FifoLock; /* Protects the fifo and the echo state, taken by the irq and the timer */
+	DECLARE_KFIFO(SampleFifo, PulseSampleType, PULSE_FIFO_SAMPLES); /* Samples not read yet */
+	wait_queue_head_t SampleWaitQueue; /* read() and poll() wait here for samples */
+	unsigned long SamplesPerSecond; /* Sample rate measured over the last window */
+	unsigned long SampleRateCount; /* Samples in the current window */
+	ktime_t SampleRateStart; /* Start of the current sample rate window */
+	PulseRingType *Ring; /* vmalloc_user ring mapped by the readers, written under FifoLock */
+	struct hrtimer SimEchoTimer; /* Echo edges of the simulated sensor */
+	MesurementEdge_Type SimNextEdge; /* Next edge of the simulated echo */
+	PulseFilterType Filter; /* Filter of the samples, protected by FifoLock */
 }PulseDevType;
 
-/* the variable that contains the thread data */
-static struct task_struct *PulseMeasurementTask = NULL;
+/*
+ * Sensor input and output. The gpio backend drives the real sensors, the
+ * simulated one answers every trigger with an echo for SimDistanceMm so
+ * that the driver can be exercised without sensors or gpios.
+ */
+typedef struct PulseIoTag
+{
+	const char *Name; /* Shown in the statistics */
+	int (*Setup)(PulseDevType *Device); /* Prepares a sensor at load */
+	void (*Cleanup)(PulseDevType *Device); /* Undoes Setup at removal */
+	int (*Open)(PulseDevType *Device); /* Claims the echo input and its irq */
+	void (*Release)(PulseDevType *Device); /* Gives them back */
+	void (*Trigger)(PulseDevType *Device, int Level); /* Drives the trigger, callable from the timer */
+}PulseIoType;
+
+/*
+ * Trigger scheduler shared by all the sensors. Only one echo window is open
+ * at a time so the sensors do not hear each other. A window is closed as
+ * soon as its echo has been measured and the next sensor that is due is
+ * triggered after PULSE_GUARD_US, which keeps the total rate as high as the
+ * distances allow.
+ */
+typedef struct PulseSchedTag
+{
+	struct hrtimer Timer; /* Fires the triggers and the echo timeouts */
+	spinlock_t Lock; /* Protects the scheduler, taken before a FifoLock */
+	struct mutex ModeMutex; /* Serialises starting and stopping measurements */
+	PulseTimerPhase_Type Phase; /* Next action of the timer */
+	PulseDevType *Active; /* Sensor whose trigger or echo window is on, NULL if none */
+	unsigned int Next; /* Sensor looked at first, for round robin */
+	unsigned int Running; /* Sensors in the continuous mode */
+	bool TimerArmed; /* Timer started and not stopped yet */
+	ktime_t NotBefore; /* No trigger before the end of the guard time */
+}PulseSchedType;
+
+/*
+ * Device pointer which stores the upper layer device structure
+ */
+static PulseDevType *PulseDevMem = NULL;
+
+/* Trigger scheduler */
+static PulseSchedType PulseSched;
+
+/* Event counters of the sensors, a copy per cpu */
+static PulseCountersType __percpu *PulseCounters = NULL;
+
+/* Sensor backend in use, chosen at load */
+static const PulseIoType *PulseIo = NULL;
+
+/* Device number alloted */
+static dev_t PulseDevNumber;
+
+/* Create class and device which are required for udev */
+struct class *PulseDevClass;
+
+/* debugfs directory holding the measurement statistics */
+static struct dentry *PulseDebugDir = NULL;
+
+/*
+ * Sensor pins. The number of TriggerGpio values gives the number of
+ * sensors, sensor 0 is /dev/pulse and sensor n /dev/pulsen. The defaults
+ * are the IO2/IO3 header pins of the Galileo and their muxes.
+ */
+static unsigned int PulseCount = 1;
+static unsigned int EchoGpioCount = 1;
+static int TriggerGpio[NUMBER_OF_DEVICES] = {14, -1, -1, -1};
+static int EchoGpio[NUMBER_OF_DEVICES] = {15, -1, -1, -1};
+static int TriggerMuxGpio[NUMBER_OF_DEVICES] = {31, -1, -1, -1};
+static int EchoMuxGpio[NUMBER_OF_DEVICES] = {30, -1, -1, -1};
+module_param_array(TriggerGpio, int, &PulseCount, 0444);
+MODULE_PARM_DESC(TriggerGpio, "Trigger gpio of every sensor");
+module_param_array(EchoGpio, int, &EchoGpioCount, 0444);
+MODULE_PARM_DESC(EchoGpio, "Echo gpio of every sensor");
+module_param_array(TriggerMuxGpio, int, NULL, 0444);
+MODULE_PARM_DESC(TriggerMuxGpio, "Mux gpio driven low to route the trigger, -1 for none");
+module_param_array(EchoMuxGpio, int, NULL, 0444);
+MODULE_PARM_DESC(EchoMuxGpio, "Mux gpio driven low to route the echo, -1 for none");
+
+/*
+ * Simulated sensors, no gpio is touched
+ */
+static bool SimulatedIo = 0;
+module_param(SimulatedIo, bool, 0444);
+MODULE_PARM_DESC(SimulatedIo, "Simulate the sensors instead of using the gpios");
+
+/*
+ * Distance seen by each simulated sensor, 0 for no echo
+ */
+static int SimDistanceMm[NUMBER_OF_DEVICES] = {500, 1000, 1500, 2000};
+module_param_array(SimDistanceMm, int, NULL, 0644);
+MODULE_PARM_DESC(SimDistanceMm, "Distance seen by each simulated sensor in mm, 0 for no echo");
+
+/*
+ * Timestamp the edges with the TSC instead of the monotonic clock. The TSC
+ * is calibrated at load, and not used if its rate is not constant or if it
+ * may differ between the CPUs.
+ */
+static bool TscTiming = 0;
+module_param(TscTiming, bool, 0444);
+MODULE_PARM_DESC(TscTiming, "Timestamp echo edges with the calibrated TSC");
+
+/*
+ * Speed of sound used to turn the echo time into a distance, 343 m/s in
+ * air at 20 degree Celsius
+ */
+static unsigned int SpeedOfSoundMmPerSec = 343000;
+module_param(SpeedOfSoundMmPerSec, uint, 0644);
+MODULE_PARM_DESC(SpeedOfSoundMmPerSec, "Speed of sound in mm/s (default 343000)");
+
+/*
+ * Filter of the continuous mode. An echo further than FilterGateMm from
+ * the predicted distance is an outlier. The tracker gains are fractions
+ * of 256.
+ */
+static bool FilterEnable = 1;
+module_param(FilterEnable, bool, 0644);
+MODULE_PARM_DESC(FilterEnable, "Filter the samples of the continuous mode");
+static unsigned int FilterGateMm = 500;
+module_param(FilterGateMm, uint, 0644);
+MODULE_PARM_DESC(FilterGateMm, "Largest distance from the prediction accepted, in mm");
+static unsigned int FilterAlpha = 128;
+module_param(FilterAlpha, uint, 0644);
+MODULE_PARM_DESC(FilterAlpha, "Position gain of the tracker, out of 256");
+static unsigned int FilterBeta = 32;
+module_param(FilterBeta, uint, 0644);
+MODULE_PARM_DESC(FilterBeta, "Velocity gain of the tracker, out of 256");
+
+/* Nano seconds per TSC tick in 32.32 fixed point, set by the calibration */
+static u64 PulseTscMult = 0;
+
+/* TSC rate found by the calibration */
+static unsigned long PulseTscKhz = 0;
+
+/* *********************************************************************
+ * NAME:             PulseKtimeRead / PulseKtimeToNs
+ * CALLED BY:        Through PulseClock
+ * DESCRIPTION:      Default backend, the monotonic clock in nano seconds
+ ***********************************************************************/
+static u64 PulseKtimeRead(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static u64 PulseKtimeToNs(u64 Delta)
+{
+	return Delta;
+}
+
+/* *********************************************************************
+ * NAME:             PulseTscRead / PulseTscToNs
+ * CALLED BY:        Through PulseClock
+ * DESCRIPTION:      TSC backend, cheaper to read than the clocksource.
+ *                   The conversion is exact enough for deltas of a few
+ *                   seconds, far beyond the echo window
+ ***********************************************************************/
+static u64 PulseTscRead(void)
+{
+	u64 Counter;
+
+	rdtscll(Counter);
+	return Counter;
+}
+
+static u64 PulseTscToNs(u64 Delta)
+{
+	return (Delta * PulseTscMult) >> 32;
+}
+
+static const PulseClockType PulseKtimeClock = {
+	.Name = "ktime",
+	.Read = PulseKtimeRead,
+	.ToNs = PulseKtimeToNs,
+};
+
+static const PulseClockType PulseTscClock = {
+	.Name = "tsc",
+	.Read = PulseTscRead,
+	.ToNs = PulseTscToNs,
+};
+
+/* Backend in use, chosen at load */
+static const PulseClockType *PulseClock = &PulseKtimeClock;
+
+/* *********************************************************************
+ * NAME:             PulseTscCalibrate
+ * CALLED BY:        PulseDriverInit
+ * DESCRIPTION:      Measures the TSC against the monotonic clock
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : status - Fail/Pass(0), the TSC must not be used
+ *                   if it fails
+ ***********************************************************************/
+static int PulseTscCalibrate(void)
+{
+	u64 TscStart, TscEnd, NsStart, NsEnd;
+	unsigned long Flags;
+
+	if (!boot_cpu_has(X86_FEATURE_CONSTANT_TSC))
+	{
+		printk(KERN_INFO "pulse: TSC rate is not constant\n");
+		return -ENODEV;
+	}
+	/* Edges may be timestamped on any CPU */
+	if ((num_online_cpus() > 1) && !boot_cpu_has(X86_FEATURE_TSC_RELIABLE))
+	{
+		printk(KERN_INFO "pulse: TSC may not be synchronised between CPUs\n");
+		return -ENODEV;
+	}
+	local_irq_save(Flags);
+	rdtscll(TscStart);
+	NsStart = ktime_to_ns(ktime_get());
+	local_irq_restore(Flags);
+	msleep(PULSE_TSC_CALIBRATION_MS);
+	local_irq_save(Flags);
+	rdtscll(TscEnd);
+	NsEnd = ktime_to_ns(ktime_get());
+	local_irq_restore(Flags);
+
+	if ((TscEnd <= TscStart) || (NsEnd <= NsStart))
+	{
+		return -EINVAL;
+	}
+	PulseTscMult = div64_u64((NsEnd - NsStart) << 32,TscEnd - TscStart);
+	PulseTscKhz = div64_u64((TscEnd - TscStart) * USEC_PER_SEC,NsEnd - NsStart);
+	printk(KERN_INFO "pulse: TSC calibrated at %lu kHz\n",PulseTscKhz);
+	return (PulseTscMult) ? 0 : -EINVAL;
+}
+
+/* *********************************************************************
+ * NAME:             PulseNsToMm
+ * CALLED BY:        PulseSamplePush, PulseSimTrigger
+ * DESCRIPTION:      Distance of the obstacle for an echo time, the sound
+ *                   travels there and back
+ * INPUT PARAMETERS: WidthNs : echo width in nano seconds
+ * RETURN VALUES:    u32 : distance in milli metres
+ ***********************************************************************/
+static u32 PulseNsToMm(u32 WidthNs)
+{
+	return (u32)div_u64((u64)WidthNs * SpeedOfSoundMmPerSec,2 * NSEC_PER_SEC);
+}
+
+/* *********************************************************************
+ * NAME:             PulseEchoWidthNs
+ * CALLED BY:        PulseEchoEdge, PulseDriverRead
+ * DESCRIPTION:      Width of the last measured echo
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    u32 : echo width in nano seconds
+ ***********************************************************************/
+static u32 PulseEchoWidthNs(PulseDevType *Device)
+{
+	u64 WidthNs = PulseClock->ToNs(Device->MeasurementEndTime - Device->MeasurementStartTime);
+
+	return (WidthNs > 0xFFFFFFFFULL) ? 0xFFFFFFFF : (u32)WidthNs;
+}
+
+/* *********************************************************************
+ * NAME:             PulseTimeBefore
+ * CALLED BY:        Trigger scheduler
+ * DESCRIPTION:      Compares two points of the monotonic clock
+ * INPUT PARAMETERS: A, B : times to compare
+ * RETURN VALUES:    bool : true if A is earlier than B
+ ***********************************************************************/
+static bool PulseTimeBefore(ktime_t A, ktime_t B)
+{
+	return (ktime_to_ns(ktime_sub(A,B)) < 0);
+}
+
+/* *********************************************************************
+ * NAME:             PulseFilterReset
+ * CALLED BY:        PulseStartContinuous, PulseFilterUpdate
+ * DESCRIPTION:      Forgets the track, the outlier count is kept
+ * INPUT PARAMETERS: Filter : filter of the device
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseFilterReset(PulseFilterType *Filter)
+{
+	u32 Rejected = Filter->Output.Rejected;
+
+	memset(Filter,0,sizeof(*Filter));
+	Filter->Output.Rejected = Rejected;
+}
+
+/* *********************************************************************
+ * NAME:             PulseFilterMedian
+ * CALLED BY:        PulseFilterUpdate
+ * DESCRIPTION:      Adds a distance to the median window, replacing the
+ *                   oldest one once the window is full
+ * INPUT PARAMETERS: Filter : filter of the device
+ *                   DistanceMm : accepted distance
+ * RETURN VALUES:    s32 : median of the window
+ ***********************************************************************/
+static s32 PulseFilterMedian(PulseFilterType *Filter, s32 DistanceMm)
+{
+	unsigned int LoopIndex;
+
+	if (PULSE_FILTER_MEDIAN_SAMPLES == Filter->Count)
+	{
+		/* Take the oldest distance out of the sorted copy */
+		for (LoopIndex = 0; Filter->Sorted[LoopIndex] != Filter->Window[Filter->Head]; LoopIndex++);
+		for (; LoopIndex < (Filter->Count - 1); LoopIndex++)
+		{
+			Filter->Sorted[LoopIndex] = Filter->Sorted[LoopIndex + 1];
+		}
+		Filter->Count--;
+	}
+	Filter->Window[Filter->Head] = DistanceMm;
+	Filter->Head = (Filter->Head + 1) % PULSE_FILTER_MEDIAN_SAMPLES;
+	/* Insertion sort step */
+	for (LoopIndex = Filter->Count; (LoopIndex > 0) && (Filter->Sorted[LoopIndex - 1] > DistanceMm); LoopIndex--)
+	{
+		Filter->Sorted[LoopIndex] = Filter->Sorted[LoopIndex - 1];
+	}
+	Filter->Sorted[LoopIndex] = DistanceMm;
+	Filter->Count++;
+	return Filter->Sorted[(Filter->Count - 1) / 2];
+}
+
+/* *********************************************************************
+ * NAME:             PulseFilterUpdate
+ * CALLED BY:        PulseSamplePush, with FifoLock held
+ * DESCRIPTION:      Runs a measured distance through the filter: outlier
+ *                   gate on the predicted distance, sliding median, then
+ *                   one alpha-beta step with the velocity bounded by
+ *                   PULSE_FILTER_MAX_SPEED_MM_PER_SEC. A gap of more
+ *                   than a second between samples, or
+ *                   PULSE_FILTER_MAX_REJECTS outliers in a row,
+ *                   restarts the track
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   DistanceMm : measured distance
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseFilterUpdate(PulseDevType *Device, u32 DistanceMm)
+{
+	PulseFilterType *Filter = &(Device->Filter);
+	s64 TimestampNs = ktime_to_ns(Device->TriggerTime);
+	s64 DtNs = 0, PredictedUm = 0, ResidualUm;
+	s64 Alpha = min_t(unsigned int,ACCESS_ONCE(FilterAlpha),256);
+	s64 Beta = min_t(unsigned int,ACCESS_ONCE(FilterBeta),256);
+	s32 MedianMm;
+
+	if (Filter->Output.Accepted)
+	{
+		DtNs = TimestampNs - (s64)Filter->Output.TimestampNs;
+		if ((DtNs <= 0) || (DtNs > NSEC_PER_SEC))
+		{
+			/* Too old to predict from */
+			PulseFilterReset(Filter);
+		}
+	}
+	if (Filter->Output.Accepted)
+	{
+		PredictedUm = Filter->PositionUm + div_s64(Filter->VelocityUmPerSec * DtNs,NSEC_PER_SEC);
+		ResidualUm = (s64)DistanceMm * 1000 - PredictedUm;
+		if (abs64(ResidualUm) > ((s64)ACCESS_ONCE(FilterGateMm) * 1000))
+		{
+			if (Filter->Rejects < PULSE_FILTER_MAX_REJECTS)
+			{
+				Filter->Rejects++;
+				Filter->Output.Rejected++;
+				return;
+			}
+			/* The obstacle really moved, follow it */
+			PulseFilterReset(Filter);
+		}
+	}
+	Filter->Rejects = 0;
+	MedianMm = PulseFilterMedian(Filter,(s32)DistanceMm);
+	if (0 == Filter->Output.Accepted)
+	{
+		Filter->PositionUm = (s64)MedianMm * 1000;
+		Filter->VelocityUmPerSec = 0;
+	}
+	else
+	{
+		ResidualUm = (s64)MedianMm * 1000 - PredictedUm;
+		Filter->PositionUm = PredictedUm + ((Alpha * ResidualUm) >> 8);
+		Filter->VelocityUmPerSec += div_s64(((Beta * ResidualUm) >> 8) * NSEC_PER_SEC,(s32)DtNs);
+		Filter->VelocityUmPerSec = clamp_t(s64,Filter->VelocityUmPerSec,
+		                                   -(PULSE_FILTER_MAX_SPEED_MM_PER_SEC * 1000LL),
+		                                   PULSE_FILTER_MAX_SPEED_MM_PER_SEC * 1000LL);
+	}
+	Filter->Output.TimestampNs = TimestampNs;
+	Filter->Output.DistanceMm = (s32)div_s64(Filter->PositionUm,1000);
+	Filter->Output.VelocityMmPerSec = (s32)div_s64(Filter->VelocityUmPerSec,1000);
+	Filter->Output.Sequence = Device->SampleSequence;
+	Filter->Output.Accepted++;
+	Filter->Output.Status = PULSE_FILTER_VALID;
+}
+
+/* *********************************************************************
+ * NAME:             PulseRingPush
+ * CALLED BY:        PulseSamplePush, with FifoLock held
+ * DESCRIPTION:      Publishes a sample in the mapped ring. The layout is
+ *                   shared with user space, so the sequence count is kept
+ *                   by hand in the ring rather than with a seqcount_t
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Sample : sample to publish
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseRingPush(PulseDevType *Device, const PulseSampleType *Sample)
+{
+	PulseRingType *Ring = Device->Ring;
+	u32 Head = Ring->Head;
+
+	ACCESS_ONCE(Ring->Seq) = Ring->Seq + 1;
+	smp_wmb();
+	Ring->Sample[Head % PULSE_RING_SAMPLES] = *Sample;
+	smp_wmb();
+	ACCESS_ONCE(Ring->Head) = Head + 1;
+	smp_wmb();
+	ACCESS_ONCE(Ring->Seq) = Ring->Seq + 1;
+}
+
+/* *********************************************************************
+ * NAME:             PulseSamplePush
+ * CALLED BY:        PulseEchoEdge, PulseEchoTimeout
+ * DESCRIPTION:      Puts a sample of the current trigger in the fifo,
+ *                   dropping the oldest one if it is full, and in the
+ *                   mapped ring. Must be called
+ *                   with FifoLock held
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   WidthNs : echo width in nano seconds
+ *                   Status : PULSE_SAMPLE_*
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseSamplePush(PulseDevType *Device, u32 WidthNs, u32 Status)
+{
+	PulseSampleType Sample;
+	s64 WindowNs;
+
+	Sample.TimestampNs = ktime_to_ns(Device->TriggerTime);
+	Sample.WidthNs = WidthNs;
+	Sample.Status = Status;
+	Sample.Sequence = Device->SampleSequence;
+	Sample.DistanceMm = PulseNsToMm(WidthNs);
+	/* A control loop wants the newest samples */
+	if (kfifo_is_full(&(Device->SampleFifo)))
+	{
+		kfifo_skip(&(Device->SampleFifo));
+		PULSE_COUNT(Device,PULSE_CNT_FIFO_OVERRUNS);
+	}
+	kfifo_put(&(Device->SampleFifo),&Sample);
+	PulseRingPush(Device,&Sample);
+	PULSE_COUNT(Device,PULSE_CNT_SAMPLES);
+	if (PULSE_SAMPLE_OK == Status)
+	{
+		trace_pulse_sample(Device->Index,Sample.Sequence,WidthNs,Sample.DistanceMm);
+	}
+	if ((PULSE_SAMPLE_OK == Status) && ACCESS_ONCE(FilterEnable))
+	{
+		PulseFilterUpdate(Device,Sample.DistanceMm);
+	}
+
+	/* Sample rate of the channel, latched once every second */
+	Device->SampleRateCount++;
+	WindowNs = ktime_to_ns(ktime_sub(ktime_get(),Device->SampleRateStart));
+	if (WindowNs >= NSEC_PER_SEC)
+	{
+		Device->SamplesPerSecond = div64_u64((u64)Device->SampleRateCount * NSEC_PER_SEC,WindowNs);
+		Device->SampleRateCount = 0;
+		Device->SampleRateStart = ktime_get();
+	}
+}
+
+/* *********************************************************************
+ * NAME:             PulseSchedEchoDone
+ * CALLED BY:        PulseEchoEdge
+ * DESCRIPTION:      Closes the echo window of a sensor whose echo has
+ *                   been measured, the next sensor is triggered after the
+ *                   guard time instead of at the end of the window
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseSchedEchoDone(PulseDevType *Device)
+{
+	unsigned long Flags;
+	ktime_t NotBefore;
+	bool Restart = 0;
+
+	spin_lock_irqsave(&(PulseSched.Lock),Flags);
+	/* An echo before the end of the trigger is handled by the timer */
+	if ((Device == PulseSched.Active) && (PULSE_PHASE_ECHO == PulseSched.Phase))
+	{
+		PulseSched.Active = NULL;
+		PulseSched.Phase = PULSE_PHASE_TRIGGER;
+		PulseSched.NotBefore = ktime_add_us(ktime_get(),PULSE_GUARD_US);
+		NotBefore = PulseSched.NotBefore;
+		Restart = 1;
+	}
+	spin_unlock_irqrestore(&(PulseSched.Lock),Flags);
+	/* A running timer callback sees the new phase by itself */
+	if ((Restart) && (hrtimer_try_to_cancel(&(PulseSched.Timer)) >= 0))
+	{
+		hrtimer_start(&(PulseSched.Timer),NotBefore,HRTIMER_MODE_ABS);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             PulseEchoEdge
+ * CALLED BY:        PulseEchoIrqThread, PulseSimEchoTimer
+ * DESCRIPTION:      Takes an edge of the echo of a sensor. The falling
+ *                   edge completes the measurement, an echo the sensor
+ *                   was not triggered for is counted as a collision and
+ *                   an edge that does not follow the other kind of edge
+ *                   as unpaired
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Counter : count of the timing backend at the edge
+ *                   Level : echo line after the edge
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseEchoEdge(PulseDevType *Device, u64 Counter, int Level)
+{
+	unsigned long Flags;
+	bool Done = 0;
+
+	/* The scheduler may reset the edge of a lost echo */
+	if (Level)
+	{
+		trace_pulse_echo_rise(Device->Index,Counter);
+	}
+	else
+	{
+		trace_pulse_echo_fall(Device->Index,Counter);
+	}
+	spin_lock_irqsave(&(Device->FifoLock),Flags);
+	if (Level)
+	{
+		/* The falling edge of the previous echo was lost */
+		if (FALLING == Device->MeasurementEdge)
+		{
+			PULSE_COUNT(Device,PULSE_CNT_EDGES_UNPAIRED);
+		}
+		/* Most likely the echo of another sensor */
+		if ((Device->Continuous) && !(Device->EchoPending))
+		{
+			PULSE_COUNT(Device,PULSE_CNT_COLLISIONS);
+		}
+		Device->MeasurementStartTime = Counter;
+		Device->MeasurementEdge = FALLING;
+	}
+	else if (RISING == Device->MeasurementEdge)
+	{
+		/* No start time to measure from */
+		PULSE_COUNT(Device,PULSE_CNT_EDGES_UNPAIRED);
+	}
+	else
+	{
+		Device->MeasurementEndTime = Counter;
+		Device->MeasurementEdge = RISING;
+		/* Pulse measurment is complete at this point */
+		if (Device->Continuous)
+		{
+			/* An edge left over from a timed out trigger is not a sample */
+			if (Device->EchoPending)
+			{
+				Device->EchoPending = 0;
+				PulseSamplePush(Device,PulseEchoWidthNs(Device),PULSE_SAMPLE_OK);
+				Done = 1;
+			}
+		}
+		else
+		{
+			complete(&(Device->MeasurementCompletion));
+		}
+	}
+	spin_unlock_irqrestore(&(Device->FifoLock),Flags);
+	if (Done)
+	{
+		wake_up_interruptible(&(Device->SampleWaitQueue));
+		PulseSchedEchoDone(Device);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             PulseEchoIrqHandler
+ * CALLED BY:        interrupt service routine, on both edges of the echo
+ * DESCRIPTION:      Takes the time stamp of the edge and the level of the
+ *                   echo line, which tells the rising edge from the
+ *                   falling one. Everything else is left to the irq thread
+ * INPUT PARAMETERS: IrqNumber : Irq number of this interrupt
+ *                   dev:device structure pointer
+ * RETURN VALUES:    irqreturn_t : IRQ_WAKE_THREAD
+ ***********************************************************************/
+static irqreturn_t PulseEchoIrqHandler(int IrqNumber, void *dev)
+{
+    PulseDevType *Device = dev;
+    PulseEdgeType Edge;
+
+    /* Timestamp first */
+    Edge.Counter = PulseClock->Read();
+    Edge.Level = gpio_get_value(Device->EchoGpio);
+    /* Only this handler puts edges in, only the irq thread takes them out */
+    if (!kfifo_put(&(Device->EdgeFifo),&Edge))
+    {
+		PULSE_COUNT(Device,PULSE_CNT_EDGES_MISSED);
+	}
+	return IRQ_WAKE_THREAD;
+}
+
+/* *********************************************************************
+ * NAME:             PulseEchoIrqThread
+ * CALLED BY:        irq thread, after PulseEchoIrqHandler
+ * DESCRIPTION:      Pairs the queued edges into echo measurements
+ * INPUT PARAMETERS: IrqNumber : Irq number of this interrupt
+ *                   dev:device structure pointer
+ * RETURN VALUES:    irqreturn_t : IRQ_HANDLED
+ ***********************************************************************/
+static irqreturn_t PulseEchoIrqThread(int IrqNumber, void *dev)
+{
+	PulseDevType *Device = dev;
+	PulseEdgeType Edge;
+
+	while (kfifo_get(&(Device->EdgeFifo),&Edge))
+	{
+		PulseEchoEdge(Device,Edge.Counter,Edge.Level);
+	}
+	return IRQ_HANDLED;
+}
+
+/* *********************************************************************
+ * NAME:             PulseGpioSetup / PulseGpioCleanup
+ * CALLED BY:        Through PulseIo, at load and removal
+ * DESCRIPTION:      Claims the trigger output of a sensor and the muxes
+ *                   routing its pins to the header
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseGpioSetup(PulseDevType *Device)
+{
+	int Ret;
+
+	Ret = gpio_request_one(Device->TriggerGpio,GPIOF_OUT_INIT_LOW,Device->name);
+	if (Ret)
+	{
+		printk(KERN_INFO "%s: trigger gpio %d not available\n",Device->name,Device->TriggerGpio);
+		return Ret;
+	}
+	if ((Device->TriggerMuxGpio >= 0) &&
+	    (Ret = gpio_request_one(Device->TriggerMuxGpio,GPIOF_OUT_INIT_LOW,Device->name)))
+	{
+		gpio_free(Device->TriggerGpio);
+		return Ret;
+	}
+	if ((Device->EchoMuxGpio >= 0) &&
+	    (Ret = gpio_request_one(Device->EchoMuxGpio,GPIOF_OUT_INIT_LOW,Device->name)))
+	{
+		if (Device->TriggerMuxGpio >= 0)
+		{
+			gpio_free(Device->TriggerMuxGpio);
+		}
+		gpio_free(Device->TriggerGpio);
+		return Ret;
+	}
+	return 0;
+}
+
+static void PulseGpioCleanup(PulseDevType *Device)
+{
+	if (Device->EchoMuxGpio >= 0)
+	{
+		gpio_free(Device->EchoMuxGpio);
+	}
+	if (Device->TriggerMuxGpio >= 0)
+	{
+		gpio_free(Device->TriggerMuxGpio);
+	}
+	gpio_free(Device->TriggerGpio);
+}
+
+/* *********************************************************************
+ * NAME:             PulseGpioOpen / PulseGpioRelease
+ * CALLED BY:        Through PulseIo, from PulseDriverOpen and
+ *                   PulseDriverRelease
+ * DESCRIPTION:      Claims the echo input and its irq while the device
+ *                   is open
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseGpioOpen(PulseDevType *Device)
+{
+	int Ret;
+
+	Ret = gpio_request_one(Device->EchoGpio,GPIOF_IN,Device->name);
+	if (Ret)
+	{
+		return Ret;
+	}
+	Device->EchoIrq = gpio_to_irq(Device->EchoGpio);
+	if (Device->EchoIrq < 0)
+	{
+		gpio_free(Device->EchoGpio);
+		return Device->EchoIrq;
+	}
+#ifdef DEBUG
+    printk(KERN_INFO "\n Registering IRQ handler %i \n",Device->EchoIrq);
+#endif
+	Device->MeasurementEdge = RISING;
+	kfifo_reset(&(Device->EdgeFifo));
+	/* Both edges, the level of the line tells them apart */
+	Ret = request_threaded_irq(Device->EchoIrq,&PulseEchoIrqHandler,&PulseEchoIrqThread,
+	                           IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,Device->name,Device);
+	if (Ret)
+	{
+		printk(KERN_INFO "\n %s Irq Request failed ",Device->name);
+		gpio_free(Device->EchoGpio);
+	}
+	return Ret;
+}
+
+static void PulseGpioRelease(PulseDevType *Device)
+{
+	free_irq(Device->EchoIrq,Device);
+	gpio_free(Device->EchoGpio);
+}
+
+/* *********************************************************************
+ * NAME:             PulseGpioTrigger
+ * CALLED BY:        Through PulseIo
+ * DESCRIPTION:      Drives the trigger
+ ***********************************************************************/
+static void PulseGpioTrigger(PulseDevType *Device, int Level)
+{
+	gpio_set_value(Device->TriggerGpio,Level);
+}
+
+/* *********************************************************************
+ * NAME:             PulseSimEchoTimer
+ * CALLED BY:        hrtimer, when a simulated sensor has been triggered
+ * DESCRIPTION:      Gives the rising edge of the echo and then its falling
+ *                   edge after the round trip to SimDistanceMm
+ * INPUT PARAMETERS: Timer : SimEchoTimer of the device
+ * RETURN VALUES:    enum hrtimer_restart : HRTIMER_RESTART for the
+ *                   falling edge
+ ***********************************************************************/
+static enum hrtimer_restart PulseSimEchoTimer(struct hrtimer *Timer)
+{
+	PulseDevType *Device = container_of(Timer, PulseDevType, SimEchoTimer);
+	u64 WidthNs;
+
+	PulseEchoEdge(Device,PulseClock->Read(),(RISING == Device->SimNextEdge));
+	if (FALLING == Device->SimNextEdge)
+	{
+		return HRTIMER_NORESTART;
+	}
+	Device->SimNextEdge = FALLING;
+	WidthNs = div_u64((u64)ACCESS_ONCE(SimDistanceMm[Device->Index]) * 2 * NSEC_PER_SEC,SpeedOfSoundMmPerSec);
+	hrtimer_forward_now(Timer,ns_to_ktime(WidthNs));
+	return HRTIMER_RESTART;
+}
+
+/* *********************************************************************
+ * NAME:             PulseSimSetup / PulseSimCleanup / PulseSimOpen /
+ *                   PulseSimRelease / PulseSimTrigger
+ * CALLED BY:        Through PulseIo
+ * DESCRIPTION:      Simulated sensor. The end of the trigger starts the
+ *                   echo timer, a distance of 0 or beyond the echo window
+ *                   gives no echo
+ ***********************************************************************/
+static int PulseSimSetup(PulseDevType *Device)
+{
+	hrtimer_init(&(Device->SimEchoTimer),CLOCK_MONOTONIC,HRTIMER_MODE_REL);
+	Device->SimEchoTimer.function = &PulseSimEchoTimer;
+	return 0;
+}
+
+static void PulseSimCleanup(PulseDevType *Device)
+{
+	hrtimer_cancel(&(Device->SimEchoTimer));
+}
+
+static int PulseSimOpen(PulseDevType *Device)
+{
+	Device->MeasurementEdge = RISING;
+	return 0;
+}
+
+static void PulseSimRelease(PulseDevType *Device)
+{
+	hrtimer_cancel(&(Device->SimEchoTimer));
+}
+
+static void PulseSimTrigger(PulseDevType *Device, int Level)
+{
+	int DistanceMm = ACCESS_ONCE(SimDistanceMm[Device->Index]);
+
+	if ((0 == Level) && (DistanceMm > 0) &&
+	    (PulseNsToMm(PULSE_ECHO_WINDOW_US * NSEC_PER_USEC) > (u32)DistanceMm))
+	{
+		Device->SimNextEdge = RISING;
+		hrtimer_start(&(Device->SimEchoTimer),ktime_set(0,PULSE_SIM_ECHO_DELAY_US * NSEC_PER_USEC),HRTIMER_MODE_REL);
+	}
+}
+
+static const PulseIoType PulseGpioIo = {
+	.Name = "gpio",
+	.Setup = PulseGpioSetup,
+	.Cleanup = PulseGpioCleanup,
+	.Open = PulseGpioOpen,
+	.Release = PulseGpioRelease,
+	.Trigger = PulseGpioTrigger,
+};
+
+static const PulseIoType PulseSimIo = {
+	.Name = "simulated",
+	.Setup = PulseSimSetup,
+	.Cleanup = PulseSimCleanup,
+	.Open = PulseSimOpen,
+	.Release = PulseSimRelease,
+	.Trigger = PulseSimTrigger,
+};
+
+/* *********************************************************************
+ * NAME:             PulseEchoArm
+ * CALLED BY:        PulseSchedTrigger
+ * DESCRIPTION:      Prepares a sensor for the echo of the trigger about
+ *                   to be sent
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Now : time of the trigger
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseEchoArm(PulseDevType *Device, ktime_t Now)
+{
+	unsigned long Flags;
+
+	spin_lock_irqsave(&(Device->FifoLock),Flags);
+	/* The falling edge of a lost echo never came, wait for a rising edge again */
+	if (FALLING == Device->MeasurementEdge)
+	{
+		Device->MeasurementEdge = RISING;
+	}
+	Device->EchoPending = 1;
+	Device->SampleSequence++;
+	Device->TriggerTime = Now;
+	spin_unlock_irqrestore(&(Device->FifoLock),Flags);
+}
+
+/* *********************************************************************
+ * NAME:             PulseEchoTimeout
+ * CALLED BY:        PulseSchedTimer
+ * DESCRIPTION:      Reports a trigger whose echo window ended without
+ *                   echo as a timeout sample
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    bool : true if a sample was added
+ ***********************************************************************/
+static bool PulseEchoTimeout(PulseDevType *Device)
+{
+	unsigned long Flags;
+	bool Pushed = 0;
+
+	spin_lock_irqsave(&(Device->FifoLock),Flags);
+	if (Device->EchoPending)
+	{
+		Device->EchoPending = 0;
+		trace_pulse_timeout(Device->Index,Device->SampleSequence);
+		PulseSamplePush(Device,0,PULSE_SAMPLE_TIMEOUT);
+		PULSE_COUNT(Device,PULSE_CNT_TIMEOUTS);
+		Pushed = 1;
+	}
+	spin_unlock_irqrestore(&(Device->FifoLock),Flags);
+	return Pushed;
+}
+
+/* *********************************************************************
+ * NAME:             PulseSchedTrigger
+ * CALLED BY:        PulseSchedTimer, with the scheduler lock held
+ * DESCRIPTION:      Raises the trigger of the next sensor that is due,
+ *                   looking at the sensors round robin so that none of
+ *                   them starves the others
+ * INPUT PARAMETERS: Now : current time
+ * RETURN VALUES:    ktime_t : next expiry of the scheduler timer
+ ***********************************************************************/
+static ktime_t PulseSchedTrigger(ktime_t Now)
+{
+	PulseDevType *Device = NULL;
+	ktime_t Earliest = Now;
+	bool EarliestSet = 0;
+	unsigned int LoopIndex;
+
+	if (PulseTimeBefore(Now,PulseSched.NotBefore))
+	{
+		return PulseSched.NotBefore;
+	}
+	for (LoopIndex = 0; LoopIndex < PulseCount; LoopIndex++)
+	{
+		Device = &PulseDevMem[(PulseSched.Next + LoopIndex) % PulseCount];
+		if (!(Device->Continuous))
+		{
+			continue;
+		}
+		if (!PulseTimeBefore(Now,Device->NextTrigger))
+		{
+			break;
+		}
+		if (!(EarliestSet) || PulseTimeBefore(Device->NextTrigger,Earliest))
+		{
+			Earliest = Device->NextTrigger;
+			EarliestSet = 1;
+		}
+		Device = NULL;
+	}
+	if (NULL == Device)
+	{
+		/* Nobody is due, sleep until the first one is */
+		return Earliest;
+	}
+	PulseSched.Next = (Device->Index + 1) % PulseCount;
+	if (PulseTimeBefore(ktime_add_us(Device->NextTrigger,PULSE_ECHO_WINDOW_US),Now))
+	{
+		/* The other sensors held this one back, start a new period */
+		PULSE_COUNT(Device,PULSE_CNT_TRIGGERS_LATE);
+		Device->NextTrigger = ktime_add(Now,Device->SamplePeriod);
+	}
+	else
+	{
+		Device->NextTrigger = ktime_add(Device->NextTrigger,Device->SamplePeriod);
+	}
+	PulseEchoArm(Device,Now);
+	trace_pulse_trigger(Device->Index,Device->SampleSequence);
+	PulseIo->Trigger(Device,1);
+	PulseSched.Active = Device;
+	PulseSched.Phase = PULSE_PHASE_TRIGGER_END;
+	return ktime_add_us(Now,PULSE_TRIGGER_US);
+}
+
+/* *********************************************************************
+ * NAME:             PulseSchedTimer
+ * CALLED BY:        hrtimer, while a sensor is in the continuous mode
+ * DESCRIPTION:      Triggers the sensors one after the other. Each trigger
+ *                   is followed by the echo window of that sensor, which
+ *                   ends early when the echo has been measured
+ * INPUT PARAMETERS: Timer : scheduler timer
+ * RETURN VALUES:    enum hrtimer_restart : HRTIMER_NORESTART once no
+ *                   sensor is left in the continuous mode
+ ***********************************************************************/
+static enum hrtimer_restart PulseSchedTimer(struct hrtimer *Timer)
+{
+	PulseDevType *Device;
+	PulseDevType *Wake = NULL;
+	unsigned long Flags;
+	ktime_t Now, Expires;
+
+	spin_lock_irqsave(&(PulseSched.Lock),Flags);
+	if (0 == PulseSched.Running)
+	{
+		PulseSched.TimerArmed = 0;
+		spin_unlock_irqrestore(&(PulseSched.Lock),Flags);
+		return HRTIMER_NORESTART;
+	}
+	Now = ktime_get();
+	Device = PulseSched.Active;
+	if ((NULL == Device) && (PULSE_PHASE_TRIGGER != PulseSched.Phase))
+	{
+		/* The active sensor was stopped */
+		PulseSched.Phase = PULSE_PHASE_TRIGGER;
+	}
+	switch (PulseSched.Phase)
+	{
+	case PULSE_PHASE_TRIGGER_END:
+		PulseIo->Trigger(Device,0);
+		if (ACCESS_ONCE(Device->EchoPending))
+		{
+			PulseSched.Phase = PULSE_PHASE_ECHO;
+			Expires = ktime_add_us(Device->TriggerTime,PULSE_ECHO_WINDOW_US);
+			break;
+		}
+		/* Echo already measured, close the window */
+		PulseSched.Active = NULL;
+		PulseSched.Phase = PULSE_PHASE_TRIGGER;
+		PulseSched.NotBefore = ktime_add_us(Now,PULSE_GUARD_US);
+		Expires = PulseSched.NotBefore;
+		break;
+
+	case PULSE_PHASE_ECHO:
+		if (PulseEchoTimeout(Device))
+		{
+			Wake = Device;
+		}
+		PulseSched.Active = NULL;
+		PulseSched.Phase = PULSE_PHASE_TRIGGER;
+		PulseSched.NotBefore = ktime_add_us(Now,PULSE_GUARD_US);
+		Expires = PulseSched.NotBefore;
+		break;
 
-/*
- * Device pointer which stores the upper layer device structure
- */
-static PulseDevType *PulseDevMem = NULL;
+	default:
+		Expires = PulseSchedTrigger(Now);
+		break;
+	}
+	hrtimer_set_expires(Timer,Expires);
+	spin_unlock_irqrestore(&(PulseSched.Lock),Flags);
+	if (Wake)
+	{
+		wake_up_interruptible(&(Wake->SampleWaitQueue));
+	}
+	return HRTIMER_RESTART;
+}
 
-/* Device number alloted */
-static dev_t PulseDevNumber;
+/* *********************************************************************
+ * NAME:             PulseStartContinuous
+ * CALLED BY:        PulseDriverIoctl
+ * DESCRIPTION:      Adds a sensor to the trigger scheduler, or changes its
+ *                   rate if it is already there. Must be called with
+ *                   ModeMutex held
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   RateHz : triggers per second
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseStartContinuous(PulseDevType *Device, unsigned long RateHz)
+{
+	unsigned long Flags;
+	bool StartTimer = 0;
 
-/* Create class and device which are required for udev */
-struct class *PulseDevClass;
-static struct device *PulseDevName;
+	if ((RateHz < PULSE_MIN_RATE_HZ) || (RateHz > PULSE_MAX_RATE_HZ))
+	{
+		return -EINVAL;
+	}
+	if (ONGOING == Device->MesurementOperation)
+	{
+		return -EBUSY;
+	}
+	spin_lock_irqsave(&(PulseSched.Lock),Flags);
+	/* The new period applies from the next trigger on */
+	Device->SamplePeriod = ns_to_ktime(div_u64(NSEC_PER_SEC,RateHz));
+	if (!(Device->Continuous))
+	{
+		spin_lock(&(Device->FifoLock));
+		kfifo_reset(&(Device->SampleFifo));
+		memset(&(Device->Filter),0,sizeof(Device->Filter));
+		Device->EchoPending = 0;
+		Device->SampleSequence = 0;
+		Device->SampleRateCount = 0;
+		Device->SampleRateStart = ktime_get();
+		Device->Continuous = 1;
+		spin_unlock(&(Device->FifoLock));
+		Device->NextTrigger = ktime_get();
+		PulseSched.Running++;
+		if (!(PulseSched.TimerArmed))
+		{
+			PulseSched.TimerArmed = 1;
+			StartTimer = 1;
+		}
+	}
+	spin_unlock_irqrestore(&(PulseSched.Lock),Flags);
+	if (StartTimer)
+	{
+		hrtimer_start(&(PulseSched.Timer),ktime_get(),HRTIMER_MODE_ABS);
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             PulseStopContinuous
+ * CALLED BY:        PulseDriverIoctl, PulseDriverRelease
+ * DESCRIPTION:      Takes a sensor out of the trigger scheduler and wakes
+ *                   up its readers. The timer stops with the last sensor.
+ *                   Must be called with ModeMutex held
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseStopContinuous(PulseDevType *Device)
+{
+	unsigned long Flags;
+	bool StopTimer = 0;
 
+	if (!(Device->Continuous))
+	{
+		return;
+	}
+	spin_lock_irqsave(&(PulseSched.Lock),Flags);
+	if (Device == PulseSched.Active)
+	{
+		PulseIo->Trigger(Device,0);
+		PulseSched.Active = NULL;
+		PulseSched.Phase = PULSE_PHASE_TRIGGER;
+	}
+	spin_lock(&(Device->FifoLock));
+	Device->EchoPending = 0;
+	ACCESS_ONCE(Device->Continuous) = 0;
+	spin_unlock(&(Device->FifoLock));
+	PulseSched.Running--;
+	StopTimer = (0 == PulseSched.Running);
+	spin_unlock_irqrestore(&(PulseSched.Lock),Flags);
+	if (StopTimer)
+	{
+		hrtimer_cancel(&(PulseSched.Timer));
+		PulseSched.TimerArmed = 0;
+	}
+	/* Readers waiting for a sample get the end of file */
+	wake_up_interruptible(&(Device->SampleWaitQueue));
+}
 
 /* *********************************************************************
- * NAME:             PulseEchoIrqHandler
- * CALLED BY:        interrupt service routine
- * DESCRIPTION:      Detects rising and falling edge and updat the
- *                   time stamp counters
- * INPUT PARAMETERS: IrqNumber : Irq number of this interrupt
- *                   dev:device structure pointer
- * RETURN VALUES:    irqreturn_t : status - Fail/IRQ_HANDLED
+ * NAME:             PulseInjectSample
+ * CALLED BY:        PulseDriverIoctl
+ * DESCRIPTION:      Puts a recorded sample in the fifo, the ring and the
+ *                   filter as the echo of a trigger sent now, so a trace
+ *                   replays through the same path as the sensor. Must be
+ *                   called with ModeMutex held
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Sample : recorded sample, only WidthNs and Status
+ *                            are used
+ * RETURN VALUES:    int : status - Fail/Pass(0)
  ***********************************************************************/
-static irqreturn_t PulseEchoIrqHandler(int IrqNumber, void *dev)
+static int PulseInjectSample(PulseDevType *Device, const PulseSampleType *Sample)
 {
-    unsigned long long CurrentCounter = 0; /* Counter that gets the current cpu time ticks */
-#ifdef DEBUG    
-    printk(KERN_INFO "\n IRQ called !!! ");
-#endif
-    if (RISING == ((PulseDevType*)dev)->MeasurementEdge)
-	{
-		/* This IRQ must be rising edge, so take the time stamp */
-		/* Get the current counter */
-		rdtscll(CurrentCounter);
-		/* copy this counter to global device structure */
-		((PulseDevType*)dev)->MeasurementStartTime = CurrentCounter;
-        if (!(irq_set_irq_type(IrqNumber,IRQ_TYPE_EDGE_FALLING)))
-        {
-	    	((PulseDevType*)dev)->MeasurementEdge = FALLING;
-	    }
+	unsigned long Flags;
+
+	if ((PULSE_SAMPLE_OK != Sample->Status) && (PULSE_SAMPLE_TIMEOUT != Sample->Status))
+	{
+		return -EINVAL;
 	}
-	else
+	/* The sensor owns the samples while it is being triggered */
+	if ((Device->Continuous) || (ONGOING == Device->MesurementOperation))
 	{
-		/* this must be falling edge */
-		rdtscll(CurrentCounter);
-		/* copy this counter to global device structure */
-		((PulseDevType*)dev)->MeasurementEndTime = CurrentCounter;
-        /* set the irq to rising edge */
-        if (!(irq_set_irq_type(IrqNumber,IRQ_TYPE_EDGE_RISING)))
-        {
-	    	((PulseDevType*)dev)->MeasurementEdge = RISING;
-	    }
-		/* Pulse measurment is complete at this point */
-		complete(&(((PulseDevType*)dev)->MeasurementCompletion));	
+		return -EBUSY;
 	}
-	return IRQ_HANDLED;
+	spin_lock_irqsave(&(Device->FifoLock),Flags);
+	Device->SampleSequence++;
+	Device->TriggerTime = ktime_get();
+	PulseSamplePush(Device,(PULSE_SAMPLE_OK == Sample->Status) ? Sample->WidthNs : 0,Sample->Status);
+	PULSE_COUNT(Device,PULSE_CNT_INJECTED);
+	spin_unlock_irqrestore(&(Device->FifoLock),Flags);
+	wake_up_interruptible(&(Device->SampleWaitQueue));
+	return 0;
 }
 
 /* *********************************************************************
@@ -152,19 +1369,35 @@ static irqreturn_t PulseEchoIrqHandler(int IrqNumber, void *dev)
  ***********************************************************************/
 static int PulseMeasurementThread(void *dev)
 {
-    /* Trigger pulse of Gpio14/IO2 */
-    gpio_set_value(14,1);
-    
+    PulseDevType *Device = dev;
+    unsigned long Flags;
+
+    /* A completion left over from a stray echo must not end this measurement */
+    INIT_COMPLETION(Device->MeasurementCompletion);
+    /* Trigger pulse of the sensor */
+    trace_pulse_trigger(Device->Index,0);
+    PulseIo->Trigger((PulseDevType*)dev,1);
+
 	/* sleep for 15 micro seconds */
 	udelay(150);
-	
-    /* Trigger pulse of Gpio14/IO2 */
-    gpio_set_value(14,0);
-#ifdef DEBUG  
+
+    /* Trigger pulse of the sensor */
+    PulseIo->Trigger((PulseDevType*)dev,0);
+#ifdef DEBUG
     printk(KERN_INFO "/n before waiting for wait_for_completion_interruptible_timeout\n");
 #endif
-    /* Wait for the IRQ to complete the pulse measurement */
-    wait_for_completion_interruptible_timeout(&(((PulseDevType*)dev)->MeasurementCompletion),1000*HZ);
+    /* Wait for the IRQ to complete the pulse measurement, the sensor gives up after the echo window */
+    if (0 == wait_for_completion_interruptible_timeout(&(Device->MeasurementCompletion),
+                                                       usecs_to_jiffies(PULSE_ECHO_WINDOW_US) + 1))
+    {
+		/* No echo, the legacy read gives a width of 0 */
+		trace_pulse_timeout(Device->Index,0);
+		spin_lock_irqsave(&(Device->FifoLock),Flags);
+		PULSE_COUNT(Device,PULSE_CNT_MEASUREMENT_TIMEOUTS);
+		Device->MeasurementEdge = RISING;
+		Device->MeasurementEndTime = Device->MeasurementStartTime;
+		spin_unlock_irqrestore(&(Device->FifoLock),Flags);
+	}
 #ifdef DEBUG
     printk(KERN_INFO "/n before waiting for wait_for_completion_interruptible_timeout\n");
 #endif
@@ -176,12 +1409,12 @@ static int PulseMeasurementThread(void *dev)
     return 0;
 }
 
-
 /* *********************************************************************
  * NAME:             PulseDriverOpen
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      copies the device structure pointer to the private  
- *                   data of the file pointer. 
+ * DESCRIPTION:      copies the device structure pointer to the private
+ *                   data of the file pointer and claims the echo input
+ *                   of the sensor
  * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
  *                   filept:file pointer used by this inode
  * RETURN VALUES:    int : status - Fail/Pass(0)
@@ -189,27 +1422,19 @@ static int PulseMeasurementThread(void *dev)
 int PulseDriverOpen(struct inode *inode, struct file *filept)
 {
 	PulseDevType *dev; /* dev pointer for the present device */
-	int EchoIrq;
-	/*  make gpio15 as input as this is required for sensing echo signal */
-    gpio_request_one(15,GPIOF_IN,"IO3");
-    
-    /* get irq of gpio15 */
-    EchoIrq = gpio_to_irq(15);
+	int Ret;
 
 	/* to get the device specific structure from cdev pointer */
 	dev = container_of(inode->i_cdev, PulseDevType, cdev);
 	/* stored to private data so that next time filept can be directly used */
 	filept->private_data = dev;
-#ifdef DEBUG  
-    printk(KERN_INFO "\n Registering IRQ handler %i \n",EchoIrq);
-#endif
-    /* Request the IRQ for gpio15 */
-    if (request_irq(EchoIrq,&PulseEchoIrqHandler,IRQF_TRIGGER_RISING,"PulseEchoIrqHandler",dev))
-    {
-		printk(KERN_INFO "\n first PulseMeasurementThread Irq Request failed ");
+	/* The echo irq can only be claimed once */
+	Ret = PulseIo->Open(dev);
+	if (Ret)
+	{
+		return Ret;
 	}
-#ifdef DEBUG  
-    printk(KERN_INFO "\n Registering IRQ handler %i is done\n",EchoIrq);
+#ifdef DEBUG
 	/* Print that device has opened succesfully */
 	printk(KERN_INFO "Device %s opened succesfully ! \n",(char *)&(dev->name));
 #endif
@@ -227,8 +1452,12 @@ int PulseDriverOpen(struct inode *inode, struct file *filept)
 int PulseDriverRelease(struct inode *inode, struct file *filept)
 {
 	PulseDevType *dev = (PulseDevType*)(filept->private_data);
+    /* No trigger may be sent once the irq is gone */
+    mutex_lock(&(PulseSched.ModeMutex));
+    PulseStopContinuous(dev);
+    mutex_unlock(&(PulseSched.ModeMutex));
     /* Free the Irq to be safer*/
-    free_irq(gpio_to_irq(15),dev);
+    PulseIo->Release(dev);
 	printk(KERN_INFO "\n%s is closing\n", dev->name);
 	return 0;
 }
@@ -250,13 +1479,14 @@ ssize_t PulseDriverWrite(struct file *filept, const char *buf,size_t count, loff
 	ssize_t RetValue =  0; /* Error code sent when the buffer is full */
     /* If no measurement operation is going on , invoke new write operation */
 	PulseDevType *dev = (PulseDevType*)(filept->private_data);
-	if (FREE == dev->MesurementOperation)
+	mutex_lock(&(PulseSched.ModeMutex));
+	/* The scheduler owns the triggers while any sensor is in continuous mode */
+	if ((FREE == dev->MesurementOperation) && (0 == PulseSched.Running))
 	{
-		/* intiate a kernel thread that sends trigger pulse and waits for irq */
 		/* intiate a kernel thread that sends trigger pulse and waits for irq */
 		dev->MesurementOperation = ONGOING;
-		PulseMeasurementTask = kthread_run(&PulseMeasurementThread,dev,"DisMeasurementThread");
-		if (IS_ERR(PulseMeasurementTask))
+		dev->MeasurementTask = kthread_run(&PulseMeasurementThread,dev,"DisMeasurementThread");
+		if (IS_ERR(dev->MeasurementTask))
 		{
 			/* failed to create kthread */
 			printk(KERN_INFO "\n Failed to create measurment thread ");
@@ -268,10 +1498,69 @@ ssize_t PulseDriverWrite(struct file *filept, const char *buf,size_t count, loff
 		/* Measurement operation is going on */
 		RetValue = -1;
 	}
-	
+	mutex_unlock(&(PulseSched.ModeMutex));
+
     return RetValue;
 }
 
+/* *********************************************************************
+ * NAME:             PulseReadSamples
+ * CALLED BY:        PulseDriverRead
+ * DESCRIPTION:      Copies as many whole samples as fit in the buffer,
+ *                   waiting for the first one unless the file is non
+ *                   blocking
+ * INPUT PARAMETERS: dev : device structure pointer
+ *                   filept : file pointer used by this inode
+ *                   buf : pointer to the user buffer
+ *                   count : size of the user buffer
+ * RETURN VALUES:    ssize_t : bytes copied, 0 if the continuous mode is
+ *                   stopped and no sample is left
+ *                  -EAGAIN, if no sample is ready and the file is non
+ *                           blocking
+ *                  -ERESTARTSYS, if interrupted by a signal
+ ***********************************************************************/
+static ssize_t PulseReadSamples(PulseDevType *dev, struct file *filept, char *buf, size_t count)
+{
+	PulseSampleType Batch[PULSE_READ_BATCH];
+	unsigned int Wanted, Got;
+	unsigned long Flags;
+	size_t Copied = 0;
+
+	if (kfifo_is_empty(&(dev->SampleFifo)))
+	{
+		if (!ACCESS_ONCE(dev->Continuous))
+		{
+			return 0;
+		}
+		if (filept->f_flags & O_NONBLOCK)
+		{
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(dev->SampleWaitQueue,
+		                             !kfifo_is_empty(&(dev->SampleFifo)) || !ACCESS_ONCE(dev->Continuous)))
+		{
+			return -ERESTARTSYS;
+		}
+	}
+	while ((count - Copied) >= sizeof(PulseSampleType))
+	{
+		Wanted = min_t(size_t,(count - Copied) / sizeof(PulseSampleType),PULSE_READ_BATCH);
+		spin_lock_irqsave(&(dev->FifoLock),Flags);
+		Got = kfifo_out(&(dev->SampleFifo),Batch,Wanted);
+		spin_unlock_irqrestore(&(dev->FifoLock),Flags);
+		if (0 == Got)
+		{
+			break;
+		}
+		if (copy_to_user(buf + Copied,Batch,Got * sizeof(PulseSampleType)))
+		{
+			return (Copied) ? (ssize_t)Copied : -EFAULT;
+		}
+		Copied += Got * sizeof(PulseSampleType);
+	}
+	return Copied;
+}
+
 /* *********************************************************************
  * NAME:             PulseDriverRead
  * CALLED BY:        User App through kernel
@@ -281,6 +1570,8 @@ ssize_t PulseDriverWrite(struct file *filept, const char *buf,size_t count, loff
  *                   count : no of bytes to be copied to the user buffer
  *                   offp: offset from which the string to be read
  *                         (not used)
+ *                   A buffer of at least one PulseSampleType drains the
+ *                   samples of the continuous mode, see PulseReadSamples
  * RETURN VALUES:    ssize_t : number of bytes written to the user space
  *                  -EAGAIN, if the request is submitted to the workqueue
  *                  -EBUSY, if the EEPROM is busy with read or write oprtn 
@@ -290,12 +1581,16 @@ ssize_t PulseDriverRead(struct file *filept, char *buf,size_t count, loff_t *off
 	ssize_t RetValue = -1;
 	PulseDevType *dev = (PulseDevType*)(filept->private_data);
 	unsigned int PulseWidth;
-	unsigned long long PulseWidth64 = ((dev->MeasurementEndTime) - (dev->MeasurementStartTime));
+	if (count >= sizeof(PulseSampleType))
+	{
+		return PulseReadSamples(dev,filept,buf,count);
+	}
 	if (FREE == dev->MesurementOperation)
 	{
 		/* Measured data is ready*/
 		
-		PulseWidth = div_u64(PulseWidth64,400);
+		/* The legacy read gives micro seconds */
+		PulseWidth = PulseEchoWidthNs(dev) / NSEC_PER_USEC;
         /* Copy to the user space*/
         if(copy_to_user(buf,&PulseWidth,sizeof(PulseWidth)))
         {
@@ -309,6 +1604,236 @@ ssize_t PulseDriverRead(struct file *filept, char *buf,size_t count, loff_t *off
     return RetValue;
 }
 
+/* *********************************************************************
+ * NAME:             PulseDriverPoll
+ * CALLED BY:        User App through kernel (poll, select, epoll)
+ * DESCRIPTION:      Readable when samples are waiting in the fifo
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   Wait : poll table of the caller
+ * RETURN VALUES:    unsigned int : POLLIN mask
+ ***********************************************************************/
+static unsigned int PulseDriverPoll(struct file *filept, poll_table *Wait)
+{
+	PulseDevType *dev = (PulseDevType*)(filept->private_data);
+
+	poll_wait(filept,&(dev->SampleWaitQueue),Wait);
+	return (kfifo_is_empty(&(dev->SampleFifo))) ? 0 : (POLLIN | POLLRDNORM);
+}
+
+/* *********************************************************************
+ * NAME:             PulseDriverIoctl
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      Starts and stops the continuous mode, gives its
+ *                   filtered estimate and replays recorded samples, see
+ *                   pulse.h
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   Command : PULSE_IOC_*
+ *                   Argument : command argument
+ * RETURN VALUES:    long : error codes / return success
+ ***********************************************************************/
+static long PulseDriverIoctl(struct file *filept, unsigned int Command, unsigned long Argument)
+{
+	PulseDevType *dev = (PulseDevType*)(filept->private_data);
+	PulseFilteredType Filtered;
+	PulseSampleType Sample;
+	unsigned long Flags;
+	long Ret = 0;
+
+	mutex_lock(&(PulseSched.ModeMutex));
+	switch (Command)
+	{
+	case PULSE_IOC_START:
+		Ret = PulseStartContinuous(dev,Argument);
+		break;
+
+	case PULSE_IOC_STOP:
+		PulseStopContinuous(dev);
+		break;
+
+	case PULSE_IOC_INJECT:
+		if (copy_from_user(&Sample,(const void __user *)Argument,sizeof(Sample)))
+		{
+			Ret = -EFAULT;
+			break;
+		}
+		Ret = PulseInjectSample(dev,&Sample);
+		break;
+
+	case PULSE_IOC_GET_FILTERED:
+		spin_lock_irqsave(&(dev->FifoLock),Flags);
+		Filtered = dev->Filter.Output;
+		spin_unlock_irqrestore(&(dev->FifoLock),Flags);
+		if (copy_to_user((void __user *)Argument,&Filtered,sizeof(Filtered)))
+		{
+			Ret = -EFAULT;
+		}
+		break;
+
+	default:
+		Ret = -ENOTTY;
+		break;
+	}
+	mutex_unlock(&(PulseSched.ModeMutex));
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             PulseCounterRead
+ * CALLED BY:        PulseStatsShow, PulseCountersShow
+ * DESCRIPTION:      Adds up the copies of a counter of every cpu. A copy
+ *                   may be counting meanwhile, the sum is a snapshot
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Counter : counter to be read
+ * RETURN VALUES:    unsigned long : events counted on all cpus
+ ***********************************************************************/
+static unsigned long PulseCounterRead(PulseDevType *Device, PulseCounter_Type Counter)
+{
+	unsigned long Sum = 0;
+	int Cpu;
+
+	for_each_possible_cpu(Cpu)
+	{
+		Sum += ACCESS_ONCE(per_cpu_ptr(PulseCounters,Cpu)->Count[Device->Index][Counter]);
+	}
+	return Sum;
+}
+
+/* *********************************************************************
+ * NAME:             PulseStatsShow
+ * CALLED BY:        seq_file core on read of debugfs pulse/stats
+ * DESCRIPTION:      Prints the measurement statistics, the scheduler
+ *                   first and then one section per sensor
+ * INPUT PARAMETERS: File : seq file
+ *                   Unused : not used
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseStatsShow(struct seq_file *File, void *Unused)
+{
+	PulseDevType *Device;
+	unsigned int LoopIndex;
+
+	seq_printf(File,"clock: %s\n",PulseClock->Name);
+	seq_printf(File,"tsc_khz: %lu\n",PulseTscKhz);
+	seq_printf(File,"io: %s\n",PulseIo->Name);
+	seq_printf(File,"speed_of_sound_mm_per_sec: %u\n",SpeedOfSoundMmPerSec);
+	seq_printf(File,"sensors: %u\n",PulseCount);
+	seq_printf(File,"running: %u\n",PulseSched.Running);
+	for (LoopIndex = 0; LoopIndex < PulseCount; LoopIndex++)
+	{
+		Device = &PulseDevMem[LoopIndex];
+		seq_printf(File,"[%s]\n",Device->name);
+		seq_printf(File,"continuous: %d\n",Device->Continuous);
+		seq_printf(File,"period_ns: %lld\n",(long long)ktime_to_ns(Device->SamplePeriod));
+		seq_printf(File,"triggers: %u\n",Device->SampleSequence);
+		seq_printf(File,"samples: %lu\n",PulseCounterRead(Device,PULSE_CNT_SAMPLES));
+		seq_printf(File,"samples_per_second: %lu\n",Device->SamplesPerSecond);
+		seq_printf(File,"timeouts: %lu\n",PulseCounterRead(Device,PULSE_CNT_TIMEOUTS));
+		seq_printf(File,"collisions: %lu\n",PulseCounterRead(Device,PULSE_CNT_COLLISIONS));
+		seq_printf(File,"fifo_overruns: %lu\n",PulseCounterRead(Device,PULSE_CNT_FIFO_OVERRUNS));
+		seq_printf(File,"triggers_late: %lu\n",PulseCounterRead(Device,PULSE_CNT_TRIGGERS_LATE));
+		seq_printf(File,"fifo_len: %u\n",kfifo_len(&(Device->SampleFifo)));
+		seq_printf(File,"edges_missed: %lu\n",PulseCounterRead(Device,PULSE_CNT_EDGES_MISSED));
+		seq_printf(File,"edges_unpaired: %lu\n",PulseCounterRead(Device,PULSE_CNT_EDGES_UNPAIRED));
+		seq_printf(File,"measurement_timeouts: %lu\n",PulseCounterRead(Device,PULSE_CNT_MEASUREMENT_TIMEOUTS));
+		seq_printf(File,"filter_distance_mm: %d\n",Device->Filter.Output.DistanceMm);
+		seq_printf(File,"filter_velocity_mm_per_sec: %d\n",Device->Filter.Output.VelocityMmPerSec);
+		seq_printf(File,"filter_accepted: %u\n",Device->Filter.Output.Accepted);
+		seq_printf(File,"filter_rejected: %u\n",Device->Filter.Output.Rejected);
+	}
+	return 0;
+}
+
+static int PulseStatsOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,PulseStatsShow,inode->i_private);
+}
+
+static const struct file_operations PulseStatsFops = {
+	.owner = THIS_MODULE,
+	.open = PulseStatsOpen,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* *********************************************************************
+ * NAME:             PulseCountersShow
+ * CALLED BY:        seq_file core on read of debugfs pulse/counters
+ * DESCRIPTION:      Prints the event counters of every sensor with the
+ *                   count of each cpu and the total
+ * INPUT PARAMETERS: File : seq file
+ *                   Unused : not used
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseCountersShow(struct seq_file *File, void *Unused)
+{
+	PulseDevType *Device;
+	unsigned int LoopIndex, Counter;
+	unsigned long Value;
+	int Cpu;
+
+	for (LoopIndex = 0; LoopIndex < PulseCount; LoopIndex++)
+	{
+		Device = &PulseDevMem[LoopIndex];
+		seq_printf(File,"[%s]\n%-20s",Device->name,"counter");
+		for_each_possible_cpu(Cpu)
+		{
+			seq_printf(File," cpu%-8d",Cpu);
+		}
+		seq_printf(File," total\n");
+		for (Counter = 0; Counter < PULSE_COUNTERS; Counter++)
+		{
+			seq_printf(File,"%-20s",PulseCounterNames[Counter]);
+			for_each_possible_cpu(Cpu)
+			{
+				Value = ACCESS_ONCE(per_cpu_ptr(PulseCounters,Cpu)->Count[LoopIndex][Counter]);
+				seq_printf(File," %-11lu",Value);
+			}
+			seq_printf(File," %lu\n",PulseCounterRead(Device,Counter));
+		}
+	}
+	return 0;
+}
+
+static int PulseCountersOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,PulseCountersShow,inode->i_private);
+}
+
+static const struct file_operations PulseCountersFops = {
+	.owner = THIS_MODULE,
+	.open = PulseCountersOpen,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* *********************************************************************
+ * NAME:             PulseDriverMmap
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      Maps the sample ring of the sensor read only, see
+ *                   PulseRingType
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   vma : user mapping to be filled
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseDriverMmap(struct file *filept, struct vm_area_struct *vma)
+{
+	PulseDevType *dev = (PulseDevType*)(filept->private_data);
+
+	if ((vma->vm_pgoff) || ((vma->vm_end - vma->vm_start) > PAGE_ALIGN(sizeof(PulseRingType))))
+	{
+		return -EINVAL;
+	}
+	/* The driver is the only writer */
+	if (vma->vm_flags & VM_WRITE)
+	{
+		return -EACCES;
+	}
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma,dev->Ring,0);
+}
+
 /* Assigning operations to file operation structure */
 static struct file_operations PulseFops = {
     .owner = THIS_MODULE, /* Owner */
@@ -316,8 +1841,115 @@ static struct file_operations PulseFops = {
     .release = PulseDriverRelease, /* Release method */
     .write = PulseDriverWrite, /* Write method */
     .read = PulseDriverRead, /* Read method */
+    .poll = PulseDriverPoll, /* Samples ready */
+    .unlocked_ioctl = PulseDriverIoctl, /* Continuous mode */
+    .mmap = PulseDriverMmap, /* Sample ring */
 };
 
+/* *********************************************************************
+ * NAME:             PulseDevSetup
+ * CALLED BY:        PulseDriverInit
+ * DESCRIPTION:      Initializes a sensor and creates its device node,
+ *                   /dev/pulse for the first one and /dev/pulseN for the
+ *                   others. Nothing is left behind on failure
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Index : sensor number
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int PulseDevSetup(PulseDevType *Device, unsigned int Index)
+{
+	struct device *PulseDevName;
+	int Ret;
+
+    /* Driver Initialization */
+    Device->Index = Index;
+    Device->TriggerGpio = TriggerGpio[Index];
+    Device->EchoGpio = EchoGpio[Index];
+    Device->TriggerMuxGpio = TriggerMuxGpio[Index];
+    Device->EchoMuxGpio = EchoMuxGpio[Index];
+    Device->MesurementOperation = FREE;
+    Device->MeasurementEdge = RISING;
+    Device->MeasurementEndTime = 0;
+    Device->MeasurementStartTime = 0;
+    /* Copy the respective device name */
+    if (0 == Index)
+    {
+		sprintf(Device->name,DEVICE_NAME);
+	}
+	else
+	{
+		sprintf(Device->name,DEVICE_NAME "%u",Index);
+	}
+    /* Initialize complettion event */
+    init_completion(&(Device->MeasurementCompletion));
+    /* Continuous mode */
+    spin_lock_init(&(Device->FifoLock));
+    INIT_KFIFO(Device->SampleFifo);
+    init_waitqueue_head(&(Device->SampleWaitQueue));
+    INIT_KFIFO(Device->EdgeFifo);
+    /* Sample ring, zeroed by vmalloc_user */
+    Device->Ring = (PulseRingType*)vmalloc_user(PAGE_ALIGN(sizeof(PulseRingType)));
+    if (NULL == Device->Ring)
+    {
+		return -ENOMEM;
+	}
+	Device->Ring->Size = PULSE_RING_SAMPLES;
+
+	Ret = PulseIo->Setup(Device);
+	if (Ret)
+	{
+		vfree(Device->Ring);
+		return Ret;
+	}
+
+    /* Connect the file operations with the cdev */
+    cdev_init(&Device->cdev,&PulseFops);
+
+    Device->cdev.owner = THIS_MODULE;
+    /* Connect the major/minor number to the cdev */
+    Ret = cdev_add(&Device->cdev,MKDEV(MAJOR(PulseDevNumber),Index),1);
+	if (Ret)
+	{
+	    printk(KERN_INFO "Bad cdev\n");
+	    PulseIo->Cleanup(Device);
+	    vfree(Device->Ring);
+	    return Ret;
+	}
+
+	PulseDevName = device_create(PulseDevClass,NULL,MKDEV(MAJOR(PulseDevNumber),Index),NULL,Device->name);
+	if (IS_ERR(PulseDevName))
+	{
+		cdev_del(&(Device->cdev));
+		PulseIo->Cleanup(Device);
+		vfree(Device->Ring);
+		return PTR_ERR(PulseDevName);
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             PulseDevCleanup
+ * CALLED BY:        PulseDriverInit, PulseDriverExit
+ * DESCRIPTION:      Removes the first Count sensors set up by
+ *                   PulseDevSetup
+ * INPUT PARAMETERS: Count : number of sensors to remove
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void PulseDevCleanup(unsigned int Count)
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < Count; LoopIndex++)
+	{
+		/* Destroy the devices first */
+		device_destroy(PulseDevClass,MKDEV(MAJOR(PulseDevNumber),LoopIndex));
+		/* Delete each of the cdevs */
+		cdev_del(&(PulseDevMem[LoopIndex].cdev));
+		PulseIo->Cleanup(&PulseDevMem[LoopIndex]);
+		vfree(PulseDevMem[LoopIndex].Ring);
+	}
+}
+
 /* *********************************************************************
  * NAME:             PulseDriverInit
  * CALLED BY:        By system when the driver is installed
@@ -328,73 +1960,92 @@ static struct file_operations PulseFops = {
 int __init PulseDriverInit(void)
 {
 	int Ret = -1; /* return variable */
-    const struct gpio AllGpios[4] = {
-		{31,GPIOF_OUT_INIT_LOW,"IO2Enable"},
-		{30,GPIOF_OUT_INIT_LOW,"IO3Enable"},
-		{14,GPIOF_OUT_INIT_LOW,"IO2"},
-		{15,GPIOF_OUT_INIT_LOW,"IO3"} } ;
-    
+	unsigned int LoopIndex;
+
+	/* Every sensor needs both of its pins */
+	if ((PulseCount < 1) || (PulseCount > NUMBER_OF_DEVICES) ||
+	    (!(SimulatedIo) && (EchoGpioCount != PulseCount)))
+	{
+		printk(KERN_INFO "pulse: give one EchoGpio per TriggerGpio, at most %d\n",NUMBER_OF_DEVICES);
+		return -EINVAL;
+	}
+	PulseIo = (SimulatedIo) ? &PulseSimIo : &PulseGpioIo;
+
+	/* The monotonic clock is used unless the TSC is asked for and usable */
+	if (TscTiming)
+	{
+		if (0 == PulseTscCalibrate())
+		{
+			PulseClock = &PulseTscClock;
+		}
+		else
+		{
+			printk(KERN_INFO "pulse: using ktime for timing\n");
+		}
+	}
+
+	/* Trigger scheduler */
+	spin_lock_init(&(PulseSched.Lock));
+	mutex_init(&(PulseSched.ModeMutex));
+	PulseSched.Phase = PULSE_PHASE_TRIGGER;
+	hrtimer_init(&(PulseSched.Timer),CLOCK_MONOTONIC,HRTIMER_MODE_ABS);
+	PulseSched.Timer.function = &PulseSchedTimer;
+
 	/* Allocate device major number dynamically */
-	if (alloc_chrdev_region(&PulseDevNumber, 0, NUMBER_OF_DEVICES, DEVICE_NAME) < 0)
+	if (alloc_chrdev_region(&PulseDevNumber, 0, PulseCount, DEVICE_NAME) < 0)
 	{
          printk(KERN_INFO "Device could not acquire a major number ! \n");
          return -1;
 	}
-	
+
 	/* Populate sysfs entries */
 	PulseDevClass = class_create(THIS_MODULE, DEVICE_NAME);
-   
+
     /* Allocate memory for all the devices */
-    PulseDevMem = (PulseDevType*)kmalloc(((sizeof(PulseDevType)) * NUMBER_OF_DEVICES), GFP_KERNEL);
-    
-    /* Driver Initialization */
-    PulseDevMem->MesurementOperation = FREE;
-    PulseDevMem->MeasurementEdge = RISING;
-    PulseDevMem->MeasurementEndTime = 0;
-    PulseDevMem->MeasurementStartTime = 0;
-    sprintf(PulseDevMem->name,DEVICE_NAME);
-    /* Initialize complettion event */
-    init_completion(&(PulseDevMem->MeasurementCompletion));
+    PulseDevMem = (PulseDevType*)kzalloc(((sizeof(PulseDevType)) * PulseCount), GFP_KERNEL);
+    /* Event counters, zeroed by alloc_percpu */
+    PulseCounters = alloc_percpu(PulseCountersType);
 
     /* Check if memory was allocated properly */
-   	if (NULL == PulseDevMem)
+   	if ((NULL == PulseDevMem) || (NULL == PulseCounters))
 	{
        printk(KERN_INFO "Kmalloc Fail \n");
+       free_percpu(PulseCounters);
+       kfree(PulseDevMem);
 
 	   /* Remove the device class that was created earlier */
 	   class_destroy(PulseDevClass);
        /* Unregister devices */
-	   unregister_chrdev_region(MKDEV(MAJOR(PulseDevNumber), 0), NUMBER_OF_DEVICES);
+	   unregister_chrdev_region(MKDEV(MAJOR(PulseDevNumber), 0), PulseCount);
        return -ENOMEM;
-	} 
-
-    /* Device Creation */ 
-    /* Copy the respective device name */
-    sprintf(PulseDevMem->name,DEVICE_NAME);
+	}
 
-    /* Connect the file operations with the cdev */
-    cdev_init(&PulseDevMem->cdev,&PulseFops);    
+    /* Device Creation */
+    for (LoopIndex = 0; LoopIndex < PulseCount; LoopIndex++)
+    {
+		Ret = PulseDevSetup(&PulseDevMem[LoopIndex],LoopIndex);
+		if (Ret)
+		{
+			printk(KERN_INFO "pulse: sensor %u could not be set up\n",LoopIndex);
+			PulseDevCleanup(LoopIndex);
+			free_percpu(PulseCounters);
+			kfree(PulseDevMem);
+			class_destroy(PulseDevClass);
+			unregister_chrdev_region(MKDEV(MAJOR(PulseDevNumber), 0), PulseCount);
+			return Ret;
+		}
+	}
 
-    PulseDevMem->cdev.owner = THIS_MODULE;
-    /* Connect the major/minor number to the cdev */
-    Ret = cdev_add(&PulseDevMem->cdev,PulseDevNumber,1);
-	if (Ret)
+	/* Statistics are optional, the driver works without debugfs */
+	PulseDebugDir = debugfs_create_dir(DEVICE_NAME,NULL);
+	if (!IS_ERR_OR_NULL(PulseDebugDir))
 	{
-	    printk(KERN_INFO "Bad cdev\n");
-	    return Ret;
+		debugfs_create_file("stats",0444,PulseDebugDir,NULL,&PulseStatsFops);
+		debugfs_create_file("counters",0444,PulseDebugDir,NULL,&PulseCountersFops);
 	}
 
-	PulseDevName = device_create(PulseDevClass,NULL,PulseDevNumber,NULL,DEVICE_NAME);
-	
-    gpio_request_array(&AllGpios[0],4);
-    gpio_set_value_cansleep(31,0);
-    gpio_set_value_cansleep(30,0);
-    gpio_set_value(14,0);
-    gpio_set_value(15,0);
-    gpio_free(15);
+	printk(KERN_INFO "\n Pulse Driver is initialized with %u %s sensors \n",PulseCount,PulseIo->Name);
 
-	printk(KERN_INFO "\n Pulse Driver is initialized \n");
-	
 	return Ret;
 }
 /* *********************************************************************
@@ -406,29 +2057,24 @@ int __init PulseDriverInit(void)
  ***********************************************************************/
 void __exit PulseDriverExit(void)
 {
-    const struct gpio AllGpios[4] = {
-		{31,GPIOF_OUT_INIT_LOW,"IO2Enable"},
-		{30,GPIOF_OUT_INIT_LOW,"IO3Enable"},
-		{14,GPIOF_OUT_INIT_LOW,"IO2"},
-		{15,GPIOF_OUT_INIT_LOW,"IO3"} } ;
+    /* Remove the statistics before the device memory goes away */
+    debugfs_remove_recursive(PulseDebugDir);
 
-     /* unregister gpios */
-    gpio_free_array(&AllGpios[0],4);
+    /* All files are closed, so no sensor is in the continuous mode */
+    hrtimer_cancel(&(PulseSched.Timer));
 
-    /* Destroy the devices first */
-	device_destroy(PulseDevClass,PulseDevNumber);
-
-	/* Delete each of the cdevs */
-	cdev_del(&(PulseDevMem->cdev));
+    /* Remove the devices and give back their gpios */
+    PulseDevCleanup(PulseCount);
 
 	/* Free up the allocated memory for all of the device */
+	 free_percpu(PulseCounters);
 	 kfree(PulseDevMem);
 
 	/* Remove the device class that was created earlier */
 	class_destroy(PulseDevClass);
-	
+
 	/* Unregister char devices */
-	unregister_chrdev_region(PulseDevNumber, NUMBER_OF_DEVICES);
+	unregister_chrdev_region(PulseDevNumber, PulseCount);
 
 	printk(KERN_INFO "\n Pulse device and driver are removed ! \n ");
 }
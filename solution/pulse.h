@@ -0,0 +1,183 @@
+/* *********************************************************************
+ *
+ * Interface of the Pulse device driver shared with user applications
+ *
+ * Program Name:        Pulse
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Longest echo the driver waits for. The sensor gives up after about
+ * 4m (23ms round trip), a trigger is never sent before the echo window of
+ * the previous one has ended.
+ */
+#define PULSE_ECHO_WINDOW_US   25000
+
+/*
+ * Sampling rates accepted by PULSE_IOC_START, bounded by the echo window
+ */
+#define PULSE_MIN_RATE_HZ   1
+#define PULSE_MAX_RATE_HZ   (1000000 / PULSE_ECHO_WINDOW_US)
+
+/* Status of a sample */
+#define PULSE_SAMPLE_OK        0 /* Echo measured */
+#define PULSE_SAMPLE_TIMEOUT   1 /* No echo within the echo window */
+
+/*
+ * /dev/pulse is the first sensor, /dev/pulseN sensor N. Every sensor has
+ * its own continuous mode and samples.
+ */
+
+/*
+ * One measurement of the continuous mode. read() with a buffer of at least
+ * sizeof(PulseSampleType) returns whole samples, oldest first.
+ */
+typedef struct PulseSampleTag
+{
+	__u64 TimestampNs; /* ktime of the trigger pulse */
+	__u32 WidthNs; /* Echo pulse width in nano seconds, 0 on timeout */
+	__u32 Status; /* PULSE_SAMPLE_* */
+	__u32 Sequence; /* Trigger number, gaps show samples lost to a full fifo */
+	__u32 DistanceMm; /* Distance for the module's SpeedOfSoundMmPerSec */
+}PulseSampleType;
+
+/*
+ * Samples kept in the ring mapped from the device, a power of two. The
+ * oldest slot may be being overwritten, so PULSE_RING_SAMPLES - 1 samples
+ * of history can be read.
+ */
+#define PULSE_RING_SAMPLES   256
+
+/*
+ * Layout of the ring mapped read only at offset 0 of /dev/pulse. The
+ * driver is the only writer, every sample of the continuous mode goes to
+ * Sample[Head % PULSE_RING_SAMPLES] and then Head is incremented. Seq is
+ * odd while a sample is written. Head keeps counting across start and
+ * stop, so a reader remembers its position and finds out with
+ * PulseRingRead how many samples it missed.
+ */
+typedef struct PulseRingTag
+{
+	__u32 Seq; /* Even when no sample is being written */
+	__u32 Head; /* Samples written since the driver was loaded */
+	__u32 Size; /* PULSE_RING_SAMPLES */
+	__u32 Reserved; /* 0 */
+	PulseSampleType Sample[PULSE_RING_SAMPLES]; /* Newest sample at Head - 1 */
+}PulseRingType;
+
+#ifndef __KERNEL__
+/*
+ * Reads the sample at Position (0 is the first sample ever written).
+ * Returns 0 if Sample was filled, 1 if it is not written yet, -1 if it
+ * has been overwritten: Head - PULSE_RING_SAMPLES + 1 is the oldest
+ * position that can still be read.
+ */
+static inline int PulseRingRead(const volatile PulseRingType *Ring, __u32 Position, PulseSampleType *Sample)
+{
+	__u32 Head = Ring->Head;
+
+	__sync_synchronize();
+	if ((__s32)(Position - Head) >= 0)
+	{
+		return 1;
+	}
+	if ((Head - Position) >= PULSE_RING_SAMPLES)
+	{
+		return -1;
+	}
+	*Sample = Ring->Sample[Position % PULSE_RING_SAMPLES];
+	__sync_synchronize();
+	/* The slot is reused once Head has gone round the ring */
+	return ((Ring->Head - Position) < PULSE_RING_SAMPLES) ? 0 : -1;
+}
+
+/*
+ * Reads the newest sample. Returns 0 if Sample was filled, 1 if no sample
+ * has been written yet.
+ */
+static inline int PulseRingLatest(const volatile PulseRingType *Ring, PulseSampleType *Sample)
+{
+	__u32 Seq, Head;
+
+	do
+	{
+		Seq = Ring->Seq;
+		__sync_synchronize();
+		Head = Ring->Head;
+		if (0 == Head)
+		{
+			return 1;
+		}
+		*Sample = Ring->Sample[(Head - 1) % PULSE_RING_SAMPLES];
+		__sync_synchronize();
+	}while ((Seq & 1) || (Seq != Ring->Seq));
+	return 0;
+}
+#endif
+
+/* Distances the median of the filter is taken over */
+#define PULSE_FILTER_MEDIAN_SAMPLES   5
+
+/*
+ * Fastest an obstacle in front of the sensor is taken to move. A jump of
+ * the median would otherwise give a velocity that gates out the good
+ * echoes after it
+ */
+#define PULSE_FILTER_MAX_SPEED_MM_PER_SEC   3000
+
+/* Status of the filtered estimate */
+#define PULSE_FILTER_NONE    0 /* No echo accepted since the continuous mode started */
+#define PULSE_FILTER_VALID   1 /* Estimate of the last accepted echo */
+
+/*
+ * Output of the filter of the continuous mode. Outliers are dropped, the
+ * rest goes through a sliding median and an alpha-beta tracker.
+ */
+typedef struct PulseFilteredTag
+{
+	__u64 TimestampNs; /* ktime of the trigger of the last accepted sample */
+	__s32 DistanceMm; /* Estimated distance */
+	__s32 VelocityMmPerSec; /* Estimated speed, negative when the obstacle comes closer */
+	__u32 Sequence; /* Trigger number of the last accepted sample */
+	__u32 Accepted; /* Samples in the estimate, restarts when the track is lost */
+	__u32 Rejected; /* Outliers dropped since the continuous mode started */
+	__u32 Status; /* PULSE_FILTER_* */
+}PulseFilteredType;
+
+#define PULSE_IOC_MAGIC   'P'
+
+/*
+ * Starts the continuous mode. The argument is the trigger rate in Hz,
+ * PULSE_MIN_RATE_HZ to PULSE_MAX_RATE_HZ. EBUSY while an on demand
+ * measurement is running.
+ */
+#define PULSE_IOC_START   _IOW(PULSE_IOC_MAGIC, 1, __u32)
+
+/* Stops the continuous mode, samples already taken can still be read */
+#define PULSE_IOC_STOP   _IO(PULSE_IOC_MAGIC, 2)
+
+/*
+ * Latest filtered estimate, updated with every sample of the continuous
+ * mode. Does not wait, poll() or a raw read() tell when a sample came in.
+ */
+#define PULSE_IOC_GET_FILTERED   _IOR(PULSE_IOC_MAGIC, 3, PulseFilteredType)
+
+/*
+ * Replays a recorded sample: it goes to the fifo, the ring and the filter
+ * as if the sensor had just measured it. WidthNs and Status are taken from
+ * the argument, the timestamp and the sequence are those of a trigger sent
+ * now. EBUSY while the sensor is in continuous mode or measuring on demand.
+ */
+#define PULSE_IOC_INJECT   _IOW(PULSE_IOC_MAGIC, 4, PulseSampleType)
+
+#endif
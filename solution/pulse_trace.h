@@ -0,0 +1,109 @@
+/* *********************************************************************
+ *
+ * Trace events of the pulse driver
+ *
+ * Program Name:        Pulse
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/*
+ * Disabled events cost a not taken branch. They are switched on at run time
+ * under /sys/kernel/debug/tracing/events/pulse, without reloading the
+ * module. pulse.c defines CREATE_TRACE_POINTS before including this file.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pulse
+
+#if !defined(PULSE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PULSE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Events of one trigger of a sensor */
+DECLARE_EVENT_CLASS(pulse_trigger_class,
+	TP_PROTO(unsigned int Sensor, u32 Sequence),
+	TP_ARGS(Sensor, Sequence),
+	TP_STRUCT__entry(
+		__field(unsigned int, sensor)
+		__field(u32, sequence)
+	),
+	TP_fast_assign(
+		__entry->sensor = Sensor;
+		__entry->sequence = Sequence;
+	),
+	TP_printk("sensor=%u seq=%u", __entry->sensor, __entry->sequence)
+);
+
+/* Trigger raised, seq is 0 for an on demand measurement */
+DEFINE_EVENT(pulse_trigger_class, pulse_trigger,
+	TP_PROTO(unsigned int Sensor, u32 Sequence),
+	TP_ARGS(Sensor, Sequence)
+);
+
+/* Echo window over without echo */
+DEFINE_EVENT(pulse_trigger_class, pulse_timeout,
+	TP_PROTO(unsigned int Sensor, u32 Sequence),
+	TP_ARGS(Sensor, Sequence)
+);
+
+/*
+ * Edge of the echo, taken by the irq thread. counter is the time stamp of
+ * the hard irq in the unit of the clock backend (ns, or TSC cycles with
+ * TscTiming), so the event time shows how late the thread took it.
+ */
+DECLARE_EVENT_CLASS(pulse_edge_class,
+	TP_PROTO(unsigned int Sensor, u64 Counter),
+	TP_ARGS(Sensor, Counter),
+	TP_STRUCT__entry(
+		__field(unsigned int, sensor)
+		__field(u64, counter)
+	),
+	TP_fast_assign(
+		__entry->sensor = Sensor;
+		__entry->counter = Counter;
+	),
+	TP_printk("sensor=%u counter=%llu", __entry->sensor, (unsigned long long)__entry->counter)
+);
+
+DEFINE_EVENT(pulse_edge_class, pulse_echo_rise,
+	TP_PROTO(unsigned int Sensor, u64 Counter),
+	TP_ARGS(Sensor, Counter)
+);
+
+DEFINE_EVENT(pulse_edge_class, pulse_echo_fall,
+	TP_PROTO(unsigned int Sensor, u64 Counter),
+	TP_ARGS(Sensor, Counter)
+);
+
+/* Sample of the continuous mode put in the fifo */
+TRACE_EVENT(pulse_sample,
+	TP_PROTO(unsigned int Sensor, u32 Sequence, u32 WidthNs, u32 DistanceMm),
+	TP_ARGS(Sensor, Sequence, WidthNs, DistanceMm),
+	TP_STRUCT__entry(
+		__field(unsigned int, sensor)
+		__field(u32, sequence)
+		__field(u32, width_ns)
+		__field(u32, distance_mm)
+	),
+	TP_fast_assign(
+		__entry->sensor = Sensor;
+		__entry->sequence = Sequence;
+		__entry->width_ns = WidthNs;
+		__entry->distance_mm = DistanceMm;
+	),
+	TP_printk("sensor=%u seq=%u width_ns=%u distance_mm=%u", __entry->sensor, __entry->sequence,
+	          __entry->width_ns, __entry->distance_mm)
+);
+
+#endif
+
+/* The trace header is not in include/trace/events */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pulse_trace
+#include <trace/define_trace.h>
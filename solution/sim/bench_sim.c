@@ -0,0 +1,177 @@
+/* *********************************************************************
+ *
+ * Backend of the benchmark on the host simulation of both drivers
+ *
+ * Program Name:        BenchSim
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "ksim_host.h"
+#include "../bench.h"
+
+/* Sensor pins, the driver defaults */
+#define BENCH_SIM_TRIGGER_GPIO   14
+#define BENCH_SIM_ECHO_GPIO   15
+
+/*
+ * Default script of the sensor: an obstacle at 200mm every eighth echo, the
+ * rest at 1m, so the reaction benchmark sees an obstacle several times a
+ * second at the full rate
+ */
+static int BenchSimScript[KSIM_ECHO_MAX_STEPS] = {1000, 1000, 1000, 1000, 1000, 1000, 1000, 200};
+static unsigned int BenchSimScriptCount = 8;
+static int BenchSimPins[2] = {BENCH_SIM_TRIGGER_GPIO, BENCH_SIM_ECHO_GPIO};
+
+/* *********************************************************************
+ * NAME:             BenchSimParseList
+ * CALLED BY:        BenchSimParam
+ * DESCRIPTION:      Parses comma separated numbers
+ * INPUT PARAMETERS: Text : list to parse
+ *                   Value : filled with the numbers
+ *                   Max : size of Value
+ * RETURN VALUES:    unsigned int : numbers parsed, 0 on a bad list
+ ***********************************************************************/
+static unsigned int BenchSimParseList(const char *Text, int *Value, unsigned int Max)
+{
+	unsigned int Count = 0;
+	char *End;
+
+	do
+	{
+		if (Count == Max)
+		{
+			return 0;
+		}
+		Value[Count++] = (int)strtol(Text,&End,0);
+		if ((End == Text) || ((*End) && (',' != *End)))
+		{
+			return 0;
+		}
+		Text = End + 1;
+	}while (',' == *End);
+	return Count;
+}
+
+/* *********************************************************************
+ * NAME:             BenchSimParam
+ * CALLED BY:        Benchmark, for the arguments it does not know
+ * DESCRIPTION:      echo=mm,mm,... scripts the sensor, pins=trigger,echo
+ *                   names its gpios, anything else is a module parameter
+ * INPUT PARAMETERS: Argument : name=value
+ * RETURN VALUES:    int : 0, -EINVAL for a bad argument
+ ***********************************************************************/
+static int BenchSimParam(const char *Argument)
+{
+	unsigned int Count;
+
+	if (0 == strncmp(Argument,"echo=",5))
+	{
+		Count = BenchSimParseList(Argument + 5,BenchSimScript,KSIM_ECHO_MAX_STEPS);
+		if (0 == Count)
+		{
+			return -EINVAL;
+		}
+		BenchSimScriptCount = Count;
+		return 0;
+	}
+	if (0 == strncmp(Argument,"pins=",5))
+	{
+		return (2 == BenchSimParseList(Argument + 5,BenchSimPins,2)) ? 0 : -EINVAL;
+	}
+	return (KsimParamSet(Argument)) ? -EINVAL : 0;
+}
+
+/* *********************************************************************
+ * NAME:             BenchSimSetup / BenchSimTeardown
+ * CALLED BY:        Benchmark, around the runs
+ * DESCRIPTION:      Starts the simulation with the scripted sensor and
+ *                   loads both drivers, as insmod would
+ ***********************************************************************/
+static int BenchSimSetup(void)
+{
+	int Ret;
+
+	Ret = KsimStart();
+	if (Ret)
+	{
+		return Ret;
+	}
+	Ret = KsimEchoScript(BenchSimPins[0],BenchSimPins[1],BenchSimScript,BenchSimScriptCount);
+	if (0 == Ret)
+	{
+		Ret = KsimModuleInit();
+	}
+	if (Ret)
+	{
+		KsimStop();
+	}
+	return Ret;
+}
+
+static void BenchSimTeardown(void)
+{
+	KsimModuleExit();
+	KsimStop();
+}
+
+/* *********************************************************************
+ * NAME:             BenchSim<file operation>
+ * CALLED BY:        Benchmark
+ * DESCRIPTION:      File operations on the simulated devices
+ ***********************************************************************/
+static int BenchSimOpen(const char *Device, BenchFileType *File)
+{
+	KsimFileType *Sim;
+	int Ret;
+
+	Ret = KsimOpen(Device,O_RDWR,&Sim);
+	File->Fd = -1;
+	File->Sim = (Ret) ? NULL : Sim;
+	return Ret;
+}
+
+static void BenchSimClose(BenchFileType *File)
+{
+	KsimClose(File->Sim);
+	File->Sim = NULL;
+}
+
+static ssize_t BenchSimRead(BenchFileType *File, void *Buffer, size_t Size)
+{
+	return KsimRead(File->Sim,Buffer,Size);
+}
+
+static long BenchSimIoctl(BenchFileType *File, unsigned int Command, unsigned long Argument)
+{
+	return KsimIoctl(File->Sim,Command,Argument);
+}
+
+static int BenchSimPoll(BenchFileType *File, short Events, int TimeoutMs)
+{
+	int Ret;
+
+	Ret = KsimPoll(File->Sim,Events,TimeoutMs);
+	return (Ret < 0) ? Ret : (0 != Ret);
+}
+
+const BenchIoType SimBenchIo = {
+	.Name = "sim",
+	.Param = BenchSimParam,
+	.Setup = BenchSimSetup,
+	.Teardown = BenchSimTeardown,
+	.Open = BenchSimOpen,
+	.Close = BenchSimClose,
+	.Read = BenchSimRead,
+	.Ioctl = BenchSimIoctl,
+	.Poll = BenchSimPoll,
+};
@@ -0,0 +1,1928 @@
+/* *********************************************************************
+ *
+ * Kernel services of the host simulation build
+ *
+ * Program Name:        KernelSim
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/*
+ * One thread runs every hrtimer, one the spi messages given to spi_async
+ * and every threaded irq has its own thread, so the drivers see the same
+ * concurrency as on the board. Hard irq handlers run on the thread that
+ * drives the gpio, which for the scripted sensors is the timer thread.
+ */
+#include <stdarg.h>
+#include <time.h>
+#include "ksim.h"
+#include "ksim_host.h"
+
+/* Numbers of the simulated resources */
+#define KSIM_MAX_PARAMS   32
+#define KSIM_MAX_MODULES   4
+#define KSIM_MAX_GPIOS   128
+#define KSIM_IRQ_BASE   256
+#define KSIM_MAX_CDEVS   8
+#define KSIM_MAX_DEVICES   16
+#define KSIM_MAX_DENTRIES   16
+#define KSIM_MAX_SENSORS   4
+#define KSIM_FIRST_MAJOR   240
+#define KSIM_NAME_LENGTH   32
+
+/* Module parameter */
+typedef struct KsimParamTag
+{
+	const char *Name; /* Name given to module_param */
+	void *Value; /* Variable or first element of the array */
+	KsimParam_Type Type; /* Type of the elements */
+	unsigned int Count; /* Elements of the array, 1 for a variable */
+	unsigned int *Set; /* Elements given on the command line, may be NULL */
+}KsimParamType;
+
+/* Driver linked into the program */
+typedef struct KsimModuleTag
+{
+	const char *File; /* Source file, pairs module_init with module_exit */
+	int (*Init)(void); /* module_init function */
+	void (*Exit)(void); /* module_exit function */
+}KsimModuleType;
+
+/* Kernel thread */
+struct task_struct
+{
+	pthread_t Thread; /* Thread running ThreadFn */
+	int (*ThreadFn)(void *); /* Thread function */
+	void *Data; /* Argument of ThreadFn */
+	char Name[KSIM_NAME_LENGTH]; /* Name given to kthread_run */
+	pthread_mutex_t Lock; /* Protects State */
+	pthread_cond_t Cond; /* Signalled by wake_up_process */
+	int State; /* TASK_RUNNING or sleeping */
+	int StopRequested; /* Set by kthread_stop */
+	wait_queue_head_t *Waiting; /* Queue the thread sleeps on */
+	int Ret; /* Value returned by ThreadFn */
+};
+
+/* Threaded irq of a gpio */
+typedef struct KsimIrqTag
+{
+	irq_handler_t Handler; /* Hard irq handler */
+	irq_handler_t ThreadFn; /* Irq thread function */
+	unsigned long Flags; /* IRQF_TRIGGER_* */
+	void *DevId; /* Argument of the handlers */
+	pthread_t Thread; /* Runs ThreadFn */
+	pthread_cond_t Cond; /* Signalled when the thread is woken */
+	int Pending; /* IRQ_WAKE_THREAD seen */
+	int Stop; /* Set by free_irq */
+	unsigned long Count; /* Hard irqs delivered */
+}KsimIrqType;
+
+/* Gpio line */
+typedef struct KsimGpioTag
+{
+	int Value; /* Level of the line */
+	int Requested; /* Claimed by gpio_request_one */
+	KsimIrqType *Irq; /* Registered irq, NULL if none */
+}KsimGpioType;
+
+/* Scripted HC-SR04 */
+typedef struct KsimSensorTag
+{
+	int TriggerGpio, EchoGpio; /* Pins of the sensor */
+	int DistanceMm[KSIM_ECHO_MAX_STEPS]; /* Script */
+	unsigned int Count, Next; /* Steps of the script and step of the next echo */
+	struct hrtimer Timer; /* Gives the edges of the echo */
+	int NextLevel; /* Echo level driven by the next expiry */
+	u64 WidthNs; /* Width of the pending echo */
+	KsimEchoStatsType Stats; /* Totals */
+	KsimEchoRecordType Record[KSIM_ECHO_RECORDS]; /* Echo of trigger n in Record[n % KSIM_ECHO_RECORDS] */
+	KsimEchoRecordType *Pending; /* Record of the echo being given */
+}KsimSensorType;
+
+/* Device node created by device_create */
+typedef struct KsimDeviceTag
+{
+	char Name[KSIM_NAME_LENGTH]; /* Name in /dev */
+	dev_t Dev; /* Device number */
+}KsimDeviceType;
+
+/* debugfs directory or file */
+struct dentry
+{
+	char Name[KSIM_NAME_LENGTH]; /* Name in its directory */
+	struct dentry *Parent; /* NULL at the top */
+	void *Data; /* i_private of the file */
+	const struct file_operations *Fops; /* NULL for a directory */
+	int InUse; /* Slot taken */
+};
+
+struct class
+{
+	char Name[KSIM_NAME_LENGTH];
+};
+
+/* Open file of a simulated device */
+struct KsimFileTag
+{
+	struct inode Inode; /* Inode of the device */
+	struct file File; /* File given to the operations */
+	loff_t Pos; /* File position */
+	const struct file_operations *Fops; /* Operations of the cdev */
+};
+
+/* Drivers registered by the constructors of module_init and module_exit */
+static KsimModuleType KsimModules[KSIM_MAX_MODULES];
+static unsigned int KsimModuleCount = 0, KsimModulesLoaded = 0;
+
+/* Parameters registered by the constructors of module_param */
+static KsimParamType KsimParams[KSIM_MAX_PARAMS];
+static unsigned int KsimParamCount = 0;
+
+/* Kernel thread running on the calling thread, NULL for others */
+static __thread struct task_struct *KsimTask = NULL;
+
+/* Timer thread and its list of queued timers, soonest first */
+static pthread_t KsimTimerThread;
+static pthread_mutex_t KsimTimerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t KsimTimerCond;
+static pthread_cond_t KsimTimerDoneCond;
+static struct hrtimer *KsimTimerHead = NULL;
+static struct hrtimer *KsimTimerRunning = NULL;
+static int KsimTimerStop = 0;
+
+/* spi bus, messages of spi_async and the capture */
+static pthread_t KsimSpiThread;
+static pthread_mutex_t KsimSpiBusLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t KsimSpiQueueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t KsimSpiQueueCond = PTHREAD_COND_INITIALIZER;
+static struct spi_message *KsimSpiQueueHead = NULL, *KsimSpiQueueTail = NULL;
+static int KsimSpiStop = 0;
+static FILE *KsimSpiLog = NULL;
+static KsimSpiStatsType KsimSpiTotals;
+static unsigned char KsimSpiShift[2 * KSIM_MAX_PANELS]; /* Bytes since the last latch */
+static unsigned int KsimSpiShiftCount = 0;
+static unsigned int KsimSpiLatchBytes = 0, KsimSpiLatchTransfers = 0; /* Sent since the last latch */
+static struct spi_driver *KsimSpiDriver = NULL;
+static struct spi_device KsimSpiDevice;
+
+/* gpios and their irqs */
+static pthread_mutex_t KsimIrqLock = PTHREAD_MUTEX_INITIALIZER;
+static KsimGpioType KsimGpio[KSIM_MAX_GPIOS];
+static KsimSensorType KsimSensor[KSIM_MAX_SENSORS];
+static unsigned int KsimSensorCount = 0;
+
+/* Character devices */
+static pthread_mutex_t KsimDevLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int KsimNextMajor = KSIM_FIRST_MAJOR;
+static struct cdev *KsimCdev[KSIM_MAX_CDEVS];
+static KsimDeviceType KsimDevice[KSIM_MAX_DEVICES];
+static struct dentry KsimDentry[KSIM_MAX_DENTRIES];
+
+/*
+ * Time of the edge whose hard handler runs on this thread, 0 otherwise.
+ * The handler then reads the time of the edge exactly, as a kernel irq
+ * taken at once would, whatever the host does between the two
+ */
+static __thread s64 KsimPinnedNs = 0;
+
+/* *********************************************************************
+ * NAME:             KsimNowNs / KsimHostNowNs
+ * CALLED BY:        ktime_get, jiffies and the test programs
+ * DESCRIPTION:      Monotonic clock of the host in nano seconds, pinned
+ *                   to the edge while a hard irq handler runs
+ ***********************************************************************/
+s64 KsimNowNs(void)
+{
+	struct timespec Now;
+
+	if (KsimPinnedNs)
+	{
+		return KsimPinnedNs;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&Now);
+	return ((s64)Now.tv_sec * NSEC_PER_SEC) + Now.tv_nsec;
+}
+
+unsigned long long KsimHostNowNs(void)
+{
+	return (unsigned long long)KsimNowNs();
+}
+
+/* *********************************************************************
+ * NAME:             KsimNsToTimespec
+ * CALLED BY:        Timed waits of this file
+ * DESCRIPTION:      Monotonic time in nano seconds as a timespec
+ ***********************************************************************/
+static struct timespec KsimNsToTimespec(s64 Ns)
+{
+	struct timespec Time;
+
+	Time.tv_sec = Ns / NSEC_PER_SEC;
+	Time.tv_nsec = Ns % NSEC_PER_SEC;
+	return Time;
+}
+
+/* *********************************************************************
+ * NAME:             KsimCondInit
+ * CALLED BY:        Every condition variable with a timed wait
+ * DESCRIPTION:      Condition variable timed on the monotonic clock
+ ***********************************************************************/
+static void KsimCondInit(pthread_cond_t *Cond)
+{
+	pthread_condattr_t Attr;
+
+	pthread_condattr_init(&Attr);
+	pthread_condattr_setclock(&Attr,CLOCK_MONOTONIC);
+	pthread_cond_init(Cond,&Attr);
+	pthread_condattr_destroy(&Attr);
+}
+
+/* *********************************************************************
+ * NAME:             KsimSleepNs
+ * CALLED BY:        msleep, usleep_range, the spi bus
+ * DESCRIPTION:      Sleeps on the host
+ ***********************************************************************/
+static void KsimSleepNs(s64 Ns)
+{
+	struct timespec Until = KsimNsToTimespec(KsimNowNs() + Ns);
+
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&Until,NULL))
+	{
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KsimPrintk
+ * CALLED BY:        printk
+ * DESCRIPTION:      Kernel log on the standard error, the standard
+ *                   output is left to the test programs
+ ***********************************************************************/
+int KsimPrintk(const char *Format, ...)
+{
+	va_list Args;
+	int Ret;
+
+	va_start(Args,Format);
+	Ret = vfprintf(stderr,Format,Args);
+	va_end(Args);
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             KsimModuleRegister
+ * CALLED BY:        Constructors of module_init and module_exit
+ * DESCRIPTION:      Records the init or exit function of the driver in
+ *                   File
+ ***********************************************************************/
+void KsimModuleRegister(const char *File, int (*Init)(void), void (*Exit)(void))
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < KsimModuleCount; LoopIndex++)
+	{
+		if (0 == strcmp(File,KsimModules[LoopIndex].File))
+		{
+			break;
+		}
+	}
+	if (LoopIndex == KSIM_MAX_MODULES)
+	{
+		return;
+	}
+	if (LoopIndex == KsimModuleCount)
+	{
+		KsimModules[KsimModuleCount++].File = File;
+	}
+	if (Init)
+	{
+		KsimModules[LoopIndex].Init = Init;
+	}
+	if (Exit)
+	{
+		KsimModules[LoopIndex].Exit = Exit;
+	}
+}
+
+int KsimModuleInit(void)
+{
+	int Ret;
+
+	for (KsimModulesLoaded = 0; KsimModulesLoaded < KsimModuleCount; KsimModulesLoaded++)
+	{
+		if (NULL == KsimModules[KsimModulesLoaded].Init)
+		{
+			continue;
+		}
+		Ret = KsimModules[KsimModulesLoaded].Init();
+		if (Ret)
+		{
+			KsimModuleExit();
+			return Ret;
+		}
+	}
+	return 0;
+}
+
+void KsimModuleExit(void)
+{
+	while (KsimModulesLoaded)
+	{
+		KsimModulesLoaded--;
+		if (KsimModules[KsimModulesLoaded].Exit)
+		{
+			KsimModules[KsimModulesLoaded].Exit();
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KsimParamRegister
+ * CALLED BY:        Constructors of module_param and module_param_array
+ * DESCRIPTION:      Records a module parameter for KsimParamSet
+ ***********************************************************************/
+void KsimParamRegister(const char *Name, void *Value, KsimParam_Type Type, unsigned int Count, unsigned int *Set)
+{
+	if (KsimParamCount < KSIM_MAX_PARAMS)
+	{
+		KsimParams[KsimParamCount].Name = Name;
+		KsimParams[KsimParamCount].Value = Value;
+		KsimParams[KsimParamCount].Type = Type;
+		KsimParams[KsimParamCount].Count = Count;
+		KsimParams[KsimParamCount].Set = Set;
+		KsimParamCount++;
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KsimParamSet
+ * CALLED BY:        Test programs, for every name=value argument
+ * DESCRIPTION:      Parses a parameter as insmod does, arrays take comma
+ *                   separated values
+ * INPUT PARAMETERS: Argument : name=value[,value...]
+ * RETURN VALUES:    int : 0, -ENOENT for an unknown name, -EINVAL for a
+ *                   bad value
+ ***********************************************************************/
+int KsimParamSet(const char *Argument)
+{
+	const char *Value = strchr(Argument,'=');
+	size_t NameLength;
+	unsigned int LoopIndex, Element = 0;
+	KsimParamType *Param = NULL;
+	char *End;
+	long Number;
+
+	if (NULL == Value)
+	{
+		return -EINVAL;
+	}
+	NameLength = Value - Argument;
+	Value++;
+	for (LoopIndex = 0; LoopIndex < KsimParamCount; LoopIndex++)
+	{
+		if ((strlen(KsimParams[LoopIndex].Name) == NameLength) &&
+		    (0 == strncmp(KsimParams[LoopIndex].Name,Argument,NameLength)))
+		{
+			Param = &KsimParams[LoopIndex];
+		}
+	}
+	if (NULL == Param)
+	{
+		return -ENOENT;
+	}
+	do
+	{
+		if (Element >= Param->Count)
+		{
+			return -EINVAL;
+		}
+		if ((KSIM_PARAM_bool == Param->Type) && strchr("YyNn",*Value) && (*Value))
+		{
+			Number = (('Y' == *Value) || ('y' == *Value));
+			End = (char *)Value + 1;
+		}
+		else
+		{
+			Number = strtol(Value,&End,0);
+		}
+		if ((End == Value) || ((*End) && (',' != *End)))
+		{
+			return -EINVAL;
+		}
+		switch (Param->Type)
+		{
+		case KSIM_PARAM_bool:
+			((bool *)Param->Value)[Element] = (0 != Number);
+			break;
+		case KSIM_PARAM_int:
+			((int *)Param->Value)[Element] = (int)Number;
+			break;
+		case KSIM_PARAM_uint:
+			((unsigned int *)Param->Value)[Element] = (unsigned int)Number;
+			break;
+		}
+		Element++;
+		Value = End + 1;
+	}while (',' == *End);
+	if (Param->Set)
+	{
+		*(Param->Set) = Element;
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             vmalloc_user / remap_vmalloc_range
+ * CALLED BY:        Drivers, for the memory mapped by the applications
+ * DESCRIPTION:      Page aligned zeroed memory. The test program shares
+ *                   the address space, so a mapping is the memory itself
+ ***********************************************************************/
+void *vmalloc_user(unsigned long Size)
+{
+	void *Memory = NULL;
+
+	if (posix_memalign(&Memory,PAGE_SIZE,PAGE_ALIGN(Size)))
+	{
+		return NULL;
+	}
+	memset(Memory,0,PAGE_ALIGN(Size));
+	return Memory;
+}
+
+int remap_vmalloc_range(struct vm_area_struct *Vma, void *Address, unsigned long PgOff)
+{
+	Vma->vm_start = (unsigned long)Address + (PgOff << PAGE_SHIFT);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             udelay / msleep / usleep_range
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      udelay spins as it does in the kernel
+ ***********************************************************************/
+void udelay(unsigned long Us)
+{
+	s64 Until = KsimNowNs() + ((s64)Us * NSEC_PER_USEC);
+
+	while (KsimNowNs() < Until)
+	{
+	}
+}
+
+void msleep(unsigned int Ms)
+{
+	KsimSleepNs((s64)Ms * NSEC_PER_MSEC);
+}
+
+void usleep_range(unsigned long Min, unsigned long Max)
+{
+	(void)Max;
+	KsimSleepNs((s64)Min * NSEC_PER_USEC);
+}
+
+/* *********************************************************************
+ * NAME:             KsimTimerInsert / KsimTimerRemove
+ * CALLED BY:        Timer functions, with KsimTimerLock held
+ * DESCRIPTION:      Keeps the list sorted by expiry, a timer queued
+ *                   twice for the same time runs in the order queued
+ ***********************************************************************/
+static void KsimTimerInsert(struct hrtimer *Timer)
+{
+	struct hrtimer **Link = &KsimTimerHead;
+
+	while ((*Link) && ((*Link)->expires.tv64 <= Timer->expires.tv64))
+	{
+		Link = &((*Link)->KsimNext);
+	}
+	Timer->KsimNext = *Link;
+	*Link = Timer;
+	Timer->KsimQueued = 1;
+	if (KsimTimerHead == Timer)
+	{
+		pthread_cond_signal(&KsimTimerCond);
+	}
+}
+
+static int KsimTimerRemove(struct hrtimer *Timer)
+{
+	struct hrtimer **Link = &KsimTimerHead;
+
+	if (!Timer->KsimQueued)
+	{
+		return 0;
+	}
+	while (*Link != Timer)
+	{
+		Link = &((*Link)->KsimNext);
+	}
+	*Link = Timer->KsimNext;
+	Timer->KsimQueued = 0;
+	return 1;
+}
+
+/* *********************************************************************
+ * NAME:             KsimTimerMain
+ * CALLED BY:        Timer thread created by KsimStart
+ * DESCRIPTION:      Runs the expired timers, one at a time and without
+ *                   the lock so that a callback may start timers. A
+ *                   callback returning HRTIMER_RESTART is queued again
+ *                   for the expiry it has set
+ ***********************************************************************/
+static void *KsimTimerMain(void *Unused)
+{
+	struct hrtimer *Timer;
+	struct timespec Until;
+	enum hrtimer_restart Restart;
+
+	(void)Unused;
+	pthread_mutex_lock(&KsimTimerLock);
+	while (!KsimTimerStop)
+	{
+		Timer = KsimTimerHead;
+		if (NULL == Timer)
+		{
+			pthread_cond_wait(&KsimTimerCond,&KsimTimerLock);
+		}
+		else if (Timer->expires.tv64 > KsimNowNs())
+		{
+			Until = KsimNsToTimespec(Timer->expires.tv64);
+			pthread_cond_timedwait(&KsimTimerCond,&KsimTimerLock,&Until);
+		}
+		else
+		{
+			KsimTimerRemove(Timer);
+			KsimTimerRunning = Timer;
+			pthread_mutex_unlock(&KsimTimerLock);
+			Restart = Timer->function(Timer);
+			pthread_mutex_lock(&KsimTimerLock);
+			KsimTimerRunning = NULL;
+			if ((HRTIMER_RESTART == Restart) && !(Timer->KsimQueued))
+			{
+				KsimTimerInsert(Timer);
+			}
+			pthread_cond_broadcast(&KsimTimerDoneCond);
+		}
+	}
+	pthread_mutex_unlock(&KsimTimerLock);
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             hrtimer_init / hrtimer_start / hrtimer_cancel /
+ *                   hrtimer_try_to_cancel / hrtimer_forward_now
+ * CALLED BY:        Drivers and the scripted sensors
+ * DESCRIPTION:      hrtimer on the timer thread
+ ***********************************************************************/
+void hrtimer_init(struct hrtimer *Timer, int ClockId, enum hrtimer_mode Mode)
+{
+	(void)ClockId;
+	(void)Mode;
+	memset(Timer,0,sizeof(*Timer));
+}
+
+int hrtimer_start(struct hrtimer *Timer, ktime_t Time, const enum hrtimer_mode Mode)
+{
+	int WasQueued;
+
+	pthread_mutex_lock(&KsimTimerLock);
+	WasQueued = KsimTimerRemove(Timer);
+	Timer->expires = (HRTIMER_MODE_REL == Mode) ? ktime_add(ktime_get(),Time) : Time;
+	KsimTimerInsert(Timer);
+	pthread_mutex_unlock(&KsimTimerLock);
+	return WasQueued;
+}
+
+int hrtimer_cancel(struct hrtimer *Timer)
+{
+	int WasQueued;
+
+	pthread_mutex_lock(&KsimTimerLock);
+	WasQueued = KsimTimerRemove(Timer);
+	while (KsimTimerRunning == Timer)
+	{
+		pthread_cond_wait(&KsimTimerDoneCond,&KsimTimerLock);
+		/* A restarting callback has queued it again */
+		WasQueued |= KsimTimerRemove(Timer);
+	}
+	pthread_mutex_unlock(&KsimTimerLock);
+	return WasQueued;
+}
+
+int hrtimer_try_to_cancel(struct hrtimer *Timer)
+{
+	int Ret = -1;
+
+	pthread_mutex_lock(&KsimTimerLock);
+	if (KsimTimerRunning != Timer)
+	{
+		Ret = KsimTimerRemove(Timer);
+	}
+	pthread_mutex_unlock(&KsimTimerLock);
+	return Ret;
+}
+
+u64 hrtimer_forward_now(struct hrtimer *Timer, ktime_t Interval)
+{
+	s64 Delta = KsimNowNs() - Timer->expires.tv64;
+	u64 Overruns;
+
+	if (Delta < 0)
+	{
+		return 0;
+	}
+	Overruns = (Delta / Interval.tv64) + 1;
+	Timer->expires.tv64 += (s64)Overruns * Interval.tv64;
+	return Overruns;
+}
+
+/* *********************************************************************
+ * NAME:             KsimThreadMain
+ * CALLED BY:        Thread created by kthread_run
+ * DESCRIPTION:      Runs the thread function as current
+ ***********************************************************************/
+static void *KsimThreadMain(void *TaskLocal)
+{
+	struct task_struct *Task = TaskLocal;
+	int Stopped;
+
+	KsimTask = Task;
+	Task->Ret = Task->ThreadFn(Task->Data);
+	/* A thread ending without kthread_stop is freed at once, as in the kernel */
+	pthread_mutex_lock(&(Task->Lock));
+	Stopped = Task->StopRequested;
+	pthread_mutex_unlock(&(Task->Lock));
+	if (!Stopped)
+	{
+		pthread_detach(Task->Thread);
+		free(Task);
+	}
+	return NULL;
+}
+
+struct task_struct *KsimCurrent(void)
+{
+	return KsimTask;
+}
+
+/* *********************************************************************
+ * NAME:             KsimKthreadRun / kthread_stop / kthread_should_stop
+ * CALLED BY:        Drivers, through kthread_run
+ * DESCRIPTION:      Kernel threads on pthreads. kthread_stop wakes the
+ *                   thread from the queue or the timeout it sleeps on
+ *                   and waits for the thread function to return
+ ***********************************************************************/
+struct task_struct *KsimKthreadRun(int (*ThreadFn)(void *), void *Data, const char *Name)
+{
+	struct task_struct *Task = calloc(1,sizeof(*Task));
+
+	if (NULL == Task)
+	{
+		return ERR_PTR(-ENOMEM);
+	}
+	Task->ThreadFn = ThreadFn;
+	Task->Data = Data;
+	snprintf(Task->Name,sizeof(Task->Name),"%s",Name);
+	Task->State = TASK_RUNNING;
+	pthread_mutex_init(&(Task->Lock),NULL);
+	KsimCondInit(&(Task->Cond));
+	if (pthread_create(&(Task->Thread),NULL,&KsimThreadMain,Task))
+	{
+		free(Task);
+		return ERR_PTR(-EAGAIN);
+	}
+	return Task;
+}
+
+int kthread_stop(struct task_struct *Task)
+{
+	wait_queue_head_t *Queue;
+	int Ret;
+
+	pthread_mutex_lock(&(Task->Lock));
+	__atomic_store_n(&(Task->StopRequested),1,__ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&(Task->Lock));
+	Queue = __atomic_load_n(&(Task->Waiting),__ATOMIC_SEQ_CST);
+	if (Queue)
+	{
+		wake_up(Queue);
+	}
+	wake_up_process(Task);
+	pthread_join(Task->Thread,NULL);
+	Ret = Task->Ret;
+	free(Task);
+	return Ret;
+}
+
+bool kthread_should_stop(void)
+{
+	return (KsimTask) && __atomic_load_n(&(KsimTask->StopRequested),__ATOMIC_SEQ_CST);
+}
+
+/* *********************************************************************
+ * NAME:             set_current_state / wake_up_process /
+ *                   schedule_hrtimeout_range
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      A thread that has set itself sleeping and is woken
+ *                   before it calls schedule_hrtimeout_range does not
+ *                   sleep, as in the kernel
+ ***********************************************************************/
+void set_current_state(int State)
+{
+	if (KsimTask)
+	{
+		pthread_mutex_lock(&(KsimTask->Lock));
+		KsimTask->State = State;
+		pthread_mutex_unlock(&(KsimTask->Lock));
+	}
+}
+
+int wake_up_process(struct task_struct *Task)
+{
+	int Woken = 0;
+
+	pthread_mutex_lock(&(Task->Lock));
+	if (TASK_RUNNING != Task->State)
+	{
+		Task->State = TASK_RUNNING;
+		pthread_cond_signal(&(Task->Cond));
+		Woken = 1;
+	}
+	pthread_mutex_unlock(&(Task->Lock));
+	return Woken;
+}
+
+int schedule_hrtimeout_range(ktime_t *Expires, unsigned long Delta, const enum hrtimer_mode Mode)
+{
+	s64 Until = (HRTIMER_MODE_REL == Mode) ? (KsimNowNs() + Expires->tv64) : Expires->tv64;
+	struct timespec Deadline = KsimNsToTimespec(Until);
+	int Ret = 0;
+
+	(void)Delta;
+	if (NULL == KsimTask)
+	{
+		KsimSleepNs(Until - KsimNowNs());
+		return 0;
+	}
+	pthread_mutex_lock(&(KsimTask->Lock));
+	while ((TASK_RUNNING != KsimTask->State) && (KsimNowNs() < Until))
+	{
+		pthread_cond_timedwait(&(KsimTask->Cond),&(KsimTask->Lock),&Deadline);
+	}
+	if (TASK_RUNNING == KsimTask->State)
+	{
+		Ret = -EINTR;
+	}
+	KsimTask->State = TASK_RUNNING;
+	pthread_mutex_unlock(&(KsimTask->Lock));
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             init_waitqueue_head / wake_up / KsimWaitPrepare /
+ *                   KsimWaitSleep / KsimWaitFinish
+ * CALLED BY:        Drivers, through wait_event and poll_wait
+ * DESCRIPTION:      Wait queue counting its wake ups. A waiter that has
+ *                   read the count before testing its condition cannot
+ *                   miss a wake up that comes after the test
+ ***********************************************************************/
+void init_waitqueue_head(wait_queue_head_t *Queue)
+{
+	spin_lock_init(&(Queue->lock));
+	KsimCondInit(&(Queue->Cond));
+	Queue->Sequence = 0;
+}
+
+void wake_up(wait_queue_head_t *Queue)
+{
+	spin_lock(&(Queue->lock));
+	Queue->Sequence++;
+	pthread_cond_broadcast(&(Queue->Cond));
+	spin_unlock(&(Queue->lock));
+}
+
+unsigned long KsimWaitPrepare(wait_queue_head_t *Queue)
+{
+	unsigned long Sequence;
+
+	if (KsimTask)
+	{
+		__atomic_store_n(&(KsimTask->Waiting),Queue,__ATOMIC_SEQ_CST);
+	}
+	spin_lock(&(Queue->lock));
+	Sequence = Queue->Sequence;
+	spin_unlock(&(Queue->lock));
+	return Sequence;
+}
+
+/* *********************************************************************
+ * NAME:             KsimWaitSleepUntil
+ * CALLED BY:        KsimWaitSleep, KsimPoll
+ * DESCRIPTION:      Sleeps until the queue is woken after Sequence was
+ *                   read, or until Until if it is not 0
+ * RETURN VALUES:    int : 1 if woken, 0 on timeout
+ ***********************************************************************/
+static int KsimWaitSleepUntil(wait_queue_head_t *Queue, unsigned long Sequence, s64 Until)
+{
+	struct timespec Deadline = KsimNsToTimespec(Until);
+	int Woken;
+
+	spin_lock(&(Queue->lock));
+	while ((Queue->Sequence == Sequence) && ((0 == Until) || (KsimNowNs() < Until)))
+	{
+		if (Until)
+		{
+			pthread_cond_timedwait(&(Queue->Cond),&(Queue->lock.Lock),&Deadline);
+		}
+		else
+		{
+			pthread_cond_wait(&(Queue->Cond),&(Queue->lock.Lock));
+		}
+	}
+	Woken = (Queue->Sequence != Sequence);
+	spin_unlock(&(Queue->lock));
+	return Woken;
+}
+
+void KsimWaitSleep(wait_queue_head_t *Queue, unsigned long Sequence)
+{
+	KsimWaitSleepUntil(Queue,Sequence,0);
+}
+
+void KsimWaitFinish(void)
+{
+	if (KsimTask)
+	{
+		__atomic_store_n(&(KsimTask->Waiting),NULL,__ATOMIC_SEQ_CST);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             init_completion / complete /
+ *                   wait_for_completion_interruptible_timeout
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      Completion counting the calls to complete
+ ***********************************************************************/
+void init_completion(struct completion *Completion)
+{
+	pthread_mutex_init(&(Completion->Lock),NULL);
+	KsimCondInit(&(Completion->Cond));
+	Completion->done = 0;
+}
+
+void complete(struct completion *Completion)
+{
+	pthread_mutex_lock(&(Completion->Lock));
+	Completion->done++;
+	pthread_cond_signal(&(Completion->Cond));
+	pthread_mutex_unlock(&(Completion->Lock));
+}
+
+long wait_for_completion_interruptible_timeout(struct completion *Completion, unsigned long Timeout)
+{
+	s64 Until = KsimNowNs() + ((s64)Timeout * (NSEC_PER_SEC / HZ));
+	struct timespec Deadline = KsimNsToTimespec(Until);
+	long Left = 0;
+
+	pthread_mutex_lock(&(Completion->Lock));
+	while ((0 == Completion->done) && (KsimNowNs() < Until))
+	{
+		pthread_cond_timedwait(&(Completion->Cond),&(Completion->Lock),&Deadline);
+	}
+	if (Completion->done)
+	{
+		Completion->done--;
+		/* Jiffies left, at least 1 as the kernel returns */
+		Left = max_t(long,1,(Until - KsimNowNs()) / (NSEC_PER_SEC / HZ));
+	}
+	pthread_mutex_unlock(&(Completion->Lock));
+	return Left;
+}
+
+/* *********************************************************************
+ * NAME:             KsimSpiShiftOut
+ * CALLED BY:        KsimSpiRun, with the bus lock held
+ * DESCRIPTION:      Shifts the bytes of a transfer into the chain. At the
+ *                   release of the chip select every panel latches the
+ *                   register word in its shift register: the last word
+ *                   sent is in panel 0, the first in the last panel. The
+ *                   capture log gives the bytes and transfers of every
+ *                   latch, bytes past the chain are not decoded
+ ***********************************************************************/
+static void KsimSpiShiftOut(const unsigned char *Data, unsigned int Length, int Latch)
+{
+	unsigned int LoopIndex, Words, Panel;
+
+	KsimSpiLatchBytes += Length;
+	KsimSpiLatchTransfers++;
+	for (LoopIndex = 0; LoopIndex < Length; LoopIndex++)
+	{
+		/* The oldest byte is shifted out of the last panel */
+		if (KsimSpiShiftCount == sizeof(KsimSpiShift))
+		{
+			memmove(&KsimSpiShift[0],&KsimSpiShift[1],sizeof(KsimSpiShift) - 1);
+			KsimSpiShiftCount--;
+		}
+		KsimSpiShift[KsimSpiShiftCount++] = Data[LoopIndex];
+	}
+	if (!Latch)
+	{
+		return;
+	}
+	Words = KsimSpiShiftCount / 2;
+	if (KsimSpiLog)
+	{
+		fprintf(KsimSpiLog,"%12.3f us latch %u bytes %u transfers",(double)KsimNowNs() / NSEC_PER_USEC,
+		        KsimSpiLatchBytes,KsimSpiLatchTransfers);
+	}
+	for (LoopIndex = 0; LoopIndex < Words; LoopIndex++)
+	{
+		Panel = Words - 1 - LoopIndex;
+		KsimSpiTotals.Register[Panel][KsimSpiShift[2 * LoopIndex] & 0x0F] = KsimSpiShift[(2 * LoopIndex) + 1];
+		if (KsimSpiLog)
+		{
+			fprintf(KsimSpiLog," p%u:%02x=%02x",Panel,KsimSpiShift[2 * LoopIndex],KsimSpiShift[(2 * LoopIndex) + 1]);
+		}
+	}
+	if (KsimSpiLog)
+	{
+		fputc('\n',KsimSpiLog);
+	}
+	KsimSpiTotals.Latches++;
+	KsimSpiShiftCount = 0;
+	KsimSpiLatchBytes = 0;
+	KsimSpiLatchTransfers = 0;
+}
+
+/* *********************************************************************
+ * NAME:             KsimSpiRun
+ * CALLED BY:        spi_sync, spi thread
+ * DESCRIPTION:      Runs a message on the bus, taking the time the bytes
+ *                   need at the speed of every transfer. The chip select
+ *                   is released after the last transfer and after every
+ *                   transfer with cs_change set
+ ***********************************************************************/
+static void KsimSpiRun(struct spi_message *Message)
+{
+	struct list_head *Entry;
+	struct spi_transfer *Transfer;
+	s64 BusNs;
+
+	pthread_mutex_lock(&KsimSpiBusLock);
+	Message->actual_length = 0;
+	for (Entry = Message->transfers.next; Entry != &(Message->transfers); Entry = Entry->next)
+	{
+		Transfer = container_of(Entry, struct spi_transfer, transfer_list);
+		BusNs = ((s64)Transfer->len * 8 * NSEC_PER_SEC) / ((Transfer->speed_hz) ? Transfer->speed_hz : 1000000);
+		KsimSleepNs(BusNs + ((s64)Transfer->delay_usecs * NSEC_PER_USEC));
+		if (Transfer->tx_buf)
+		{
+			KsimSpiShiftOut(Transfer->tx_buf,Transfer->len,
+			                (Transfer->cs_change) || (Entry->next == &(Message->transfers)));
+		}
+		if (Transfer->rx_buf)
+		{
+			memset(Transfer->rx_buf,0,Transfer->len);
+		}
+		Message->actual_length += Transfer->len;
+		KsimSpiTotals.Transfers++;
+		KsimSpiTotals.Bytes += Transfer->len;
+		KsimSpiTotals.BusNs += BusNs;
+	}
+	KsimSpiTotals.Messages++;
+	Message->status = 0;
+	pthread_mutex_unlock(&KsimSpiBusLock);
+}
+
+/* *********************************************************************
+ * NAME:             KsimSpiMain
+ * CALLED BY:        spi thread created by KsimStart
+ * DESCRIPTION:      Runs the messages of spi_async in order and calls
+ *                   their complete callback, as the spi master queue does
+ ***********************************************************************/
+static void *KsimSpiMain(void *Unused)
+{
+	struct spi_message *Message;
+
+	(void)Unused;
+	pthread_mutex_lock(&KsimSpiQueueLock);
+	while (!KsimSpiStop || KsimSpiQueueHead)
+	{
+		Message = KsimSpiQueueHead;
+		if (NULL == Message)
+		{
+			pthread_cond_wait(&KsimSpiQueueCond,&KsimSpiQueueLock);
+			continue;
+		}
+		KsimSpiQueueHead = Message->KsimNext;
+		if (NULL == KsimSpiQueueHead)
+		{
+			KsimSpiQueueTail = NULL;
+		}
+		pthread_mutex_unlock(&KsimSpiQueueLock);
+		KsimSpiRun(Message);
+		if (Message->complete)
+		{
+			Message->complete(Message->context);
+		}
+		pthread_mutex_lock(&KsimSpiQueueLock);
+	}
+	pthread_mutex_unlock(&KsimSpiQueueLock);
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             spi_sync / spi_async
+ * CALLED BY:        spi_led
+ * DESCRIPTION:      spi_sync runs the message on the caller, spi_async
+ *                   queues it for the spi thread
+ ***********************************************************************/
+int spi_sync(struct spi_device *Spi, struct spi_message *Message)
+{
+	Message->spi = Spi;
+	KsimSpiRun(Message);
+	return Message->status;
+}
+
+int spi_async(struct spi_device *Spi, struct spi_message *Message)
+{
+	Message->spi = Spi;
+	Message->KsimNext = NULL;
+	pthread_mutex_lock(&KsimSpiQueueLock);
+	if (KsimSpiQueueTail)
+	{
+		KsimSpiQueueTail->KsimNext = Message;
+	}
+	else
+	{
+		KsimSpiQueueHead = Message;
+	}
+	KsimSpiQueueTail = Message;
+	KsimSpiTotals.AsyncMessages++;
+	pthread_cond_signal(&KsimSpiQueueCond);
+	pthread_mutex_unlock(&KsimSpiQueueLock);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             spi_register_driver / spi_unregister_driver
+ * CALLED BY:        spi_led
+ * DESCRIPTION:      The bus has one device, which is given to probe
+ ***********************************************************************/
+int spi_register_driver(struct spi_driver *Driver)
+{
+	KsimSpiDriver = Driver;
+	return (Driver->probe) ? Driver->probe(&KsimSpiDevice) : 0;
+}
+
+void spi_unregister_driver(struct spi_driver *Driver)
+{
+	if (Driver->remove)
+	{
+		Driver->remove(&KsimSpiDevice);
+	}
+	KsimSpiDriver = NULL;
+}
+
+void KsimSpiCapture(FILE *Log)
+{
+	pthread_mutex_lock(&KsimSpiBusLock);
+	KsimSpiLog = Log;
+	pthread_mutex_unlock(&KsimSpiBusLock);
+}
+
+void KsimSpiStats(KsimSpiStatsType *Stats)
+{
+	pthread_mutex_lock(&KsimSpiBusLock);
+	*Stats = KsimSpiTotals;
+	pthread_mutex_unlock(&KsimSpiBusLock);
+}
+
+/* *********************************************************************
+ * NAME:             KsimIrqMain
+ * CALLED BY:        Irq thread created by request_threaded_irq
+ * DESCRIPTION:      Runs the thread function once for every wake up,
+ *                   wake ups coming in while it runs are merged
+ ***********************************************************************/
+static void *KsimIrqMain(void *GpioLocal)
+{
+	KsimGpioType *Gpio = GpioLocal;
+	KsimIrqType *Irq = Gpio->Irq;
+
+	pthread_mutex_lock(&KsimIrqLock);
+	while (!Irq->Stop)
+	{
+		if (!Irq->Pending)
+		{
+			pthread_cond_wait(&(Irq->Cond),&KsimIrqLock);
+			continue;
+		}
+		Irq->Pending = 0;
+		pthread_mutex_unlock(&KsimIrqLock);
+		Irq->ThreadFn((int)(Gpio - KsimGpio) + KSIM_IRQ_BASE,Irq->DevId);
+		pthread_mutex_lock(&KsimIrqLock);
+	}
+	pthread_mutex_unlock(&KsimIrqLock);
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             KsimGpioDrive
+ * CALLED BY:        Scripted sensors
+ * DESCRIPTION:      Drives an input and gives the irq of the edge to
+ *                   the hard handler on the calling thread. EdgeNs gets
+ *                   the time of the edge, which is also the time the
+ *                   handler reads with ktime_get
+ ***********************************************************************/
+static void KsimGpioDrive(int GpioNumber, int Value, unsigned long long *EdgeNs)
+{
+	KsimGpioType *Gpio = &KsimGpio[GpioNumber];
+	KsimIrqType *Irq;
+	unsigned long Trigger;
+
+	pthread_mutex_lock(&KsimIrqLock);
+	if (Gpio->Value == Value)
+	{
+		pthread_mutex_unlock(&KsimIrqLock);
+		return;
+	}
+	__atomic_store_n(&(Gpio->Value),Value,__ATOMIC_SEQ_CST);
+	*EdgeNs = KsimNowNs();
+	Irq = Gpio->Irq;
+	Trigger = (Value) ? IRQF_TRIGGER_RISING : IRQF_TRIGGER_FALLING;
+	if ((Irq) && (Irq->Flags & Trigger))
+	{
+		Irq->Count++;
+		KsimPinnedNs = (s64)*EdgeNs;
+		if (IRQ_WAKE_THREAD == Irq->Handler(GpioNumber + KSIM_IRQ_BASE,Irq->DevId))
+		{
+			Irq->Pending = 1;
+			pthread_cond_signal(&(Irq->Cond));
+		}
+		KsimPinnedNs = 0;
+	}
+	pthread_mutex_unlock(&KsimIrqLock);
+}
+
+/* *********************************************************************
+ * NAME:             KsimEchoTimer
+ * CALLED BY:        hrtimer of a scripted sensor
+ * DESCRIPTION:      Rising edge of the echo, then the falling edge after
+ *                   the round trip time of the scripted distance
+ ***********************************************************************/
+static enum hrtimer_restart KsimEchoTimer(struct hrtimer *Timer)
+{
+	KsimSensorType *Sensor = container_of(Timer, KsimSensorType, Timer);
+	s64 LateNs = KsimNowNs() - Timer->expires.tv64;
+
+	if (LateNs > (s64)Sensor->Stats.WorstLateNs)
+	{
+		Sensor->Stats.WorstLateNs = LateNs;
+	}
+	KsimGpioDrive(Sensor->EchoGpio,Sensor->NextLevel,
+	              (Sensor->NextLevel) ? &(Sensor->Pending->RiseNs) : &(Sensor->Pending->FallNs));
+	if (0 == Sensor->NextLevel)
+	{
+		Sensor->Stats.Echoes++;
+		return HRTIMER_NORESTART;
+	}
+	Sensor->NextLevel = 0;
+	Timer->expires = ktime_add_ns(Timer->expires,Sensor->WidthNs);
+	return HRTIMER_RESTART;
+}
+
+/* *********************************************************************
+ * NAME:             KsimEchoTrigger
+ * CALLED BY:        gpio_set_value, on the falling edge of a trigger
+ * DESCRIPTION:      Starts the echo of the next step of the script
+ ***********************************************************************/
+static void KsimEchoTrigger(KsimSensorType *Sensor)
+{
+	int DistanceMm = Sensor->DistanceMm[Sensor->Next % Sensor->Count];
+	KsimEchoRecordType *Record = &(Sensor->Record[Sensor->Stats.Triggers % KSIM_ECHO_RECORDS]);
+
+	Sensor->Next++;
+	if (hrtimer_try_to_cancel(&(Sensor->Timer)) > 0)
+	{
+		Sensor->Stats.Overlaps++;
+	}
+	pthread_mutex_lock(&KsimIrqLock);
+	memset(Record,0,sizeof(*Record));
+	Record->DistanceMm = DistanceMm;
+	Sensor->Stats.Triggers++;
+	pthread_mutex_unlock(&KsimIrqLock);
+	if (DistanceMm <= 0)
+	{
+		return;
+	}
+	Sensor->Pending = Record;
+	Sensor->NextLevel = 1;
+	Sensor->WidthNs = div_u64((u64)DistanceMm * 2 * NSEC_PER_SEC,KSIM_SPEED_OF_SOUND_MM_PER_SEC);
+	hrtimer_start(&(Sensor->Timer),ktime_set(0,KSIM_ECHO_DELAY_US * NSEC_PER_USEC),HRTIMER_MODE_REL);
+}
+
+int KsimEchoScript(int TriggerGpio, int EchoGpio, const int *DistanceMm, unsigned int Count)
+{
+	KsimSensorType *Sensor;
+
+	if ((KsimSensorCount == KSIM_MAX_SENSORS) || (0 == Count) || (Count > KSIM_ECHO_MAX_STEPS) ||
+	    (TriggerGpio < 0) || (TriggerGpio >= KSIM_MAX_GPIOS) || (EchoGpio < 0) || (EchoGpio >= KSIM_MAX_GPIOS))
+	{
+		return -EINVAL;
+	}
+	Sensor = &KsimSensor[KsimSensorCount++];
+	memset(Sensor,0,sizeof(*Sensor));
+	Sensor->TriggerGpio = TriggerGpio;
+	Sensor->EchoGpio = EchoGpio;
+	memcpy(Sensor->DistanceMm,DistanceMm,Count * sizeof(int));
+	Sensor->Count = Count;
+	hrtimer_init(&(Sensor->Timer),CLOCK_MONOTONIC,HRTIMER_MODE_REL);
+	Sensor->Timer.function = &KsimEchoTimer;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             KsimEchoFind
+ * CALLED BY:        KsimEchoStats, KsimEchoRecord
+ * DESCRIPTION:      Scripted sensor of a trigger gpio, NULL if none
+ ***********************************************************************/
+static KsimSensorType *KsimEchoFind(int TriggerGpio)
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < KsimSensorCount; LoopIndex++)
+	{
+		if (TriggerGpio == KsimSensor[LoopIndex].TriggerGpio)
+		{
+			return &KsimSensor[LoopIndex];
+		}
+	}
+	return NULL;
+}
+
+void KsimEchoStats(int TriggerGpio, KsimEchoStatsType *Stats)
+{
+	KsimSensorType *Sensor = KsimEchoFind(TriggerGpio);
+
+	memset(Stats,0,sizeof(*Stats));
+	if (Sensor)
+	{
+		pthread_mutex_lock(&KsimIrqLock);
+		*Stats = Sensor->Stats;
+		pthread_mutex_unlock(&KsimIrqLock);
+	}
+}
+
+int KsimEchoRecord(int TriggerGpio, unsigned long Trigger, KsimEchoRecordType *Record)
+{
+	KsimSensorType *Sensor = KsimEchoFind(TriggerGpio);
+	int Ret = -ENOENT;
+
+	if (NULL == Sensor)
+	{
+		return -ENODEV;
+	}
+	pthread_mutex_lock(&KsimIrqLock);
+	if ((Trigger < Sensor->Stats.Triggers) && ((Sensor->Stats.Triggers - Trigger) <= KSIM_ECHO_RECORDS))
+	{
+		*Record = Sensor->Record[Trigger % KSIM_ECHO_RECORDS];
+		Ret = 0;
+	}
+	pthread_mutex_unlock(&KsimIrqLock);
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             gpio_request_one / gpio_free / gpio_set_value /
+ *                   gpio_get_value / gpio_to_irq
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      gpios 0 to KSIM_MAX_GPIOS - 1, irq KSIM_IRQ_BASE + n
+ *                   belongs to gpio n
+ ***********************************************************************/
+int gpio_request_one(unsigned int Gpio, unsigned long Flags, const char *Label)
+{
+	int Ret = 0;
+
+	(void)Label;
+	if (Gpio >= KSIM_MAX_GPIOS)
+	{
+		return -EINVAL;
+	}
+	pthread_mutex_lock(&KsimIrqLock);
+	if (KsimGpio[Gpio].Requested)
+	{
+		Ret = -EBUSY;
+	}
+	else
+	{
+		KsimGpio[Gpio].Requested = 1;
+		if (GPIOF_IN != Flags)
+		{
+			KsimGpio[Gpio].Value = (GPIOF_OUT_INIT_HIGH == Flags);
+		}
+	}
+	pthread_mutex_unlock(&KsimIrqLock);
+	return Ret;
+}
+
+void gpio_free(unsigned int Gpio)
+{
+	if (Gpio < KSIM_MAX_GPIOS)
+	{
+		pthread_mutex_lock(&KsimIrqLock);
+		KsimGpio[Gpio].Requested = 0;
+		pthread_mutex_unlock(&KsimIrqLock);
+	}
+}
+
+void gpio_set_value(unsigned int Gpio, int Value)
+{
+	unsigned int LoopIndex;
+	int Old;
+
+	if (Gpio >= KSIM_MAX_GPIOS)
+	{
+		return;
+	}
+	Old = __atomic_exchange_n(&(KsimGpio[Gpio].Value),!!Value,__ATOMIC_SEQ_CST);
+	if ((Old) && !(Value))
+	{
+		for (LoopIndex = 0; LoopIndex < KsimSensorCount; LoopIndex++)
+		{
+			if ((int)Gpio == KsimSensor[LoopIndex].TriggerGpio)
+			{
+				KsimEchoTrigger(&KsimSensor[LoopIndex]);
+			}
+		}
+	}
+}
+
+int gpio_get_value(unsigned int Gpio)
+{
+	return (Gpio < KSIM_MAX_GPIOS) ? __atomic_load_n(&(KsimGpio[Gpio].Value),__ATOMIC_SEQ_CST) : 0;
+}
+
+int gpio_to_irq(unsigned int Gpio)
+{
+	return (Gpio < KSIM_MAX_GPIOS) ? (int)Gpio + KSIM_IRQ_BASE : -EINVAL;
+}
+
+/* *********************************************************************
+ * NAME:             request_threaded_irq / free_irq
+ * CALLED BY:        pulse
+ * DESCRIPTION:      One irq per gpio. IRQF_ONESHOT is not modelled, the
+ *                   line stays enabled while the thread runs
+ ***********************************************************************/
+int request_threaded_irq(unsigned int IrqNumber, irq_handler_t Handler, irq_handler_t ThreadFn,
+                         unsigned long Flags, const char *Name, void *DevId)
+{
+	KsimGpioType *Gpio;
+	KsimIrqType *Irq;
+
+	(void)Name;
+	if ((IrqNumber < KSIM_IRQ_BASE) || (IrqNumber >= KSIM_IRQ_BASE + KSIM_MAX_GPIOS) || (NULL == Handler))
+	{
+		return -EINVAL;
+	}
+	Gpio = &KsimGpio[IrqNumber - KSIM_IRQ_BASE];
+	Irq = calloc(1,sizeof(*Irq));
+	if (NULL == Irq)
+	{
+		return -ENOMEM;
+	}
+	Irq->Handler = Handler;
+	Irq->ThreadFn = ThreadFn;
+	Irq->Flags = Flags;
+	Irq->DevId = DevId;
+	pthread_cond_init(&(Irq->Cond),NULL);
+	pthread_mutex_lock(&KsimIrqLock);
+	if (Gpio->Irq)
+	{
+		pthread_mutex_unlock(&KsimIrqLock);
+		free(Irq);
+		return -EBUSY;
+	}
+	Gpio->Irq = Irq;
+	if ((ThreadFn) && pthread_create(&(Irq->Thread),NULL,&KsimIrqMain,Gpio))
+	{
+		Gpio->Irq = NULL;
+		pthread_mutex_unlock(&KsimIrqLock);
+		free(Irq);
+		return -EAGAIN;
+	}
+	pthread_mutex_unlock(&KsimIrqLock);
+	return 0;
+}
+
+void free_irq(unsigned int IrqNumber, void *DevId)
+{
+	KsimGpioType *Gpio;
+	KsimIrqType *Irq;
+
+	if ((IrqNumber < KSIM_IRQ_BASE) || (IrqNumber >= KSIM_IRQ_BASE + KSIM_MAX_GPIOS))
+	{
+		return;
+	}
+	Gpio = &KsimGpio[IrqNumber - KSIM_IRQ_BASE];
+	pthread_mutex_lock(&KsimIrqLock);
+	Irq = Gpio->Irq;
+	if ((NULL == Irq) || (DevId != Irq->DevId))
+	{
+		pthread_mutex_unlock(&KsimIrqLock);
+		return;
+	}
+	Irq->Stop = 1;
+	pthread_cond_signal(&(Irq->Cond));
+	pthread_mutex_unlock(&KsimIrqLock);
+	/* The thread still reads Gpio->Irq, which is cleared once it has ended */
+	if (Irq->ThreadFn)
+	{
+		pthread_join(Irq->Thread,NULL);
+	}
+	pthread_mutex_lock(&KsimIrqLock);
+	Gpio->Irq = NULL;
+	pthread_mutex_unlock(&KsimIrqLock);
+	free(Irq);
+}
+
+/* *********************************************************************
+ * NAME:             alloc_chrdev_region / unregister_chrdev_region /
+ *                   cdev_init / cdev_add / cdev_del
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      Every region gets a new major number
+ ***********************************************************************/
+int alloc_chrdev_region(dev_t *Dev, unsigned int FirstMinor, unsigned int Count, const char *Name)
+{
+	(void)Count;
+	(void)Name;
+	pthread_mutex_lock(&KsimDevLock);
+	*Dev = MKDEV(KsimNextMajor,FirstMinor);
+	KsimNextMajor++;
+	pthread_mutex_unlock(&KsimDevLock);
+	return 0;
+}
+
+void unregister_chrdev_region(dev_t Dev, unsigned int Count)
+{
+	(void)Dev;
+	(void)Count;
+}
+
+void cdev_init(struct cdev *Cdev, const struct file_operations *Fops)
+{
+	memset(Cdev,0,sizeof(*Cdev));
+	Cdev->ops = Fops;
+}
+
+int cdev_add(struct cdev *Cdev, dev_t Dev, unsigned int Count)
+{
+	unsigned int LoopIndex;
+	int Ret = -ENOMEM;
+
+	pthread_mutex_lock(&KsimDevLock);
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_CDEVS; LoopIndex++)
+	{
+		if (NULL == KsimCdev[LoopIndex])
+		{
+			Cdev->dev = Dev;
+			Cdev->count = Count;
+			KsimCdev[LoopIndex] = Cdev;
+			Ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&KsimDevLock);
+	return Ret;
+}
+
+void cdev_del(struct cdev *Cdev)
+{
+	unsigned int LoopIndex;
+
+	pthread_mutex_lock(&KsimDevLock);
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_CDEVS; LoopIndex++)
+	{
+		if (Cdev == KsimCdev[LoopIndex])
+		{
+			KsimCdev[LoopIndex] = NULL;
+		}
+	}
+	pthread_mutex_unlock(&KsimDevLock);
+}
+
+/* *********************************************************************
+ * NAME:             class_create / class_destroy / device_create /
+ *                   device_destroy
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      device_create gives the name KsimOpen looks up
+ ***********************************************************************/
+struct class *class_create(struct module *Owner, const char *Name)
+{
+	struct class *Class = calloc(1,sizeof(*Class));
+
+	(void)Owner;
+	if (NULL == Class)
+	{
+		return ERR_PTR(-ENOMEM);
+	}
+	snprintf(Class->Name,sizeof(Class->Name),"%s",Name);
+	return Class;
+}
+
+void class_destroy(struct class *Class)
+{
+	free(Class);
+}
+
+struct device *device_create(struct class *Class, struct device *Parent, dev_t Dev, void *Data, const char *Format, ...)
+{
+	unsigned int LoopIndex;
+	struct device *Device = ERR_PTR(-ENOMEM);
+	va_list Args;
+
+	(void)Class;
+	(void)Parent;
+	(void)Data;
+	pthread_mutex_lock(&KsimDevLock);
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_DEVICES; LoopIndex++)
+	{
+		if (0 == KsimDevice[LoopIndex].Name[0])
+		{
+			va_start(Args,Format);
+			vsnprintf(KsimDevice[LoopIndex].Name,KSIM_NAME_LENGTH,Format,Args);
+			va_end(Args);
+			KsimDevice[LoopIndex].Dev = Dev;
+			/* Only compared against error pointers by the drivers */
+			Device = (struct device *)&KsimDevice[LoopIndex];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&KsimDevLock);
+	return Device;
+}
+
+void device_destroy(struct class *Class, dev_t Dev)
+{
+	unsigned int LoopIndex;
+
+	(void)Class;
+	pthread_mutex_lock(&KsimDevLock);
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_DEVICES; LoopIndex++)
+	{
+		if ((KsimDevice[LoopIndex].Name[0]) && (Dev == KsimDevice[LoopIndex].Dev))
+		{
+			KsimDevice[LoopIndex].Name[0] = 0;
+		}
+	}
+	pthread_mutex_unlock(&KsimDevLock);
+}
+
+/* *********************************************************************
+ * NAME:             debugfs_create_dir / debugfs_create_file /
+ *                   debugfs_remove_recursive
+ * CALLED BY:        Drivers
+ * DESCRIPTION:      Entries kept for KsimDebugfsDump
+ ***********************************************************************/
+static struct dentry *KsimDentryCreate(const char *Name, struct dentry *Parent, void *Data,
+                                       const struct file_operations *Fops)
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_DENTRIES; LoopIndex++)
+	{
+		if (!KsimDentry[LoopIndex].InUse)
+		{
+			snprintf(KsimDentry[LoopIndex].Name,KSIM_NAME_LENGTH,"%s",Name);
+			KsimDentry[LoopIndex].Parent = Parent;
+			KsimDentry[LoopIndex].Data = Data;
+			KsimDentry[LoopIndex].Fops = Fops;
+			KsimDentry[LoopIndex].InUse = 1;
+			return &KsimDentry[LoopIndex];
+		}
+	}
+	return NULL;
+}
+
+struct dentry *debugfs_create_dir(const char *Name, struct dentry *Parent)
+{
+	return KsimDentryCreate(Name,Parent,NULL,NULL);
+}
+
+struct dentry *debugfs_create_file(const char *Name, unsigned short Mode, struct dentry *Parent, void *Data,
+                                   const struct file_operations *Fops)
+{
+	(void)Mode;
+	return KsimDentryCreate(Name,Parent,Data,Fops);
+}
+
+void debugfs_remove_recursive(struct dentry *Dentry)
+{
+	unsigned int LoopIndex;
+
+	if (NULL == Dentry)
+	{
+		return;
+	}
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_DENTRIES; LoopIndex++)
+	{
+		if ((KsimDentry[LoopIndex].InUse) && (Dentry == KsimDentry[LoopIndex].Parent))
+		{
+			debugfs_remove_recursive(&KsimDentry[LoopIndex]);
+		}
+	}
+	Dentry->InUse = 0;
+}
+
+/* *********************************************************************
+ * NAME:             seq_printf / seq_read / seq_lseek / single_open /
+ *                   single_release
+ * CALLED BY:        debugfs files of the drivers
+ * DESCRIPTION:      The show function runs once, at the first read
+ ***********************************************************************/
+int seq_printf(struct seq_file *File, const char *Format, ...)
+{
+	va_list Args;
+	int Length;
+	char *Grown;
+
+	va_start(Args,Format);
+	Length = vsnprintf(NULL,0,Format,Args);
+	va_end(Args);
+	if (File->Count + Length + 1 > File->Size)
+	{
+		Grown = realloc(File->Buffer,(File->Count + Length + 1) * 2);
+		if (NULL == Grown)
+		{
+			return -1;
+		}
+		File->Buffer = Grown;
+		File->Size = (File->Count + Length + 1) * 2;
+	}
+	va_start(Args,Format);
+	vsnprintf(File->Buffer + File->Count,File->Size - File->Count,Format,Args);
+	va_end(Args);
+	File->Count += Length;
+	return 0;
+}
+
+ssize_t seq_read(struct file *FilePt, char *Buffer, size_t Size, loff_t *Pos)
+{
+	struct seq_file *File = FilePt->private_data;
+	size_t Copied;
+
+	if (!File->Shown)
+	{
+		File->Shown = 1;
+		File->Show(File,(void *)1);
+	}
+	if ((size_t)*Pos >= File->Count)
+	{
+		return 0;
+	}
+	Copied = min_t(size_t,Size,File->Count - *Pos);
+	memcpy(Buffer,File->Buffer + *Pos,Copied);
+	*Pos += Copied;
+	return Copied;
+}
+
+loff_t seq_lseek(struct file *FilePt, loff_t Offset, int Whence)
+{
+	(void)FilePt;
+	(void)Whence;
+	return Offset;
+}
+
+int single_open(struct file *FilePt, int (*Show)(struct seq_file *, void *), void *Data)
+{
+	struct seq_file *File = calloc(1,sizeof(*File));
+
+	if (NULL == File)
+	{
+		return -ENOMEM;
+	}
+	File->Show = Show;
+	File->private = Data;
+	FilePt->private_data = File;
+	return 0;
+}
+
+int single_release(struct inode *Inode, struct file *FilePt)
+{
+	struct seq_file *File = FilePt->private_data;
+
+	(void)Inode;
+	free(File->Buffer);
+	free(File);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             KsimDebugfsDump
+ * CALLED BY:        Test programs
+ * DESCRIPTION:      Prints every debugfs file as cat would
+ ***********************************************************************/
+void KsimDebugfsDump(FILE *Out)
+{
+	struct inode Inode;
+	struct file FilePt;
+	char Buffer[256];
+	unsigned int LoopIndex;
+	ssize_t Length;
+	loff_t Pos;
+	struct dentry *Entry;
+
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_DENTRIES; LoopIndex++)
+	{
+		Entry = &KsimDentry[LoopIndex];
+		if (!(Entry->InUse) || (NULL == Entry->Fops) || (NULL == Entry->Fops->read))
+		{
+			continue;
+		}
+		fprintf(Out,"--- debugfs/%s/%s ---\n",(Entry->Parent) ? Entry->Parent->Name : "",Entry->Name);
+		memset(&Inode,0,sizeof(Inode));
+		memset(&FilePt,0,sizeof(FilePt));
+		Inode.i_private = Entry->Data;
+		if ((Entry->Fops->open) && Entry->Fops->open(&Inode,&FilePt))
+		{
+			continue;
+		}
+		Pos = 0;
+		while ((Length = Entry->Fops->read(&FilePt,Buffer,sizeof(Buffer),&Pos)) > 0)
+		{
+			fwrite(Buffer,1,Length,Out);
+		}
+		if (Entry->Fops->release)
+		{
+			Entry->Fops->release(&Inode,&FilePt);
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KsimOpen / KsimClose / KsimRead / KsimWrite /
+ *                   KsimIoctl / KsimMmap / KsimPoll
+ * CALLED BY:        Test programs
+ * DESCRIPTION:      System calls on the devices of device_create. The
+ *                   user pointers are pointers of the test program
+ ***********************************************************************/
+int KsimOpen(const char *Name, int Flags, KsimFileType **File)
+{
+	KsimFileType *Open;
+	struct cdev *Cdev = NULL;
+	unsigned int LoopIndex;
+	dev_t Dev = 0;
+	int Found = 0, Ret;
+
+	pthread_mutex_lock(&KsimDevLock);
+	for (LoopIndex = 0; LoopIndex < KSIM_MAX_DEVICES; LoopIndex++)
+	{
+		if (0 == strcmp(Name,KsimDevice[LoopIndex].Name))
+		{
+			Dev = KsimDevice[LoopIndex].Dev;
+			Found = 1;
+		}
+	}
+	for (LoopIndex = 0; (Found) && (LoopIndex < KSIM_MAX_CDEVS); LoopIndex++)
+	{
+		if ((KsimCdev[LoopIndex]) && (Dev >= KsimCdev[LoopIndex]->dev) &&
+		    (Dev < KsimCdev[LoopIndex]->dev + KsimCdev[LoopIndex]->count))
+		{
+			Cdev = KsimCdev[LoopIndex];
+		}
+	}
+	pthread_mutex_unlock(&KsimDevLock);
+	if (NULL == Cdev)
+	{
+		return -ENODEV;
+	}
+	Open = calloc(1,sizeof(*Open));
+	if (NULL == Open)
+	{
+		return -ENOMEM;
+	}
+	Open->Inode.i_cdev = Cdev;
+	Open->Inode.i_rdev = Dev;
+	Open->File.f_flags = Flags;
+	Open->Fops = Cdev->ops;
+	if (Open->Fops->open)
+	{
+		Ret = Open->Fops->open(&(Open->Inode),&(Open->File));
+		if (Ret)
+		{
+			free(Open);
+			return Ret;
+		}
+	}
+	*File = Open;
+	return 0;
+}
+
+int KsimClose(KsimFileType *File)
+{
+	int Ret = (File->Fops->release) ? File->Fops->release(&(File->Inode),&(File->File)) : 0;
+
+	free(File);
+	return Ret;
+}
+
+ssize_t KsimRead(KsimFileType *File, void *Buffer, size_t Size)
+{
+	return (File->Fops->read) ? File->Fops->read(&(File->File),Buffer,Size,&(File->Pos)) : -EINVAL;
+}
+
+ssize_t KsimWrite(KsimFileType *File, const void *Buffer, size_t Size)
+{
+	return (File->Fops->write) ? File->Fops->write(&(File->File),Buffer,Size,&(File->Pos)) : -EINVAL;
+}
+
+long KsimIoctl(KsimFileType *File, unsigned int Command, unsigned long Argument)
+{
+	return (File->Fops->unlocked_ioctl) ? File->Fops->unlocked_ioctl(&(File->File),Command,Argument) : -ENOTTY;
+}
+
+int KsimMmap(KsimFileType *File, size_t Length, unsigned long Offset, int Writable, void **Address)
+{
+	struct vm_area_struct Vma;
+	int Ret;
+
+	if (NULL == File->Fops->mmap)
+	{
+		return -ENODEV;
+	}
+	memset(&Vma,0,sizeof(Vma));
+	Vma.vm_end = PAGE_ALIGN(Length);
+	Vma.vm_pgoff = Offset >> PAGE_SHIFT;
+	Vma.vm_flags = VM_SHARED | ((Writable) ? (VM_WRITE | VM_MAYWRITE) : 0);
+	Ret = File->Fops->mmap(&(File->File),&Vma);
+	if (0 == Ret)
+	{
+		*Address = (void *)Vma.vm_start;
+	}
+	return Ret;
+}
+
+int KsimPoll(KsimFileType *File, short Events, int TimeoutMs)
+{
+	s64 Until = KsimNowNs() + ((s64)TimeoutMs * NSEC_PER_MSEC);
+	poll_table Table;
+	unsigned int Mask;
+
+	if (NULL == File->Fops->poll)
+	{
+		return Events & (POLLIN | POLLOUT);
+	}
+	for (;;)
+	{
+		memset(&Table,0,sizeof(Table));
+		Mask = File->Fops->poll(&(File->File),&Table);
+		if ((Mask & Events) || (NULL == Table.KsimQueue) || (KsimNowNs() >= Until))
+		{
+			return Mask & Events;
+		}
+		KsimWaitSleepUntil(Table.KsimQueue,Table.KsimSequence,Until);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KsimStart / KsimStop
+ * CALLED BY:        Test programs, around the life of the module
+ * DESCRIPTION:      Starts and stops the timer and spi threads
+ ***********************************************************************/
+int KsimStart(void)
+{
+	KsimCondInit(&KsimTimerCond);
+	pthread_cond_init(&KsimTimerDoneCond,NULL);
+	KsimTimerStop = 0;
+	KsimSpiStop = 0;
+	if (pthread_create(&KsimTimerThread,NULL,&KsimTimerMain,NULL))
+	{
+		return -EAGAIN;
+	}
+	if (pthread_create(&KsimSpiThread,NULL,&KsimSpiMain,NULL))
+	{
+		KsimStop();
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+void KsimStop(void)
+{
+	unsigned int LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < KsimSensorCount; LoopIndex++)
+	{
+		hrtimer_cancel(&(KsimSensor[LoopIndex].Timer));
+	}
+	pthread_mutex_lock(&KsimTimerLock);
+	KsimTimerStop = 1;
+	pthread_cond_signal(&KsimTimerCond);
+	pthread_mutex_unlock(&KsimTimerLock);
+	pthread_join(KsimTimerThread,NULL);
+	pthread_mutex_lock(&KsimSpiQueueLock);
+	KsimSpiStop = 1;
+	pthread_cond_signal(&KsimSpiQueueCond);
+	pthread_mutex_unlock(&KsimSpiQueueLock);
+	pthread_join(KsimSpiThread,NULL);
+}
@@ -0,0 +1,527 @@
+/* *********************************************************************
+ *
+ * Kernel interfaces of spi_led and pulse for the host simulation build
+ *
+ * Program Name:        KernelSim
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/*
+ * Every <linux/...> and <asm/...> header included by the drivers is
+ * generated by "make sim" as an include of this file. Timers, kernel
+ * threads, wait queues and irqs are run on pthreads by ksim.c, the spi bus
+ * writes a capture log and the gpios answer the sensor triggers with
+ * scripted echoes.
+ */
+#ifndef KSIM_H
+#define KSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <asm/types.h>
+#include <linux/ioctl.h>
+
+/* ******************************** TYPES ******************************/
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s8 s8;
+typedef __s16 s16;
+typedef __s32 s32;
+typedef __s64 s64;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+
+#define __user
+#define __init
+#define __exit
+#define __iomem
+#define __must_check
+#define ____cacheline_aligned __attribute__((aligned(64)))
+#define likely(x) __builtin_expect(!!(x),1)
+#define unlikely(x) __builtin_expect(!!(x),0)
+
+/* ************************* HELPERS AND MACROS ************************/
+#define ERESTARTSYS 512
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define __stringify_1(x) #x
+#define __stringify(x) __stringify_1(x)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min_t(t,a,b) (((t)(a) < (t)(b)) ? (t)(a) : (t)(b))
+#define max_t(t,a,b) (((t)(a) > (t)(b)) ? (t)(a) : (t)(b))
+#define clamp_t(t,v,lo,hi) min_t(t,max_t(t,v,lo),hi)
+#define BUILD_BUG_ON(c) ((void)sizeof(char[1 - 2 * !!(c)]))
+#define is_power_of_2(n) (((n) != 0) && ((((n) - 1) & (n)) == 0))
+#define DIV_ROUND_UP(n,d) (((n) + (d) - 1) / (d))
+#define abs64(x) ({ s64 __x = (x); (__x < 0) ? -__x : __x; })
+#define IS_ERR_VALUE(x) ((unsigned long)(x) >= (unsigned long)-4095)
+#define IS_ERR(p) IS_ERR_VALUE(p)
+#define IS_ERR_OR_NULL(p) ((!(p)) || IS_ERR_VALUE(p))
+#define PTR_ERR(p) ((long)(p))
+#define ERR_PTR(e) ((void *)(long)(e))
+#define ACCESS_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define barrier() __asm__ __volatile__("" ::: "memory")
+#define smp_mb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+#define smp_wmb() __sync_synchronize()
+
+static inline u64 div_u64(u64 Dividend, u32 Divisor) { return Dividend / Divisor; }
+static inline s64 div_s64(s64 Dividend, s32 Divisor) { return Dividend / Divisor; }
+static inline u64 div64_u64(u64 Dividend, u64 Divisor) { return Dividend / Divisor; }
+static inline int fls64(u64 x) { return (x) ? 64 - __builtin_clzll(x) : 0; }
+static inline int fls(unsigned int x) { return (x) ? 32 - __builtin_clz(x) : 0; }
+
+/* ***************************** PRINTK ********************************/
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+int KsimPrintk(const char *Format, ...) __attribute__((format(printf,1,2)));
+#define printk(...) KsimPrintk(__VA_ARGS__)
+
+/* ***************************** MODULE ********************************/
+struct module;
+#define THIS_MODULE ((struct module *)0)
+#define MODULE_LICENSE(x) extern int KsimModuleLicense
+#define MODULE_AUTHOR(x) extern int KsimModuleAuthor
+#define MODULE_DESCRIPTION(x) extern int KsimModuleDescription
+#define MODULE_PARM_DESC(n,d) extern int KsimParmDesc_##n
+/* Every driver linked in is loaded by KsimModuleInit, in link order */
+void KsimModuleRegister(const char *File, int (*Init)(void), void (*Exit)(void));
+#define module_init(fn) \
+	static void __attribute__((constructor)) KsimModuleInit_##fn(void) { KsimModuleRegister(__FILE__,fn,NULL); }
+#define module_exit(fn) \
+	static void __attribute__((constructor)) KsimModuleExit_##fn(void) { KsimModuleRegister(__FILE__,NULL,fn); }
+
+/* Types of the module parameters, set on the command line as name=value */
+typedef enum KsimParam_Tag {
+	KSIM_PARAM_bool,
+	KSIM_PARAM_int,
+	KSIM_PARAM_uint
+}KsimParam_Type;
+void KsimParamRegister(const char *Name, void *Value, KsimParam_Type Type, unsigned int Count, unsigned int *Set);
+#define module_param(name, type, perm) \
+	static void __attribute__((constructor)) KsimParam_##name(void) \
+	{ KsimParamRegister(#name,&(name),KSIM_PARAM_##type,1,NULL); }
+#define module_param_array(name, type, nump, perm) \
+	static void __attribute__((constructor)) KsimParam_##name(void) \
+	{ KsimParamRegister(#name,(name),KSIM_PARAM_##type,ARRAY_SIZE(name),(nump)); }
+
+/* ***************************** MEMORY *******************************/
+#define GFP_KERNEL 0u
+#define GFP_ATOMIC 1u
+#define GFP_DMA 2u
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+static inline void *kmalloc(size_t Size, gfp_t Flags) { (void)Flags; return malloc(Size); }
+static inline void *kzalloc(size_t Size, gfp_t Flags) { (void)Flags; return calloc(1,Size); }
+static inline void kfree(const void *Memory) { free((void *)Memory); }
+void *vmalloc_user(unsigned long Size);
+static inline void vfree(const void *Memory) { free((void *)Memory); }
+static inline unsigned long copy_to_user(void *To, const void *From, unsigned long Size) { memcpy(To,From,Size); return 0; }
+static inline unsigned long copy_from_user(void *To, const void *From, unsigned long Size) { memcpy(To,From,Size); return 0; }
+#define get_user(x, p) ((x) = *(p), 0)
+#define put_user(x, p) (*(p) = (x), 0)
+
+/* ***************************** ATOMICS ******************************/
+typedef struct { int counter; } atomic_t;
+#define ATOMIC_INIT(i) { (i) }
+static inline int atomic_read(const atomic_t *v) { return __atomic_load_n(&(v->counter),__ATOMIC_SEQ_CST); }
+static inline void atomic_set(atomic_t *v, int i) { __atomic_store_n(&(v->counter),i,__ATOMIC_SEQ_CST); }
+static inline void atomic_inc(atomic_t *v) { __atomic_add_fetch(&(v->counter),1,__ATOMIC_SEQ_CST); }
+static inline void atomic_dec(atomic_t *v) { __atomic_sub_fetch(&(v->counter),1,__ATOMIC_SEQ_CST); }
+static inline int atomic_inc_return(atomic_t *v) { return __atomic_add_fetch(&(v->counter),1,__ATOMIC_SEQ_CST); }
+static inline int atomic_dec_and_test(atomic_t *v) { return 0 == __atomic_sub_fetch(&(v->counter),1,__ATOMIC_SEQ_CST); }
+static inline int atomic_xchg(atomic_t *v, int i) { return __atomic_exchange_n(&(v->counter),i,__ATOMIC_SEQ_CST); }
+
+/* ***************************** PER CPU ******************************/
+/*
+ * A single cpu, as on the Galileo. The threads of the simulation run on any
+ * host cpu, so the one copy is updated with atomic adds.
+ */
+#define __percpu
+#define alloc_percpu(type) ((type *)calloc(1,sizeof(type)))
+#define free_percpu(p) free(p)
+#define per_cpu_ptr(p, cpu) ((void)(cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(x, v) ((void)__atomic_add_fetch(&(x),(v),__ATOMIC_RELAXED))
+#define this_cpu_inc(x) this_cpu_add(x,1)
+
+/* *************************** LOCKS **********************************/
+struct mutex { pthread_mutex_t Lock; };
+static inline void mutex_init(struct mutex *m) { pthread_mutex_init(&(m->Lock),NULL); }
+static inline void mutex_lock(struct mutex *m) { pthread_mutex_lock(&(m->Lock)); }
+static inline int mutex_lock_interruptible(struct mutex *m) { pthread_mutex_lock(&(m->Lock)); return 0; }
+static inline int mutex_trylock(struct mutex *m) { return 0 == pthread_mutex_trylock(&(m->Lock)); }
+static inline void mutex_unlock(struct mutex *m) { pthread_mutex_unlock(&(m->Lock)); }
+
+/* Irqs are delivered by a thread, a spinlock keeps them out by being a mutex */
+typedef struct { pthread_mutex_t Lock; } spinlock_t;
+static inline void spin_lock_init(spinlock_t *l) { pthread_mutex_init(&(l->Lock),NULL); }
+static inline void spin_lock(spinlock_t *l) { pthread_mutex_lock(&(l->Lock)); }
+static inline void spin_unlock(spinlock_t *l) { pthread_mutex_unlock(&(l->Lock)); }
+#define spin_lock_irq(l) spin_lock(l)
+#define spin_unlock_irq(l) spin_unlock(l)
+#define spin_lock_irqsave(l, f) do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) do { (void)(f); spin_unlock(l); } while (0)
+#define local_irq_save(f) ((f) = 0)
+#define local_irq_restore(f) ((void)(f))
+
+/* ***************************** TIME *********************************/
+#define HZ 1000
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+#define USEC_PER_SEC 1000000L
+#define MSEC_PER_SEC 1000L
+
+typedef union { s64 tv64; } ktime_t;
+s64 KsimNowNs(void);
+static inline ktime_t ns_to_ktime(u64 Ns) { ktime_t t; t.tv64 = (s64)Ns; return t; }
+static inline ktime_t ktime_set(long Sec, unsigned long Ns) { return ns_to_ktime(((u64)Sec * NSEC_PER_SEC) + Ns); }
+static inline ktime_t ktime_get(void) { return ns_to_ktime(KsimNowNs()); }
+static inline s64 ktime_to_ns(ktime_t t) { return t.tv64; }
+static inline s64 ktime_to_us(ktime_t t) { return t.tv64 / NSEC_PER_USEC; }
+static inline ktime_t ktime_add(ktime_t a, ktime_t b) { return ns_to_ktime(a.tv64 + b.tv64); }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return ns_to_ktime(a.tv64 - b.tv64); }
+static inline ktime_t ktime_add_ns(ktime_t t, u64 Ns) { return ns_to_ktime(t.tv64 + Ns); }
+static inline ktime_t ktime_add_us(ktime_t t, u64 Us) { return ns_to_ktime(t.tv64 + (Us * NSEC_PER_USEC)); }
+static inline s64 ktime_us_delta(ktime_t a, ktime_t b) { return (a.tv64 - b.tv64) / NSEC_PER_USEC; }
+#define ktime_compare(a, b) (((a).tv64 < (b).tv64) ? -1 : ((a).tv64 > (b).tv64))
+
+#define jiffies ((unsigned long)(KsimNowNs() / (NSEC_PER_SEC / HZ)))
+static inline unsigned long msecs_to_jiffies(unsigned int Ms) { return DIV_ROUND_UP((unsigned long)Ms * HZ,MSEC_PER_SEC); }
+static inline unsigned long usecs_to_jiffies(unsigned int Us) { return DIV_ROUND_UP((unsigned long)Us * HZ,USEC_PER_SEC); }
+static inline unsigned int jiffies_to_msecs(unsigned long j) { return (unsigned int)((j * MSEC_PER_SEC) / HZ); }
+void udelay(unsigned long Us);
+void msleep(unsigned int Ms);
+void usleep_range(unsigned long Min, unsigned long Max);
+
+/* Time stamp counter, the monotonic clock on hosts without one */
+#if defined(__i386__) || defined(__x86_64__)
+#define rdtscll(v) ((v) = __builtin_ia32_rdtsc())
+#else
+#define rdtscll(v) ((v) = (u64)KsimNowNs())
+#endif
+#define X86_FEATURE_CONSTANT_TSC 1
+#define X86_FEATURE_TSC_RELIABLE 2
+static inline int boot_cpu_has(int Feature) { (void)Feature; return 1; }
+/* The Galileo has a single cpu */
+static inline unsigned int num_online_cpus(void) { return 1; }
+
+/* **************************** HRTIMER *******************************/
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_ABS, HRTIMER_MODE_REL };
+#define CLOCK_MONOTONIC_KSIM 1
+
+/* Timers are kept in a list sorted by expiry and run by the timer thread */
+struct hrtimer
+{
+	enum hrtimer_restart (*function)(struct hrtimer *); /* Callback */
+	ktime_t expires; /* Expiry */
+	struct hrtimer *KsimNext; /* Next queued timer */
+	bool KsimQueued; /* In the list */
+};
+void hrtimer_init(struct hrtimer *Timer, int ClockId, enum hrtimer_mode Mode);
+int hrtimer_start(struct hrtimer *Timer, ktime_t Time, const enum hrtimer_mode Mode);
+int hrtimer_cancel(struct hrtimer *Timer);
+int hrtimer_try_to_cancel(struct hrtimer *Timer);
+u64 hrtimer_forward_now(struct hrtimer *Timer, ktime_t Interval);
+static inline void hrtimer_set_expires(struct hrtimer *Timer, ktime_t Time) { Timer->expires = Time; }
+
+/* ************************* THREADS AND WAITS ************************/
+#define TASK_RUNNING 0
+#define TASK_INTERRUPTIBLE 1
+#define TASK_UNINTERRUPTIBLE 2
+
+struct task_struct;
+struct task_struct *KsimKthreadRun(int (*ThreadFn)(void *), void *Data, const char *Name);
+#define kthread_run(fn, data, ...) KsimKthreadRun((fn),(data),__VA_ARGS__)
+int kthread_stop(struct task_struct *Task);
+bool kthread_should_stop(void);
+int wake_up_process(struct task_struct *Task);
+void set_current_state(int State);
+#define __set_current_state(s) set_current_state(s)
+int schedule_hrtimeout_range(ktime_t *Expires, unsigned long Delta, const enum hrtimer_mode Mode);
+
+/*
+ * A waiter reads Sequence, tests its condition without any lock and
+ * sleeps only while Sequence has not moved. Every wake up moves it.
+ */
+typedef struct
+{
+	spinlock_t lock; /* Named as in the kernel, taken by the drivers */
+	pthread_cond_t Cond;
+	unsigned long Sequence;
+}wait_queue_head_t;
+void init_waitqueue_head(wait_queue_head_t *Queue);
+void wake_up(wait_queue_head_t *Queue);
+#define wake_up_interruptible(q) wake_up(q)
+#define wake_up_all(q) wake_up(q)
+unsigned long KsimWaitPrepare(wait_queue_head_t *Queue);
+void KsimWaitSleep(wait_queue_head_t *Queue, unsigned long Sequence);
+void KsimWaitFinish(void);
+#define wait_event(wq, condition) \
+	do { \
+		unsigned long __Seq; \
+		for (;;) { \
+			__Seq = KsimWaitPrepare(&(wq)); \
+			if (condition) \
+				break; \
+			KsimWaitSleep(&(wq),__Seq); \
+		} \
+		KsimWaitFinish(); \
+	} while (0)
+/* No signals in the simulation */
+#define wait_event_interruptible(wq, condition) ({ wait_event(wq,condition); 0; })
+
+struct completion
+{
+	pthread_mutex_t Lock;
+	pthread_cond_t Cond;
+	unsigned int done;
+};
+void init_completion(struct completion *Completion);
+#define INIT_COMPLETION(c) __atomic_store_n(&((c).done),0,__ATOMIC_SEQ_CST)
+void complete(struct completion *Completion);
+long wait_for_completion_interruptible_timeout(struct completion *Completion, unsigned long Timeout);
+
+/* ***************************** FILES ********************************/
+struct file_operations;
+struct cdev
+{
+	struct module *owner;
+	const struct file_operations *ops; /* Set by cdev_init */
+	dev_t dev; /* First number, set by cdev_add */
+	unsigned int count; /* Numbers of the cdev */
+};
+struct inode
+{
+	struct cdev *i_cdev;
+	dev_t i_rdev;
+	void *i_private;
+};
+struct file
+{
+	void *private_data;
+	unsigned int f_flags;
+};
+struct vm_area_struct
+{
+	unsigned long vm_start, vm_end, vm_pgoff, vm_flags;
+};
+#define VM_WRITE 0x00000002UL
+#define VM_SHARED 0x00000008UL
+#define VM_MAYWRITE 0x00000020UL
+#define VM_RESERVED 0x00080000UL
+#define VM_DONTEXPAND 0x00040000UL
+int remap_vmalloc_range(struct vm_area_struct *Vma, void *Address, unsigned long PgOff);
+
+/* poll_wait keeps the first queue, KsimPoll sleeps on it */
+typedef struct poll_table_struct
+{
+	wait_queue_head_t *KsimQueue; /* Queue given to poll_wait */
+	unsigned long KsimSequence; /* Wake ups of the queue before the poll */
+}poll_table;
+static inline void poll_wait(struct file *File, wait_queue_head_t *Queue, poll_table *Table)
+{
+	(void)File;
+	if ((Table) && (NULL == Table->KsimQueue))
+	{
+		Table->KsimSequence = KsimWaitPrepare(Queue);
+		Table->KsimQueue = Queue;
+	}
+}
+
+struct file_operations
+{
+	struct module *owner;
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+	ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	unsigned int (*poll)(struct file *, poll_table *);
+	loff_t (*llseek)(struct file *, loff_t, int);
+};
+
+#define MINORBITS 20
+#define MKDEV(ma, mi) ((dev_t)(((ma) << MINORBITS) | (mi)))
+#define MAJOR(d) ((unsigned int)((d) >> MINORBITS))
+#define MINOR(d) ((unsigned int)((d) & ((1U << MINORBITS) - 1)))
+int alloc_chrdev_region(dev_t *Dev, unsigned int FirstMinor, unsigned int Count, const char *Name);
+void unregister_chrdev_region(dev_t Dev, unsigned int Count);
+void cdev_init(struct cdev *Cdev, const struct file_operations *Fops);
+int cdev_add(struct cdev *Cdev, dev_t Dev, unsigned int Count);
+void cdev_del(struct cdev *Cdev);
+struct class;
+struct device;
+struct class *class_create(struct module *Owner, const char *Name);
+void class_destroy(struct class *Class);
+struct device *device_create(struct class *Class, struct device *Parent, dev_t Dev, void *Data, const char *Format, ...)
+	__attribute__((format(printf,5,6)));
+void device_destroy(struct class *Class, dev_t Dev);
+
+/* ************************* DEBUGFS / SEQ_FILE ***********************/
+struct dentry;
+struct dentry *debugfs_create_dir(const char *Name, struct dentry *Parent);
+struct dentry *debugfs_create_file(const char *Name, unsigned short Mode, struct dentry *Parent, void *Data,
+                                   const struct file_operations *Fops);
+void debugfs_remove_recursive(struct dentry *Dentry);
+struct seq_file
+{
+	char *Buffer; /* Text written by the show function */
+	size_t Size, Count; /* Allocated and used bytes of Buffer */
+	bool Shown; /* show has run */
+	int (*Show)(struct seq_file *, void *);
+	void *private;
+};
+int seq_printf(struct seq_file *File, const char *Format, ...) __attribute__((format(printf,2,3)));
+ssize_t seq_read(struct file *File, char *Buffer, size_t Size, loff_t *Pos);
+loff_t seq_lseek(struct file *File, loff_t Offset, int Whence);
+int single_open(struct file *File, int (*Show)(struct seq_file *, void *), void *Data);
+int single_release(struct inode *Inode, struct file *File);
+
+/* ******************************* SPI ********************************/
+struct list_head { struct list_head *next, *prev; };
+struct spi_device { int chip_select; };
+struct spi_transfer
+{
+	const void *tx_buf;
+	void *rx_buf;
+	unsigned len;
+	unsigned cs_change:1;
+	u8 bits_per_word;
+	u16 delay_usecs;
+	u32 speed_hz;
+	struct list_head transfer_list;
+};
+struct spi_message
+{
+	struct list_head transfers;
+	struct spi_device *spi;
+	void (*complete)(void *context);
+	void *context;
+	unsigned actual_length;
+	int status;
+	struct spi_message *KsimNext; /* Queue of the bus thread */
+};
+static inline void spi_message_init(struct spi_message *Message)
+{
+	memset(Message,0,sizeof(*Message));
+	Message->transfers.next = Message->transfers.prev = &(Message->transfers);
+}
+static inline void spi_message_add_tail(struct spi_transfer *Transfer, struct spi_message *Message)
+{
+	Transfer->transfer_list.prev = Message->transfers.prev;
+	Transfer->transfer_list.next = &(Message->transfers);
+	Message->transfers.prev->next = &(Transfer->transfer_list);
+	Message->transfers.prev = &(Transfer->transfer_list);
+}
+struct spi_device_id { char name[32]; unsigned long driver_data; };
+struct device_driver { const char *name; struct module *owner; };
+struct spi_driver
+{
+	const struct spi_device_id *id_table;
+	int (*probe)(struct spi_device *);
+	int (*remove)(struct spi_device *);
+	struct device_driver driver;
+};
+int spi_register_driver(struct spi_driver *Driver);
+void spi_unregister_driver(struct spi_driver *Driver);
+int spi_sync(struct spi_device *Spi, struct spi_message *Message);
+int spi_async(struct spi_device *Spi, struct spi_message *Message);
+
+/* *************************** GPIO / IRQ *****************************/
+#define GPIOF_OUT_INIT_LOW 0
+#define GPIOF_IN 1
+#define GPIOF_OUT_INIT_HIGH 2
+int gpio_request_one(unsigned int Gpio, unsigned long Flags, const char *Label);
+void gpio_free(unsigned int Gpio);
+void gpio_set_value(unsigned int Gpio, int Value);
+int gpio_get_value(unsigned int Gpio);
+#define gpio_set_value_cansleep(g, v) gpio_set_value(g,v)
+#define gpio_get_value_cansleep(g) gpio_get_value(g)
+int gpio_to_irq(unsigned int Gpio);
+
+typedef enum irqreturn { IRQ_NONE, IRQ_HANDLED, IRQ_WAKE_THREAD } irqreturn_t;
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+#define IRQF_TRIGGER_RISING 0x00000001
+#define IRQF_TRIGGER_FALLING 0x00000002
+#define IRQF_ONESHOT 0x00002000
+int request_threaded_irq(unsigned int Irq, irq_handler_t Handler, irq_handler_t ThreadFn,
+                         unsigned long Flags, const char *Name, void *DevId);
+void free_irq(unsigned int Irq, void *DevId);
+
+/* ******************************* KFIFO ******************************/
+/* Power of two sized fifo of fixed records, one reader and one writer */
+#define DECLARE_KFIFO(fifo, type, size) \
+	struct { unsigned int in, out; type buf[((size) < 2) || ((size) & ((size) - 1)) ? -1 : (size)]; } fifo
+#define INIT_KFIFO(fifo) ((fifo).in = (fifo).out = 0)
+#define KSIM_KFIFO_SIZE(f) ((unsigned int)ARRAY_SIZE((f)->buf))
+#define kfifo_len(f) ((unsigned int)(ACCESS_ONCE((f)->in) - ACCESS_ONCE((f)->out)))
+#define kfifo_is_empty(f) (0 == kfifo_len(f))
+#define kfifo_is_full(f) (kfifo_len(f) >= KSIM_KFIFO_SIZE(f))
+#define kfifo_reset(f) ((f)->in = (f)->out = 0)
+#define kfifo_skip(f) ((f)->out++)
+#define kfifo_put(f, val) ({ \
+	__typeof__(f) __f = (f); \
+	unsigned int __ret = !kfifo_is_full(__f); \
+	if (__ret) { \
+		__f->buf[__f->in & (KSIM_KFIFO_SIZE(__f) - 1)] = *(val); \
+		__atomic_thread_fence(__ATOMIC_RELEASE); \
+		__f->in++; \
+	} \
+	__ret; })
+#define kfifo_get(f, val) ({ \
+	__typeof__(f) __f = (f); \
+	unsigned int __ret = !kfifo_is_empty(__f); \
+	if (__ret) { \
+		__atomic_thread_fence(__ATOMIC_ACQUIRE); \
+		*(val) = __f->buf[__f->out & (KSIM_KFIFO_SIZE(__f) - 1)]; \
+		__f->out++; \
+	} \
+	__ret; })
+#define kfifo_out(f, buffer, n) ({ \
+	__typeof__(f) __fo = (f); \
+	unsigned int __n = 0; \
+	while ((__n < (unsigned int)(n)) && kfifo_get(__fo,&((buffer)[__n]))) \
+		__n++; \
+	__n; })
+
+/* **************************** TRACEPOINTS ***************************/
+/* Events are type checked and compiled out, there is no tracer to feed */
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+	static inline void trace_##name(proto) { }
+
+/* Kernel headers define this, pulse.h hides its user space helpers */
+#ifndef __KERNEL__
+#define __KERNEL__
+#endif
+#define current KsimCurrent()
+struct task_struct *KsimCurrent(void);
+
+#endif
@@ -0,0 +1,116 @@
+/* *********************************************************************
+ *
+ * Interface of the kernel simulation used by the host test programs
+ *
+ * Program Name:        KernelSim
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef KSIM_HOST_H
+#define KSIM_HOST_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Distances a scripted sensor can be given */
+#define KSIM_ECHO_MAX_STEPS   64
+
+/* Speed of sound of the scripted sensors, the driver default */
+#define KSIM_SPEED_OF_SOUND_MM_PER_SEC   343000
+
+/* Time from the end of the trigger to the rising edge of the echo */
+#define KSIM_ECHO_DELAY_US   450
+
+/* Chained MAX7219 panels the capture log can decode */
+#define KSIM_MAX_PANELS   16
+
+/* Open file of a simulated character device */
+typedef struct KsimFileTag KsimFileType;
+
+/* Totals of the simulated spi bus */
+typedef struct KsimSpiStatsTag
+{
+	unsigned long Messages; /* spi_sync and spi_async messages */
+	unsigned long AsyncMessages; /* Of those given to spi_async */
+	unsigned long Transfers; /* Transfers of the messages */
+	unsigned long Latches; /* Chip select releases, one register write per panel */
+	unsigned long Bytes; /* Bytes shifted out */
+	unsigned long long BusNs; /* Time the bus was busy */
+	unsigned char Register[KSIM_MAX_PANELS][16]; /* Last value of every MAX7219 register */
+}KsimSpiStatsType;
+
+/* Totals of a scripted sensor */
+typedef struct KsimEchoStatsTag
+{
+	unsigned long Triggers; /* Falling edges of the trigger */
+	unsigned long Echoes; /* Echo pulses given */
+	unsigned long Overlaps; /* Triggers while an echo was still pending */
+	unsigned long long WorstLateNs; /* Latest edge, against its scripted time */
+}KsimEchoStatsType;
+
+/*
+ * Echo given for one trigger. The host may run the echo timer late, so
+ * the edges actually driven are kept next to the scripted distance.
+ */
+#define KSIM_ECHO_RECORDS   256
+typedef struct KsimEchoRecordTag
+{
+	int DistanceMm; /* Scripted distance, 0 for no echo */
+	unsigned long long RiseNs; /* Time the echo went high, 0 if it did not */
+	unsigned long long FallNs; /* Time the echo went low, 0 if it did not */
+}KsimEchoRecordType;
+
+/* *********************************************************************
+ * NAME:             KsimModuleInit / KsimModuleExit
+ * CALLED BY:        Test programs, as insmod and rmmod would
+ * DESCRIPTION:      module_init functions of the drivers linked into the
+ *                   program in link order, module_exit in reverse order.
+ *                   If one init fails the drivers already loaded are
+ *                   removed again
+ ***********************************************************************/
+int KsimModuleInit(void);
+void KsimModuleExit(void);
+
+/* Sets a module parameter given as name=value[,value...] */
+int KsimParamSet(const char *Argument);
+
+/* Starts the timer, spi and irq threads, before KsimModuleInit */
+int KsimStart(void);
+/* Stops them, after KsimModuleExit */
+void KsimStop(void);
+
+/* Writes every spi transfer with its time to Log, NULL to stop */
+void KsimSpiCapture(FILE *Log);
+void KsimSpiStats(KsimSpiStatsType *Stats);
+
+/*
+ * Scripts a sensor: every falling edge of TriggerGpio gives an echo on
+ * EchoGpio for the next distance of the list, round again after the last.
+ * A distance of 0 gives no echo.
+ */
+int KsimEchoScript(int TriggerGpio, int EchoGpio, const int *DistanceMm, unsigned int Count);
+void KsimEchoStats(int TriggerGpio, KsimEchoStatsType *Stats);
+/* Echo of trigger number Trigger (0 for the first), -ENOENT once overwritten */
+int KsimEchoRecord(int TriggerGpio, unsigned long Trigger, KsimEchoRecordType *Record);
+
+/* File operations on /dev/Name, negative errno values on failure */
+int KsimOpen(const char *Name, int Flags, KsimFileType **File);
+int KsimClose(KsimFileType *File);
+ssize_t KsimRead(KsimFileType *File, void *Buffer, size_t Size);
+ssize_t KsimWrite(KsimFileType *File, const void *Buffer, size_t Size);
+long KsimIoctl(KsimFileType *File, unsigned int Command, unsigned long Argument);
+int KsimMmap(KsimFileType *File, size_t Length, unsigned long Offset, int Writable, void **Address);
+int KsimPoll(KsimFileType *File, short Events, int TimeoutMs);
+
+/* Prints every debugfs file */
+void KsimDebugfsDump(FILE *Out);
+
+/* Monotonic time of the simulation */
+unsigned long long KsimHostNowNs(void);
+
+#endif
@@ -0,0 +1,359 @@
+/* *********************************************************************
+ *
+ * Host run of the Pulse driver against a scripted HC-SR04
+ *
+ * Program Name:        SimPulse
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "ksim_host.h"
+#include "../pulse.h"
+
+/* Defaults of the run, the pins are the driver defaults */
+#define SIM_DEFAULT_TRIGGER_GPIO   14
+#define SIM_DEFAULT_ECHO_GPIO   15
+#define SIM_DEFAULT_RATE_HZ   20
+#define SIM_DEFAULT_SAMPLES   40
+/*
+ * Largest distance error accepted against the echo the simulation drove,
+ * which is timed by the host and may be off the scripted distance
+ */
+#define SIM_DEFAULT_TOLERANCE_MM   10
+/*
+ * Error accepted on the filter against an obstacle injected at a steady
+ * speed, the host injects a little off the rate
+ */
+#define SIM_TRACK_TOLERANCE_MM   5
+#define SIM_TRACK_TOLERANCE_MM_PER_SEC   20
+/* Gap that restarts the track of the filter, over a second */
+#define SIM_TRACK_RESTART_US   1100000
+/*
+ * Samples replayed with PULSE_IOC_INJECT after the run: about 700mm, a
+ * timeout, then about 720mm
+ */
+#define SIM_INJECT_SAMPLES   3
+static const unsigned int SimInjectWidthNs[SIM_INJECT_SAMPLES] = {4081633, 0, 4198251};
+
+/* *********************************************************************
+ * NAME:             SimParseList
+ * CALLED BY:        main
+ * DESCRIPTION:      Parses comma separated numbers
+ * INPUT PARAMETERS: Text : list to parse
+ *                   Value : filled with the numbers
+ *                   Max : size of Value
+ * RETURN VALUES:    unsigned int : numbers parsed, 0 on a bad list
+ ***********************************************************************/
+static unsigned int SimParseList(const char *Text, int *Value, unsigned int Max)
+{
+	unsigned int Count = 0;
+	char *End;
+
+	do
+	{
+		if (Count == Max)
+		{
+			return 0;
+		}
+		Value[Count++] = (int)strtol(Text,&End,0);
+		if ((End == Text) || ((*End) && (',' != *End)))
+		{
+			return 0;
+		}
+		Text = End + 1;
+	}while (',' == *End);
+	return Count;
+}
+
+/* *********************************************************************
+ * NAME:             main
+ * CALLED BY:        make sim, or the user on the terminal
+ * DESCRIPTION:      sim_pulse [echo=mm,mm,...] [pins=trigger,echo]
+ *                   [rate=Hz] [samples=n] [tolerance=mm] [module
+ *                   parameter=value ...]. Loads the driver on the gpio
+ *                   backend, runs the continuous mode against the
+ *                   scripted echoes and checks every sample against the
+ *                   echo that was driven for its trigger. A distance of
+ *                   0 in the script must give a timeout.
+ *                   track=mm,mm/s scripts an obstacle starting at mm and
+ *                   moving at a steady speed instead. The echoes the host
+ *                   drives come now and then hundreds of mm late, so the
+ *                   obstacle is then injected at the rate as well and
+ *                   the filter must give its distance and speed
+ * INPUT PARAMETERS: argc, argv : command line
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	KsimFileType *File;
+	PulseSampleType Sample;
+	PulseFilteredType Filtered, Injected;
+	KsimEchoStatsType EchoStats;
+	KsimEchoRecordType Record;
+	int Script[KSIM_ECHO_MAX_STEPS] = {500, 1000, 0, 1500, 2500};
+	unsigned int ScriptCount = 5;
+	int Track[2], Tracking = 0, TrackMm = 0;
+	unsigned int Rejected;
+	int Pins[2] = {SIM_DEFAULT_TRIGGER_GPIO, SIM_DEFAULT_ECHO_GPIO};
+	unsigned int RateHz = SIM_DEFAULT_RATE_HZ, Samples = SIM_DEFAULT_SAMPLES;
+	unsigned int ToleranceMm = SIM_DEFAULT_TOLERANCE_MM;
+	unsigned int LoopIndex, Got = 0, Errors = 0, Late = 0, FirstSequence = 0;
+	unsigned long long LatencyNs, LatencySumNs = 0, LatencyMaxNs = 0;
+	int DrivenMm, ErrorMm, WorstMm = 0, WorstScriptMm = 0;
+	unsigned int WidthUs = 0;
+	ssize_t Length;
+	int Ret;
+
+	for (LoopIndex = 1; LoopIndex < (unsigned int)argc; LoopIndex++)
+	{
+		if (0 == strncmp(argv[LoopIndex],"echo=",5))
+		{
+			ScriptCount = SimParseList(argv[LoopIndex] + 5,Script,KSIM_ECHO_MAX_STEPS);
+			Ret = (0 == ScriptCount);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"track=",6))
+		{
+			Tracking = (2 == SimParseList(argv[LoopIndex] + 6,Track,2));
+			Ret = !(Tracking);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"pins=",5))
+		{
+			Ret = (2 != SimParseList(argv[LoopIndex] + 5,Pins,2));
+		}
+		else if (0 == strncmp(argv[LoopIndex],"rate=",5))
+		{
+			RateHz = (unsigned int)atoi(argv[LoopIndex] + 5);
+			Ret = 0;
+		}
+		else if (0 == strncmp(argv[LoopIndex],"samples=",8))
+		{
+			Samples = (unsigned int)atoi(argv[LoopIndex] + 8);
+			Ret = 0;
+		}
+		else if (0 == strncmp(argv[LoopIndex],"tolerance=",10))
+		{
+			ToleranceMm = (unsigned int)atoi(argv[LoopIndex] + 10);
+			Ret = 0;
+		}
+		else
+		{
+			Ret = KsimParamSet(argv[LoopIndex]);
+		}
+		if (Ret)
+		{
+			printf("usage: %s [echo=mm,mm,... | track=mm,mm/s] [pins=trigger,echo] [rate=Hz] [samples=n]"
+			       " [tolerance=mm] [module parameter=value ...]\n",argv[0]);
+			return 1;
+		}
+	}
+	if ((Tracking) && ((0 == RateHz) || (Samples >= KSIM_ECHO_MAX_STEPS)))
+	{
+		printf("track= needs a rate and less than %d samples\n",KSIM_ECHO_MAX_STEPS);
+		return 1;
+	}
+	/* The whole script is used, the triggers after the last read carry on moving */
+	for (LoopIndex = 0; (Tracking) && (LoopIndex < KSIM_ECHO_MAX_STEPS); LoopIndex++)
+	{
+		Script[LoopIndex] = Track[0] + (((int)LoopIndex * Track[1]) / (int)RateHz);
+		ScriptCount = KSIM_ECHO_MAX_STEPS;
+	}
+
+	KsimStart();
+	KsimEchoScript(Pins[0],Pins[1],Script,ScriptCount);
+	Ret = KsimModuleInit();
+	if (Ret)
+	{
+		printf("module init failed: %d\n",Ret);
+		KsimStop();
+		return 1;
+	}
+	Ret = KsimOpen("pulse",0,&File);
+	if (Ret)
+	{
+		printf("open failed: %d\n",Ret);
+		KsimModuleExit();
+		KsimStop();
+		return 1;
+	}
+	Ret = (int)KsimIoctl(File,PULSE_IOC_START,RateHz);
+	if (Ret)
+	{
+		printf("start at %u Hz failed: %d\n",RateHz,Ret);
+		Errors++;
+		Samples = 0;
+	}
+	while (Got < Samples)
+	{
+		Length = KsimRead(File,&Sample,sizeof(Sample));
+		if (Length != (ssize_t)sizeof(Sample))
+		{
+			printf("read failed: %zd\n",Length);
+			Errors++;
+			break;
+		}
+		LatencyNs = KsimHostNowNs() - Sample.TimestampNs;
+		LatencySumNs += LatencyNs;
+		if (LatencyNs > LatencyMaxNs)
+		{
+			LatencyMaxNs = LatencyNs;
+		}
+		if (0 == Got)
+		{
+			FirstSequence = Sample.Sequence;
+		}
+		/* Every trigger takes the next step of the script */
+		if (KsimEchoRecord(Pins[0],Sample.Sequence - FirstSequence,&Record))
+		{
+			printf("sample %u: no echo record\n",Sample.Sequence);
+			Errors++;
+		}
+		else if (Record.DistanceMm <= 0)
+		{
+			if (PULSE_SAMPLE_TIMEOUT != Sample.Status)
+			{
+				printf("sample %u: %u mm, expected a timeout\n",Sample.Sequence,Sample.DistanceMm);
+				Errors++;
+			}
+		}
+		else if ((0 == Record.FallNs) || (Record.FallNs > Sample.TimestampNs + (PULSE_ECHO_WINDOW_US * 1000ULL)))
+		{
+			/* The host ran the echo past the window, either result is right */
+			Late++;
+		}
+		else if (PULSE_SAMPLE_OK != Sample.Status)
+		{
+			printf("sample %u: timeout, expected %d mm\n",Sample.Sequence,Record.DistanceMm);
+			Errors++;
+		}
+		else
+		{
+			/* Against the echo actually driven, then against the script */
+			DrivenMm = (int)(((Record.FallNs - Record.RiseNs) * KSIM_SPEED_OF_SOUND_MM_PER_SEC) / 2000000000ULL);
+			ErrorMm = abs((int)Sample.DistanceMm - DrivenMm);
+			if (ErrorMm > WorstMm)
+			{
+				WorstMm = ErrorMm;
+			}
+			if (abs((int)Sample.DistanceMm - Record.DistanceMm) > WorstScriptMm)
+			{
+				WorstScriptMm = abs((int)Sample.DistanceMm - Record.DistanceMm);
+			}
+			if (ErrorMm > (int)ToleranceMm)
+			{
+				printf("sample %u: %u mm, echo of %d mm driven\n",Sample.Sequence,Sample.DistanceMm,DrivenMm);
+				Errors++;
+			}
+		}
+		Got++;
+	}
+	memset(&Filtered,0,sizeof(Filtered));
+	KsimIoctl(File,PULSE_IOC_GET_FILTERED,(unsigned long)&Filtered);
+	KsimIoctl(File,PULSE_IOC_STOP,0);
+
+	/* One on demand measurement: write() triggers, a 4 byte read() gives the width */
+	KsimEchoStats(Pins[0],&EchoStats);
+	if (0 == KsimWrite(File,&WidthUs,sizeof(WidthUs)))
+	{
+		while (KsimRead(File,&WidthUs,sizeof(WidthUs)) != (ssize_t)sizeof(WidthUs))
+		{
+			usleep(1000);
+		}
+		KsimEchoRecord(Pins[0],EchoStats.Triggers,&Record);
+		DrivenMm = (int)(((Record.FallNs - Record.RiseNs) * KSIM_SPEED_OF_SOUND_MM_PER_SEC) / 2000000000ULL);
+		printf("on demand: %u us, echo of %d mm driven for %d mm\n",WidthUs,(Record.FallNs) ? DrivenMm : 0,Record.DistanceMm);
+		if ((Record.FallNs) && (Record.FallNs < Record.RiseNs + (PULSE_ECHO_WINDOW_US * 1000ULL)) &&
+		    (abs((int)(((unsigned long long)WidthUs * KSIM_SPEED_OF_SOUND_MM_PER_SEC) / 2000000) - DrivenMm) > (int)ToleranceMm))
+		{
+			Errors++;
+		}
+	}
+	else
+	{
+		printf("on demand measurement refused\n");
+		Errors++;
+	}
+	/* Replayed samples come back from read() as they were injected */
+	while (KsimRead(File,&Sample,sizeof(Sample)) == (ssize_t)sizeof(Sample))
+	{
+	}
+	for (LoopIndex = 0; LoopIndex < SIM_INJECT_SAMPLES; LoopIndex++)
+	{
+		memset(&Sample,0,sizeof(Sample));
+		Sample.Status = (1 == LoopIndex) ? PULSE_SAMPLE_TIMEOUT : PULSE_SAMPLE_OK;
+		Sample.WidthNs = (PULSE_SAMPLE_OK == Sample.Status) ? SimInjectWidthNs[LoopIndex] : 0;
+		Ret = (int)KsimIoctl(File,PULSE_IOC_INJECT,(unsigned long)&Sample);
+		if ((Ret) || (KsimRead(File,&Sample,sizeof(Sample)) != (ssize_t)sizeof(Sample)) ||
+		    (Sample.Status != ((1 == LoopIndex) ? PULSE_SAMPLE_TIMEOUT : PULSE_SAMPLE_OK)) ||
+		    (Sample.WidthNs != ((1 == LoopIndex) ? 0 : SimInjectWidthNs[LoopIndex])))
+		{
+			printf("injected sample %u: %d, read back %u ns\n",LoopIndex,Ret,Sample.WidthNs);
+			Errors++;
+		}
+	}
+	memset(&Injected,0,sizeof(Injected));
+	KsimIoctl(File,PULSE_IOC_GET_FILTERED,(unsigned long)&Injected);
+	printf("injected: %u samples, filter at %d mm\n",SIM_INJECT_SAMPLES,Injected.DistanceMm);
+	/* A new track, then the obstacle at its exact distances */
+	if (Tracking)
+	{
+		usleep(SIM_TRACK_RESTART_US);
+		Rejected = Injected.Rejected;
+		for (LoopIndex = 0; (0 == Ret) && (LoopIndex < Samples); LoopIndex++)
+		{
+			TrackMm = Track[0] + (((int)LoopIndex * Track[1]) / (int)RateHz);
+			memset(&Sample,0,sizeof(Sample));
+			Sample.Status = PULSE_SAMPLE_OK;
+			Sample.WidthNs = (unsigned int)((((unsigned long long)TrackMm * 2000000000ULL) + KSIM_SPEED_OF_SOUND_MM_PER_SEC - 1) /
+			                                KSIM_SPEED_OF_SOUND_MM_PER_SEC);
+			Ret = (int)KsimIoctl(File,PULSE_IOC_INJECT,(unsigned long)&Sample);
+			KsimRead(File,&Sample,sizeof(Sample));
+			usleep(1000000 / RateHz);
+		}
+		KsimIoctl(File,PULSE_IOC_GET_FILTERED,(unsigned long)&Injected);
+		/* The median is half its window behind the last distance */
+		TrackMm -= ((PULSE_FILTER_MEDIAN_SAMPLES / 2) * Track[1]) / (int)RateHz;
+		Rejected = Injected.Rejected - Rejected;
+		printf("track: filter %d mm, %d mm/s, %u rejected, expected %d mm, %d mm/s\n",
+		       Injected.DistanceMm,Injected.VelocityMmPerSec,Rejected,TrackMm,Track[1]);
+		if ((Ret) || (PULSE_FILTER_VALID != Injected.Status) || (Rejected) ||
+		    (abs(Injected.DistanceMm - TrackMm) > SIM_TRACK_TOLERANCE_MM) ||
+		    (abs(Injected.VelocityMmPerSec - Track[1]) > SIM_TRACK_TOLERANCE_MM_PER_SEC))
+		{
+			Errors++;
+		}
+	}
+
+	KsimEchoStats(Pins[0],&EchoStats);
+	printf("%u samples at %u Hz, %u echoes late on the host\n",Got,RateHz,Late);
+	printf("worst distance error %d mm against the driven echo, %d mm against the script\n",WorstMm,WorstScriptMm);
+	if (Got)
+	{
+		printf("trigger to read latency: mean %llu us, max %llu us\n",LatencySumNs / Got / 1000,LatencyMaxNs / 1000);
+	}
+	printf("filter: %d mm, %d mm/s, %u accepted, %u rejected\n",
+	       Filtered.DistanceMm,Filtered.VelocityMmPerSec,Filtered.Accepted,Filtered.Rejected);
+	/* Whatever the echoes, the velocity stays physical */
+	if ((abs(Filtered.VelocityMmPerSec) > PULSE_FILTER_MAX_SPEED_MM_PER_SEC) ||
+	    (abs(Injected.VelocityMmPerSec) > PULSE_FILTER_MAX_SPEED_MM_PER_SEC))
+	{
+		printf("filter velocity over %d mm/s\n",PULSE_FILTER_MAX_SPEED_MM_PER_SEC);
+		Errors++;
+	}
+	printf("sensor: %lu triggers, %lu echoes, %lu overlapping, edges up to %llu us late\n",
+	       EchoStats.Triggers,EchoStats.Echoes,EchoStats.Overlaps,EchoStats.WorstLateNs / 1000);
+	KsimDebugfsDump(stdout);
+	KsimClose(File);
+	KsimModuleExit();
+	KsimStop();
+	printf("%s\n",(Errors) ? "FAIL" : "PASS");
+	return (Errors) ? 1 : 0;
+}
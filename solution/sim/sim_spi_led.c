@@ -0,0 +1,380 @@
+/* *********************************************************************
+ *
+ * Host run of the SpiLed driver against the simulated spi bus
+ *
+ * Program Name:        SimSpiLed
+ * Target:              Linux host (x86, x86_64)
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include "ksim_host.h"
+#include "../spi_led.h"
+
+/* Sequences queued by default and display time of a step */
+#define SIM_DEFAULT_ROUNDS   20
+#define SIM_DEFAULT_STEP_TIME   5
+/* Longest wait for room in the sequence queue */
+#define SIM_POLL_TIMEOUT_MS   5000
+/* First MAX7219 control register, registers 1 to 8 are the rows */
+#define SIM_FIRST_CONTROL_REGISTER   0x09
+
+/* *********************************************************************
+ * NAME:             SimPattern
+ * CALLED BY:        main
+ * DESCRIPTION:      Pattern n of the test bank, a bar that walks through
+ *                   the rows and columns so that every frame differs
+ * INPUT PARAMETERS: Number : pattern number
+ *                   Rows : eight digit registers to fill
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SimPattern(unsigned int Number, __u8 *Rows)
+{
+	unsigned int Row;
+
+	for (Row = 0; Row < 8; Row++)
+	{
+		Rows[Row] = (__u8)((Row == (Number % 8)) ? 0xFF : (1u << ((Number + Row) % 8)));
+	}
+}
+
+/* *********************************************************************
+ * NAME:             SimCheckCapture
+ * CALLED BY:        main
+ * DESCRIPTION:      Checks the byte stream of the capture log. Every latch
+ *                   must be one transfer of 2 * Panels bytes carrying the
+ *                   same register for every panel. A control register
+ *                   gets the same value everywhere, a row is blank or has
+ *                   row Register - 1 of patterns n to n + Panels - 1 of
+ *                   one step, pattern n + i on panel i, so a reversed or
+ *                   shifted panel order is caught.
+ * INPUT PARAMETERS: Log : capture log, read from the start
+ *                   Panels : chained panels
+ * RETURN VALUES:    unsigned int : errors found
+ ***********************************************************************/
+static unsigned int SimCheckCapture(FILE *Log, unsigned int Panels)
+{
+	char Line[64 + (16 * KSIM_MAX_PANELS)];
+	unsigned int Bytes, Transfers, Word, Panel, Register, Data, Step, LineNumber = 0;
+	unsigned int Rows = 0, Errors = 0;
+	unsigned char Words[KSIM_MAX_PANELS][2];
+	__u8 Expected[8];
+	const char *Next;
+	int Length, Match;
+
+	if (Panels > KSIM_MAX_PANELS)
+	{
+		printf("capture: %u panels, the log decodes %u\n",Panels,KSIM_MAX_PANELS);
+		return 1;
+	}
+	rewind(Log);
+	while (NULL != fgets(Line,sizeof(Line),Log))
+	{
+		LineNumber++;
+		Next = strstr(Line," us latch ");
+		if ((NULL == Next) || (2 != sscanf(Next," us latch %u bytes %u transfers%n",&Bytes,&Transfers,&Length)))
+		{
+			continue;
+		}
+		Next += Length;
+		for (Word = 0; (Word < Panels) && (3 == sscanf(Next," p%u:%x=%x%n",&Panel,&Register,&Data,&Length)); Word++)
+		{
+			/* The first word sent is in the last panel */
+			if (Panel != Panels - 1 - Word)
+			{
+				break;
+			}
+			Words[Panel][0] = (unsigned char)Register;
+			Words[Panel][1] = (unsigned char)Data;
+			Next += Length;
+		}
+		if ((Bytes != 2 * Panels) || (1 != Transfers) || (Word != Panels))
+		{
+			printf("capture line %u: %u bytes in %u transfers, %u panels decoded, expected %u bytes in 1\n",
+			       LineNumber,Bytes,Transfers,Word,2 * Panels);
+			Errors++;
+			continue;
+		}
+		Match = 1;
+		for (Panel = 1; Panel < Panels; Panel++)
+		{
+			Match = Match && (Words[Panel][0] == Words[0][0]);
+			/* Control registers, and blank rows, are the same on every panel */
+			if ((0 == Words[0][0]) || (Words[0][0] >= SIM_FIRST_CONTROL_REGISTER))
+			{
+				Match = Match && (Words[Panel][1] == Words[0][1]);
+			}
+		}
+		if ((Match) && (Words[0][0]) && (Words[0][0] < SIM_FIRST_CONTROL_REGISTER))
+		{
+			Rows++;
+			for (Panel = 0; (Panel < Panels) && (0 == Words[Panel][1]); Panel++)
+			{
+			}
+			/* Not blank, so the frame of a step */
+			if (Panel < Panels)
+			{
+				Match = 0;
+				for (Step = 1; (Step <= SPI_LED_SEQUENCE_LENGTH) && !(Match); Step++)
+				{
+					Match = 1;
+					for (Panel = 0; (Panel < Panels) && (Match); Panel++)
+					{
+						SimPattern(Step + Panel,Expected);
+						Match = (Words[Panel][1] == Expected[Words[Panel][0] - 1]);
+					}
+				}
+			}
+		}
+		if (!(Match))
+		{
+			printf("capture line %u: panel words out of order: %s",LineNumber,Line);
+			Errors++;
+		}
+	}
+	printf("capture: %u lines, %u row writes of %u bytes in one transfer\n",LineNumber,Rows,2 * Panels);
+	if (0 == Rows)
+	{
+		printf("capture: no row was written\n");
+		Errors++;
+	}
+	return Errors;
+}
+
+/* *********************************************************************
+ * NAME:             SimCheckBankOwner
+ * CALLED BY:        main
+ * DESCRIPTION:      Allocates a bank on File and checks that a second
+ *                   open of the device gets EPERM for it on every bank
+ *                   command and mmap, while the default bank stays
+ *                   shared. Frees the bank on File again
+ * INPUT PARAMETERS: File : open device file
+ * RETURN VALUES:    unsigned int : errors found
+ ***********************************************************************/
+static unsigned int SimCheckBankOwner(KsimFileType *File)
+{
+	KsimFileType *Other;
+	SpiLedBankReqType BankReq;
+	SpiLedBankDataType BankData;
+	SpiLedPlayType Play;
+	SpiLedShmType *Shm;
+	__u8 Rows[8];
+	void *Map;
+	long Results[5];
+	unsigned int LoopIndex, Errors = 0;
+
+	if (KsimOpen("spi_led",0,&Other))
+	{
+		printf("owner: second open failed\n");
+		return 1;
+	}
+	BankReq.PatternCount = 1;
+	BankReq.SequenceLength = 1;
+	if (KsimIoctl(File,SPI_LED_IOC_BANK_ALLOC,(unsigned long)&BankReq))
+	{
+		printf("owner: bank alloc failed\n");
+		KsimClose(Other);
+		return 1;
+	}
+	SimPattern(0,Rows);
+	BankData.Handle = BankReq.Handle;
+	BankData.First = 0;
+	BankData.Count = 1;
+	BankData.Reserved = 0;
+	BankData.Data = (__u64)(unsigned long)Rows;
+	Play.Handle = BankReq.Handle;
+	Play.First = 0;
+	Play.Count = 1;
+	Results[0] = KsimIoctl(Other,SPI_LED_IOC_LOAD_PATTERNS,(unsigned long)&BankData);
+	Results[1] = KsimIoctl(Other,SPI_LED_IOC_LOAD_SEQUENCE,(unsigned long)&BankData);
+	Results[2] = KsimIoctl(Other,SPI_LED_IOC_PLAY,(unsigned long)&Play);
+	Results[3] = KsimIoctl(Other,SPI_LED_IOC_BANK_FREE,BankReq.Handle);
+	Results[4] = KsimMmap(Other,BankReq.MapSize,SPI_LED_BANK_MAP_OFFSET(BankReq.Handle),1,&Map);
+	for (LoopIndex = 0; LoopIndex < 5; LoopIndex++)
+	{
+		if (-EPERM != Results[LoopIndex])
+		{
+			printf("owner: bank of another file, check %u gave %ld, expected %d\n",LoopIndex,Results[LoopIndex],-EPERM);
+			Errors++;
+		}
+	}
+	if (KsimMmap(Other,sizeof(SpiLedShmType),SPI_LED_BANK_MAP_OFFSET(0),1,(void **)&Shm))
+	{
+		printf("owner: default bank not shared\n");
+		Errors++;
+	}
+	KsimClose(Other);
+	if (KsimIoctl(File,SPI_LED_IOC_BANK_FREE,BankReq.Handle))
+	{
+		printf("owner: owner could not free its bank\n");
+		Errors++;
+	}
+	printf("owner: %s\n",(Errors) ? "FAIL" : "ok");
+	return Errors;
+}
+
+/* *********************************************************************
+ * NAME:             main
+ * CALLED BY:        make sim, or the user on the terminal
+ * DESCRIPTION:      sim_spi_led [capture=file] [rounds=n] [step=time]
+ *                   [module parameter=value ...]. Loads the driver,
+ *                   commits rounds sequences of the default bank as fast
+ *                   as the queue takes them, prints what went over the
+ *                   bus, checks its byte stream, that the display holds
+ *                   the last frame and that a bank is refused to another
+ *                   file. Without capture= the log goes to a temporary
+ *                   file
+ * INPUT PARAMETERS: argc, argv : command line
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	KsimFileType *File;
+	SpiLedShmType *Shm;
+	SpiLedInfoType Info;
+	KsimSpiStatsType Stats;
+	FILE *Capture = NULL;
+	unsigned int Rounds = SIM_DEFAULT_ROUNDS, StepTime = SIM_DEFAULT_STEP_TIME;
+	unsigned int LoopIndex, Panel, Row, LastPattern, Errors = 0;
+	unsigned long long Start, Took;
+	__u8 Expected[8];
+	char Done;
+	int Ret;
+
+	for (LoopIndex = 1; LoopIndex < (unsigned int)argc; LoopIndex++)
+	{
+		if (0 == strncmp(argv[LoopIndex],"capture=",8))
+		{
+			Capture = fopen(argv[LoopIndex] + 8,"w+");
+			if (NULL == Capture)
+			{
+				perror(argv[LoopIndex] + 8);
+				return 1;
+			}
+		}
+		else if (0 == strncmp(argv[LoopIndex],"rounds=",7))
+		{
+			Rounds = (unsigned int)atoi(argv[LoopIndex] + 7);
+		}
+		else if (0 == strncmp(argv[LoopIndex],"step=",5))
+		{
+			StepTime = (unsigned int)atoi(argv[LoopIndex] + 5);
+		}
+		else if (KsimParamSet(argv[LoopIndex]))
+		{
+			printf("usage: %s [capture=file] [rounds=n] [step=time] [module parameter=value ...]\n",argv[0]);
+			return 1;
+		}
+	}
+	if ((0 == Rounds) || (0 == StepTime))
+	{
+		printf("rounds and step must not be 0\n");
+		return 1;
+	}
+
+	if ((NULL == Capture) && (NULL == (Capture = tmpfile())))
+	{
+		perror("capture");
+		return 1;
+	}
+
+	KsimStart();
+	KsimSpiCapture(Capture);
+	Ret = KsimModuleInit();
+	if (Ret)
+	{
+		printf("module init failed: %d\n",Ret);
+		KsimStop();
+		return 1;
+	}
+	Ret = KsimOpen("spi_led",0,&File);
+	if (Ret)
+	{
+		printf("open failed: %d\n",Ret);
+		KsimModuleExit();
+		KsimStop();
+		return 1;
+	}
+	KsimIoctl(File,SPI_LED_IOC_GET_INFO,(unsigned long)&Info);
+	/* Before the frames are played, an open blanks the display */
+	Errors += SimCheckBankOwner(File);
+	Ret = KsimMmap(File,sizeof(SpiLedShmType),SPI_LED_BANK_MAP_OFFSET(0),1,(void **)&Shm);
+	if (Ret)
+	{
+		printf("mmap failed: %d\n",Ret);
+		Errors++;
+	}
+	else
+	{
+		for (LoopIndex = 0; LoopIndex < SPI_LED_PATTERN_COUNT; LoopIndex++)
+		{
+			SimPattern(LoopIndex,&(Shm->Pattern[LoopIndex][0]));
+		}
+		/* Every step is used, so the display keeps the last frame */
+		for (LoopIndex = 0; LoopIndex < SPI_LED_SEQUENCE_LENGTH; LoopIndex++)
+		{
+			Shm->Sequence[LoopIndex][0] = LoopIndex + 1;
+			Shm->Sequence[LoopIndex][1] = StepTime;
+		}
+		printf("%u panels, %u rounds of %u steps of %u units\n",Info.PanelCount,Rounds,SPI_LED_SEQUENCE_LENGTH,StepTime);
+
+		Start = KsimHostNowNs();
+		for (LoopIndex = 0; LoopIndex < Rounds; LoopIndex++)
+		{
+			if (0 == KsimPoll(File,POLLOUT,SIM_POLL_TIMEOUT_MS))
+			{
+				printf("queue did not drain\n");
+				Errors++;
+				break;
+			}
+			Ret = (int)KsimIoctl(File,SPI_LED_IOC_COMMIT,0);
+			if (Ret)
+			{
+				printf("commit %u failed: %d\n",LoopIndex,Ret);
+				Errors++;
+			}
+		}
+		/* Blocks until every sequence has been played */
+		KsimRead(File,&Done,1);
+		Took = KsimHostNowNs() - Start;
+		printf("played in %llu us, %llu us per sequence\n",Took / 1000,Took / 1000 / Rounds);
+	}
+	KsimDebugfsDump(stdout);
+	KsimClose(File);
+	KsimModuleExit();
+
+	KsimSpiStats(&Stats);
+	printf("spi: %lu messages (%lu async), %lu transfers, %lu latches, %lu bytes, bus busy %llu us\n",
+	       Stats.Messages,Stats.AsyncMessages,Stats.Transfers,Stats.Latches,Stats.Bytes,Stats.BusNs / 1000);
+	/* The last step shows patterns 10 to 10 + PanelCount - 1 */
+	LastPattern = SPI_LED_SEQUENCE_LENGTH;
+	for (Panel = 0; (0 == Ret) && (Panel < Info.PanelCount) && (Panel < KSIM_MAX_PANELS); Panel++)
+	{
+		SimPattern(LastPattern + Panel,Expected);
+		for (Row = 0; Row < 8; Row++)
+		{
+			if (Stats.Register[Panel][Row + 1] != Expected[Row])
+			{
+				printf("panel %u row %u: %02x, expected %02x\n",Panel,Row,Stats.Register[Panel][Row + 1],Expected[Row]);
+				Errors++;
+			}
+		}
+	}
+	KsimStop();
+	KsimSpiCapture(NULL);
+	if (0 == Ret)
+	{
+		Errors += SimCheckCapture(Capture,Info.PanelCount);
+	}
+	fclose(Capture);
+	printf("%s\n",(Errors) ? "FAIL" : "PASS");
+	return (Errors) ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+/* *********************************************************************
+ *
+ * MAX7219 8x8 LED matrix driven through spidev
+ *
+ * Program Name:        SpiDisplay
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "spi_display.h"
+
+/*
+ * MAX7219 registers
+ */
+#define MAX7219_DIGIT0 0x01
+#define MAX7219_DECODE_MODE 0x09
+#define MAX7219_INTENSITY 0x0A
+#define MAX7219_SCAN_LIMIT 0x0B
+#define MAX7219_SHUTDOWN 0x0C
+#define MAX7219_DISPLAY_TEST 0x0F
+
+/* *********************************************************************
+ * NAME:             SpiDisplaySend
+ * CALLED BY:        SpiDisplayOpen, SpiDisplayFrame
+ * DESCRIPTION:      Sends the first Count register writes of TxBuf as a
+ *                   single spi message. The chip select is released
+ *                   after every transfer but the last one, spidev
+ *                   releases it at the end of the message.
+ * INPUT PARAMETERS: Display : display
+ *                   Count : number of register writes
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+static int SpiDisplaySend(SpiDisplayType *Display, unsigned int Count)
+{
+	unsigned int LoopIndex;
+
+	memset(Display->Transfer,0,Count * sizeof(Display->Transfer[0]));
+	for (LoopIndex = 0; LoopIndex < Count; LoopIndex++)
+	{
+		Display->Transfer[LoopIndex].tx_buf = (unsigned long)Display->TxBuf[LoopIndex];
+		Display->Transfer[LoopIndex].len = 2;
+		Display->Transfer[LoopIndex].speed_hz = SPI_DISPLAY_SPEED_HZ;
+		Display->Transfer[LoopIndex].bits_per_word = 8;
+		Display->Transfer[LoopIndex].cs_change = (LoopIndex + 1 < Count) ? 1 : 0;
+	}
+	return (ioctl(Display->Fd,SPI_IOC_MESSAGE(Count),Display->Transfer) < 0) ? (-1) : (0);
+}
+
+/* *********************************************************************
+ * NAME:             SpiDisplayOpen
+ * CALLED BY:        Applications, once at start
+ * DESCRIPTION:      Opens the spidev node and sets the MAX7219 up with
+ *                   a single message: no decode, medium intensity, all
+ *                   rows scanned, normal operation and a clear display
+ * INPUT PARAMETERS: Display : display to open
+ *                   Path : spidev node
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int SpiDisplayOpen(SpiDisplayType *Display, const char *Path)
+{
+	const unsigned char Setup[5][2] = {
+		{MAX7219_DISPLAY_TEST, 0x00}, /* Test mode off */
+		{MAX7219_DECODE_MODE, 0x00}, /* Select No decode */
+		{MAX7219_INTENSITY, 0x00}, /* intensity level medium */
+		{MAX7219_SCAN_LIMIT, 0x07}, /* scan all the data register for displaying */
+		{MAX7219_SHUTDOWN, 0x01} /* shutdown register - select normal operation */
+	};
+	struct timespec Start, End;
+	unsigned char LoopIndex;
+
+	clock_gettime(CLOCK_MONOTONIC,&Start);
+	Display->Frames = 0;
+	Display->Fd = open(Path,O_WRONLY);
+	if (Display->Fd < 0)
+	{
+		printf("\n LED driver open failed");
+		return -1;
+	}
+	memcpy(Display->TxBuf,Setup,sizeof(Setup));
+    /* clear the display */
+	for (LoopIndex = 0; LoopIndex < SPI_DISPLAY_ROWS; LoopIndex++)
+	{
+		Display->TxBuf[5 + LoopIndex][0] = MAX7219_DIGIT0 + LoopIndex;
+		Display->TxBuf[5 + LoopIndex][1] = 0;
+	}
+	if (SpiDisplaySend(Display,SPI_DISPLAY_INIT_WRITES) < 0)
+	{
+		perror("Display init failed ");
+		SpiDisplayClose(Display);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&End);
+	Display->InitUs = (unsigned long)(((End.tv_sec - Start.tv_sec) * 1000000L) + ((End.tv_nsec - Start.tv_nsec) / 1000));
+	printf("\n Display set up in %lu us",Display->InitUs);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             SpiDisplayFrame
+ * CALLED BY:        Animation code
+ * DESCRIPTION:      Shows a frame, all eight rows in one spi message
+ * INPUT PARAMETERS: Display : open display
+ *                   Rows : row patterns, top row first
+ * RETURN VALUES:    int : status - Fail(-1)/Pass(0)
+ ***********************************************************************/
+int SpiDisplayFrame(SpiDisplayType *Display, const unsigned char Rows[SPI_DISPLAY_ROWS])
+{
+	unsigned char LoopIndex;
+
+	for (LoopIndex = 0; LoopIndex < SPI_DISPLAY_ROWS; LoopIndex++)
+	{
+		Display->TxBuf[LoopIndex][0] = MAX7219_DIGIT0 + LoopIndex;
+		Display->TxBuf[LoopIndex][1] = Rows[LoopIndex];
+	}
+	if (SpiDisplaySend(Display,SPI_DISPLAY_ROWS) < 0)
+	{
+		return -1;
+	}
+	Display->Frames++;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             SpiDisplayClose
+ * CALLED BY:        Applications at exit, SpiDisplayOpen on failure
+ * DESCRIPTION:      Closes the spidev node
+ * INPUT PARAMETERS: Display : display
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void SpiDisplayClose(SpiDisplayType *Display)
+{
+	if (Display->Fd >= 0)
+	{
+		close(Display->Fd);
+		Display->Fd = -1;
+	}
+}
@@ -0,0 +1,51 @@
+/* *********************************************************************
+ *
+ * MAX7219 8x8 LED matrix driven through spidev
+ *
+ * Program Name:        SpiDisplay
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef SPI_DISPLAY_H
+#define SPI_DISPLAY_H
+
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+/*
+ * Rows of the matrix, one MAX7219 digit register each
+ */
+#define SPI_DISPLAY_ROWS 8
+/*
+ * Register writes of the init sequence: five setup registers and the
+ * eight rows cleared
+ */
+#define SPI_DISPLAY_INIT_WRITES (5 + SPI_DISPLAY_ROWS)
+/*
+ * Clock of the spi bus
+ */
+#define SPI_DISPLAY_SPEED_HZ 500000
+
+/*
+ * Display opened on a spidev node. A frame is the eight row registers,
+ * sent as one spi message of eight transfers. The chip select goes up
+ * between the transfers, which latches each register write.
+ */
+typedef struct SpiDisplayTag
+{
+	int Fd; /* spidev node, -1 while closed */
+	unsigned char TxBuf[SPI_DISPLAY_INIT_WRITES][2]; /* {register, value} of every transfer */
+	struct spi_ioc_transfer Transfer[SPI_DISPLAY_INIT_WRITES]; /* One per register write */
+	unsigned long Frames; /* Frames sent */
+	unsigned long InitUs; /* Time SpiDisplayOpen took */
+}SpiDisplayType;
+
+int SpiDisplayOpen(SpiDisplayType *Display, const char *Path);
+int SpiDisplayFrame(SpiDisplayType *Display, const unsigned char Rows[SPI_DISPLAY_ROWS]);
+void SpiDisplayClose(SpiDisplayType *Display);
+
+#endif
@@ -26,6 +26,21 @@
 #include <linux/delay.h>
 #include <linux/gpio.h>
 #include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include "spi_led.h"
+#define CREATE_TRACE_POINTS
+#include "spi_led_trace.h"
 
 //#define DEBUG 
 /*
@@ -44,14 +59,55 @@
 #define DEVICE_NAME    "spi_led"
 
 /*
- *  Sends the message to SPI
+ * Number of digit (row) registers in the MAX7219
+ */
+#define SPI_LED_ROWS   8
+
+/*
+ * Most MAX7219 panels that can be chained on one chip select
+ */
+#define SPI_LED_MAX_PANELS   16
+
+/*
+ * Frame buffers used in turn by the display thread, so that the next frame
+ * can be prepared while the previous one is still on the bus
+ */
+#define SPI_LED_FRAME_BUFFERS   2
+
+/*
+ * SPI clock used for the display
+ */
+#define SPI_LED_SPEED_HZ   500000
+
+/*
+ * Slots in the sequence queue between write() and the display thread.
+ * Must be a power of two.
+ */
+#define SPI_LED_QUEUE_SIZE   4
+
+/*
+ * Slack allowed to the frame timer, small enough to keep frames on time
+ */
+#define SPI_LED_TIMER_SLACK_NS   10000
+
+/*
+ * Buckets of the frame lateness histogram. Bucket 0 counts frames less
+ * than 1us late, bucket n frames between 2^(n-1) and 2^n us late, the last
+ * bucket everything beyond.
+ */
+#define SPI_LED_JITTER_BUCKETS   18
+
+/*
+ *  Sends the message to SPI, the status of spi_sync is left in Ret
  */
 #define SPI_MESSAGE_SEND() \
    do \
    { \
 	   spi_message_init(&(Device->SpiLedMessage)); \
 	   spi_message_add_tail(&(Device->SpiLedTransfer),&(Device->SpiLedMessage)); \
-	   spi_sync(SpiLedDevice,&(Device->SpiLedMessage)); \
+	   trace_spi_led_spi_submit(&(Device->SpiLedMessage),1,0); \
+	   Ret = spi_sync(SpiLedDevice,&(Device->SpiLedMessage)); \
+	   trace_spi_led_spi_complete(&(Device->SpiLedMessage),Ret); \
    } \
    while(0)
 
@@ -64,16 +120,132 @@ typedef enum DispayOperation_Tag {
 	ONGOING
 }DisplayOperation_Type;
 
+/* Pattern bank, see spi_led.h for the memory layout */
+typedef struct SpiLedBankTag
+{
+	bool InUse; /* Handle is allocated */
+	bool Orphan; /* Owner closed the file while the bank was queued */
+	void *Memory; /* vmalloc_user memory of the bank */
+	unsigned long Size; /* Bytes in use in Memory */
+	unsigned int PatternCount; /* Number of patterns */
+	unsigned int SequenceLength; /* Number of sequence steps */
+	__u8 (*Pattern)[8]; /* Patterns in Memory */
+	__u16 (*Sequence)[2]; /* Sequence steps in Memory */
+	atomic_t Pending; /* Queued sequences using this bank */
+	struct file *Owner; /* File that allocated the bank, NULL for the default bank */
+}SpiLedBankType;
+
+/*
+ * Memory handed to the spi controller. It is kmalloc'd on its own, the
+ * controller may DMA it, and the receive side starts on a new cache line
+ * so that it never shares one with bytes the CPU is writing.
+ */
+typedef struct SpiLedDmaTag
+{
+	unsigned char FrameTxBuf[SPI_LED_FRAME_BUFFERS][SPI_LED_ROWS][2 * SPI_LED_MAX_PANELS]; /* Register address and data of each row, for every panel */
+	unsigned char ControlTxBuf[2 * SPI_LED_MAX_PANELS]; /* Control register write, for every panel */
+	unsigned char FrameRxBuf[SPI_LED_FRAME_BUFFERS][SPI_LED_ROWS][2 * SPI_LED_MAX_PANELS] ____cacheline_aligned; /* Receive buffers, not used by the display */
+	unsigned char ControlRxBuf[2 * SPI_LED_MAX_PANELS];
+}SpiLedDmaType;
+
+struct SpiLedDevTag;
+
+/* Message and transfers of one frame */
+typedef struct SpiLedFrameBufTag
+{
+	struct spi_message Message; /* Message carrying the rows of the frame */
+	struct spi_transfer Transfer[SPI_LED_ROWS]; /* One transfer per digit register */
+	unsigned char (*TxBuf)[2 * SPI_LED_MAX_PANELS]; /* Rows of this buffer in the DMA memory */
+	bool Busy; /* Submitted with spi_async and not completed yet */
+	struct SpiLedDevTag *Device; /* Owner, for the completion callback */
+}SpiLedFrameBufType;
+
+/* One queued display sequence */
+typedef struct SpiLedSequenceTag
+{
+	SpiLedBankType *Bank; /* Bank holding the patterns */
+	const __u16 (*Step)[2]; /* Steps to be played, Inline or a bank sequence */
+	unsigned int StepCount; /* Number of steps */
+	__u16 Inline[SPI_LED_SEQUENCE_LENGTH][2]; /* Copy of a sequence given by write() */
+}SpiLedSequenceType;
+
+/*
+ * Event counters of the display. The display thread, write(), ioctl() and
+ * the spi completion all count, so every cpu counts in its own copy without
+ * a lock or an atomic operation, and the readers add the copies up.
+ */
+typedef enum SpiLedCounter_Tag {
+	SPI_LED_CNT_FRAMES, /* Frames sent to the display */
+	SPI_LED_CNT_SPI_CALLS, /* spi_sync and spi_async calls issued for these frames */
+	SPI_LED_CNT_FRAMES_ASYNC, /* Frames sent with spi_async */
+	SPI_LED_CNT_ASYNC_ERRORS, /* Asynchronous frames completed with an error */
+	SPI_LED_CNT_ASYNC_WAITS, /* Frames that had to wait for their buffer */
+	SPI_LED_CNT_ROWS_SENT, /* Rows transmitted */
+	SPI_LED_CNT_ROWS_SKIPPED, /* Rows not transmitted because they were unchanged */
+	SPI_LED_CNT_FRAMES_SKIPPED, /* Frames not transmitted at all */
+	SPI_LED_CNT_SEQUENCES_QUEUED, /* Sequences accepted by write() */
+	SPI_LED_CNT_SEQUENCES_PLAYED, /* Sequences completed by the display thread */
+	SPI_LED_CNT_QUEUE_DROPS, /* Sequences rejected because the queue was full */
+	SPI_LED_CNT_FRAMES_SCHEDULED, /* Frames sent on a deadline */
+	SPI_LED_COUNTERS
+}SpiLedCounter_Type;
+
+/* Names of the counters in debugfs, in SpiLedCounter_Type order */
+static const char *const SpiLedCounterNames[SPI_LED_COUNTERS] = {
+	"frames", "spi_calls", "frames_async", "async_errors", "async_waits", "rows_sent",
+	"rows_skipped", "frames_skipped", "sequences_queued", "sequences_played", "queue_drops",
+	"frames_scheduled"
+};
+
+/* Copy of the counters of one cpu */
+typedef struct SpiLedCountersTag
+{
+	unsigned long Count[SPI_LED_COUNTERS]; /* Indexed by SpiLedCounter_Type */
+}SpiLedCountersType;
+
+#define SPI_LED_COUNT(Device, Counter) this_cpu_inc((Device)->Counters->Count[Counter])
+#define SPI_LED_COUNT_ADD(Device, Counter, Value) this_cpu_add((Device)->Counters->Count[Counter],(Value))
+
 typedef struct SpiLedDevTag
 {
 	struct cdev cdev; /* cdev structure */
 	char name[DEVICE_NAME_LENGTH];   /* Driver Name*/
-	unsigned char Pattern[10][8]; /* Display pattern */
-	unsigned short Sequence[10][2]; /* Display pattern */
-	struct mutex DisplayCompleteFlagMutex; /* Mutex to protect Display complete flag */
-	volatile DisplayOperation_Type DisplayCompleteFlag; /* Flag to accept new sequence */
+	SpiLedBankType Bank[SPI_LED_MAX_BANKS]; /* Pattern banks indexed by handle */
+	struct mutex BankMutex; /* Protects bank allocation */
+	unsigned long BankPoolUsed; /* Bytes allocated to banks other than the default one */
+	SpiLedSequenceType Queue[SPI_LED_QUEUE_SIZE]; /* Sequences waiting for the display thread */
+	unsigned int QueueHead; /* Next free slot, written only by write() */
+	unsigned int QueueTail; /* Slot on display, written only by the display thread */
+	struct mutex QueueWriteMutex; /* Serialises writers so the queue has a single producer */
+	wait_queue_head_t DisplayWaitQueue; /* Display thread waits here for new sequences */
+	wait_queue_head_t SequenceDoneWaitQueue; /* read() and poll() wait here for the display thread */
+	unsigned int QueueMaxDepth; /* Highest queue depth seen */
+	u64 EnqueueLatencyLastNs; /* Time spent in the last successful write() */
+	u64 EnqueueLatencyMaxNs; /* Longest write() */
+	u64 EnqueueLatencyTotalNs; /* Sum over all successful write() calls */
+	ktime_t SequenceEnd; /* Deadline at which the last played sequence ended */
+	u64 FrameLatenessLastNs; /* How late the last frame was sent */
+	u64 FrameLatenessMaxNs; /* Worst lateness seen */
+	u64 FrameLatenessTotalNs; /* Sum of the lateness of all frames */
+	unsigned long JitterHistogram[SPI_LED_JITTER_BUCKETS]; /* Frame lateness histogram */
 	struct spi_message SpiLedMessage; /* Spi message structure required by the spi core */
 	struct spi_transfer SpiLedTransfer; /* Spi transfer structure required by the spi core */
+	SpiLedDmaType *Dma; /* Transfer buffers */
+	SpiLedFrameBufType FrameBuf[SPI_LED_FRAME_BUFFERS]; /* Frame messages, used in turn */
+	unsigned int FrameBufIndex; /* Buffer for the next frame */
+	wait_queue_head_t FrameDoneWaitQueue; /* Woken when an asynchronous frame completes */
+	atomic_t FramesInFlight; /* Frames given to spi_async and not completed */
+	atomic_t AsyncFailed; /* An asynchronous frame failed, the shadow cannot be trusted */
+	unsigned int InFlightMax; /* Most frames in flight at once */
+	u64 AsyncWaitLastNs; /* Last wait for a buffer */
+	u64 AsyncWaitMaxNs; /* Longest wait for a buffer */
+	u64 AsyncWaitTotalNs; /* Sum of all the waits for a buffer */
+	unsigned long FramesPerSecond; /* Frame rate measured over the last window */
+	unsigned long FrameRateCount; /* Frames sent in the current window */
+	ktime_t FrameRateStart; /* Start of the current frame rate window */
+	unsigned char ShadowFrame[SPI_LED_MAX_PANELS][SPI_LED_ROWS]; /* Digit registers as last written to the panels */
+	bool ShadowValid; /* Shadow matches the display */
+	SpiLedCountersType __percpu *Counters; /* Event counters, a copy per cpu */
 }SpiLedDevType;
 
 
@@ -85,78 +257,852 @@ static SpiLedDevType *SpiLedDevMem = NULL;
 /* Device number alloted */
 static dev_t SpiLedDevNumber;
 
-/* Create class and device which are required for udev */
-struct class *SpiLedDevClass;
-static struct device *SpiLedDevName;
+/* Create class and device which are required for udev */
+struct class *SpiLedDevClass;
+static struct device *SpiLedDevName;
+
+/* the variable that contains the thread data */
+static struct task_struct *PatternDisplayTask = NULL;
+
+/* debugfs directory holding the display statistics */
+static struct dentry *SpiLedDebugDir = NULL;
+
+/*
+ * Send a whole frame as one spi message. When cleared, every row goes out
+ * in its own message as before, which is useful to compare the two paths.
+ */
+static bool FrameBatching = 1;
+module_param(FrameBatching, bool, 0644);
+MODULE_PARM_DESC(FrameBatching, "Send the 8 rows of a frame in a single spi message");
+
+/*
+ * Hand frames to spi_async and return to the display thread at once. The
+ * next frame is built in the other buffer while this one is on the bus.
+ * Only the batched frame path is asynchronous.
+ */
+static bool AsyncMode = 1;
+module_param(AsyncMode, bool, 0644);
+MODULE_PARM_DESC(AsyncMode, "Send batched frames with spi_async instead of spi_sync");
+
+/*
+ * Number of MAX7219 panels daisy chained on the chip select. A frame is
+ * PanelCount consecutive patterns, pattern n + i is shown on panel i.
+ * Panel 0 is the one connected to the controller.
+ */
+static unsigned int PanelCount = 1;
+module_param(PanelCount, uint, 0444);
+MODULE_PARM_DESC(PanelCount, "Number of chained MAX7219 panels, 1 to " __stringify(SPI_LED_MAX_PANELS));
+
+/*
+ * Only send the rows that differ from what the display already shows
+ */
+static bool DirtyRowSkip = 1;
+module_param(DirtyRowSkip, bool, 0644);
+MODULE_PARM_DESC(DirtyRowSkip, "Skip rows that are unchanged since the previous frame");
+
+/*
+ * Number of sequences that may be pending, counting the one on display.
+ * Every extra sequence makes the animation more tolerant to a late writer
+ * but also delays the reaction to a new sequence by one sequence length.
+ */
+static unsigned int SequenceQueueLimit = 2;
+module_param(SequenceQueueLimit, uint, 0644);
+MODULE_PARM_DESC(SequenceQueueLimit, "Pending sequences accepted by write(), 1 to " __stringify(SPI_LED_QUEUE_SIZE));
+
+/*
+ * This will point to local kmalloc structure
+ */
+struct spi_device *SpiLedDevice = NULL;
+struct spi_device_id SpiLedDeviceID[] = {
+	{"spidev",0},
+	{}
+	};
+	
+/*
+ * Unit of the display time of a sequence step in micro seconds. The
+ * default keeps the time in milli seconds, smaller units allow sub milli
+ * second frames for smooth scrolling.
+ */
+static unsigned int FrameTimeUnitUs = 1000;
+module_param(FrameTimeUnitUs, uint, 0644);
+MODULE_PARM_DESC(FrameTimeUnitUs, "Unit of the sequence display time in us (default 1000)");
+
+/*
+ * Memory the driver may hand out to pattern banks
+ */
+static unsigned int BankPoolKb = 512;
+module_param(BankPoolKb, uint, 0644);
+MODULE_PARM_DESC(BankPoolKb, "Memory available for pattern banks in kB (default 512)");
+
+/* *********************************************************************
+ * NAME:             SpiLedBankCreate
+ * CALLED BY:        SpiLedDriverInit, SpiLedDriverIoctl
+ * DESCRIPTION:      Allocates the memory of a bank. Must be called with
+ *                   BankMutex held, except during driver initialization
+ * INPUT PARAMETERS: Bank : free bank slot
+ *                   PatternCount : number of patterns
+ *                   SequenceLength : number of sequence steps
+ *                   Owner : file owning the bank, NULL for the default bank
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int SpiLedBankCreate(SpiLedBankType *Bank, unsigned int PatternCount,
+                            unsigned int SequenceLength, struct file *Owner)
+{
+	Bank->Size = SPI_LED_BANK_SIZE(PatternCount,SequenceLength);
+	/* Page aligned and zeroed so that it can be mapped */
+	Bank->Memory = vmalloc_user(PAGE_ALIGN(Bank->Size));
+	if (NULL == Bank->Memory)
+	{
+		return -ENOMEM;
+	}
+	Bank->PatternCount = PatternCount;
+	Bank->SequenceLength = SequenceLength;
+	Bank->Pattern = Bank->Memory;
+	Bank->Sequence = (__u16 (*)[2])((char *)Bank->Memory + SPI_LED_BANK_SEQUENCE_OFFSET(PatternCount));
+	atomic_set(&(Bank->Pending),0);
+	Bank->Owner = Owner;
+	Bank->Orphan = 0;
+	Bank->InUse = 1;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedBankDestroy
+ * CALLED BY:        Bank owners and the display thread
+ * DESCRIPTION:      Frees the memory of a bank and its handle. Must be
+ *                   called with BankMutex held, except during driver exit
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Bank : bank to be freed
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedBankDestroy(SpiLedDevType *Device, SpiLedBankType *Bank)
+{
+	if (Bank->Owner)
+	{
+		Device->BankPoolUsed -= PAGE_ALIGN(Bank->Size);
+	}
+	/* Pages still mapped by a process stay valid until it unmaps them */
+	vfree(Bank->Memory);
+	memset(Bank,0,sizeof(*Bank));
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedBankGet
+ * CALLED BY:        SpiLedBankIoctl, SpiLedDriverMmap
+ * DESCRIPTION:      Looks up a bank by handle for the file using it. A
+ *                   bank belongs to the file that allocated it, only the
+ *                   default bank is shared. Must be called with
+ *                   BankMutex held
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Handle : bank handle
+ *                   File : file of the caller
+ *                   Bank : set to the bank
+ * RETURN VALUES:    int : status - -EINVAL for an invalid handle, -EPERM
+ *                   for the bank of another file/Pass(0)
+ ***********************************************************************/
+static int SpiLedBankGet(SpiLedDevType *Device, unsigned long Handle, struct file *File, SpiLedBankType **Bank)
+{
+	if ((Handle >= SPI_LED_MAX_BANKS) || !(Device->Bank[Handle].InUse) || (Device->Bank[Handle].Orphan))
+	{
+		return -EINVAL;
+	}
+	if ((Device->Bank[Handle].Owner) && (Device->Bank[Handle].Owner != File))
+	{
+		return -EPERM;
+	}
+	*Bank = &(Device->Bank[Handle]);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedDisplayStatus
+ * CALLED BY:        Driver file operations
+ * DESCRIPTION:      The display is free once every queued sequence has
+ *                   been played
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    DisplayOperation_Type : FREE / ONGOING
+ ***********************************************************************/
+static DisplayOperation_Type SpiLedDisplayStatus(SpiLedDevType *Device)
+{
+	return (ACCESS_ONCE(Device->QueueHead) == ACCESS_ONCE(Device->QueueTail)) ? FREE : ONGOING;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedQueueHasSpace
+ * CALLED BY:        SpiLedQueueReserve, SpiLedDriverPoll
+ * DESCRIPTION:      Tells whether one more sequence can be queued
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    bool : 1 if the queue is below SequenceQueueLimit
+ ***********************************************************************/
+static bool SpiLedQueueHasSpace(SpiLedDevType *Device)
+{
+	unsigned int Limit = clamp_t(unsigned int,SequenceQueueLimit,1,SPI_LED_QUEUE_SIZE);
+
+	return ((ACCESS_ONCE(Device->QueueHead) - ACCESS_ONCE(Device->QueueTail)) < Limit);
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedFrameInit
+ * CALLED BY:        SpiLedDriverInit
+ * DESCRIPTION:      Prepares the per row transfers used by the frame path
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedFrameInit(SpiLedDevType *Device)
+{
+	SpiLedFrameBufType *Buffer;
+	unsigned char LoopIndex, BufIndex;
+
+	for (BufIndex = 0; BufIndex < SPI_LED_FRAME_BUFFERS; BufIndex++)
+	{
+		Buffer = &(Device->FrameBuf[BufIndex]);
+		Buffer->TxBuf = Device->Dma->FrameTxBuf[BufIndex];
+		Buffer->Device = Device;
+		for (LoopIndex = 0; LoopIndex < SPI_LED_ROWS; LoopIndex++)
+		{
+			Buffer->Transfer[LoopIndex].tx_buf = &(Device->Dma->FrameTxBuf[BufIndex][LoopIndex][0]);
+			Buffer->Transfer[LoopIndex].rx_buf = &(Device->Dma->FrameRxBuf[BufIndex][LoopIndex][0]);
+			Buffer->Transfer[LoopIndex].len = 2 * PanelCount;
+			Buffer->Transfer[LoopIndex].bits_per_word = 8;
+			Buffer->Transfer[LoopIndex].speed_hz = SPI_LED_SPEED_HZ;
+		}
+	}
+	init_waitqueue_head(&(Device->FrameDoneWaitQueue));
+	atomic_set(&(Device->FramesInFlight),0);
+	atomic_set(&(Device->AsyncFailed),0);
+	Device->SpiLedTransfer.tx_buf = &(Device->Dma->ControlTxBuf[0]);
+	Device->SpiLedTransfer.rx_buf = &(Device->Dma->ControlRxBuf[0]);
+	Device->SpiLedTransfer.len = 2 * PanelCount;
+	Device->SpiLedTransfer.cs_change = 1;
+	Device->SpiLedTransfer.bits_per_word = 8;
+	Device->SpiLedTransfer.speed_hz = SPI_LED_SPEED_HZ;
+	Device->FrameRateStart = ktime_get();
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedPackRow
+ * CALLED BY:        SpiLedSendFrame
+ * DESCRIPTION:      Builds the 2 * PanelCount byte transfer that writes one
+ *                   digit register of every chained panel. The bytes sent
+ *                   first are shifted through to the last panel, so the
+ *                   last panel comes first and panel 0 last:
+ *                   Row+1, Frame[N-1][Row], ..., Row+1, Frame[0][Row]
+ * INPUT PARAMETERS: TxBuf : transfer buffer of 2 * Panels bytes
+ *                   Frame : Panels patterns of eight rows
+ *                   Row : digit register index 0-7
+ *                   Panels : number of chained panels
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedPackRow(unsigned char *TxBuf, const unsigned char (*Frame)[SPI_LED_ROWS],
+                          unsigned char Row, unsigned int Panels)
+{
+	unsigned int Panel;
+
+	for (Panel = 0; Panel < Panels; Panel++)
+	{
+		TxBuf[2 * (Panels - 1 - Panel)] = Row + 1;
+		TxBuf[(2 * (Panels - 1 - Panel)) + 1] = Frame[Panel][Row];
+	}
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedSendControl
+ * CALLED BY:        SpiLedDriverOpen
+ * DESCRIPTION:      Writes the same value to a register of every panel
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Register : MAX7219 register address
+ *                   Data : value to be written
+ * RETURN VALUES:    int : status of spi_sync - Fail/Pass(0)
+ ***********************************************************************/
+static int SpiLedSendControl(SpiLedDevType *Device, unsigned char Register, unsigned char Data)
+{
+	unsigned int Panel;
+	int Ret;
+
+	for (Panel = 0; Panel < PanelCount; Panel++)
+	{
+		Device->Dma->ControlTxBuf[2 * Panel] = Register;
+		Device->Dma->ControlTxBuf[(2 * Panel) + 1] = Data;
+	}
+	SPI_MESSAGE_SEND();
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedFrameComplete
+ * CALLED BY:        spi-core, when an asynchronous frame has been sent
+ * DESCRIPTION:      Hands the frame buffer back to the display thread
+ * INPUT PARAMETERS: Context : frame buffer of the message
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedFrameComplete(void *Context)
+{
+	SpiLedFrameBufType *Buffer = Context;
+	SpiLedDevType *Device = Buffer->Device;
+
+	trace_spi_led_spi_complete(&(Buffer->Message),Buffer->Message.status);
+	if (Buffer->Message.status)
+	{
+		SPI_LED_COUNT(Device,SPI_LED_CNT_ASYNC_ERRORS);
+		atomic_set(&(Device->AsyncFailed),1);
+	}
+	/* The buffer may be refilled as soon as Busy is seen cleared */
+	smp_wmb();
+	ACCESS_ONCE(Buffer->Busy) = 0;
+	atomic_dec(&(Device->FramesInFlight));
+	wake_up(&(Device->FrameDoneWaitQueue));
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedFrameDrain
+ * CALLED BY:        SpiLedDriverExit
+ * DESCRIPTION:      Waits for every asynchronous frame to complete, so
+ *                   that the buffers can be freed
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedFrameDrain(SpiLedDevType *Device)
+{
+	wait_event(Device->FrameDoneWaitQueue,0 == atomic_read(&(Device->FramesInFlight)));
+	/* The last callback may still be inside wake_up, wait for it to leave */
+	spin_lock_irq(&(Device->FrameDoneWaitQueue.lock));
+	spin_unlock_irq(&(Device->FrameDoneWaitQueue.lock));
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedSendFrame
+ * CALLED BY:        SpiLedDisplayThread
+ * DESCRIPTION:      Writes the digit registers of a frame. Only the rows
+ *                   that differ from the shadow copy of the display are
+ *                   sent, and nothing at all if the frame is unchanged.
+ *                   With FrameBatching the rows are chained in one message
+ *                   and the chip select is toggled between them so that
+ *                   the MAX7219 latches every row, otherwise each row is
+ *                   sent with its own spi_sync. With chained panels a row
+ *                   transfer carries that row for all the panels, so a
+ *                   frame costs at most eight transfers for any PanelCount.
+ *                   In AsyncMode the batched message is given to spi_async
+ *                   and the frame is built in the other buffer next time,
+ *                   waiting only if that buffer is still on the bus
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Frame : PanelCount patterns of eight rows
+ * RETURN VALUES:    int : status - Fail/Pass(0), for an asynchronous
+ *                   frame the status of the submission
+ ***********************************************************************/
+static int SpiLedSendFrame(SpiLedDevType *Device, const unsigned char (*Frame)[SPI_LED_ROWS])
+{
+	SpiLedFrameBufType *Buffer = &(Device->FrameBuf[Device->FrameBufIndex]);
+	unsigned char LoopIndex, DirtyCount = 0, LastDirty = 0;
+	unsigned char Dirty[SPI_LED_ROWS];
+	unsigned int Panel, InFlight;
+	bool Async = AsyncMode && FrameBatching;
+	ktime_t WaitStart;
+	int Ret = 0;
+	s64 WindowNs;
+	u64 WaitNs;
+
+	/* The rows cannot be written while the controller still reads them */
+	if (ACCESS_ONCE(Buffer->Busy))
+	{
+		WaitStart = ktime_get();
+		wait_event(Device->FrameDoneWaitQueue,!ACCESS_ONCE(Buffer->Busy));
+		WaitNs = ktime_to_ns(ktime_sub(ktime_get(),WaitStart));
+		SPI_LED_COUNT(Device,SPI_LED_CNT_ASYNC_WAITS);
+		Device->AsyncWaitLastNs = WaitNs;
+		Device->AsyncWaitTotalNs += WaitNs;
+		if (WaitNs > Device->AsyncWaitMaxNs)
+		{
+			Device->AsyncWaitMaxNs = WaitNs;
+		}
+	}
+	smp_rmb();
+
+	/* A failed asynchronous frame may have left the panel behind the shadow */
+	if (atomic_xchg(&(Device->AsyncFailed),0))
+	{
+		Device->ShadowValid = 0;
+	}
+
+	for (LoopIndex = 0; LoopIndex < SPI_LED_ROWS; LoopIndex++)
+	{
+		/* A row is sent if it changed on any of the panels */
+		Dirty[LoopIndex] = (!DirtyRowSkip) || (!Device->ShadowValid);
+		for (Panel = 0; (Panel < PanelCount) && !(Dirty[LoopIndex]); Panel++)
+		{
+			Dirty[LoopIndex] = (Device->ShadowFrame[Panel][LoopIndex] != Frame[Panel][LoopIndex]);
+		}
+		if (Dirty[LoopIndex])
+		{
+			SpiLedPackRow(&(Buffer->TxBuf[LoopIndex][0]),Frame,LoopIndex,PanelCount);
+			LastDirty = LoopIndex;
+			DirtyCount++;
+		}
+	}
+	SPI_LED_COUNT_ADD(Device,SPI_LED_CNT_ROWS_SENT,DirtyCount);
+	SPI_LED_COUNT_ADD(Device,SPI_LED_CNT_ROWS_SKIPPED,SPI_LED_ROWS - DirtyCount);
+
+	if (0 == DirtyCount)
+	{
+		/* Panel already shows this frame */
+		SPI_LED_COUNT(Device,SPI_LED_CNT_FRAMES_SKIPPED);
+	}
+	else if (FrameBatching)
+	{
+		spi_message_init(&(Buffer->Message));
+		for (LoopIndex = 0; LoopIndex < SPI_LED_ROWS; LoopIndex++)
+		{
+			if (Dirty[LoopIndex])
+			{
+				/* Release cs after every row except the last one, the end of message does that */
+				Buffer->Transfer[LoopIndex].cs_change = (LoopIndex != LastDirty);
+				spi_message_add_tail(&(Buffer->Transfer[LoopIndex]),&(Buffer->Message));
+			}
+		}
+		if (Async)
+		{
+			Buffer->Message.complete = SpiLedFrameComplete;
+			Buffer->Message.context = Buffer;
+			Buffer->Busy = 1;
+			InFlight = atomic_inc_return(&(Device->FramesInFlight));
+			if (InFlight > Device->InFlightMax)
+			{
+				Device->InFlightMax = InFlight;
+			}
+			trace_spi_led_spi_submit(&(Buffer->Message),DirtyCount,1);
+			Ret = spi_async(SpiLedDevice,&(Buffer->Message));
+			if (Ret)
+			{
+				/* Not queued, the callback will not run */
+				trace_spi_led_spi_complete(&(Buffer->Message),Ret);
+				Buffer->Busy = 0;
+				atomic_dec(&(Device->FramesInFlight));
+			}
+			else
+			{
+				SPI_LED_COUNT(Device,SPI_LED_CNT_FRAMES_ASYNC);
+				Device->FrameBufIndex = (Device->FrameBufIndex + 1) % SPI_LED_FRAME_BUFFERS;
+			}
+		}
+		else
+		{
+			trace_spi_led_spi_submit(&(Buffer->Message),DirtyCount,0);
+			Ret = spi_sync(SpiLedDevice,&(Buffer->Message));
+			trace_spi_led_spi_complete(&(Buffer->Message),Ret);
+		}
+		SPI_LED_COUNT(Device,SPI_LED_CNT_SPI_CALLS);
+	}
+	else
+	{
+		for (LoopIndex = 0; (LoopIndex < SPI_LED_ROWS) && (0 == Ret); LoopIndex++)
+		{
+			if (Dirty[LoopIndex])
+			{
+				Buffer->Transfer[LoopIndex].cs_change = 1;
+				spi_message_init(&(Buffer->Message));
+				spi_message_add_tail(&(Buffer->Transfer[LoopIndex]),&(Buffer->Message));
+				trace_spi_led_spi_submit(&(Buffer->Message),1,0);
+				Ret = spi_sync(SpiLedDevice,&(Buffer->Message));
+				trace_spi_led_spi_complete(&(Buffer->Message),Ret);
+				SPI_LED_COUNT(Device,SPI_LED_CNT_SPI_CALLS);
+			}
+		}
+	}
+
+	/*
+	 * The shadow is only trusted if the panel really received the rows. An
+	 * asynchronous frame is assumed to arrive, its callback says otherwise.
+	 */
+	if (0 == Ret)
+	{
+		memcpy(&(Device->ShadowFrame[0][0]),&(Frame[0][0]),PanelCount * SPI_LED_ROWS);
+		Device->ShadowValid = 1;
+	}
+	else
+	{
+		Device->ShadowValid = 0;
+	}
+
+	/* Frame statistics, the rate is latched once every second */
+	SPI_LED_COUNT(Device,SPI_LED_CNT_FRAMES);
+	Device->FrameRateCount++;
+	WindowNs = ktime_to_ns(ktime_sub(ktime_get(),Device->FrameRateStart));
+	if (WindowNs >= NSEC_PER_SEC)
+	{
+		Device->FramesPerSecond = div64_u64((u64)Device->FrameRateCount * NSEC_PER_SEC,WindowNs);
+		Device->FrameRateCount = 0;
+		Device->FrameRateStart = ktime_get();
+	}
+	trace_spi_led_frame_end(DirtyCount,Ret);
+	return Ret;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedCounterRead
+ * CALLED BY:        SpiLedStatsShow
+ * DESCRIPTION:      Adds up the copies of a counter of every cpu. A copy
+ *                   may be counting meanwhile, the sum is a snapshot
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Counter : counter to be read
+ * RETURN VALUES:    unsigned long : events counted on all cpus
+ ***********************************************************************/
+static unsigned long SpiLedCounterRead(SpiLedDevType *Device, SpiLedCounter_Type Counter)
+{
+	unsigned long Sum = 0;
+	int Cpu;
+
+	for_each_possible_cpu(Cpu)
+	{
+		Sum += ACCESS_ONCE(per_cpu_ptr(Device->Counters,Cpu)->Count[Counter]);
+	}
+	return Sum;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedStatsShow
+ * CALLED BY:        seq_file core on read of debugfs spi_led/stats
+ * DESCRIPTION:      Prints the display statistics
+ * INPUT PARAMETERS: File : seq file
+ *                   Unused : not used
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int SpiLedStatsShow(struct seq_file *File, void *Unused)
+{
+	SpiLedDevType *Device = File->private;
+	unsigned long Count[SPI_LED_COUNTERS];
+	unsigned long CallsPerFrame100 = 0;
+	unsigned int Counter;
+
+	for (Counter = 0; Counter < SPI_LED_COUNTERS; Counter++)
+	{
+		Count[Counter] = SpiLedCounterRead(Device,Counter);
+	}
+	if (Count[SPI_LED_CNT_FRAMES])
+	{
+		CallsPerFrame100 = (Count[SPI_LED_CNT_SPI_CALLS] * 100) / Count[SPI_LED_CNT_FRAMES];
+	}
+	seq_printf(File,"panel_count: %u\n",PanelCount);
+	seq_printf(File,"frame_batching: %d\n",FrameBatching);
+	seq_printf(File,"frames: %lu\n",Count[SPI_LED_CNT_FRAMES]);
+	seq_printf(File,"spi_calls: %lu\n",Count[SPI_LED_CNT_SPI_CALLS]);
+	seq_printf(File,"spi_calls_per_frame: %lu.%02lu\n",CallsPerFrame100 / 100,CallsPerFrame100 % 100);
+	seq_printf(File,"frames_per_second: %lu\n",Device->FramesPerSecond);
+	seq_printf(File,"async_mode: %d\n",AsyncMode);
+	seq_printf(File,"frames_async: %lu\n",Count[SPI_LED_CNT_FRAMES_ASYNC]);
+	seq_printf(File,"frames_in_flight: %d\n",atomic_read(&(Device->FramesInFlight)));
+	seq_printf(File,"frames_in_flight_max: %u\n",Device->InFlightMax);
+	seq_printf(File,"async_errors: %lu\n",Count[SPI_LED_CNT_ASYNC_ERRORS]);
+	seq_printf(File,"async_waits: %lu\n",Count[SPI_LED_CNT_ASYNC_WAITS]);
+	seq_printf(File,"async_wait_last_ns: %llu\n",Device->AsyncWaitLastNs);
+	seq_printf(File,"async_wait_max_ns: %llu\n",Device->AsyncWaitMaxNs);
+	seq_printf(File,"async_wait_total_ns: %llu\n",Device->AsyncWaitTotalNs);
+	seq_printf(File,"dirty_row_skip: %d\n",DirtyRowSkip);
+	seq_printf(File,"rows_sent: %lu\n",Count[SPI_LED_CNT_ROWS_SENT]);
+	seq_printf(File,"rows_skipped: %lu\n",Count[SPI_LED_CNT_ROWS_SKIPPED]);
+	seq_printf(File,"frames_skipped: %lu\n",Count[SPI_LED_CNT_FRAMES_SKIPPED]);
+	seq_printf(File,"queue_depth: %u\n",ACCESS_ONCE(Device->QueueHead) - ACCESS_ONCE(Device->QueueTail));
+	seq_printf(File,"queue_max_depth: %u\n",Device->QueueMaxDepth);
+	seq_printf(File,"queue_limit: %u\n",SequenceQueueLimit);
+	seq_printf(File,"sequences_queued: %lu\n",Count[SPI_LED_CNT_SEQUENCES_QUEUED]);
+	seq_printf(File,"sequences_played: %lu\n",Count[SPI_LED_CNT_SEQUENCES_PLAYED]);
+	seq_printf(File,"queue_drops: %lu\n",Count[SPI_LED_CNT_QUEUE_DROPS]);
+	seq_printf(File,"enqueue_latency_last_ns: %llu\n",Device->EnqueueLatencyLastNs);
+	seq_printf(File,"enqueue_latency_max_ns: %llu\n",Device->EnqueueLatencyMaxNs);
+	seq_printf(File,"enqueue_latency_avg_ns: %llu\n",(Count[SPI_LED_CNT_SEQUENCES_QUEUED]) ?
+	           div64_u64(Device->EnqueueLatencyTotalNs,Count[SPI_LED_CNT_SEQUENCES_QUEUED]) : 0);
+	seq_printf(File,"bank_pool_used_bytes: %lu\n",Device->BankPoolUsed);
+	seq_printf(File,"bank_pool_size_bytes: %lu\n",(unsigned long)BankPoolKb * 1024);
+	seq_printf(File,"frame_time_unit_us: %u\n",FrameTimeUnitUs);
+	seq_printf(File,"frames_scheduled: %lu\n",Count[SPI_LED_CNT_FRAMES_SCHEDULED]);
+	seq_printf(File,"frame_lateness_last_ns: %llu\n",Device->FrameLatenessLastNs);
+	seq_printf(File,"frame_lateness_max_ns: %llu\n",Device->FrameLatenessMaxNs);
+	seq_printf(File,"frame_lateness_avg_ns: %llu\n",(Count[SPI_LED_CNT_FRAMES_SCHEDULED]) ?
+	           div64_u64(Device->FrameLatenessTotalNs,Count[SPI_LED_CNT_FRAMES_SCHEDULED]) : 0);
+	return 0;
+}
+
+static int SpiLedStatsOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,SpiLedStatsShow,inode->i_private);
+}
+
+static const struct file_operations SpiLedStatsFops = {
+	.owner = THIS_MODULE,
+	.open = SpiLedStatsOpen,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* *********************************************************************
+ * NAME:             SpiLedCountersShow
+ * CALLED BY:        seq_file core on read of debugfs spi_led/counters
+ * DESCRIPTION:      Prints every event counter with the count of each cpu
+ *                   and the total
+ * INPUT PARAMETERS: File : seq file
+ *                   Unused : not used
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int SpiLedCountersShow(struct seq_file *File, void *Unused)
+{
+	SpiLedDevType *Device = File->private;
+	unsigned int Counter;
+	unsigned long Value;
+	int Cpu;
+
+	seq_printf(File,"%-20s","counter");
+	for_each_possible_cpu(Cpu)
+	{
+		seq_printf(File," cpu%-8d",Cpu);
+	}
+	seq_printf(File," total\n");
+	for (Counter = 0; Counter < SPI_LED_COUNTERS; Counter++)
+	{
+		seq_printf(File,"%-20s",SpiLedCounterNames[Counter]);
+		for_each_possible_cpu(Cpu)
+		{
+			Value = ACCESS_ONCE(per_cpu_ptr(Device->Counters,Cpu)->Count[Counter]);
+			seq_printf(File," %-11lu",Value);
+		}
+		seq_printf(File," %lu\n",SpiLedCounterRead(Device,Counter));
+	}
+	return 0;
+}
+
+static int SpiLedCountersOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,SpiLedCountersShow,inode->i_private);
+}
+
+static const struct file_operations SpiLedCountersFops = {
+	.owner = THIS_MODULE,
+	.open = SpiLedCountersOpen,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* *********************************************************************
+ * NAME:             SpiLedJitterShow
+ * CALLED BY:        seq_file core on read of debugfs spi_led/jitter
+ * DESCRIPTION:      Prints the histogram of frame lateness, one line per
+ *                   bucket with its range in micro seconds
+ * INPUT PARAMETERS: File : seq file
+ *                   Unused : not used
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int SpiLedJitterShow(struct seq_file *File, void *Unused)
+{
+	SpiLedDevType *Device = File->private;
+	unsigned char LoopIndex;
+
+	seq_printf(File,"%10s %10s %10s\n","from_us","to_us","frames");
+	for (LoopIndex = 0; LoopIndex < SPI_LED_JITTER_BUCKETS; LoopIndex++)
+	{
+		if (LoopIndex < (SPI_LED_JITTER_BUCKETS - 1))
+		{
+			seq_printf(File,"%10lu %10lu %10lu\n",(LoopIndex) ? (1UL << (LoopIndex - 1)) : 0UL,
+			           1UL << LoopIndex,Device->JitterHistogram[LoopIndex]);
+		}
+		else
+		{
+			seq_printf(File,"%10lu %10s %10lu\n",1UL << (LoopIndex - 1),"-",Device->JitterHistogram[LoopIndex]);
+		}
+	}
+	return 0;
+}
+
+static int SpiLedJitterOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,SpiLedJitterShow,inode->i_private);
+}
+
+static const struct file_operations SpiLedJitterFops = {
+	.owner = THIS_MODULE,
+	.open = SpiLedJitterOpen,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* *********************************************************************
+ * NAME:             SpiLedSleepUntil
+ * CALLED BY:        SpiLedPlaySequence
+ * DESCRIPTION:      Sleeps on a high resolution timer until the absolute
+ *                   deadline. Returns early only if the thread is stopped
+ * INPUT PARAMETERS: Deadline : absolute monotonic time to wake up at
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedSleepUntil(ktime_t Deadline)
+{
+	ktime_t Expires = Deadline;
+
+	if (ktime_compare(Deadline,ktime_get()) <= 0)
+	{
+		/* Already due, typically the first frame of a sequence */
+		return;
+	}
+	while (!kthread_should_stop())
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (0 == schedule_hrtimeout_range(&Expires,SPI_LED_TIMER_SLACK_NS,HRTIMER_MODE_ABS))
+		{
+			/* Timer expired */
+			break;
+		}
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedRecordLateness
+ * CALLED BY:        SpiLedPlaySequence
+ * DESCRIPTION:      Accounts how late a frame is sent with respect to its
+ *                   deadline
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Deadline : time the frame was due
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedRecordLateness(SpiLedDevType *Device, ktime_t Deadline)
+{
+	s64 LatenessNs = ktime_to_ns(ktime_sub(ktime_get(),Deadline));
+	u64 LatenessUs;
+	unsigned int Bucket;
 
-/* the variable that contains the thread data */
-static struct task_struct *PatternDisplayTask = NULL;
+	trace_spi_led_frame_start(ktime_to_ns(Deadline),LatenessNs);
+	if (LatenessNs < 0)
+	{
+		LatenessNs = 0;
+	}
+	LatenessUs = div_u64(LatenessNs,NSEC_PER_USEC);
+	Bucket = (LatenessUs) ? fls64(LatenessUs) : 0;
+	if (Bucket >= SPI_LED_JITTER_BUCKETS)
+	{
+		Bucket = SPI_LED_JITTER_BUCKETS - 1;
+	}
+	Device->JitterHistogram[Bucket]++;
+	SPI_LED_COUNT(Device,SPI_LED_CNT_FRAMES_SCHEDULED);
+	Device->FrameLatenessLastNs = LatenessNs;
+	Device->FrameLatenessTotalNs += LatenessNs;
+	if (LatenessNs > Device->FrameLatenessMaxNs)
+	{
+		Device->FrameLatenessMaxNs = LatenessNs;
+	}
+}
 
-/*
- * This will point to local kmalloc structure
- */
-struct spi_device *SpiLedDevice = NULL;
-struct spi_device_id SpiLedDeviceID[] = {
-	{"spidev",0},
-	{}
-	};
-	
 /* *********************************************************************
- * NAME:             SpiLedDisplayThread
- * CALLED BY:        Kernel after creating the lightweight process
- * DESCRIPTION:      This thread send the pattern to the display and sleeps 
- *                   for the specified amount of time indicated by the sequence
- * INPUT PARAMETERS: Device structure pointer
- * RETURN VALUES:    int : status - Fail/Pass(0)
+ * NAME:             SpiLedPlaySequence
+ * CALLED BY:        SpiLedDisplayThread
+ * DESCRIPTION:      Sends each pattern of the sequence to the display at
+ *                   its deadline. Frame n is due at Start plus the display
+ *                   times of the frames before it, so neither the spi
+ *                   transfer nor timer rounding adds up over a sequence.
+ *                   The display is cleared at the end of the sequence
+ *                   unless another sequence is already waiting to be played
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Sequence : sequence to be played
+ *                   Start : deadline of the first frame
+ * RETURN VALUES:    ktime_t : deadline at which the sequence ends
  ***********************************************************************/
-static int SpiLedDisplayThread(void *dev)
+static ktime_t SpiLedPlaySequence(SpiLedDevType *Device, const SpiLedSequenceType *Sequence, ktime_t Start)
 {
-	unsigned char LoopIndex1, LoopIndex2,EndSequence = 0;
-	unsigned char LedMessage[2] = {0x0F,0x01};
-	unsigned char LedMessageRecv[2];
-    SpiLedDevType *Device = dev;
-#ifdef DEBUG  
-    printk(KERN_INFO "/n Runnning SpiLedDisplay \n");
-#endif
-	 Device->SpiLedTransfer.tx_buf = &LedMessage[0];
-	 Device->SpiLedTransfer.rx_buf = &LedMessageRecv[0];
+	unsigned int LoopIndex1;
+	unsigned char EndSequence = 0;
+	unsigned short PatternNumber, FrameTime;
+	static const unsigned char BlankFrame[SPI_LED_MAX_PANELS][SPI_LED_ROWS];
+	ktime_t Deadline = Start;
 
     /* Transfer other patterns */
-    for (LoopIndex1 = 0; (LoopIndex1 < 10) && (0 == EndSequence); LoopIndex1++)
+    for (LoopIndex1 = 0; (LoopIndex1 < Sequence->StepCount) && (0 == EndSequence) && !kthread_should_stop(); LoopIndex1++)
     {
-		if ((Device->Sequence[LoopIndex1][0]) || (Device->Sequence[LoopIndex1][1]))
+		/* Bank sequences are user memory, read each step only once */
+		PatternNumber = ACCESS_ONCE(Sequence->Step[LoopIndex1][0]);
+		FrameTime = ACCESS_ONCE(Sequence->Step[LoopIndex1][1]);
+		if ((PatternNumber) || (FrameTime))
 		{
-			for (LoopIndex2 = 0; LoopIndex2 < 8; LoopIndex2++)
+			SpiLedSleepUntil(Deadline);
+			SpiLedRecordLateness(Device,Deadline);
+			/* The frame is PanelCount patterns wide */
+			if ((PatternNumber + PanelCount) <= Sequence->Bank->PatternCount)
 			{
-			   LedMessage[0] = LoopIndex2 + 1;
-			   LedMessage[1] = Device->Pattern[(Device->Sequence[LoopIndex1][0])][LoopIndex2];
-			   SPI_MESSAGE_SEND();
+				SpiLedSendFrame(Device,(const unsigned char (*)[SPI_LED_ROWS])&(Sequence->Bank->Pattern[PatternNumber][0]));
+			}
 #ifdef DEBUG
-		       printk(KERN_INFO "\n Display Frame %d written with %d",LedMessage[0],LedMessage[1]);
+		    printk(KERN_INFO "\n Display Frame %d written",PatternNumber);
 #endif
-			}
-			msleep((Device->Sequence[LoopIndex1][1]));
+			Deadline = ktime_add_us(Deadline,(u64)(FrameTime) * FrameTimeUnitUs);
 	    }
 	    else
 	    {
 			EndSequence = 1;
-			/* clear the display at the end of the sequence */
-			for(LoopIndex2 = 1;LoopIndex2 < 9;LoopIndex2++)
+			/* clear the display at the end of the sequence, the next one overwrites it anyway */
+			SpiLedSleepUntil(Deadline);
+			if ((ACCESS_ONCE(Device->QueueHead) - Device->QueueTail) <= 1)
 			{
-			   LedMessage[0] = LoopIndex2;
-			   LedMessage[1] = 0x00;
-			   SPI_MESSAGE_SEND();
+				SpiLedSendFrame(Device,BlankFrame);
 			}
 		}
 #ifdef DEBUG
 		printk("\n Frame %d is send to the display",LoopIndex1);
 #endif
 	}
-   /* Lock the mutex */
-    mutex_lock(&(Device->DisplayCompleteFlagMutex));
-	Device->DisplayCompleteFlag = FREE;
-    /* unlock the mutex and return */
-    mutex_unlock(&(Device->DisplayCompleteFlagMutex));
+	if (0 == EndSequence)
+	{
+		/* All steps used, hold the last frame for its full time */
+		SpiLedSleepUntil(Deadline);
+	}
+	return Deadline;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedDisplayThread
+ * CALLED BY:        Kernel after creating the lightweight process
+ * DESCRIPTION:      Long lived display thread. Consumes the sequences
+ *                   queued by write() one after the other. A sequence
+ *                   stays in its slot while it is displayed, so the queue
+ *                   depth includes the sequence on display
+ * INPUT PARAMETERS: Device structure pointer
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int SpiLedDisplayThread(void *dev)
+{
+    SpiLedDevType *Device = dev;
+    SpiLedSequenceType *Sequence;
+    unsigned int Tail;
+    ktime_t Start;
+    bool Chained;
+#ifdef DEBUG  
+    printk(KERN_INFO "/n Runnning SpiLedDisplay \n");
+#endif
+    while (!kthread_should_stop())
+    {
+		/* A sequence already waiting continues on the time line of the previous one */
+		Chained = (ACCESS_ONCE(Device->QueueHead) != Device->QueueTail);
+		wait_event_interruptible(Device->DisplayWaitQueue,
+		                         (ACCESS_ONCE(Device->QueueHead) != Device->QueueTail) || kthread_should_stop());
+		Tail = Device->QueueTail;
+		if (ACCESS_ONCE(Device->QueueHead) == Tail)
+		{
+			continue;
+		}
+		/* Read the slot only after seeing the head that published it */
+		smp_rmb();
+		Start = (Chained) ? (Device->SequenceEnd) : (ktime_get());
+		Sequence = &(Device->Queue[Tail & (SPI_LED_QUEUE_SIZE - 1)]);
+		Device->SequenceEnd = SpiLedPlaySequence(Device,Sequence,Start);
+		SPI_LED_COUNT(Device,SPI_LED_CNT_SEQUENCES_PLAYED);
+		/* Last use of a bank whose owner is gone frees it */
+		mutex_lock(&(Device->BankMutex));
+		if (atomic_dec_and_test(&(Sequence->Bank->Pending)) && (Sequence->Bank->Orphan))
+		{
+			SpiLedBankDestroy(Device,Sequence->Bank);
+		}
+		mutex_unlock(&(Device->BankMutex));
+		/* Finish with the slot before handing it back to write() */
+		smp_mb();
+		ACCESS_ONCE(Device->QueueTail) = Tail + 1;
+		/* The display may be idle now and the queue has room again */
+		wake_up_interruptible(&(Device->SequenceDoneWaitQueue));
+	}
     return 0;
 }
 
@@ -219,8 +1165,7 @@ static struct spi_driver SpiLedDriver = {
 int SpiLedDriverOpen(struct inode *inode, struct file *filept)
 {
 	SpiLedDevType *Device; /* dev pointer for the present device */
-	unsigned char LedMessage[2] = {0x0F,0x01};
-	unsigned char LedMessageRecv[2],LoopIndex;
+	unsigned char LoopIndex;
 #ifdef DEBUG
     printk(KERN_INFO "\n  Driver open was called \n\n ");
 #endif
@@ -229,7 +1174,7 @@ int SpiLedDriverOpen(struct inode *inode, struct file *filept)
 	/* stored to private data so that next time filept can be directly used */
 	filept->private_data = Device;
 	/* Test the display if the display is free */
-	if (FREE == SpiLedDevMem->DisplayCompleteFlag)
+	if (FREE == SpiLedDisplayStatus(SpiLedDevMem))
     {
 		/* Enable cs, mosi ans sck */
 		gpio_request_one(42,GPIOF_OUT_INIT_LOW,"SpiCsEnable");
@@ -240,42 +1185,24 @@ int SpiLedDriverOpen(struct inode *inode, struct file *filept)
 		gpio_set_value_cansleep(55,0);
 
 		/* Test the display */
-		/* Initiate the SPI message and transfer structure */
-		Device->SpiLedTransfer.tx_buf = &LedMessage[0];
-		Device->SpiLedTransfer.rx_buf = &LedMessageRecv[0];
-		Device->SpiLedTransfer.len = 2;
-		Device->SpiLedTransfer.cs_change = 1;
-		Device->SpiLedTransfer.bits_per_word = 8;
-		Device->SpiLedTransfer.speed_hz = 500000;
-
-        SPI_MESSAGE_SEND();
-		LedMessage[0] = 0x0F;
-		LedMessage[1] = 0x00;
-		SPI_MESSAGE_SEND();
-
+		SpiLedSendControl(Device,0x0F,0x01);
+		SpiLedSendControl(Device,0x0F,0x00);
 		/* Select No decode */
-		LedMessage[0] = 0x09;
-		LedMessage[1] = 0x00;
-		SPI_MESSAGE_SEND();
+		SpiLedSendControl(Device,0x09,0x00);
 		/* intensity level medium */
-		LedMessage[0] = 0x0A;
-		LedMessage[1] = 0x00;
-		SPI_MESSAGE_SEND();
+		SpiLedSendControl(Device,0x0A,0x00);
 		/* scan all the data register for displaying */
-		LedMessage[0] = 0x0B;
-		LedMessage[1] = 0x07;
-		SPI_MESSAGE_SEND();
+		SpiLedSendControl(Device,0x0B,0x07);
 		/* shutdown register - select normal operation */
-		LedMessage[0] = 0x0C;
-		LedMessage[1] = 0x01;
-		SPI_MESSAGE_SEND();
+		SpiLedSendControl(Device,0x0C,0x01);
 		/* clear the display */
 		for(LoopIndex = 1;LoopIndex < 9;LoopIndex++)
 		{
-		   LedMessage[0] = LoopIndex;
-		   LedMessage[1] = 0x00;
-		   SPI_MESSAGE_SEND();
+		   SpiLedSendControl(Device,LoopIndex,0x00);
 		}
+		/* Display is blank now, so is the shadow */
+		memset(&(Device->ShadowFrame[0][0]),0,sizeof(Device->ShadowFrame));
+		Device->ShadowValid = 1;
     }
 
 #ifdef DEBUG
@@ -296,131 +1223,462 @@ int SpiLedDriverOpen(struct inode *inode, struct file *filept)
 int SpiLedDriverRelease(struct inode *inode, struct file *filept)
 {
 	SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
+	unsigned int LoopIndex;
+
+	/* Free the banks of this file, queued ones once they have been played */
+	mutex_lock(&(dev->BankMutex));
+	for (LoopIndex = 1; LoopIndex < SPI_LED_MAX_BANKS; LoopIndex++)
+	{
+		if ((dev->Bank[LoopIndex].InUse) && (filept == dev->Bank[LoopIndex].Owner))
+		{
+			if (atomic_read(&(dev->Bank[LoopIndex].Pending)))
+			{
+				dev->Bank[LoopIndex].Orphan = 1;
+			}
+			else
+			{
+				SpiLedBankDestroy(dev,&(dev->Bank[LoopIndex]));
+			}
+		}
+	}
+	mutex_unlock(&(dev->BankMutex));
 	printk("\n%s is closing\n", dev->name);
 	return 0;
 }
 
+/* *********************************************************************
+ * NAME:             SpiLedQueueReserve
+ * CALLED BY:        SpiLedDriverWrite, SpiLedDriverIoctl
+ * DESCRIPTION:      Takes the producer lock and returns the free slot at
+ *                   the head of the sequence queue, cleared so that the
+ *                   steps not filled in end the sequence
+ * INPUT PARAMETERS: Device : device structure pointer
+ * RETURN VALUES:    SpiLedSequenceType * : slot to fill, NULL if the
+ *                   queue is full (the lock is released then)
+ ***********************************************************************/
+static SpiLedSequenceType *SpiLedQueueReserve(SpiLedDevType *Device)
+{
+	SpiLedSequenceType *Slot;
+
+	/* Only one producer may touch the head */
+	mutex_lock(&(Device->QueueWriteMutex));
+	if (!SpiLedQueueHasSpace(Device))
+	{
+		SPI_LED_COUNT(Device,SPI_LED_CNT_QUEUE_DROPS);
+		mutex_unlock(&(Device->QueueWriteMutex));
+		return NULL;
+	}
+	Slot = &(Device->Queue[Device->QueueHead & (SPI_LED_QUEUE_SIZE - 1)]);
+	memset(Slot,0,sizeof(*Slot));
+	/* By default the slot plays its inline copy with the default bank */
+	Slot->Bank = &(Device->Bank[0]);
+	Slot->Step = (const __u16 (*)[2])Slot->Inline;
+	Slot->StepCount = SPI_LED_SEQUENCE_LENGTH;
+	return Slot;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedQueuePublish
+ * CALLED BY:        SpiLedDriverWrite, SpiLedDriverIoctl
+ * DESCRIPTION:      Hands the reserved slot to the display thread, or
+ *                   gives it back if it could not be filled, and releases
+ *                   the producer lock
+ * INPUT PARAMETERS: Device : device structure pointer
+ *                   Filled : 1 if the slot holds a valid sequence
+ *                   StartTime : time the producer started, for statistics
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void SpiLedQueuePublish(SpiLedDevType *Device, bool Filled, ktime_t StartTime)
+{
+	unsigned int Head = Device->QueueHead, Depth;
+	SpiLedSequenceType *Slot = &(Device->Queue[Head & (SPI_LED_QUEUE_SIZE - 1)]);
+	u64 LatencyNs;
+
+	if (Filled)
+	{
+		atomic_inc(&(Slot->Bank->Pending));
+		Depth = Head + 1 - ACCESS_ONCE(Device->QueueTail);
+		/* Publish the slot contents before the new head */
+		smp_wmb();
+		ACCESS_ONCE(Device->QueueHead) = Head + 1;
+		SPI_LED_COUNT(Device,SPI_LED_CNT_SEQUENCES_QUEUED);
+		if (Depth > Device->QueueMaxDepth)
+		{
+			Device->QueueMaxDepth = Depth;
+		}
+		LatencyNs = ktime_to_ns(ktime_sub(ktime_get(),StartTime));
+		Device->EnqueueLatencyLastNs = LatencyNs;
+		Device->EnqueueLatencyTotalNs += LatencyNs;
+		if (LatencyNs > Device->EnqueueLatencyMaxNs)
+		{
+			Device->EnqueueLatencyMaxNs = LatencyNs;
+		}
+	}
+	mutex_unlock(&(Device->QueueWriteMutex));
+
+	if (Filled)
+	{
+		wake_up_interruptible(&(Device->DisplayWaitQueue));
+	}
+}
+
 /* *********************************************************************
  * NAME:             SpiLedDriverWrite
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      writes chunk of data to the message buffer
+ * DESCRIPTION:      Queues a display sequence for the display thread. The
+ *                   call does not wait for the display, the sequence is
+ *                   played right after the ones already queued
  * INPUT PARAMETERS: filept:file pointer used by this inode
  *                   buf : pointer to the user data
  *                   count : no of bytes to be copied to the msg buffer
  *                   offp: offset from which the string to be written
  *                         (not used)
- * RETURN VALUES:    ssize_t : remaining number of bytes that are to be
- *                             written. EBUSY if EEPROM is busy
+ * RETURN VALUES:    ssize_t : 0 on success
+ *                             EBUSY if the sequence queue is full
  ***********************************************************************/
 ssize_t SpiLedDriverWrite(struct file *filept, const char *buf,size_t count, loff_t *offp)
 {
-	ssize_t RetValue =  0; /* Error code sent when the buffer is full */
-	unsigned char *LocalBuffer;
-	unsigned char LoopIndex,SequenceIndex=0;
-	unsigned short FrameNumber,FrameTime;
-    SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
-    /* If no read-write operation is going on , invoke new write operation */
-    if (FREE == SpiLedDevMem->DisplayCompleteFlag)
-    {
-		LocalBuffer = (unsigned char*)kzalloc(count,GFP_KERNEL);
-		if (copy_from_user(LocalBuffer,buf,count))
-		{
-		   printk(" \nError copying from user space");
-		   return 0;
-		}
-		else
-		{
+	SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
+	SpiLedSequenceType *Slot;
+	ktime_t StartTime = ktime_get();
+
+	Slot = SpiLedQueueReserve(dev);
+	if (NULL == Slot)
+	{
+		return -EBUSY;
+	}
+	if (copy_from_user(&(Slot->Inline[0][0]),buf,min_t(size_t,count,sizeof(Slot->Inline))))
+	{
+		printk(" \nError copying from user space");
+		SpiLedQueuePublish(dev,0,StartTime);
+		return -EFAULT;
+	}
 #ifdef DEBUG
-				printk(" Driver received data from userspace \n ");
+	printk(" Driver received data from userspace \n ");
 #endif
-			for(LoopIndex = 0; LoopIndex < count; LoopIndex+=4, SequenceIndex++)
-			{
-				/* Copy the FrameNumber */
-				memcpy(&FrameNumber,(LocalBuffer + LoopIndex),sizeof(short));
-				/* Copy the FrameTime */
-				memcpy(&FrameTime,(LocalBuffer + LoopIndex + sizeof(short)),sizeof(short));
-				/* Frame Number */
-				SpiLedDevMem->Sequence[SequenceIndex][0] = FrameNumber;
-				/* Frame Display time */
-				SpiLedDevMem->Sequence[SequenceIndex][1] = FrameTime;
-			}
-            mutex_lock(&(SpiLedDevMem->DisplayCompleteFlagMutex));
-			/* intiate a kernel thread that sends trigger pulse and waits for irq */
-			SpiLedDevMem->DisplayCompleteFlag = ONGOING;
-		    mutex_unlock(&(SpiLedDevMem->DisplayCompleteFlagMutex));
-			PatternDisplayTask = kthread_run(&SpiLedDisplayThread,dev,"SpiLedDisplayThread");
-			if (IS_ERR(PatternDisplayTask))
-			{
-				/* failed to create kthread */
-				printk(KERN_INFO "\n Failed to create Display thread ");
-				mutex_lock(&(SpiLedDevMem->DisplayCompleteFlagMutex));
-				SpiLedDevMem->DisplayCompleteFlag = FREE;
-				mutex_unlock(&(SpiLedDevMem->DisplayCompleteFlagMutex));
-			}
-		 }
-		 kfree(LocalBuffer);
-    }
-    else
-    {
-		return -1;
-	}
-    return RetValue;
+	SpiLedQueuePublish(dev,1,StartTime);
+    return 0;
 }
 
 /* *********************************************************************
  * NAME:             SpiLedDriverRead
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      reads chunk of data from the message buffer
+ * DESCRIPTION:      Waits until the display is free, that is until every
+ *                   queued sequence has been played
  * INPUT PARAMETERS: filept:file pointer used by this inode
- *                   buf : pointer to the user data
+ *                   buf : pointer to the user data (not used)
  *                   count : no of bytes to be copied to the user buffer
  *                   offp: offset from which the string to be read
  *                         (not used)
- * RETURN VALUES:    ssize_t : number of bytes written to the user space
- *                  -EBUSY, if the LED driver is busy with displaying 
+ * RETURN VALUES:    ssize_t : 1 once the display is free
+ *                  -EAGAIN, if the display is busy and the file is
+ *                           non blocking
+ *                  -ERESTARTSYS, if interrupted by a signal
  ***********************************************************************/
 ssize_t SpiLedDriverRead(struct file *filept, char *buf,size_t count, loff_t *offp)
 {
-	if (FREE == SpiLedDevMem->DisplayCompleteFlag)
-    {
-		return 1;
+	SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
+
+	if (FREE != SpiLedDisplayStatus(dev))
+	{
+		if (filept->f_flags & O_NONBLOCK)
+		{
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(dev->SequenceDoneWaitQueue,FREE == SpiLedDisplayStatus(dev)))
+		{
+			return -ERESTARTSYS;
+		}
 	}
-    else
-    {
-		return -EBUSY;
+	return 1;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedDriverPoll
+ * CALLED BY:        User App through kernel (poll, select, epoll)
+ * DESCRIPTION:      Readable when the display is free, writable when the
+ *                   sequence queue can take one more sequence
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   Wait : poll table of the caller
+ * RETURN VALUES:    unsigned int : POLLIN / POLLOUT mask
+ ***********************************************************************/
+static unsigned int SpiLedDriverPoll(struct file *filept, poll_table *Wait)
+{
+	SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
+	unsigned int Mask = 0;
+
+	poll_wait(filept,&(dev->SequenceDoneWaitQueue),Wait);
+	if (FREE == SpiLedDisplayStatus(dev))
+	{
+		Mask |= POLLIN | POLLRDNORM;
+	}
+	if (SpiLedQueueHasSpace(dev))
+	{
+		Mask |= POLLOUT | POLLWRNORM;
+	}
+	return Mask;
+}
+
+/* *********************************************************************
+ * NAME:             SpiLedBankIoctl
+ * CALLED BY:        SpiLedDriverIoctl
+ * DESCRIPTION:      Handles the pattern bank commands of spi_led.h
+ * INPUT PARAMETERS: dev : device structure pointer
+ *                   filept : file pointer of the caller
+ *                   Command : SPI_LED_IOC_BANK_* / LOAD_* / PLAY
+ *                   Argument : user pointer to the command argument
+ * RETURN VALUES:    long : error codes / return success
+ ***********************************************************************/
+static long SpiLedBankIoctl(SpiLedDevType *dev, struct file *filept, unsigned int Command, unsigned long Argument)
+{
+	SpiLedBankReqType BankReq;
+	SpiLedBankDataType BankData;
+	SpiLedPlayType Play;
+	SpiLedBankType *Bank;
+	SpiLedSequenceType *Slot;
+	ktime_t StartTime = ktime_get();
+	unsigned int Handle;
+	long Ret = 0;
+
+	mutex_lock(&(dev->BankMutex));
+	switch (Command)
+	{
+	case SPI_LED_IOC_BANK_ALLOC:
+		if (copy_from_user(&BankReq,(const void __user *)Argument,sizeof(BankReq)))
+		{
+			Ret = -EFAULT;
+			break;
+		}
+		if ((0 == BankReq.PatternCount) || (BankReq.PatternCount > SPI_LED_BANK_MAX_PATTERNS) ||
+		    (0 == BankReq.SequenceLength) || (BankReq.SequenceLength > SPI_LED_BANK_MAX_STEPS))
+		{
+			Ret = -EINVAL;
+			break;
+		}
+		for (Handle = 1; (Handle < SPI_LED_MAX_BANKS) && (dev->Bank[Handle].InUse); Handle++);
+		if ((Handle == SPI_LED_MAX_BANKS) ||
+		    ((dev->BankPoolUsed + PAGE_ALIGN(SPI_LED_BANK_SIZE(BankReq.PatternCount,BankReq.SequenceLength))) >
+		     ((unsigned long)BankPoolKb * 1024)))
+		{
+			Ret = -ENOSPC;
+			break;
+		}
+		Ret = SpiLedBankCreate(&(dev->Bank[Handle]),BankReq.PatternCount,BankReq.SequenceLength,filept);
+		if (Ret)
+		{
+			break;
+		}
+		dev->BankPoolUsed += PAGE_ALIGN(dev->Bank[Handle].Size);
+		BankReq.Handle = Handle;
+		BankReq.MapSize = PAGE_ALIGN(dev->Bank[Handle].Size);
+		if (copy_to_user((void __user *)Argument,&BankReq,sizeof(BankReq)))
+		{
+			SpiLedBankDestroy(dev,&(dev->Bank[Handle]));
+			Ret = -EFAULT;
+		}
+		break;
+
+	case SPI_LED_IOC_BANK_FREE:
+		/* The default bank is never freed */
+		Ret = (0 == Argument) ? (-EINVAL) : SpiLedBankGet(dev,Argument,filept,&Bank);
+		if ((0 == Ret) && (atomic_read(&(Bank->Pending))))
+		{
+			Ret = -EBUSY;
+		}
+		else if (0 == Ret)
+		{
+			SpiLedBankDestroy(dev,Bank);
+		}
+		break;
+
+	case SPI_LED_IOC_LOAD_PATTERNS:
+	case SPI_LED_IOC_LOAD_SEQUENCE:
+		if (copy_from_user(&BankData,(const void __user *)Argument,sizeof(BankData)))
+		{
+			Ret = -EFAULT;
+			break;
+		}
+		Ret = SpiLedBankGet(dev,BankData.Handle,filept,&Bank);
+		if (Ret)
+		{
+			break;
+		}
+		if (SPI_LED_IOC_LOAD_PATTERNS == Command)
+		{
+			if ((BankData.First >= Bank->PatternCount) || (BankData.Count > (Bank->PatternCount - BankData.First)))
+			{
+				Ret = -EINVAL;
+			}
+			else if (copy_from_user(&(Bank->Pattern[BankData.First][0]),(const void __user *)(unsigned long)BankData.Data,
+			                        BankData.Count * sizeof(Bank->Pattern[0])))
+			{
+				Ret = -EFAULT;
+			}
+		}
+		else
+		{
+			if ((BankData.First >= Bank->SequenceLength) || (BankData.Count > (Bank->SequenceLength - BankData.First)))
+			{
+				Ret = -EINVAL;
+			}
+			else if (copy_from_user(&(Bank->Sequence[BankData.First][0]),(const void __user *)(unsigned long)BankData.Data,
+			                        BankData.Count * sizeof(Bank->Sequence[0])))
+			{
+				Ret = -EFAULT;
+			}
+		}
+		break;
+
+	case SPI_LED_IOC_PLAY:
+		if (copy_from_user(&Play,(const void __user *)Argument,sizeof(Play)))
+		{
+			Ret = -EFAULT;
+			break;
+		}
+		Ret = SpiLedBankGet(dev,Play.Handle,filept,&Bank);
+		if ((0 == Ret) && ((0 == Play.Count) || (Play.First >= Bank->SequenceLength) ||
+		                   (Play.Count > (Bank->SequenceLength - Play.First))))
+		{
+			Ret = -EINVAL;
+		}
+		if (Ret)
+		{
+			break;
+		}
+		Slot = SpiLedQueueReserve(dev);
+		if (NULL == Slot)
+		{
+			Ret = -EBUSY;
+			break;
+		}
+		/* Played in place, the bank cannot be freed while it is queued */
+		Slot->Bank = Bank;
+		Slot->Step = (const __u16 (*)[2])&(Bank->Sequence[Play.First][0]);
+		Slot->StepCount = Play.Count;
+		SpiLedQueuePublish(dev,1,StartTime);
+		break;
+
+	default:
+		Ret = -ENOTTY;
+		break;
 	}
+	mutex_unlock(&(dev->BankMutex));
+	return Ret;
 }
 
 /* *********************************************************************
  * NAME:             SpiLedDriverIoctl
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      Receives the pattern sent by user
- * INPUT PARAMETERS: PatternPtr:pointer to eight byte data of a pattern
- *                   PatternNumber : diaply pattern number
+ * DESCRIPTION:      Handles the commands of spi_led.h. Any other command
+ *                   value is the legacy pattern load, where the command
+ *                   is the user pointer to the eight byte pattern
+ * INPUT PARAMETERS: Command : SPI_LED_IOC_* or pointer to eight byte data
+ *                             of a pattern
+ *                   Argument : command argument or diaply pattern number
  * RETURN VALUES:    long : error codes / return success
  ***********************************************************************/
-long SpiLedDriverIoctl(struct file *filept,unsigned int PatternPtr, unsigned long PatternNumber)
+long SpiLedDriverIoctl(struct file *filept,unsigned int Command, unsigned long Argument)
 {
+	SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
+	SpiLedBankType *DefaultBank = &(dev->Bank[0]);
+	SpiLedSequenceType *Slot;
+	SpiLedInfoType Info;
+	ktime_t StartTime;
+	unsigned long StepCount;
 	unsigned char LocalBuffer[8];
-    if (FREE == SpiLedDevMem->DisplayCompleteFlag)
-    {
-		if (copy_from_user(&LocalBuffer,(const void __user *)PatternPtr,8))
+
+	switch (Command)
+	{
+	case SPI_LED_IOC_COMMIT:
+		/* Doorbell, the sequence table of the default bank is queued */
+		StartTime = ktime_get();
+		StepCount = ((0 == Argument) || (Argument > SPI_LED_SEQUENCE_LENGTH)) ? SPI_LED_SEQUENCE_LENGTH : Argument;
+		Slot = SpiLedQueueReserve(dev);
+		if (NULL == Slot)
 		{
-		   printk(" \n IOCTL : Error copying from user space");
-		   return -1;
+			return -EBUSY;
+		}
+		memcpy(&(Slot->Inline[0][0]),&(DefaultBank->Sequence[0][0]),StepCount * sizeof(Slot->Inline[0]));
+		SpiLedQueuePublish(dev,1,StartTime);
+		break;
+
+	case SPI_LED_IOC_BANK_ALLOC:
+	case SPI_LED_IOC_BANK_FREE:
+	case SPI_LED_IOC_LOAD_PATTERNS:
+	case SPI_LED_IOC_LOAD_SEQUENCE:
+	case SPI_LED_IOC_PLAY:
+		return SpiLedBankIoctl(dev,filept,Command,Argument);
+
+	case SPI_LED_IOC_GET_INFO:
+		Info.PanelCount = PanelCount;
+		Info.FrameWidth = PanelCount * 8;
+		if (copy_to_user((void __user *)Argument,&Info,sizeof(Info)))
+		{
+			return -EFAULT;
+		}
+		break;
+
+	default:
+		if (Argument >= DefaultBank->PatternCount)
+		{
+			return -EINVAL;
+		}
+		if (FREE == SpiLedDisplayStatus(SpiLedDevMem))
+		{
+			if (copy_from_user(&LocalBuffer,(const void __user *)(unsigned long)Command,8))
+			{
+			   printk(" \n IOCTL : Error copying from user space");
+			   return -1;
+			}
+			else
+			{
+				memcpy(&(DefaultBank->Pattern[Argument][0]),&LocalBuffer,8);
+			}
 		}
 		else
 		{
-			memcpy(&(SpiLedDevMem->Pattern[PatternNumber][0]),&LocalBuffer,8);
+			return -1;
 		}
-    }
-    else
-    {
-		return -1;
+		break;
 	}
 	return 0;
 }
 
+/* *********************************************************************
+ * NAME:             SpiLedDriverMmap
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      Maps a pattern bank into the caller, so patterns can
+ *                   be written without a system call per pattern. The
+ *                   offset selects the bank, see SPI_LED_BANK_MAP_OFFSET
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   vma : user mapping to be filled
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int SpiLedDriverMmap(struct file *filept, struct vm_area_struct *vma)
+{
+	SpiLedDevType *dev = (SpiLedDevType*)(filept->private_data);
+	const unsigned long PagesPerBank = 1UL << (SPI_LED_BANK_MAP_SHIFT - PAGE_SHIFT);
+	SpiLedBankType *Bank;
+	int Ret;
+
+	if (vma->vm_pgoff & (PagesPerBank - 1))
+	{
+		return -EINVAL;
+	}
+	mutex_lock(&(dev->BankMutex));
+	Ret = SpiLedBankGet(dev,vma->vm_pgoff / PagesPerBank,filept,&Bank);
+	if ((0 == Ret) && ((vma->vm_end - vma->vm_start) > PAGE_ALIGN(Bank->Size)))
+	{
+		Ret = -EINVAL;
+	}
+	else if (0 == Ret)
+	{
+		Ret = remap_vmalloc_range(vma,Bank->Memory,0);
+	}
+	mutex_unlock(&(dev->BankMutex));
+	return Ret;
+}
+
 /* Assigning operations to file operation structure */
 static struct file_operations SpiLedFops = {
     .owner = THIS_MODULE, /* Owner */
@@ -428,7 +1686,9 @@ static struct file_operations SpiLedFops = {
     .release = SpiLedDriverRelease, /* Release method */
     .write = SpiLedDriverWrite, /* Write method */
     .read = SpiLedDriverRead, /* Read method */
+    .poll = SpiLedDriverPoll, /* Display free / queue space */
     .unlocked_ioctl = SpiLedDriverIoctl,
+    .mmap = SpiLedDriverMmap, /* Pattern bank mapping */
 };
 
 /* *********************************************************************
@@ -442,6 +1702,12 @@ int __init SpiLedDriverInit(void)
 {
 	int Ret = -1; /* return variable */
 
+	if ((0 == PanelCount) || (PanelCount > SPI_LED_MAX_PANELS))
+	{
+		printk(KERN_ERR "SpiLed.ko: PanelCount must be 1 to %d\n",SPI_LED_MAX_PANELS);
+		return -EINVAL;
+	}
+
 	/* Allocate device major number dynamically */
 	if (alloc_chrdev_region(&SpiLedDevNumber, 0, NUMBER_OF_DEVICES, DEVICE_NAME) < 0)
 	{
@@ -467,11 +1733,56 @@ int __init SpiLedDriverInit(void)
        return -ENOMEM;
 	} 
 
+    /* Transfer buffers are allocated on their own, the controller may DMA them */
+    SpiLedDevMem->Dma = (SpiLedDmaType*)kzalloc(sizeof(SpiLedDmaType), GFP_KERNEL);
+    /* Event counters, zeroed by alloc_percpu */
+    SpiLedDevMem->Counters = alloc_percpu(SpiLedCountersType);
+    if ((NULL == SpiLedDevMem->Dma) || (NULL == SpiLedDevMem->Counters))
+    {
+       printk("Kmalloc Fail \n");
+       free_percpu(SpiLedDevMem->Counters);
+       kfree(SpiLedDevMem->Dma);
+       kfree(SpiLedDevMem);
+	   class_destroy(SpiLedDevClass);
+	   unregister_chrdev_region(SpiLedDevNumber, NUMBER_OF_DEVICES);
+       return -ENOMEM;
+    }
+
     /* Device Creation */ 
     /* Copy the respective device name */
     sprintf(SpiLedDevMem->name,DEVICE_NAME);
-    mutex_init(&(SpiLedDevMem->DisplayCompleteFlagMutex));
-    SpiLedDevMem->DisplayCompleteFlag = FREE;
+    mutex_init(&(SpiLedDevMem->QueueWriteMutex));
+    init_waitqueue_head(&(SpiLedDevMem->DisplayWaitQueue));
+    init_waitqueue_head(&(SpiLedDevMem->SequenceDoneWaitQueue));
+    SpiLedFrameInit(SpiLedDevMem);
+
+    /* Default bank, its layout is SpiLedShmType */
+    mutex_init(&(SpiLedDevMem->BankMutex));
+    if (SpiLedBankCreate(&(SpiLedDevMem->Bank[0]),SPI_LED_PATTERN_COUNT,SPI_LED_SEQUENCE_LENGTH,NULL))
+    {
+       printk("vmalloc Fail \n");
+       free_percpu(SpiLedDevMem->Counters);
+       kfree(SpiLedDevMem->Dma);
+       kfree(SpiLedDevMem);
+	   class_destroy(SpiLedDevClass);
+	   unregister_chrdev_region(SpiLedDevNumber, NUMBER_OF_DEVICES);
+       return -ENOMEM;
+    }
+
+    /* Display thread lives as long as the driver and waits for sequences */
+    PatternDisplayTask = kthread_run(&SpiLedDisplayThread,SpiLedDevMem,"SpiLedDisplayThread");
+    if (IS_ERR(PatternDisplayTask))
+    {
+       printk(KERN_INFO "\n Failed to create Display thread ");
+       Ret = PTR_ERR(PatternDisplayTask);
+       SpiLedBankDestroy(SpiLedDevMem,&(SpiLedDevMem->Bank[0]));
+       free_percpu(SpiLedDevMem->Counters);
+       kfree(SpiLedDevMem->Dma);
+       kfree(SpiLedDevMem);
+	   class_destroy(SpiLedDevClass);
+	   unregister_chrdev_region(SpiLedDevNumber, NUMBER_OF_DEVICES);
+       return Ret;
+    }
 
     /* Connect the file operations with the cdev */
     cdev_init(&SpiLedDevMem->cdev,&SpiLedFops);
@@ -481,6 +1792,14 @@ int __init SpiLedDriverInit(void)
 	if (Ret)
 	{
 	    printk("Bad cdev\n");
+	   /* The display thread is running already, stop it before the module goes */
+	   kthread_stop(PatternDisplayTask);
+	   SpiLedBankDestroy(SpiLedDevMem,&(SpiLedDevMem->Bank[0]));
+	   free_percpu(SpiLedDevMem->Counters);
+	   kfree(SpiLedDevMem->Dma);
+	   kfree(SpiLedDevMem);
+	   class_destroy(SpiLedDevClass);
+	   unregister_chrdev_region(SpiLedDevNumber, NUMBER_OF_DEVICES);
 	    return Ret;
 	}
 
@@ -493,6 +1812,9 @@ int __init SpiLedDriverInit(void)
 	if (Ret)
 	{
 		printk(KERN_ERR "SpiLed.ko: Driver registration failed, module not inserted.\n");
+	   /* Stop the display thread */
+	   kthread_stop(PatternDisplayTask);
+
        /* Destroy the devices first */
 	   device_destroy(SpiLedDevClass,SpiLedDevNumber);
 
@@ -500,6 +1822,9 @@ int __init SpiLedDriverInit(void)
 	   cdev_del(&(SpiLedDevMem->cdev));
 
 	   /* Free up the allocated memory for all of the device */
+	   SpiLedBankDestroy(SpiLedDevMem,&(SpiLedDevMem->Bank[0]));
+	   free_percpu(SpiLedDevMem->Counters);
+	   kfree(SpiLedDevMem->Dma);
 	   kfree(SpiLedDevMem);
 
 	   /* Remove the device class that was created earlier */
@@ -514,6 +1839,14 @@ int __init SpiLedDriverInit(void)
 	{
 		Ret = 0;
 	}
+	/* Statistics are optional, the driver works without debugfs */
+	SpiLedDebugDir = debugfs_create_dir(DEVICE_NAME,NULL);
+	if (!IS_ERR_OR_NULL(SpiLedDebugDir))
+	{
+		debugfs_create_file("stats",0444,SpiLedDebugDir,SpiLedDevMem,&SpiLedStatsFops);
+		debugfs_create_file("jitter",0444,SpiLedDebugDir,SpiLedDevMem,&SpiLedJitterFops);
+		debugfs_create_file("counters",0444,SpiLedDebugDir,SpiLedDevMem,&SpiLedCountersFops);
+	}
 	printk("\n SpiLed Driver is initialized \n");
 	
 	return Ret;
@@ -527,6 +1860,17 @@ int __init SpiLedDriverInit(void)
  ***********************************************************************/
 void __exit SpiLedDriverExit(void)
 {
+    unsigned int LoopIndex;
+
+    /* Remove the statistics before the device memory goes away */
+    debugfs_remove_recursive(SpiLedDebugDir);
+
+    /* Stop the display thread, it finishes the frame it is sending */
+    kthread_stop(PatternDisplayTask);
+
+    /* Its last frames may still be on the bus */
+    SpiLedFrameDrain(SpiLedDevMem);
+
     /* Destroy the devices first */
 	device_destroy(SpiLedDevClass,SpiLedDevNumber);
 
@@ -534,6 +1878,15 @@ void __exit SpiLedDriverExit(void)
 	cdev_del(&(SpiLedDevMem->cdev));
 
 	/* Free up the allocated memory for all of the device */
+	 for (LoopIndex = 0; LoopIndex < SPI_LED_MAX_BANKS; LoopIndex++)
+	 {
+		 if (SpiLedDevMem->Bank[LoopIndex].InUse)
+		 {
+			 SpiLedBankDestroy(SpiLedDevMem,&(SpiLedDevMem->Bank[LoopIndex]));
+		 }
+	 }
+	 free_percpu(SpiLedDevMem->Counters);
+	 kfree(SpiLedDevMem->Dma);
 	 kfree(SpiLedDevMem);
 
 	/* Remove the device class that was created earlier */
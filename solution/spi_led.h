@@ -0,0 +1,147 @@
+/* *********************************************************************
+ *
+ * Interface of the SpiLed device driver shared with user applications
+ *
+ * Program Name:        SpiLed
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef SPI_LED_H
+#define SPI_LED_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Number of patterns in the default pattern bank (handle 0)
+ */
+#define SPI_LED_PATTERN_COUNT   256
+
+/*
+ * Number of steps in a display sequence given by write() and in the
+ * sequence table of the default bank
+ */
+#define SPI_LED_SEQUENCE_LENGTH   10
+
+/*
+ * Pattern banks. Handle 0 is the default bank used by write(), the legacy
+ * pattern ioctl and SPI_LED_IOC_COMMIT. Further banks of any size up to
+ * the limits below are allocated at run time from the driver pool.
+ */
+#define SPI_LED_MAX_BANKS   16
+#define SPI_LED_BANK_MAX_PATTERNS   8192
+#define SPI_LED_BANK_MAX_STEPS   8192
+
+/*
+ * A bank of PatternCount patterns and SequenceLength steps is laid out as
+ * __u8 Pattern[PatternCount][8] followed by __u16 Sequence[SequenceLength][2]
+ */
+#define SPI_LED_BANK_SEQUENCE_OFFSET(PatternCount)   ((unsigned long)(PatternCount) * 8)
+#define SPI_LED_BANK_SIZE(PatternCount, SequenceLength) \
+	(SPI_LED_BANK_SEQUENCE_OFFSET(PatternCount) + ((unsigned long)(SequenceLength) * 4))
+
+/*
+ * mmap() offset of a bank
+ */
+#define SPI_LED_BANK_MAP_SHIFT   24
+#define SPI_LED_BANK_MAP_OFFSET(Handle)   ((unsigned long)(Handle) << SPI_LED_BANK_MAP_SHIFT)
+
+/*
+ * Layout of the default bank, mapped at offset 0 of /dev/spi_led. Pattern[n] holds
+ * the eight digit registers of pattern n, Sequence[n] the pattern number and
+ * the display time of step n. A step with both values 0 ends the sequence.
+ * Patterns are read by the display thread while it plays them, so a
+ * pattern used by a committed sequence should not be changed until the
+ * sequence has been played.
+ */
+typedef struct SpiLedShmTag
+{
+	__u8 Pattern[SPI_LED_PATTERN_COUNT][8]; /* Pattern bank */
+	__u16 Sequence[SPI_LED_SEQUENCE_LENGTH][2]; /* Sequence table */
+}SpiLedShmType;
+
+/*
+ * ioctl commands. The legacy pattern ioctl passes the pattern pointer as
+ * the command, so the commands below are all _IOWR: their value is above
+ * the 3GB user space limit of the 32 bit target and cannot be mistaken for
+ * a user pointer.
+ */
+#define SPI_LED_IOC_MAGIC   'L'
+
+/*
+ * Doorbell: queue the sequence table of the mapped memory for display.
+ * The argument is the number of steps to take from the table, 0 for all.
+ * Same behaviour as write(), fails with EBUSY if the queue is full.
+ */
+#define SPI_LED_IOC_COMMIT   _IOWR(SPI_LED_IOC_MAGIC, 1, __u32)
+
+/* Argument of SPI_LED_IOC_BANK_ALLOC */
+typedef struct SpiLedBankReqTag
+{
+	__u32 Handle; /* out: handle of the new bank */
+	__u32 PatternCount; /* in: number of patterns */
+	__u32 SequenceLength; /* in: number of sequence steps */
+	__u32 MapSize; /* out: bytes to map at SPI_LED_BANK_MAP_OFFSET(Handle) */
+}SpiLedBankReqType;
+
+/* Argument of SPI_LED_IOC_LOAD_PATTERNS and SPI_LED_IOC_LOAD_SEQUENCE */
+typedef struct SpiLedBankDataTag
+{
+	__u32 Handle; /* Bank */
+	__u32 First; /* First pattern or step to be written */
+	__u32 Count; /* Number of patterns or steps */
+	__u32 Reserved;
+	__u64 Data; /* User pointer to Count * 8 pattern bytes or Count * 2 step values */
+}SpiLedBankDataType;
+
+/* Argument of SPI_LED_IOC_PLAY */
+typedef struct SpiLedPlayTag
+{
+	__u32 Handle; /* Bank */
+	__u32 First; /* First step of the bank sequence to play */
+	__u32 Count; /* Number of steps, a step with both values 0 ends earlier */
+}SpiLedPlayType;
+
+/*
+ * Allocates a bank from the driver pool. ENOSPC if no handle or pool memory
+ * is left. The bank belongs to the file it was allocated on and is freed
+ * when that file is closed, once it is no longer queued for display. The
+ * bank commands and mmap give EPERM on the bank of another file, only the
+ * default bank 0 is shared.
+ */
+#define SPI_LED_IOC_BANK_ALLOC   _IOWR(SPI_LED_IOC_MAGIC, 2, SpiLedBankReqType)
+
+/* Frees a bank given by handle, EBUSY while it is queued for display */
+#define SPI_LED_IOC_BANK_FREE   _IOWR(SPI_LED_IOC_MAGIC, 3, __u32)
+
+/* Copies patterns into a bank, EINVAL if they do not fit */
+#define SPI_LED_IOC_LOAD_PATTERNS   _IOWR(SPI_LED_IOC_MAGIC, 4, SpiLedBankDataType)
+
+/* Copies sequence steps into a bank, EINVAL if they do not fit */
+#define SPI_LED_IOC_LOAD_SEQUENCE   _IOWR(SPI_LED_IOC_MAGIC, 5, SpiLedBankDataType)
+
+/*
+ * Queues steps of a bank sequence for display without copying them. The
+ * steps are read while they are played. EBUSY if the queue is full.
+ */
+#define SPI_LED_IOC_PLAY   _IOWR(SPI_LED_IOC_MAGIC, 6, SpiLedPlayType)
+
+/* Argument of SPI_LED_IOC_GET_INFO */
+typedef struct SpiLedInfoTag
+{
+	__u32 PanelCount; /* Number of chained MAX7219 panels */
+	__u32 FrameWidth; /* Frame width in pixels, 8 * PanelCount */
+}SpiLedInfoType;
+
+/*
+ * Returns the display geometry. With N chained panels a step with pattern
+ * number n shows patterns n to n + N - 1, pattern n + i on panel i, where
+ * panel 0 is the one connected to the controller.
+ */
+#define SPI_LED_IOC_GET_INFO   _IOWR(SPI_LED_IOC_MAGIC, 7, SpiLedInfoType)
+
+#endif
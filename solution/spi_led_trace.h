@@ -0,0 +1,95 @@
+/* *********************************************************************
+ *
+ * Trace events of the spi_led driver
+ *
+ * Program Name:        SpiLed
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+/*
+ * Disabled events cost a not taken branch. They are switched on at run time
+ * under /sys/kernel/debug/tracing/events/spi_led, without reloading the
+ * module. spi_led.c defines CREATE_TRACE_POINTS before including this file.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM spi_led
+
+#if !defined(SPI_LED_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SPI_LED_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* A frame of a sequence is due and about to be sent */
+TRACE_EVENT(spi_led_frame_start,
+	TP_PROTO(s64 DeadlineNs, s64 LatenessNs),
+	TP_ARGS(DeadlineNs, LatenessNs),
+	TP_STRUCT__entry(
+		__field(s64, deadline_ns)
+		__field(s64, lateness_ns)
+	),
+	TP_fast_assign(
+		__entry->deadline_ns = DeadlineNs;
+		__entry->lateness_ns = LatenessNs;
+	),
+	TP_printk("deadline_ns=%lld lateness_ns=%lld", __entry->deadline_ns, __entry->lateness_ns)
+);
+
+/* The rows of a frame have been sent, or given to spi_async */
+TRACE_EVENT(spi_led_frame_end,
+	TP_PROTO(unsigned int Rows, int Status),
+	TP_ARGS(Rows, Status),
+	TP_STRUCT__entry(
+		__field(unsigned int, rows)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		__entry->rows = Rows;
+		__entry->status = Status;
+	),
+	TP_printk("rows=%u status=%d", __entry->rows, __entry->status)
+);
+
+/* A message goes to spi_sync or spi_async, msg pairs it with its completion */
+TRACE_EVENT(spi_led_spi_submit,
+	TP_PROTO(const void *Message, unsigned int Transfers, bool Async),
+	TP_ARGS(Message, Transfers, Async),
+	TP_STRUCT__entry(
+		__field(const void *, message)
+		__field(unsigned int, transfers)
+		__field(bool, async)
+	),
+	TP_fast_assign(
+		__entry->message = Message;
+		__entry->transfers = Transfers;
+		__entry->async = Async;
+	),
+	TP_printk("msg=%p transfers=%u async=%d", __entry->message, __entry->transfers, __entry->async)
+);
+
+/* spi_sync returned, or the completion of spi_async ran */
+TRACE_EVENT(spi_led_spi_complete,
+	TP_PROTO(const void *Message, int Status),
+	TP_ARGS(Message, Status),
+	TP_STRUCT__entry(
+		__field(const void *, message)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		__entry->message = Message;
+		__entry->status = Status;
+	),
+	TP_printk("msg=%p status=%d", __entry->message, __entry->status)
+);
+
+#endif
+
+/* The trace header is not in include/trace/events */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE spi_led_trace
+#include <trace/define_trace.h>